@@ -0,0 +1,1338 @@
+/*=============================================================================
+*       bench.c
+*       Headless benchmarks of the model and its file formats, run with
+*       `make bench`. Builds a synthetic tree (or reads a given file), times
+*       each operation and prints one JSON object per line.
+=============================================================================*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree.h"
+
+/*=============================================================================
+*   Struct Definitions
+=============================================================================*/
+
+/*
+*   A length distribution: uniform over [min, max], or exponential with
+*   the given mean and capped at max.
+*/
+typedef struct _LengthDist
+{
+    int exponential;
+    double mean;
+    uint32_t min;
+    uint32_t max;
+} LengthDist;
+
+typedef struct _GenParams
+{
+    int32_t nodes;          //total nodes to generate
+    int depth;              //deepest level, top level nodes are depth 1
+    int fanMin;             //children per node below the top level
+    int fanMax;
+    LengthDist name;
+    LengthDist description;
+    double newlines;        //chance of each description byte being a newline
+    uint64_t seed;
+} GenParams;
+
+typedef struct _BenchParams
+{
+    GenParams gen;
+    const char* input;      //benchmark this file instead of generating
+    const char* output;     //also write the generated tree here
+    const char* work;       //scratch file for the save and load runs
+    int repeat;             //every timing is the best of this many runs
+    int threads;
+} BenchParams;
+
+/*=============================================================================
+*   Generator
+=============================================================================*/
+
+/*=============================================================================
+*   NextRandom [uint64_t]
+*       xorshift64*, good enough for test data and the same everywhere
+=============================================================================*/
+static uint64_t NextRandom(uint64_t* state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/*=============================================================================
+*   RandomUnit [double]
+*       Uniform in [0, 1)
+=============================================================================*/
+static double RandomUnit(uint64_t* state)
+{
+    return (double)(NextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*=============================================================================
+*   RandomRange [uint32_t]
+*       Uniform in [min, max]
+=============================================================================*/
+static uint32_t RandomRange(uint64_t* state, uint32_t min, uint32_t max)
+{
+    return min + (uint32_t)(NextRandom(state) % ((uint64_t)max - min + 1));
+}
+
+/*=============================================================================
+*   RandomLength [uint32_t]
+=============================================================================*/
+static uint32_t RandomLength(uint64_t* state, const LengthDist* dist)
+{
+    if(!dist->exponential)
+    {
+        return RandomRange(state, dist->min, dist->max);
+    }
+
+    //Inverse transform sampling; 1 - u is never 0
+    double length = -dist->mean * log(1.0 - RandomUnit(state));
+    return length >= dist->max ? dist->max : (uint32_t)length;
+}
+
+/*=============================================================================
+*   RandomText [void]
+*       Fills `out` with words of lowercase letters, and newlines at the
+*       given density. Nothing the text format treats specially appears.
+=============================================================================*/
+static void RandomText(uint64_t* state, char* out, uint32_t length, double newlines)
+{
+    static const char letters[] = "abcdefghijklmnopqrstuvwxyz";
+    for(uint32_t i = 0; i < length; i++)
+    {
+        uint64_t r = NextRandom(state);
+        if(newlines > 0 && RandomUnit(state) < newlines)
+        {
+            out[i] = '\n';
+        }
+        else
+        {
+            out[i] = (r & 7) == 0 ? ' ' : letters[(r >> 3) % 26];
+        }
+    }
+}
+
+/*=============================================================================
+*   Generate [int]
+*       Builds a random tree depth first. Top level nodes are added until
+*       the node budget is used up; every other node gets a random number
+*       of children until the depth limit.
+*
+*       Returns nonzero on success
+=============================================================================*/
+static int Generate(TreeModel* tree, const GenParams* params)
+{
+    typedef struct { TreeNodeId node; int depth; int childrenLeft; } Level;
+
+    uint32_t scratchSize = params->name.max > params->description.max ? params->name.max : params->description.max;
+    char* scratch = (char*)malloc(scratchSize + 1);
+    char* nameText = (char*)malloc(params->name.max + 1);
+    Level* stack = (Level*)malloc((params->depth + 1) * sizeof(Level));
+    if(!scratch || !nameText || !stack || !TreeReserve(tree, params->nodes + 1))
+    {
+        free(scratch);
+        free(nameText);
+        free(stack);
+        return 0;
+    }
+
+    uint64_t state = params->seed ? params->seed : 1;
+    int top = 0;
+    stack[0].node = TREE_ROOT;
+    stack[0].depth = 0;
+    stack[0].childrenLeft = -1;     //no limit, the budget ends the walk
+
+    int ok = 1;
+    while(top >= 0 && tree->count < params->nodes)
+    {
+        Level* level = &stack[top];
+        if(level->childrenLeft == 0)
+        {
+            top--;
+            continue;
+        }
+        if(level->childrenLeft > 0)
+        {
+            level->childrenLeft--;
+        }
+
+        TreeStr name;
+        TreeStr description;
+        name.len = RandomLength(&state, &params->name);
+        RandomText(&state, nameText, name.len, 0);
+        name.ptr = nameText;
+        description.len = RandomLength(&state, &params->description);
+        RandomText(&state, scratch, description.len, params->newlines);
+        description.ptr = scratch;
+
+        TreeNodeId node = TreeAddNode(tree, level->node, name, description);
+        if(node == TREE_NIL)
+        {
+            ok = 0;
+            break;
+        }
+        if(level->depth + 1 < params->depth)
+        {
+            top++;
+            stack[top].node = node;
+            stack[top].depth = level->depth + 1;
+            stack[top].childrenLeft = (int)RandomRange(&state, params->fanMin, params->fanMax);
+        }
+    }
+
+    free(scratch);
+    free(nameText);
+    free(stack);
+    return ok;
+}
+
+/*=============================================================================
+*   Reporting
+=============================================================================*/
+
+//What a benchmark returns instead of its time when the tree does not allow it
+#define BENCH_SKIPPED -2.0
+
+/*=============================================================================
+*   Report [void]
+*       Prints one result line. Peak memory is the process peak so far,
+*       so it only grows from line to line.
+=============================================================================*/
+static void Report(const char* name, int64_t nodes, uint64_t bytes, double seconds)
+{
+    double nodesPerSecond = seconds > 0 ? (double)nodes / seconds : 0;
+    double megabytesPerSecond = seconds > 0 ? (double)bytes / (1024.0 * 1024.0) / seconds : 0;
+    printf("{\"bench\":\"%s\",\"nodes\":%lld,\"bytes\":%llu,\"seconds\":%.6f,"
+           "\"nodes_per_s\":%.0f,\"mb_per_s\":%.2f,\"peak_rss_bytes\":%llu}\n",
+           name, (long long)nodes, (unsigned long long)bytes, seconds,
+           nodesPerSecond, megabytesPerSecond, (unsigned long long)TreePeakMemory());
+    fflush(stdout);
+}
+
+/*=============================================================================
+*   ReportSkipped [void]
+*       Prints the line of a benchmark the tree did not allow, and why
+=============================================================================*/
+static void ReportSkipped(const char* name, const char* reason)
+{
+    printf("{\"bench\":\"%s\",\"skipped\":\"%s\"}\n", name, reason);
+    fflush(stdout);
+}
+
+/*=============================================================================
+*   FileSize [uint64_t]
+=============================================================================*/
+static uint64_t FileSize(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if(!file)
+    {
+        return 0;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size > 0 ? (uint64_t)size : 0;
+}
+
+/*
+*   Every benchmark returns the best time of params->repeat runs, or a
+*   negative value if a run failed
+*/
+
+#define SAVE_TEXT     0
+#define SAVE_PARALLEL 1
+#define SAVE_BINARY   2
+#define SAVE_COMPRESSED 3
+
+#define LOAD_STREAM   0
+#define LOAD_MAPPED   1
+#define LOAD_PARALLEL 2
+#define LOAD_BINARY   3
+#define LOAD_COMPRESSED 4
+
+/*=============================================================================
+*   BenchSave [double]
+*       Writes the tree to `path` in one of the SAVE_* ways
+=============================================================================*/
+static double BenchSave(const BenchParams* params, const TreeModel* tree, int kind, const char* path)
+{
+    double best = -1;
+    for(int run = 0; run < params->repeat; run++)
+    {
+        FILE* file = fopen(path, "wb");
+        if(!file)
+        {
+            return -1;
+        }
+        double start = TreeSeconds();
+        int saved = kind == SAVE_COMPRESSED ? TreeSaveCompressed(tree, file, params->threads) :
+                    kind == SAVE_BINARY ? TreeSaveBinary(tree, file) :
+                    kind == SAVE_PARALLEL ? TreeSaveToStreamParallel(tree, file, params->threads) :
+                    TreeSaveToStream(tree, file);
+        saved = fclose(file) == 0 && saved;
+        double elapsed = TreeSeconds() - start;
+        if(!saved)
+        {
+            return -1;
+        }
+        if(best < 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+/*=============================================================================
+*   BenchLoad [double]
+*       Reads `path` into `tree` in one of the LOAD_* ways
+=============================================================================*/
+static double BenchLoad(const BenchParams* params, TreeModel* tree, int kind, const char* path)
+{
+    double best = -1;
+    for(int run = 0; run < params->repeat; run++)
+    {
+        FILE* file = fopen(path, "rb");
+        if(!file)
+        {
+            return -1;
+        }
+        double start = TreeSeconds();
+        int loaded = kind == LOAD_COMPRESSED ? TreeLoadCompressed(tree, file, params->threads) :
+                     kind == LOAD_BINARY ? TreeLoadBinary(tree, file) :
+                     kind == LOAD_PARALLEL ? TreeLoadParallel(tree, file, params->threads) :
+                     kind == LOAD_MAPPED ? TreeLoadMapped(tree, file) :
+                     TreeLoadFromStream(tree, file);
+        double elapsed = TreeSeconds() - start;
+        fclose(file);
+        if(!loaded)
+        {
+            return -1;
+        }
+        if(best < 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+/*=============================================================================
+*   BenchTeardown [double]
+*       Loads with the stream loader, so every string is in the arena, then
+*       times dropping the document
+=============================================================================*/
+static double BenchTeardown(const BenchParams* params, TreeModel* tree, const char* path)
+{
+    double best = -1;
+    for(int run = 0; run < params->repeat; run++)
+    {
+        if(BenchLoad(params, tree, LOAD_STREAM, path) < 0)
+        {
+            return -1;
+        }
+        double start = TreeSeconds();
+        TreeClear(tree);
+        double elapsed = TreeSeconds() - start;
+        if(best < 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+/*=============================================================================
+*   BenchEscape [double]
+*       Escapes every description, or unescapes all of them at once
+*
+*       Parameters:
+*           uint64_t* bytes - Receives the input size of one run
+=============================================================================*/
+static double BenchEscape(const BenchParams* params, const TreeModel* tree, int unescape, uint64_t* bytes)
+{
+    //Every description escaped back to back, the input of the unescape run
+    uint64_t total = 0;
+    for(TreeNodeId node = 1; node < tree->used; node++)
+    {
+        total += TreeIsLive(tree, node) ? TreeDescription(tree, node).len : 0;
+    }
+    char* escaped = (char*)malloc(total * 2 + 1);
+    char* out = (char*)malloc(total * 2 + 1);
+    if(!escaped || !out)
+    {
+        free(escaped);
+        free(out);
+        return -1;
+    }
+    size_t escapedLength = 0;
+    for(TreeNodeId node = 1; node < tree->used; node++)
+    {
+        if(TreeIsLive(tree, node))
+        {
+            TreeStr text = TreeDescription(tree, node);
+            escapedLength += TreeEscape(escaped + escapedLength, text.ptr, text.len);
+        }
+    }
+
+    double best = -1;
+    volatile size_t check = 0;
+    for(int run = 0; run < params->repeat; run++)
+    {
+        double start = TreeSeconds();
+        if(unescape)
+        {
+            check += TreeUnescape(out, escaped, escapedLength);
+        }
+        else
+        {
+            size_t length = 0;
+            for(TreeNodeId node = 1; node < tree->used; node++)
+            {
+                if(TreeIsLive(tree, node))
+                {
+                    TreeStr text = TreeDescription(tree, node);
+                    length += TreeEscape(out + length, text.ptr, text.len);
+                }
+            }
+            check += length;
+        }
+        double elapsed = TreeSeconds() - start;
+        if(best < 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+
+    *bytes = unescape ? escapedLength : total;
+    free(escaped);
+    free(out);
+    return best;
+}
+
+/*=============================================================================
+*   BenchTranscode [double]
+*       Converts all descriptions, back to back, from UTF-8 to UTF-16 as
+*       the GUI does for display, or from UTF-16 back to UTF-8
+*
+*       Parameters:
+*           uint64_t* bytes - Receives the input size of one run
+=============================================================================*/
+static double BenchTranscode(const BenchParams* params, const TreeModel* tree, int toUtf8, uint64_t* bytes)
+{
+    uint64_t total = 0;
+    for(TreeNodeId node = 1; node < tree->used; node++)
+    {
+        total += TreeIsLive(tree, node) ? TreeDescription(tree, node).len : 0;
+    }
+    char* text = (char*)malloc(total * 3 + 1);
+    uint16_t* wide = (uint16_t*)malloc((total + 1) * sizeof(uint16_t));
+    if(!text || !wide)
+    {
+        free(text);
+        free(wide);
+        return -1;
+    }
+    size_t textLength = 0;
+    for(TreeNodeId node = 1; node < tree->used; node++)
+    {
+        if(TreeIsLive(tree, node))
+        {
+            TreeStr description = TreeDescription(tree, node);
+            memcpy(text + textLength, description.ptr, description.len);
+            textLength += description.len;
+        }
+    }
+    size_t wideLength = TreeUtf8ToUtf16(wide, text, textLength);
+
+    double best = -1;
+    volatile size_t check = 0;
+    for(int run = 0; run < params->repeat; run++)
+    {
+        double start = TreeSeconds();
+        if(toUtf8)
+        {
+            check += TreeUtf16ToUtf8(text, wide, wideLength);
+        }
+        else
+        {
+            check += TreeUtf8ToUtf16(wide, text, textLength);
+        }
+        double elapsed = TreeSeconds() - start;
+        if(best < 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+
+    *bytes = toUtf8 ? wideLength * sizeof(uint16_t) : textLength;
+    free(text);
+    free(wide);
+    return best;
+}
+
+/*=============================================================================
+*   BenchTraverse [double]
+*       A full preorder walk that touches every node's name
+=============================================================================*/
+static double BenchTraverse(const BenchParams* params, const TreeModel* tree)
+{
+    double best = -1;
+    volatile uint64_t sink = 0;
+    for(int run = 0; run < params->repeat; run++)
+    {
+        double start = TreeSeconds();
+        uint64_t sum = 0;
+        for(TreeNodeId node = TREE_ROOT; node != TREE_NIL; node = TreeNextPreorder(tree, node, TREE_ROOT))
+        {
+            sum += TreeName(tree, node).len;
+        }
+        double elapsed = TreeSeconds() - start;
+        sink += sum;
+        if(best < 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    (void)sink;
+    return best;
+}
+
+/*=============================================================================
+*   BenchSnapshot [double]
+*       What a background save costs the editing thread: copying the
+*       model's arrays for the save thread to write
+=============================================================================*/
+static double BenchSnapshot(const BenchParams* params, const TreeModel* tree)
+{
+    double best = -1;
+    for(int run = 0; run < params->repeat; run++)
+    {
+        TreeModel snapshot;
+        double start = TreeSeconds();
+        int taken = TreeSnapshot(&snapshot, tree);
+        double elapsed = TreeSeconds() - start;
+        if(!taken)
+        {
+            return -1;
+        }
+        TreeFree(&snapshot);
+        if(best < 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+/*=============================================================================
+*   BenchIndexBuild [double]
+*       Builds the search index over every name and description
+*
+*       Parameters:
+*           TreeIndex* index - Receives the index of the last run
+*           uint64_t* bytes - Receives its size
+=============================================================================*/
+static double BenchIndexBuild(const BenchParams* params, const TreeModel* tree, TreeIndex* index, uint64_t* bytes)
+{
+    double best = -1;
+    for(int run = 0; run < params->repeat; run++)
+    {
+        double start = TreeSeconds();
+        int built = TreeIndexBuild(index, tree);
+        double elapsed = TreeSeconds() - start;
+        if(!built)
+        {
+            return -1;
+        }
+        if(best < 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    *bytes = TreeIndexMemory(index);
+    return best;
+}
+
+/*=============================================================================
+*   BenchIndexQuery [double]
+*       Mean time of a query for a piece of a random node's name, taken
+*       whole or as a word prefix, with every match returned
+*
+*       Parameters:
+*           int flags - TREE_FIND_* for every query
+*           int64_t* matches - Receives the matches of all the queries
+=============================================================================*/
+#define BENCH_QUERIES 200
+
+static double BenchIndexQuery(const BenchParams* params, const TreeModel* tree, const TreeIndex* index, int flags, int64_t* matches)
+{
+    TreeNodeId* out = (TreeNodeId*)malloc(((size_t)tree->count + 1) * sizeof(TreeNodeId));
+    if(!out || tree->count == 0)
+    {
+        free(out);
+        return -1;
+    }
+
+    uint64_t state = params->gen.seed + 7;
+    double total = 0;
+    *matches = 0;
+    for(int query = 0; query < BENCH_QUERIES; query++)
+    {
+        TreeNodeId node;
+        do
+        {
+            node = (TreeNodeId)RandomRange(&state, 1, (uint32_t)tree->used - 1);
+        }
+        while(!TreeIsLive(tree, node) || TreeName(tree, node).len == 0);
+
+        //Four to eight bytes, from the start of a word for prefix queries
+        TreeStr name = TreeName(tree, node);
+        uint32_t length = RandomRange(&state, 4, 8);
+        length = length < name.len ? length : name.len;
+        uint32_t offset = flags & TREE_FIND_PREFIX ? 0 : RandomRange(&state, 0, name.len - length);
+
+        double start = TreeSeconds();
+        size_t found = TreeIndexFind(index, tree, name.ptr + offset, length, flags, out, (size_t)tree->count);
+        total += TreeSeconds() - start;
+        *matches += (int64_t)found;
+    }
+    free(out);
+    return total / BENCH_QUERIES;
+}
+
+/*=============================================================================
+*   BenchPathBuild [double]
+*       Time to file every node of a tree by parent and name
+*
+*       Parameters:
+*           TreePathIndex* index - Receives the index of the last run
+*           uint64_t* bytes - Receives its size
+=============================================================================*/
+static double BenchPathBuild(const BenchParams* params, const TreeModel* tree, TreePathIndex* index, uint64_t* bytes)
+{
+    double best = -1;
+    for(int run = 0; run < params->repeat; run++)
+    {
+        double start = TreeSeconds();
+        int built = TreePathBuild(index, tree);
+        double elapsed = TreeSeconds() - start;
+        if(!built)
+        {
+            return -1;
+        }
+        if(best < 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    *bytes = TreePathMemory(index);
+    return best;
+}
+
+/*=============================================================================
+*   BenchPathFind [double]
+*       Mean time to resolve the path of a random node, with the index
+*       or, if it is not built, by walking the siblings at every level
+*
+*       Parameters:
+*           int64_t* depth - Receives the levels of all the paths resolved
+=============================================================================*/
+static double BenchPathFind(const BenchParams* params, const TreeModel* tree, const TreePathIndex* index, int64_t* depth)
+{
+    if(tree->count == 0)
+    {
+        return -1;
+    }
+
+    uint64_t state = params->gen.seed + 11;
+    double total = 0;
+    *depth = 0;
+    for(int query = 0; query < BENCH_QUERIES; query++)
+    {
+        TreeNodeId node;
+        do
+        {
+            node = (TreeNodeId)RandomRange(&state, 1, (uint32_t)tree->used - 1);
+        }
+        while(!TreeIsLive(tree, node));
+
+        size_t length = TreePathFormat(tree, node, NULL, 0);
+        char* path = (char*)malloc(length + 1);
+        if(!path)
+        {
+            return -1;
+        }
+        TreePathFormat(tree, node, path, length + 1);
+
+        double start = TreeSeconds();
+        TreeNodeId found = TreePathFind(index, tree, path, length);
+        total += TreeSeconds() - start;
+        free(path);
+        if(found == TREE_NIL)
+        {
+            return -1;
+        }
+        for(TreeNodeId current = node; current != TREE_ROOT; current = tree->parent[current])
+        {
+            (*depth)++;
+        }
+    }
+    return total / BENCH_QUERIES;
+}
+
+/*=============================================================================
+*   LargestChild [TreeNodeId]
+*       The child of a node with the most nodes below it
+*
+*       Parameters:
+*           TreeNodeId parent - The node, TREE_ROOT for the top level
+*           int64_t* nodes - Receives the size of its subtree
+=============================================================================*/
+static TreeNodeId LargestChild(const TreeModel* tree, TreeNodeId parent, int64_t* nodes)
+{
+    TreeNodeId largest = TREE_NIL;
+    *nodes = 0;
+    for(TreeNodeId top = tree->firstChild[parent]; top != TREE_NIL; top = tree->nextSibling[top])
+    {
+        int64_t size = 0;
+        for(TreeNodeId node = top; node != TREE_NIL; node = TreeNextPreorder(tree, node, top))
+        {
+            size++;
+        }
+        if(size > *nodes)
+        {
+            largest = top;
+            *nodes = size;
+        }
+    }
+    return largest;
+}
+
+/*=============================================================================
+*   BenchUndoDelete [double]
+*       Time to delete the largest top level subtree and undo that, which
+*       should not depend on its size. The tree is left as it was.
+*
+*       Parameters:
+*           int64_t* nodes - Receives the size of the subtree
+*           uint64_t* bytes - Receives the bytes of history one step takes
+=============================================================================*/
+static double BenchUndoDelete(const BenchParams* params, TreeModel* tree, int64_t* nodes, uint64_t* bytes)
+{
+    TreeNodeId largest = LargestChild(tree, TREE_ROOT, nodes);
+    if(largest == TREE_NIL)
+    {
+        return -1;
+    }
+
+    TreeHistory history;
+    TreeHistoryInit(&history);
+    double best = -1;
+    for(int run = 0; run < params->repeat; run++)
+    {
+        TreeChange change;
+        double start = TreeSeconds();
+        TreeHistoryDelete(&history, tree, largest);
+        int undone = TreeHistoryUndo(&history, tree, &change);
+        double elapsed = TreeSeconds() - start;
+        if(!undone || !TreeIsAttached(tree, largest))
+        {
+            best = -1;
+            break;
+        }
+        if(best < 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    *bytes = TreeHistoryStepSize();
+    TreeHistoryClear(&history, tree);
+    TreeHistoryFree(&history);
+    return best;
+}
+
+/*=============================================================================
+*   BenchMove [double]
+*       Time to move the largest top level subtree under the last top level
+*       node, with its history step and path index update, and to undo
+*       that. Neither should depend on the size of the subtree. With one
+*       top level node the children of the first node that has two are
+*       used instead. The tree is left as it was.
+*
+*       Parameters:
+*           TreePathIndex* paths - A built index of `tree`, kept up to date
+*           int64_t* nodes - Receives the size of the subtree
+*
+*       Returns BENCH_SKIPPED if no node has two children
+=============================================================================*/
+static double BenchMove(const BenchParams* params, TreeModel* tree, TreePathIndex* paths, int64_t* nodes)
+{
+    //A small generated tree may have a single top level node; go down to
+    //the first node with two children
+    TreeNodeId parent = TREE_ROOT;
+    while(tree->firstChild[parent] != TREE_NIL && tree->firstChild[parent] == tree->lastChild[parent])
+    {
+        parent = tree->firstChild[parent];
+    }
+    TreeNodeId largest = LargestChild(tree, parent, nodes);
+    TreeNodeId target = tree->lastChild[parent];
+    if(target == largest)
+    {
+        target = tree->prevSibling[largest];
+    }
+    if(largest == TREE_NIL || target == TREE_NIL)
+    {
+        return BENCH_SKIPPED;
+    }
+
+    TreeHistory history;
+    TreeHistoryInit(&history);
+    double best = -1;
+    for(int run = 0; run < params->repeat; run++)
+    {
+        TreeChange change;
+        TreeNodeId before = tree->nextSibling[largest];
+        double start = TreeSeconds();
+        int moved = TreeMoveNode(tree, largest, target, TREE_NIL);
+        TreePathMoved(paths, tree, largest);
+        TreeHistoryMoved(&history, tree, largest, parent, before);
+        int undone = TreeHistoryUndo(&history, tree, &change);
+        TreePathMoved(paths, tree, largest);
+        double elapsed = TreeSeconds() - start;
+        if(!moved || !undone || tree->parent[largest] != parent || tree->nextSibling[largest] != before)
+        {
+            best = -1;
+            break;
+        }
+        if(best < 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    TreeHistoryClear(&history, tree);
+    TreeHistoryFree(&history);
+    return best;
+}
+
+/*=============================================================================
+*   BenchDiff [double]
+*       Diffs the tree against a copy of itself taken before renaming a
+*       handful of nodes spread over it and adding one; the hashing should
+*       dominate, as the unchanged subtrees are skipped. The tree is left
+*       as it was.
+*
+*       Parameters:
+*           int64_t* edits - Receives the number of edits found
+=============================================================================*/
+static double BenchDiff(const BenchParams* params, TreeModel* tree, int64_t* edits)
+{
+    TreeModel before;
+    if(!TreeSnapshot(&before, tree))
+    {
+        return -1;
+    }
+
+    TreeNodeId renamed[8];
+    TreeStr names[8];
+    int count = 0;
+    for(int i = 0; i < 8; i++)
+    {
+        TreeNodeId node = (TreeNodeId)(1 + (int64_t)(tree->used - 1) * i / 8);
+        if(node < tree->used && TreeIsAttached(tree, node))
+        {
+            renamed[count] = node;
+            names[count] = TreeName(tree, node);
+            if(!TreeSetName(tree, node, TreeStrFromC("renamed")))
+            {
+                break;
+            }
+            count++;
+        }
+    }
+    TreeNodeId added = TreeAddNode(tree, tree->lastChild[TREE_ROOT] != TREE_NIL ? tree->lastChild[TREE_ROOT] : TREE_ROOT,
+                                   TreeStrFromC("added"), TreeStrFromC(""));
+
+    double best = -1;
+    for(int run = 0; added != TREE_NIL && run < params->repeat; run++)
+    {
+        TreeDiff diff;
+        double start = TreeSeconds();
+        int built = TreeDiffBuild(&diff, &before, tree);
+        double elapsed = TreeSeconds() - start;
+        *edits = built ? (int64_t)diff.count : 0;
+        TreeDiffFree(&diff);
+        if(!built || *edits != count + 1)
+        {
+            best = -1;
+            break;
+        }
+        if(best < 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+
+    TreeDeleteSubtree(tree, added);
+    while(count-- > 0)
+    {
+        TreeSetName(tree, renamed[count], names[count]);
+    }
+    TreeFree(&before);
+    return best;
+}
+
+/*=============================================================================
+*   BenchHashBuild [double]
+*       Time to hash every subtree of a tree into a cache
+*
+*       Parameters:
+*           TreeHashCache* cache - Receives the cache of the last run
+*           uint64_t* bytes - Receives its size
+=============================================================================*/
+static double BenchHashBuild(const BenchParams* params, const TreeModel* tree, TreeHashCache* cache, uint64_t* bytes)
+{
+    double best = -1;
+    for(int run = 0; run < params->repeat; run++)
+    {
+        double start = TreeSeconds();
+        int built = TreeHashBuild(cache, tree);
+        double elapsed = TreeSeconds() - start;
+        if(!built)
+        {
+            return -1;
+        }
+        if(best < 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    *bytes = TreeHashMemory(cache);
+    return best;
+}
+
+/*=============================================================================
+*   BenchHashCheck [double]
+*       Mean time to rename a random node and ask whether the document
+*       still matches its saved hash, which rehashes the nodes above it.
+*       Each node gets its name back afterwards, which must bring the
+*       saved hash back too. The tree is left as it was.
+*
+*       Parameters:
+*           TreeHashCache* cache - A built cache of `tree`, kept up to date
+=============================================================================*/
+static double BenchHashCheck(const BenchParams* params, TreeModel* tree, TreeHashCache* cache)
+{
+    uint64_t saved;
+    if(tree->count == 0 || !TreeHashSubtree(cache, tree, TREE_ROOT, &saved))
+    {
+        return -1;
+    }
+
+    uint64_t state = params->gen.seed + 13;
+    double total = 0;
+    for(int query = 0; query < BENCH_QUERIES; query++)
+    {
+        TreeNodeId node;
+        do
+        {
+            node = (TreeNodeId)RandomRange(&state, 1, (uint32_t)tree->used - 1);
+        }
+        while(!TreeIsAttached(tree, node));
+        TreeStr name = TreeName(tree, node);
+
+        uint64_t hash;
+        double start = TreeSeconds();
+        int renamed = TreeSetName(tree, node, TreeStrFromC("renamed"));
+        TreeHashChanged(cache, tree, node);
+        int hashed = TreeHashSubtree(cache, tree, TREE_ROOT, &hash);
+        total += TreeSeconds() - start;
+
+        TreeSetName(tree, node, name);
+        TreeHashChanged(cache, tree, node);
+        uint64_t restored;
+        if(!renamed || !hashed || !TreeHashSubtree(cache, tree, TREE_ROOT, &restored) || restored != saved ||
+           (hash == saved && !TreeStrEqual(name, TreeStrFromC("renamed"))))
+        {
+            return -1;
+        }
+    }
+    return total / BENCH_QUERIES;
+}
+
+/*=============================================================================
+*   BenchView [double]
+*       Time to show a document in a windowless view, and how many items
+*       that takes; the lazy mirror should only insert the top level
+=============================================================================*/
+static double BenchView(const BenchParams* params, TreeModel* tree, int64_t* materialized)
+{
+    TreeMirror mirror;
+    TreeMirrorInit(&mirror, tree, &TreeCountingViewOps, NULL);
+    double best = -1;
+    for(int run = 0; run < params->repeat; run++)
+    {
+        TreeMirrorClear(&mirror);
+        double start = TreeSeconds();
+        int shown = TreeMirrorReset(&mirror);
+        double elapsed = TreeSeconds() - start;
+        if(!shown)
+        {
+            best = -1;
+            break;
+        }
+        if(best < 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    *materialized = mirror.materialized;
+    TreeMirrorFree(&mirror);
+    return best;
+}
+
+/*=============================================================================
+*   Command line
+=============================================================================*/
+
+/*=============================================================================
+*   ParseDist [int]
+*       Reads "MIN:MAX" (uniform) or "exp:MEAN[:MAX]"
+=============================================================================*/
+static int ParseDist(const char* text, LengthDist* dist)
+{
+    unsigned min;
+    unsigned max;
+    double mean;
+    if(strncmp(text, "exp:", 4) == 0)
+    {
+        dist->exponential = 1;
+        dist->max = 1u << 20;
+        int fields = sscanf(text + 4, "%lf:%u", &mean, &max);
+        if(fields < 1 || mean < 0)
+        {
+            return 0;
+        }
+        dist->mean = mean;
+        dist->min = 0;
+        if(fields == 2)
+        {
+            dist->max = max;
+        }
+        return 1;
+    }
+    if(sscanf(text, "%u:%u", &min, &max) != 2 || min > max)
+    {
+        return 0;
+    }
+    dist->exponential = 0;
+    dist->min = min;
+    dist->max = max;
+    return 1;
+}
+
+/*=============================================================================
+*   Usage [void]
+=============================================================================*/
+static void Usage(void)
+{
+    fprintf(stderr,
+        "usage: dtree-bench [options]\n"
+        "  -n NODES      nodes to generate (200000)\n"
+        "  -d DEPTH      deepest level (8)\n"
+        "  -f MIN:MAX    children per node below the top level (0:6)\n"
+        "  -N DIST       name length, MIN:MAX or exp:MEAN[:MAX] (4:24)\n"
+        "  -D DIST       description length (exp:60:4096)\n"
+        "  -l DENSITY    chance of a description byte being a newline (0.01)\n"
+        "  -s SEED       generator seed (1)\n"
+        "  -i FILE       benchmark this .dat file instead of generating one\n"
+        "  -o FILE       also write the generated tree (.dtb for binary)\n"
+        "  -w FILE       scratch file (dtree-bench.tmp)\n"
+        "  -r COUNT      best of COUNT runs (3)\n"
+        "  -t THREADS    threads for the parallel runs, 0 for all (0)\n");
+}
+
+/*=============================================================================
+*   ParseArguments [int]
+*       Fills in the defaults, then applies the options
+*
+*       Returns 0 on a bad option
+=============================================================================*/
+static int ParseArguments(int argc, char** argv, BenchParams* params)
+{
+    memset(params, 0, sizeof(*params));
+    params->gen.nodes = 200000;
+    params->gen.depth = 8;
+    params->gen.fanMin = 0;
+    params->gen.fanMax = 6;
+    ParseDist("4:24", &params->gen.name);
+    ParseDist("exp:60:4096", &params->gen.description);
+    params->gen.newlines = 0.01;
+    params->gen.seed = 1;
+    params->work = "dtree-bench.tmp";
+    params->repeat = 3;
+
+    for(int i = 1; i < argc; i++)
+    {
+        const char* option = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if(option[0] != '-' || option[1] == '\0' || option[2] != '\0' || !value)
+        {
+            return 0;
+        }
+        i++;
+
+        int ok = 1;
+        switch(option[1])
+        {
+            case 'n': params->gen.nodes = atoi(value); ok = params->gen.nodes > 0; break;
+            case 'd': params->gen.depth = atoi(value); ok = params->gen.depth > 0; break;
+            case 'f': ok = sscanf(value, "%d:%d", &params->gen.fanMin, &params->gen.fanMax) == 2 &&
+                           params->gen.fanMin >= 0 && params->gen.fanMin <= params->gen.fanMax; break;
+            case 'N': ok = ParseDist(value, &params->gen.name); break;
+            case 'D': ok = ParseDist(value, &params->gen.description); break;
+            case 'l': params->gen.newlines = atof(value); break;
+            case 's': params->gen.seed = strtoull(value, NULL, 10); break;
+            case 'i': params->input = value; break;
+            case 'o': params->output = value; break;
+            case 'w': params->work = value; break;
+            case 'r': params->repeat = atoi(value); ok = params->repeat > 0; break;
+            case 't': params->threads = atoi(value); break;
+            default: ok = 0; break;
+        }
+        if(!ok)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   main
+=============================================================================*/
+int main(int argc, char** argv)
+{
+    BenchParams params;
+    if(!ParseArguments(argc, argv, &params))
+    {
+        Usage();
+        return 2;
+    }
+
+    TreeModel tree;
+    TreeModel scratch;
+    if(!TreeInit(&tree) || !TreeInit(&scratch))
+    {
+        fprintf(stderr, "dtree-bench: out of memory\n");
+        return 1;
+    }
+
+    //The document under test, either generated or read once up front
+    double start = TreeSeconds();
+    int ready;
+    if(params.input)
+    {
+        FILE* file = fopen(params.input, "rb");
+        ready = file && TreeLoadFromStream(&tree, file);
+        if(file)
+        {
+            fclose(file);
+        }
+    }
+    else
+    {
+        ready = Generate(&tree, &params.gen);
+    }
+    if(!ready)
+    {
+        fprintf(stderr, "dtree-bench: could not %s the tree\n", params.input ? "read" : "generate");
+        return 1;
+    }
+    double elapsed = TreeSeconds() - start;
+
+    printf("{\"bench\":\"config\",\"input\":\"%s\",\"nodes\":%d,\"depth\":%d,\"fan_out\":\"%d:%d\","
+           "\"newlines\":%g,\"seed\":%llu,\"repeat\":%d,\"threads\":%d,\"cpus\":%d,\"escape_kernel\":\"%s\"}\n",
+           params.input ? params.input : "generated", tree.count, params.gen.depth,
+           params.gen.fanMin, params.gen.fanMax, params.gen.newlines,
+           (unsigned long long)params.gen.seed, params.repeat, params.threads, TreeCpuCount(), TreeEscapeKernel());
+    Report(params.input ? "read_input" : "generate", tree.count, 0, elapsed);
+
+    if(params.output)
+    {
+        size_t length = strlen(params.output);
+        int binary = length >= 4 && strcmp(params.output + length - 4, ".dtb") == 0;
+        FILE* file = fopen(params.output, "wb");
+        int saved = file && (binary ? TreeSaveBinary(&tree, file) : TreeSaveToStream(&tree, file));
+        if(!file || fclose(file) != 0 || !saved)
+        {
+            fprintf(stderr, "dtree-bench: could not write %s\n", params.output);
+            return 1;
+        }
+    }
+
+    int failed = 0;
+    int64_t nodes = tree.count;
+
+    //Text format
+    double seconds = BenchSave(&params, &tree, SAVE_TEXT, params.work);
+    uint64_t textBytes = FileSize(params.work);
+    failed |= seconds < 0;
+    Report("save_text", nodes, textBytes, seconds);
+
+    seconds = BenchSave(&params, &tree, SAVE_PARALLEL, params.work);
+    failed |= seconds < 0;
+    Report("save_text_parallel", nodes, textBytes, seconds);
+
+    seconds = BenchLoad(&params, &scratch, LOAD_STREAM, params.work);
+    failed |= seconds < 0 || scratch.count != nodes;
+    Report("load_stream", nodes, textBytes, seconds);
+
+    seconds = BenchLoad(&params, &scratch, LOAD_MAPPED, params.work);
+    failed |= seconds < 0 || scratch.count != nodes;
+    Report("load_mapped", nodes, textBytes, seconds);
+
+    seconds = BenchLoad(&params, &scratch, LOAD_PARALLEL, params.work);
+    failed |= seconds < 0 || scratch.count != nodes;
+    Report("load_parallel", nodes, textBytes, seconds);
+
+    seconds = BenchTeardown(&params, &scratch, params.work);
+    failed |= seconds < 0;
+    Report("teardown", nodes, 0, seconds);
+
+    //Binary format
+    seconds = BenchSave(&params, &tree, SAVE_BINARY, params.work);
+    uint64_t binaryBytes = FileSize(params.work);
+    failed |= seconds < 0;
+    Report("save_binary", nodes, binaryBytes, seconds);
+
+    seconds = BenchLoad(&params, &scratch, LOAD_BINARY, params.work);
+    failed |= seconds < 0 || scratch.count != nodes;
+    Report("load_binary", nodes, binaryBytes, seconds);
+    TreeClear(&scratch);
+
+    //Compressed format; bytes are those of the file, see save_binary for the image
+    seconds = BenchSave(&params, &tree, SAVE_COMPRESSED, params.work);
+    uint64_t compressedBytes = FileSize(params.work);
+    failed |= seconds < 0;
+    Report("save_compressed", nodes, compressedBytes, seconds);
+
+    seconds = BenchLoad(&params, &scratch, LOAD_COMPRESSED, params.work);
+    failed |= seconds < 0 || scratch.count != nodes;
+    Report("load_compressed", nodes, compressedBytes, seconds);
+    TreeClear(&scratch);
+    remove(params.work);
+
+    //In memory
+    uint64_t bytes = 0;
+    seconds = BenchEscape(&params, &tree, 0, &bytes);
+    failed |= seconds < 0;
+    Report("escape", nodes, bytes, seconds);
+
+    seconds = BenchEscape(&params, &tree, 1, &bytes);
+    failed |= seconds < 0;
+    Report("unescape", nodes, bytes, seconds);
+
+    seconds = BenchTranscode(&params, &tree, 0, &bytes);
+    failed |= seconds < 0;
+    Report("utf8_to_utf16", nodes, bytes, seconds);
+
+    seconds = BenchTranscode(&params, &tree, 1, &bytes);
+    failed |= seconds < 0;
+    Report("utf16_to_utf8", nodes, bytes, seconds);
+
+    seconds = BenchTraverse(&params, &tree);
+    Report("traverse_preorder", nodes, 0, seconds);
+
+    seconds = BenchSnapshot(&params, &tree);
+    failed |= seconds < 0;
+    Report("snapshot", nodes, 0, seconds);
+
+    TreeIndex index;
+    TreeIndexInit(&index);
+    seconds = BenchIndexBuild(&params, &tree, &index, &bytes);
+    failed |= seconds < 0;
+    Report("index_build", nodes, bytes, seconds);
+
+    int64_t matches = 0;
+    seconds = BenchIndexQuery(&params, &tree, &index, 0, &matches);
+    failed |= seconds < 0;
+    Report("index_query", matches, 0, seconds);
+
+    seconds = BenchIndexQuery(&params, &tree, &index, TREE_FIND_PREFIX, &matches);
+    failed |= seconds < 0;
+    Report("index_query_prefix", matches, 0, seconds);
+    TreeIndexFree(&index);
+
+    TreePathIndex paths;
+    TreePathInit(&paths);
+    int64_t levels = 0;
+    seconds = BenchPathFind(&params, &tree, &paths, &levels);
+    failed |= seconds < 0;
+    Report("path_find_scan", levels, 0, seconds);
+
+    seconds = BenchPathBuild(&params, &tree, &paths, &bytes);
+    failed |= seconds < 0;
+    Report("path_build", nodes, bytes, seconds);
+
+    seconds = BenchPathFind(&params, &tree, &paths, &levels);
+    failed |= seconds < 0;
+    Report("path_find", levels, 0, seconds);
+
+    int64_t subtree = 0;
+    seconds = BenchMove(&params, &tree, &paths, &subtree);
+    if(seconds == BENCH_SKIPPED)
+    {
+        ReportSkipped("move_undo", "no node has two children");
+    }
+    else
+    {
+        failed |= seconds < 0;
+        Report("move_undo", subtree, 0, seconds);
+    }
+    TreePathFree(&paths);
+
+    seconds = BenchUndoDelete(&params, &tree, &subtree, &bytes);
+    failed |= seconds < 0;
+    Report("undo_delete", subtree, bytes, seconds);
+
+    int64_t edits = 0;
+    seconds = BenchDiff(&params, &tree, &edits);
+    failed |= seconds < 0;
+    Report("diff", nodes, 0, seconds);
+
+    TreeHashCache hashes;
+    TreeHashInit(&hashes);
+    seconds = BenchHashBuild(&params, &tree, &hashes, &bytes);
+    failed |= seconds < 0;
+    Report("hash_build", nodes, bytes, seconds);
+
+    seconds = BenchHashCheck(&params, &tree, &hashes);
+    failed |= seconds < 0;
+    Report("hash_check", BENCH_QUERIES, 0, seconds);
+    TreeHashFree(&hashes);
+
+    int64_t materialized = 0;
+    seconds = BenchView(&params, &tree, &materialized);
+    failed |= seconds < 0;
+    Report("view_open", materialized, 0, seconds);
+
+    TreeFree(&scratch);
+    TreeFree(&tree);
+    if(failed)
+    {
+        fprintf(stderr, "dtree-bench: a benchmark failed\n");
+    }
+    return failed;
+}
@@ -0,0 +1,945 @@
+/*=============================================================================
+*       cli.c
+*       dtree-cli, the model's file handling without the window: format
+*       conversion, statistics, queries and subtree extraction for use in
+*       scripts, built with `make cli`. Every command streams its input
+*       one node at a time, so memory stays bounded however large the file,
+*       except diff and merge, which match whole models against each other.
+=============================================================================*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "tree.h"
+
+/*=============================================================================
+*   Struct Definitions
+=============================================================================*/
+
+typedef struct _CliParams
+{
+    const char* command;
+    const char* input;      //"-" for text on stdin
+    const char* output;     //"-" for stdout
+    const char* others[2];  //diff: the new file; merge: ours and theirs
+    const char* path;       //node to start at, as TreePathFind reads it
+    const char* text;       //text to look for
+    int format;             //TREE_FORMAT_* to write, -1 to go by the extension
+    int threads;
+    long long limit;        //most matches to print, 0 for all
+    int verbose;            //print descriptions along with paths
+} CliParams;
+
+/*
+*   A path split into its names, which point into `buffer`
+*/
+typedef struct _CliPath
+{
+    char* buffer;
+    TreeStr* names;
+    int count;
+} CliPath;
+
+/*
+*   The path of the node being visited, escaped as TreePathFormat writes
+*   it plus line breaks and tabs, so that it prints on one line; ends[d] is where
+*   the name at depth d ends
+*/
+typedef struct _CliTrail
+{
+    char* text;
+    size_t length;
+    size_t capacity;
+    size_t* ends;
+    int depthCapacity;
+} CliTrail;
+
+/*
+*   State shared by the scan callbacks of every command
+*/
+typedef struct _CliScan
+{
+    const CliParams* params;
+    CliPath path;
+    CliTrail trail;
+    TreeStreamWriter writer;
+    int failed;
+
+    //query
+    long long matches;
+    char* escaped;
+    size_t escapedCapacity;
+
+    //extract
+    int extracting;         //the node at the path was found
+    int top;                //its depth in the input
+
+    //stats
+    long long nodes;
+    long long leaves;
+    long long nameBytes;
+    long long descriptionBytes;
+    long long maxChildren;
+    long long* perDepth;    //nodes at every depth
+    long long* children;    //children of the open node at every depth
+    int perDepthCapacity;
+    int childrenCapacity;
+    int maxDepth;
+    int lastDepth;
+} CliScan;
+
+/*=============================================================================
+*   Helpers
+=============================================================================*/
+
+/*=============================================================================
+*   GrowArray [int]
+*       Makes room for index `depth` in an array of `size`-byte items,
+*       zeroing what is added
+=============================================================================*/
+static int GrowArray(void** array, int* capacity, int depth, size_t size)
+{
+    if(depth < *capacity)
+    {
+        return 1;
+    }
+    int grown = *capacity ? *capacity : 16;
+    while(grown <= depth)
+    {
+        grown *= 2;
+    }
+    char* bigger = (char*)realloc(*array, (size_t)grown * size);
+    if(!bigger)
+    {
+        return 0;
+    }
+    memset(bigger + (size_t)*capacity * size, 0, (size_t)(grown - *capacity) * size);
+    *array = bigger;
+    *capacity = grown;
+    return 1;
+}
+
+/*=============================================================================
+*   Contains [int]
+*       Nonzero if `needle` occurs in `text`
+=============================================================================*/
+static int Contains(TreeStr text, const char* needle, size_t length)
+{
+    if(length == 0)
+    {
+        return 1;
+    }
+    const char* cursor = text.ptr;
+    const char* end = text.ptr + text.len;
+    while((size_t)(end - cursor) >= length)
+    {
+        cursor = (const char*)memchr(cursor, needle[0], (end - cursor) - length + 1);
+        if(!cursor)
+        {
+            return 0;
+        }
+        if(memcmp(cursor, needle, length) == 0)
+        {
+            return 1;
+        }
+        cursor++;
+    }
+    return 0;
+}
+
+/*=============================================================================
+*   SplitPath [int]
+*       Splits a path into names, resolving the backslash escapes the way
+*       TreePathFind does, and \n, \r and \t as TrailAppend writes line
+*       breaks and tabs
+=============================================================================*/
+static int SplitPath(const char* text, CliPath* path)
+{
+    size_t length = strlen(text);
+    path->buffer = (char*)malloc(length + 1);
+    path->names = (TreeStr*)malloc((length + 1) * sizeof(TreeStr));
+    path->count = 0;
+    if(!path->buffer || !path->names)
+    {
+        return 0;
+    }
+
+    size_t out = 0;
+    size_t i = 0;
+    for(;;)
+    {
+        TreeStr* name = &path->names[path->count++];
+        name->ptr = path->buffer + out;
+        size_t start = out;
+        while(i < length && text[i] != '/')
+        {
+            if(text[i] == '\\' && i + 1 < length)
+            {
+                i++;
+                if(text[i] == 'n' || text[i] == 'r' || text[i] == 't')
+                {
+                    path->buffer[out++] = text[i] == 'n' ? '\n' : text[i] == 'r' ? '\r' : '\t';
+                    i++;
+                    continue;
+                }
+            }
+            path->buffer[out++] = text[i++];
+        }
+        name->len = (uint32_t)(out - start);
+        if(i == length)
+        {
+            return 1;
+        }
+        i++;
+    }
+}
+
+/*=============================================================================
+*   TrailAppend [int]
+*       Makes `name` at `depth` the end of the trail
+=============================================================================*/
+static int TrailAppend(CliTrail* trail, int depth, TreeStr name)
+{
+    if(!GrowArray((void**)&trail->ends, &trail->depthCapacity, depth, sizeof(size_t)))
+    {
+        return 0;
+    }
+    trail->length = depth ? trail->ends[depth - 1] : 0;
+
+    size_t needed = trail->length + 1 + (size_t)name.len * 2 + 1;
+    if(needed > trail->capacity)
+    {
+        size_t capacity = trail->capacity ? trail->capacity : 256;
+        while(capacity < needed)
+        {
+            capacity *= 2;
+        }
+        char* text = (char*)realloc(trail->text, capacity);
+        if(!text)
+        {
+            return 0;
+        }
+        trail->text = text;
+        trail->capacity = capacity;
+    }
+
+    if(depth)
+    {
+        trail->text[trail->length++] = '/';
+    }
+    for(uint32_t i = 0; i < name.len; i++)
+    {
+        char byte = name.ptr[i];
+        if(byte == '/' || byte == '\\' || byte == '\n' || byte == '\r' || byte == '\t')
+        {
+            trail->text[trail->length++] = '\\';
+        }
+        trail->text[trail->length++] = byte == '\n' ? 'n' : byte == '\r' ? 'r' : byte == '\t' ? 't' : byte;
+    }
+    trail->text[trail->length] = '\0';
+    trail->ends[depth] = trail->length;
+    return 1;
+}
+
+/*=============================================================================
+*   FollowPath [int]
+*       Narrows a scan to the subtree at params->path: nodes off the path
+*       are skipped along with everything below them
+*
+*       Returns TREE_SCAN_SKIP for a node off the path, TREE_SCAN_NEXT for
+*       one on the way to it, and -1 for the node at the path or below it
+=============================================================================*/
+static int FollowPath(const CliScan* scan, int depth, TreeStr name)
+{
+    if(depth >= scan->path.count)
+    {
+        return -1;
+    }
+    if(!TreeStrEqual(name, scan->path.names[depth]))
+    {
+        return TREE_SCAN_SKIP;
+    }
+    return depth == scan->path.count - 1 ? -1 : TREE_SCAN_NEXT;
+}
+
+/*=============================================================================
+*   FormatOf [int]
+*       The TREE_FORMAT_* a file name asks for by its extension
+=============================================================================*/
+static int FormatOf(const char* fileName)
+{
+    size_t length = strlen(fileName);
+    if(length >= 4 && strcmp(fileName + length - 4, ".dtz") == 0)
+    {
+        return TREE_FORMAT_COMPRESSED;
+    }
+    if(length >= 4 && strcmp(fileName + length - 4, ".dtb") == 0)
+    {
+        return TREE_FORMAT_BINARY;
+    }
+    return TREE_FORMAT_TEXT;
+}
+
+/*=============================================================================
+*   Commands
+=============================================================================*/
+
+/*=============================================================================
+*   ConvertNode [int]
+*       Writes every node to the output
+=============================================================================*/
+static int ConvertNode(void* context, int depth, TreeStr name, TreeStr description)
+{
+    CliScan* scan = (CliScan*)context;
+    if(!TreeStreamWriterNode(&scan->writer, depth, name, description))
+    {
+        scan->failed = 1;
+        return TREE_SCAN_STOP;
+    }
+    return TREE_SCAN_NEXT;
+}
+
+/*=============================================================================
+*   ExtractNode [int]
+*       Writes the first node at the path and its subtree to the output,
+*       moved up to the top level
+=============================================================================*/
+static int ExtractNode(void* context, int depth, TreeStr name, TreeStr description)
+{
+    CliScan* scan = (CliScan*)context;
+    if(!scan->extracting)
+    {
+        int next = FollowPath(scan, depth, name);
+        if(next != -1)
+        {
+            return next;
+        }
+        scan->extracting = 1;
+        scan->top = depth;
+    }
+    else if(depth <= scan->top)
+    {
+        //Past the end of the subtree
+        return TREE_SCAN_STOP;
+    }
+    return ConvertNode(context, depth - scan->top, name, description);
+}
+
+/*=============================================================================
+*   QueryNode [int]
+*       Prints the path of the node at params->path, or with params->text
+*       of every node at or below it whose name or description holds the
+*       text
+=============================================================================*/
+static int QueryNode(void* context, int depth, TreeStr name, TreeStr description)
+{
+    CliScan* scan = (CliScan*)context;
+    const CliParams* params = scan->params;
+    int next = scan->path.count ? FollowPath(scan, depth, name) : -1;
+    if(!TrailAppend(&scan->trail, depth, name))
+    {
+        scan->failed = 1;
+        return TREE_SCAN_STOP;
+    }
+    if(next != -1)
+    {
+        return next;
+    }
+
+    size_t length = params->text ? strlen(params->text) : 0;
+    if(params->text && !Contains(name, params->text, length) && !Contains(description, params->text, length))
+    {
+        return TREE_SCAN_NEXT;
+    }
+
+    fputs(scan->trail.text, stdout);
+    if(params->verbose)
+    {
+        //Escaped, so that one match is one line
+        size_t needed = (size_t)description.len * 2 + 1;
+        if(needed > scan->escapedCapacity)
+        {
+            char* escaped = (char*)realloc(scan->escaped, needed);
+            if(!escaped)
+            {
+                scan->failed = 1;
+                return TREE_SCAN_STOP;
+            }
+            scan->escaped = escaped;
+            scan->escapedCapacity = needed;
+        }
+        fputc('\t', stdout);
+        fwrite(scan->escaped, 1, TreeEscape(scan->escaped, description.ptr, description.len), stdout);
+    }
+    fputc('\n', stdout);
+
+    scan->matches++;
+    if(params->limit && scan->matches >= params->limit)
+    {
+        return TREE_SCAN_STOP;
+    }
+
+    //A path alone names the node; text is looked for below it too
+    return params->text ? TREE_SCAN_NEXT : TREE_SCAN_SKIP;
+}
+
+/*=============================================================================
+*   StatsNode [int]
+*       Counts nodes, leaves, text and the widest and deepest parts
+=============================================================================*/
+static int StatsNode(void* context, int depth, TreeStr name, TreeStr description)
+{
+    CliScan* scan = (CliScan*)context;
+    if(!GrowArray((void**)&scan->perDepth, &scan->perDepthCapacity, depth, sizeof(long long)) ||
+       !GrowArray((void**)&scan->children, &scan->childrenCapacity, depth + 1, sizeof(long long)))
+    {
+        scan->failed = 1;
+        return TREE_SCAN_STOP;
+    }
+
+    //The node before was a leaf unless this one is its child
+    if(scan->nodes && depth <= scan->lastDepth)
+    {
+        scan->leaves++;
+    }
+    scan->nodes++;
+    scan->perDepth[depth]++;
+    scan->nameBytes += name.len;
+    scan->descriptionBytes += description.len;
+    if(depth > scan->maxDepth)
+    {
+        scan->maxDepth = depth;
+    }
+
+    //children[d] counts the children of the open node at depth d - 1
+    scan->children[depth]++;
+    if(scan->children[depth] > scan->maxChildren)
+    {
+        scan->maxChildren = scan->children[depth];
+    }
+    scan->children[depth + 1] = 0;
+    scan->lastDepth = depth;
+    return TREE_SCAN_NEXT;
+}
+
+/*=============================================================================
+*   PrintStats [void]
+*       One JSON object, as the benchmarks print them
+=============================================================================*/
+static void PrintStats(const CliScan* scan, const char* input, int format, uint64_t bytes)
+{
+    static const char* formats[] = {"text", "binary", "compressed"};
+    printf("{\"input\":\"%s\",\"format\":\"%s\",\"bytes\":%llu,\"nodes\":%lld,\"leaves\":%lld,"
+           "\"max_depth\":%d,\"max_children\":%lld,\"name_bytes\":%lld,\"description_bytes\":%lld,\"per_depth\":[",
+           input, formats[format], (unsigned long long)bytes, scan->nodes, scan->leaves + (scan->nodes > 0),
+           scan->nodes ? scan->maxDepth + 1 : 0, scan->maxChildren, scan->nameBytes, scan->descriptionBytes);
+    for(int depth = 0; scan->nodes && depth <= scan->maxDepth; depth++)
+    {
+        printf(depth ? ",%lld" : "%lld", scan->perDepth[depth]);
+    }
+    printf("]}\n");
+}
+
+/*=============================================================================
+*   Diff and merge
+=============================================================================*/
+
+/*=============================================================================
+*   LoadModel [int]
+*       Reads a whole file of any format into a model; text is mapped and
+*       parsed on `threads` threads unless it comes from stdin or another
+*       pipe
+=============================================================================*/
+static int LoadModel(TreeModel* tree, const char* fileName, int threads)
+{
+    int fromStdin = strcmp(fileName, "-") == 0;
+    FILE* in = fromStdin ? stdin : fopen(fileName, "rb");
+    if(!in || !TreeInit(tree))
+    {
+        fprintf(stderr, "dtree-cli: cannot open %s\n", fileName);
+        if(in && !fromStdin)
+        {
+            fclose(in);
+        }
+        return 0;
+    }
+
+    int streamed = fromStdin || !TreeStreamIsFile(in);
+    int format = streamed ? TREE_FORMAT_TEXT : TreeStreamFormat(in);
+    int loaded = format == TREE_FORMAT_COMPRESSED ? TreeLoadCompressed(tree, in, threads) :
+                 format == TREE_FORMAT_BINARY ? TreeLoadBinary(tree, in) :
+                 format == TREE_FORMAT_TEXT && !streamed && TreeLoadParallel(tree, in, threads);
+    if(!loaded && format == TREE_FORMAT_TEXT && !tree->mapping.data)
+    {
+        //Not mapped at all, so read it the buffered way
+        loaded = (streamed || fseek(in, 0, SEEK_SET) == 0) && TreeLoadFromStream(tree, in);
+    }
+    if(!fromStdin)
+    {
+        fclose(in);
+    }
+    if(!loaded)
+    {
+        fprintf(stderr, "dtree-cli: %s could not be read\n", fileName);
+        TreeFree(tree);
+    }
+    return loaded;
+}
+
+/*=============================================================================
+*   PrintPath [int]
+*       Prints the path of a node, escaped as TrailAppend writes it
+=============================================================================*/
+static int PrintPath(FILE* out, const TreeModel* tree, TreeNodeId node, char** buffer, size_t* capacity)
+{
+    size_t length = TreePathFormat(tree, node, *buffer, *capacity);
+    if(length >= *capacity)
+    {
+        size_t grown = *capacity ? *capacity : 256;
+        while(grown <= length)
+        {
+            grown *= 2;
+        }
+        char* bigger = (char*)realloc(*buffer, grown);
+        if(!bigger)
+        {
+            return 0;
+        }
+        *buffer = bigger;
+        *capacity = grown;
+        TreePathFormat(tree, node, *buffer, *capacity);
+    }
+    for(size_t i = 0; i < length; i++)
+    {
+        char byte = (*buffer)[i];
+        if(byte == '\n' || byte == '\r' || byte == '\t')
+        {
+            fputc('\\', out);
+            byte = byte == '\n' ? 'n' : byte == '\r' ? 'r' : 't';
+        }
+        fputc(byte, out);
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   DiffFiles [int]
+*       Prints the edits that turn the input into params->others[0], one
+*       per line:
+*           - PATH              deleted with everything below it
+*           + PATH              inserted with everything below it
+*           > OLDPATH<tab>PATH  moved with everything below it
+*           ~n OLDPATH<tab>PATH renamed; ~d for a new description, ~nd both
+*
+*       Returns the exit status
+=============================================================================*/
+static int DiffFiles(const CliParams* params)
+{
+    TreeModel oldTree;
+    TreeModel newTree;
+    if(!LoadModel(&oldTree, params->input, params->threads))
+    {
+        return 1;
+    }
+    if(!LoadModel(&newTree, params->others[0], params->threads))
+    {
+        TreeFree(&oldTree);
+        return 1;
+    }
+
+    TreeDiff diff;
+    int status = 0;
+    if(!TreeDiffBuild(&diff, &oldTree, &newTree))
+    {
+        fprintf(stderr, "dtree-cli: out of memory\n");
+        status = 1;
+    }
+    char* buffer = NULL;
+    size_t capacity = 0;
+    for(size_t i = 0; !status && i < diff.count; i++)
+    {
+        const TreeDiffEdit* edit = &diff.edits[i];
+        int printed = 1;
+        switch(edit->kind)
+        {
+            case TREE_DIFF_DELETE:
+                fputs("- ", stdout);
+                printed = PrintPath(stdout, &oldTree, edit->oldNode, &buffer, &capacity);
+                break;
+            case TREE_DIFF_INSERT:
+                fputs("+ ", stdout);
+                printed = PrintPath(stdout, &newTree, edit->newNode, &buffer, &capacity);
+                break;
+            case TREE_DIFF_MOVE:
+            case TREE_DIFF_UPDATE:
+                fputs(edit->kind == TREE_DIFF_MOVE ? "> " :
+                      edit->flags == TREE_DIFF_NAME ? "~n " :
+                      edit->flags == TREE_DIFF_DESCRIPTION ? "~d " : "~nd ", stdout);
+                printed = PrintPath(stdout, &oldTree, edit->oldNode, &buffer, &capacity);
+                putchar('\t');
+                printed = printed && PrintPath(stdout, &newTree, edit->newNode, &buffer, &capacity);
+                break;
+        }
+        putchar('\n');
+        if(!printed)
+        {
+            fprintf(stderr, "dtree-cli: out of memory\n");
+            status = 1;
+        }
+    }
+    if(fflush(stdout) != 0)
+    {
+        status = 1;
+    }
+
+    free(buffer);
+    TreeDiffFree(&diff);
+    TreeFree(&oldTree);
+    TreeFree(&newTree);
+    return status;
+}
+
+/*=============================================================================
+*   MergeFiles [int]
+*       Merges what params->others[0] (ours) and params->others[1]
+*       (theirs) changed since the input (their common ancestor) and writes
+*       the result. Conflicts are listed on stderr and make the exit status
+*       1, though the result is written all the same, with ours kept, so
+*       the command works as a git merge driver:
+*           dtree-cli merge %O %A %B %A
+*
+*       Returns the exit status
+=============================================================================*/
+static int MergeFiles(const CliParams* params)
+{
+    TreeModel base;
+    TreeModel ours;
+    TreeModel theirs;
+    if(!LoadModel(&base, params->input, params->threads))
+    {
+        return 1;
+    }
+    if(!LoadModel(&ours, params->others[0], params->threads))
+    {
+        TreeFree(&base);
+        return 1;
+    }
+    if(!LoadModel(&theirs, params->others[1], params->threads))
+    {
+        TreeFree(&base);
+        TreeFree(&ours);
+        return 1;
+    }
+
+    //The result may go over one of the inputs, so none of them stays mapped
+    TreeMergeResult result;
+    int merged = TreeMerge(&base, &ours, &theirs, &result) && TreeReleaseMapping(&base);
+    TreeFree(&ours);
+    TreeFree(&theirs);
+    if(!merged)
+    {
+        fprintf(stderr, "dtree-cli: out of memory\n");
+        TreeMergeResultFree(&result);
+        TreeFree(&base);
+        return 1;
+    }
+
+    int toStdout = strcmp(params->output, "-") == 0;
+    FILE* out = toStdout ? stdout : fopen(params->output, "wb");
+    int format = params->format >= 0 ? params->format : toStdout ? TREE_FORMAT_TEXT : FormatOf(params->output);
+    int written = out && (format == TREE_FORMAT_COMPRESSED ? TreeSaveCompressed(&base, out, params->threads) :
+                          format == TREE_FORMAT_BINARY ? TreeSaveBinary(&base, out) : TreeSaveToStream(&base, out));
+    written = out && (toStdout ? fflush(out) == 0 : fclose(out) == 0) && written;
+    int status = 0;
+    if(!written)
+    {
+        fprintf(stderr, "dtree-cli: cannot write %s\n", params->output);
+        status = 1;
+    }
+
+    static const char* conflicts[] = {"", "changed on both sides", "moved on both sides", "deleted on one side, changed on the other"};
+    char* buffer = NULL;
+    size_t capacity = 0;
+    for(size_t i = 0; i < result.count; i++)
+    {
+        fprintf(stderr, "dtree-cli: conflict, %s: ", conflicts[result.conflicts[i].kind]);
+        PrintPath(stderr, &base, result.conflicts[i].node, &buffer, &capacity);
+        fputc('\n', stderr);
+    }
+    if(result.count)
+    {
+        status = 1;
+    }
+
+    free(buffer);
+    TreeMergeResultFree(&result);
+    TreeFree(&base);
+    return status;
+}
+
+/*=============================================================================
+*   Usage [void]
+=============================================================================*/
+static void Usage(void)
+{
+    fprintf(stderr,
+        "usage: dtree-cli COMMAND [options] ARGUMENTS\n"
+        "  convert IN OUT          write IN in another format\n"
+        "  stats IN                print counts as a JSON object\n"
+        "  query IN                print the paths of matching nodes\n"
+        "  extract IN PATH OUT     write the node at PATH and its subtree\n"
+        "  diff OLD NEW            print the edits that turn OLD into NEW\n"
+        "  merge BASE OURS THEIRS OUT\n"
+        "                          merge what OURS and THEIRS changed since BASE;\n"
+        "                          exits with 1 on conflicts, where OURS wins\n"
+        "options:\n"
+        "  -f FORMAT     text, binary or compressed (by the extension of OUT)\n"
+        "  -p PATH       query: the node at PATH, e.g. Servers/eu-west\n"
+        "  -s TEXT       query: nodes whose name or description holds TEXT\n"
+        "  -n COUNT      query: stop after COUNT matches\n"
+        "  -v            query: print descriptions after the paths\n"
+        "  -t THREADS    threads for compression and loading, 0 for all (0)\n"
+        "IN may be - for text on stdin, OUT - for stdout. Names in a path\n"
+        "are separated by /; / and \\ in a name are escaped with \\, line\n"
+        "breaks and tabs as \\n, \\r and \\t.\n");
+}
+
+/*=============================================================================
+*   ParseArguments [int]
+*       Reads the command, its options and its arguments
+*
+*       Returns 0 if they do not make sense
+=============================================================================*/
+static int ParseArguments(int argc, char** argv, CliParams* params)
+{
+    memset(params, 0, sizeof(*params));
+    params->format = -1;
+    if(argc < 2)
+    {
+        return 0;
+    }
+    params->command = argv[1];
+
+    const char* arguments[4];
+    int count = 0;
+    for(int i = 2; i < argc; i++)
+    {
+        const char* option = argv[i];
+        if(option[0] != '-' || option[1] == '\0')
+        {
+            if(count == 4)
+            {
+                return 0;
+            }
+            arguments[count++] = option;
+            continue;
+        }
+        if(option[2] != '\0')
+        {
+            return 0;
+        }
+        if(option[1] == 'v')
+        {
+            params->verbose = 1;
+            continue;
+        }
+
+        const char* value = i + 1 < argc ? argv[++i] : NULL;
+        if(!value)
+        {
+            return 0;
+        }
+        switch(option[1])
+        {
+            case 'f':
+                params->format = strcmp(value, "text") == 0 ? TREE_FORMAT_TEXT :
+                                 strcmp(value, "binary") == 0 ? TREE_FORMAT_BINARY :
+                                 strcmp(value, "compressed") == 0 ? TREE_FORMAT_COMPRESSED : -2;
+                if(params->format == -2)
+                {
+                    return 0;
+                }
+                break;
+            case 'p': params->path = value; break;
+            case 's': params->text = value; break;
+            case 'n': params->limit = atoll(value); break;
+            case 't': params->threads = atoi(value); break;
+            default: return 0;
+        }
+    }
+
+    int wanted;
+    if(strcmp(params->command, "convert") == 0)
+    {
+        wanted = 2;
+        params->output = arguments[1];
+    }
+    else if(strcmp(params->command, "extract") == 0)
+    {
+        wanted = 3;
+        params->path = arguments[1];
+        params->output = arguments[2];
+    }
+    else if(strcmp(params->command, "stats") == 0 || strcmp(params->command, "query") == 0)
+    {
+        wanted = 1;
+    }
+    else if(strcmp(params->command, "diff") == 0)
+    {
+        wanted = 2;
+        params->others[0] = arguments[1];
+    }
+    else if(strcmp(params->command, "merge") == 0)
+    {
+        wanted = 4;
+        params->others[0] = arguments[1];
+        params->others[1] = arguments[2];
+        params->output = arguments[3];
+    }
+    else
+    {
+        return 0;
+    }
+    if(count != wanted)
+    {
+        return 0;
+    }
+    params->input = arguments[0];
+    return 1;
+}
+
+/*=============================================================================
+*   main
+=============================================================================*/
+int main(int argc, char** argv)
+{
+    CliParams params;
+    if(!ParseArguments(argc, argv, &params))
+    {
+        Usage();
+        return 2;
+    }
+
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    if(strcmp(params.command, "diff") == 0)
+    {
+        return DiffFiles(&params);
+    }
+    if(strcmp(params.command, "merge") == 0)
+    {
+        return MergeFiles(&params);
+    }
+
+    //Only text can be read from a pipe, named or not, since peeking at the
+    //magic number needs a rewind; files are told apart by it
+    int fromStdin = strcmp(params.input, "-") == 0;
+    FILE* in = fromStdin ? stdin : fopen(params.input, "rb");
+    if(!in)
+    {
+        fprintf(stderr, "dtree-cli: cannot open %s\n", params.input);
+        return 1;
+    }
+    int streamed = fromStdin || !TreeStreamIsFile(in);
+    int inputFormat = streamed ? TREE_FORMAT_TEXT : TreeStreamFormat(in);
+    if(inputFormat == TREE_FORMAT_ERROR)
+    {
+        fprintf(stderr, "dtree-cli: cannot rewind %s\n", params.input);
+        if(!fromStdin)
+        {
+            fclose(in);
+        }
+        return 1;
+    }
+
+    CliScan scan;
+    memset(&scan, 0, sizeof(scan));
+    scan.params = &params;
+    scan.lastDepth = -1;
+    if(params.path && !SplitPath(params.path, &scan.path))
+    {
+        fprintf(stderr, "dtree-cli: out of memory\n");
+        return 1;
+    }
+
+    FILE* out = NULL;
+    int toStdout = params.output && strcmp(params.output, "-") == 0;
+    if(params.output)
+    {
+        out = toStdout ? stdout : fopen(params.output, "wb");
+        int format = params.format >= 0 ? params.format : toStdout ? TREE_FORMAT_TEXT : FormatOf(params.output);
+        if(!out || !TreeStreamWriterOpen(&scan.writer, out, format, params.threads))
+        {
+            fprintf(stderr, "dtree-cli: cannot write %s\n", params.output);
+            return 1;
+        }
+    }
+
+    TreeScanEvent onNode = strcmp(params.command, "convert") == 0 ? ConvertNode :
+                           strcmp(params.command, "extract") == 0 ? ExtractNode :
+                           strcmp(params.command, "query") == 0 ? QueryNode : StatsNode;
+    int error = TreeScanStream(in, inputFormat, onNode, &scan);
+    uint64_t inputBytes = streamed ? 0 : TreeStreamSize(in);
+    if(!fromStdin)
+    {
+        fclose(in);
+    }
+
+    int status = 0;
+    static const char* errors[] = {"", "is malformed", "could not be read", "needs more memory", "could not be read"};
+    if(error != TREE_PARSE_OK)
+    {
+        fprintf(stderr, "dtree-cli: %s %s\n", params.input, errors[error]);
+        status = 1;
+    }
+    if(scan.failed)
+    {
+        fprintf(stderr, "dtree-cli: out of memory or cannot write\n");
+        status = 1;
+    }
+    if(onNode == ExtractNode && !scan.extracting)
+    {
+        fprintf(stderr, "dtree-cli: no node at %s\n", params.path);
+        status = 1;
+    }
+    if(onNode == StatsNode && !status)
+    {
+        PrintStats(&scan, params.input, inputFormat, inputBytes);
+    }
+
+    if(out)
+    {
+        int written = TreeStreamWriterClose(&scan.writer);
+        written = (toStdout || fclose(out) == 0) && written;
+        if(!written)
+        {
+            fprintf(stderr, "dtree-cli: cannot write %s\n", params.output);
+            status = 1;
+        }
+        if(status && !toStdout)
+        {
+            remove(params.output);
+        }
+    }
+    if(onNode == QueryNode && fflush(stdout) != 0)
+    {
+        status = 1;
+    }
+
+    free(scan.path.buffer);
+    free(scan.path.names);
+    free(scan.trail.text);
+    free(scan.trail.ends);
+    free(scan.escaped);
+    free(scan.perDepth);
+    free(scan.children);
+    return status;
+}
@@ -1,1031 +1,2760 @@
-/*=============================================================================
-*       dtree.c
-*       timwking1
-*       20-Mar 2025
-=============================================================================*/
-#ifndef UNICODE
-#define UNICODE
-#define _UNICODE
-#endif
-
-#include <windows.h>
-#include <commctrl.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
-#pragma comment(lib, "comctl32.lib")
-
-/*=============================================================================
-*   Constants
-=============================================================================*/
-
-#define MAX_LOADSTRING 255
-
-#define WINDOW_WIDTH 800
-#define WINDOW_HEIGHT 600
-
-#define TREEVIEW_WIDTH 250
-#define TREEVIEW_HEIGHT 600
-
-#define IDM_NEW 101
-#define IDM_OPEN 102
-#define IDM_SAVE 103
-#define IDM_EXIT 104
-#define IDM_ABOUT 105
-
-#define ID_TREEVIEW 201
-#define ID_EDIT_NAME 202
-#define ID_EDIT_DESCRIPTION 203
-
-/*=============================================================================
-*   Struct Definitions
-=============================================================================*/
-
-typedef struct _TreeNodeData 
-{
-    wchar_t name[MAX_LOADSTRING];
-    wchar_t description[MAX_LOADSTRING];
-} TreeNodeData;
-
-/*=============================================================================
-*   Global Declarations
-=============================================================================*/
-
-HINSTANCE hMainInstance;
-HWND hMainWindow;
-HWND hTreeView;
-HWND hNameEditWindow;
-HWND hDescEditWindow;
-
-HTREEITEM hSelectedItem;
-TreeNodeData* hSelectedItemData;
-
-wchar_t g_szFileName[MAX_PATH] = L"";
-
-/*=============================================================================
-*   Declarations
-=============================================================================*/
-
-LRESULT CALLBACK WindowProc(HWND, UINT, WPARAM, LPARAM);
-void InitializeUI(HWND hwnd);
-void AddItemToTree(HWND hTreeView, HTREEITEM hParent, TreeNodeData* data);
-void SaveTreeToFile(HWND hTreeView, const wchar_t* fileName);
-void LoadTreeFromFile(HWND hTreeView, const wchar_t* fileName);
-
-void OnSelectionChanged(LPARAM);
-void UpdateEditFields();
-void SaveFieldsToSelectedItem();
-void UpdateTreeViewText();
-
-void DeleteItem(HTREEITEM);
-void RecursiveDeleteItem(HTREEITEM);
-void DeleteTree(HWND);
-
-void InsertTreeViewData(HWND, HTREEITEM, TreeNodeData*);
-HTREEITEM RecursiveSaveTree(HWND, HTREEITEM, FILE*, int);
-HTREEITEM RecursiveLoadTree(HWND , HTREEITEM, FILE*, int);
-void CreateNewItem(HWND, HTREEITEM, wchar_t*, wchar_t*);
-
-/*=============================================================================
-*   WinMain 
-*       The entry point of a win32 application
-*       ***gcc REQUIRES the -mwindows flag to recognize this as the entry point!***
-=============================================================================*/
-int FAR PASCAL WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevious, WCHAR *lpCmdLine, int nCmdShow)
-{
-    /*
-    *   Initialize the instance handle reference and the common controls
-    *   used in the window procedure.
-    */
-    hMainInstance = hInstance;
-    INITCOMMONCONTROLSEX icex;
-    icex.dwSize = sizeof(INITCOMMONCONTROLSEX);
-    icex.dwICC = ICC_TREEVIEW_CLASSES;
-    InitCommonControlsEx(&icex);
-    
-    //Initialize the Window class
-    WNDCLASSEX wc;
-    wc.cbSize = sizeof(WNDCLASSEX);                    //class struct size in bytes
-    wc.style = CS_HREDRAW | CS_VREDRAW;                //class style (CS_)
-    wc.lpfnWndProc = WindowProc;                       //long pointer to window procedure function
-    wc.cbClsExtra = 0;                                 //extra bytes to allocate for the class
-    wc.cbWndExtra = 0;                                 //extra bytes to allocate for the window instance
-    wc.hInstance = hInstance;                          //instance handle
-    wc.hIcon = LoadIcon(NULL, IDI_APPLICATION);        //icon (IDI_)
-    wc.hCursor = LoadCursor(NULL, IDC_ARROW);          //curosr (IDC_)
-    wc.hbrBackground = (HBRUSH)(COLOR_WINDOW +1);      //background brush handle
-    wc.lpszMenuName = NULL;                            //resource name of class menu
-    wc.lpszClassName = L"Editor Class";                //class name string
-    wc.hIconSm = LoadIcon(NULL, IDI_APPLICATION);      //small version of the icon (IDI_)
-    
-    /*
-    *   The Window class only needs to be registered once.
-    *   If there is a previous instance handle we do not register the class again.
-    */
-    if (!hPrevious)
-    {
-        //Register the window class we just initialized (wc)
-        if(!RegisterClassEx(&wc))
-        {
-            //This should never happen, but we inform the user and return gracefully in case it does.
-            MessageBox(NULL, L"Window Registration Failed", L"Error", MB_ICONERROR | MB_OK);
-            return 0;
-        }
-    }
-
-    //Initialize the menu bar
-    HMENU hMenu = CreateMenu();
-
-    //Initialize the File submenu
-    HMENU hFileMenu = CreatePopupMenu();
-    AppendMenu(hFileMenu, MF_STRING, IDM_NEW, L"&New");
-    AppendMenu(hFileMenu, MF_STRING, IDM_OPEN, L"&Open...");
-    AppendMenu(hFileMenu, MF_STRING, IDM_SAVE, L"&Save...");
-    AppendMenu(hFileMenu, MF_STRING, IDM_EXIT, L"E&xit");
-
-    //Append the File submenu and about button to the menu bar
-    AppendMenu(hMenu, MF_POPUP, (UINT_PTR)hFileMenu, L"&File");
-    AppendMenu(hMenu, MF_STRING, IDM_ABOUT, L"&About");
-
-    //Initialize the main window
-    hMainWindow = CreateWindowEx
-    (
-        WS_EX_CLIENTEDGE,                              //Extended window style (WS_EX_)
-        L"Editor Class",                               //Class name
-        L"dtree",                                      //Title bar text
-        WS_OVERLAPPEDWINDOW,                           //Window style (WS_)
-        CW_USEDEFAULT, CW_USEDEFAULT,                  //Default X and Y screen position of window
-        WINDOW_WIDTH, WINDOW_HEIGHT,                   //Width and Height of the window
-        NULL,                                          //Parent window (there isn't one, this is the main window)
-        hMenu,                                         //Menu handle
-        hInstance,                                     //Instance Handle
-        NULL                                           //lParam (not used here)
-    );
-
-    if(hMainWindow == NULL)
-    {
-        //Again, this should never happen since we just created hMainWindow, but just in case, inform the user and return gracefully.
-        MessageBox(NULL, L"Window creation failed.", L"Error", MB_ICONERROR | MB_OK);
-        return 0;
-    }
-
-    /*
-    *   Now that the main window handle is set up, we can start initializing 
-    *   the individual ui-element "windows" in our main window
-    *   For organization sake, we do this in the InitializeUI function.
-    */
-    InitializeUI(hMainWindow);
-
-    /*
-    *   Finally, now that the window is fully initialized, we can show it 
-    *   and begin ticking the message loop.
-    */
-    ShowWindow(hMainWindow, nCmdShow);
-    UpdateWindow(hMainWindow);
-    MSG msg;
-    while(GetMessage(&msg, NULL, 0, 0))
-    {
-        TranslateMessage(&msg);
-        DispatchMessage(&msg);
-    }
-    return (int)msg.wParam;
-}
-
-/*=============================================================================
-*   WindowProc [LRESULT]
-*       The win32 window procedure
-=============================================================================*/
-LRESULT CALLBACK WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
-{
-    switch(msg)
-    {
-        //When the Window is created:
-        case WM_CREATE:
-        {
-            //Do nothing... for now...
-            break;
-        }
-        
-        //When the Window is resized:
-        case WM_SIZE:
-        {
-            //lParam holds the new window size x and y as 16-bit WORDs
-            int width = LOWORD(lParam);
-            int height = HIWORD(lParam);
-
-            //If the window height is made shorter or longer, readjust the treeview height.
-            SetWindowPos(hTreeView, NULL, 0, 0, TREEVIEW_WIDTH, height, SWP_NOZORDER);
-
-            //If the window width is made narrower or wider, readjust the editor width.
-            int editLeft = TREEVIEW_WIDTH + 10;
-            int editWidth = width - TREEVIEW_WIDTH - 20;
-            SetWindowPos(hNameEditWindow, NULL, editLeft, 10, editWidth, 25, SWP_NOZORDER);
-            SetWindowPos(hDescEditWindow, NULL, editLeft, 70, editWidth, 100, SWP_NOZORDER);
-        }
-        break;
-
-        //When a Command is sent to the window:
-        case WM_COMMAND:
-        {
-            //wParam for a menu holds 
-            switch(LOWORD(wParam))
-            {
-
-                case IDM_NEW:
-                {
-                    hSelectedItem = NULL;
-                    DeleteTree(hTreeView);
-
-                    UpdateEditFields();
-                    wcscpy(g_szFileName, L"");
-                    break;
-                }
-
-                case IDM_OPEN:
-                {
-                    wchar_t szFile[MAX_PATH] = {0};
-
-                    //Initialize an OPENFILENAME struct to be used by GetOpenFileName
-                    OPENFILENAME ofn = {0};
-                    ofn.lStructSize = sizeof(OPENFILENAME);
-                    ofn.hwndOwner = hWnd;
-                    ofn.lpstrFile = szFile;
-                    ofn.nMaxFile = MAX_PATH;
-                    ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST;
-
-                    //Display an open file dialog
-                    if (GetOpenFileName(&ofn))
-                    {
-                        wcscpy(g_szFileName, szFile);
-                        //Clear the treeview
-                        hSelectedItem = NULL;
-                        DeleteTree(hTreeView);
-
-                        //Load the file data into the treeview from the given path
-                        LoadTreeFromFile(hTreeView, szFile);
-                    }
-                    break;
-                }
-
-                case IDM_SAVE:
-                {
-                    wchar_t szFile[MAX_PATH] = {0};
-
-                    //If this is a new file with no name globally defined
-                    if(g_szFileName[0] == '\0')
-                    {
-                        //Initialize an OPENFILENAME struct to be used by GetSaveFileName
-                        OPENFILENAME ofn = {0};
-                        wcscpy(szFile, L"untitled.dat");
-                        ofn.lStructSize = sizeof(OPENFILENAME);
-                        ofn.hwndOwner = hWnd;
-                        ofn.lpstrFile = szFile;
-                        ofn.nMaxFile = MAX_PATH;
-                        ofn.Flags = OFN_OVERWRITEPROMPT;
-
-                        //Dispaly a save file dialog
-                        if(GetSaveFileName(&ofn))
-                        {
-                            wcscpy(g_szFileName, szFile);
-                            //Save our data
-                            SaveTreeToFile(hTreeView, szFile);
-                        }
-                    }
-                    else
-                    {
-                        //Simply save the data if we're editing an open file
-                        SaveTreeToFile(hTreeView, g_szFileName);
-                    }
-                }
-                break;
-
-                case IDM_EXIT:
-                {
-                    DestroyWindow(hWnd);
-                    break;
-                }
-
-                case IDM_ABOUT:
-                {
-                    //Show an about dialog
-                    MessageBox(hWnd, L"dtree", L"About", MB_OK | MB_ICONINFORMATION);
-                    break;
-                }
-
-                // Handle edit control changes
-                case ID_EDIT_NAME:
-                {
-                    if(HIWORD(wParam) == EN_CHANGE && hSelectedItem != NULL)
-                    {
-                        UpdateTreeViewText();
-                    }
-                    break;
-                }
-                case ID_EDIT_DESCRIPTION:
-                {
-                    if (HIWORD(wParam) == EN_CHANGE && hSelectedItem != NULL)
-                    {
-                        //OnItemChanges(hTreeView, hSelectedItem);
-                    }
-                    break;
-                }
-            }
-            break;
-        }
-
-        //Called on special window events
-        case WM_NOTIFY:
-        {
-            NMHDR* pnmhdr = (NMHDR*)lParam;
-            if(pnmhdr->idFrom == ID_TREEVIEW)
-            {
-                switch(pnmhdr->code)
-                {
-                    //When the selection of our treeview is changed:
-                    case TVN_SELCHANGED:
-                    {
-                        OnSelectionChanged(lParam);
-                        UpdateEditFields(hTreeView);
-                    }
-                    break;
-
-                    //When the mouse right clicks our tree view
-                    case NM_RCLICK:
-                    {
-                        POINT pt;
-                        GetCursorPos(&pt);
-
-                        HMENU hPopupMenu = CreatePopupMenu();
-                        AppendMenu(hPopupMenu, MF_STRING, 1001, L"Add Child Item");
-                        AppendMenu(hPopupMenu, MF_STRING, 1002, L"Delete Item");
-
-                        //Create a popup menu at the mouse position
-                        int cmd = TrackPopupMenu(hPopupMenu, TPM_RETURNCMD | TPM_LEFTBUTTON, pt.x, pt.y, 0, hWnd, NULL);
-                        DestroyMenu(hPopupMenu);
-
-                        switch(cmd)
-                        {
-                            //Create an item:
-                            case 1001:
-                            {
-                                CreateNewItem(hTreeView, hSelectedItem, L"New Item", L"Description");
-                                UpdateWindow(hWnd);
-                                break;
-                            }
-                            //Delete an item:
-                            case 1002:
-                            {
-                                //Only if something is selected
-                                if(hSelectedItem != NULL)
-                                {
-                                    RecursiveDeleteItem(hSelectedItem);
-                                    hSelectedItem = NULL;
-                                    hSelectedItemData = NULL;
-                                    //Clear the contents of the editor
-                                    UpdateEditFields();
-                                }
-                                break;
-                            }
-                        }
-                    }
-                    break;
-                }
-            }
-        }
-        break;
-        //Called on DestroyWindow(hWnd)
-        case WM_DESTROY:
-        {
-            //Request that the system terminate the application thread
-            PostQuitMessage(0);
-            break;
-        }
-        default:
-        {
-            //return the default window procedure
-            return DefWindowProc(hWnd, msg, wParam, lParam);
-        }
-    }
-    return 0;
-}
-
-/*=============================================================================
-*   InitializeUI [void]
-*       Construct/Create the "windows" for each of our individual UI elements
-*
-*       Parameters:
-*           HWND hWnd - The main window handle that will be used as the parent for the ui elements
-*
-=============================================================================*/
-void InitializeUI(HWND hWnd)
-{
-    //Create the Tree View box
-    hTreeView = CreateWindowEx
-    (
-        WS_EX_CLIENTEDGE,
-        WC_TREEVIEW,
-        L"",
-        WS_VISIBLE | WS_CHILD | WS_BORDER | TVS_HASLINES | TVS_LINESATROOT | TVS_HASBUTTONS | TVS_SHOWSELALWAYS,
-        0,
-        0,
-        TREEVIEW_WIDTH,
-        0,
-        hWnd,
-        (HMENU)ID_TREEVIEW,
-        hMainInstance,
-        NULL
-    );
-
-    //Create the Name TextBlock
-    HWND hNameLabel = CreateWindow
-    (
-        L"STATIC", 
-        L"Name:",
-        WS_VISIBLE | WS_CHILD,
-        TREEVIEW_WIDTH + 10, 10,
-        100, 20,
-        hWnd,
-        NULL,
-        hMainInstance,
-        NULL
-    );
-
-    //Create the Description TextBlock
-    HWND hDescLabel = CreateWindow
-    (
-        L"STATIC", 
-        L"Description:",
-        WS_VISIBLE | WS_CHILD,
-        TREEVIEW_WIDTH + 10, 50,
-        100, 20,
-        hWnd,
-        NULL,
-        hMainInstance,
-        NULL
-    );
-
-    //Create the Name editor TextBox
-    hNameEditWindow = CreateWindowEx
-    (
-        WS_EX_CLIENTEDGE,
-        L"EDIT",
-        L"",
-        WS_VISIBLE | WS_CHILD | WS_BORDER | ES_AUTOHSCROLL,
-        TREEVIEW_WIDTH + 10, 30,
-        300, 25,
-        hWnd,
-        (HMENU)ID_EDIT_NAME, 
-        hMainInstance,
-        NULL
-    );
-
-    //Create the Description editor TextBox
-    hDescEditWindow = CreateWindowEx
-    (
-        WS_EX_CLIENTEDGE,
-        L"EDIT",
-        L"",
-        WS_VISIBLE | WS_CHILD | WS_BORDER | ES_MULTILINE | ES_AUTOVSCROLL | WS_VSCROLL,
-        TREEVIEW_WIDTH + 10, 70,
-        300, 100,
-        hWnd,
-        (HMENU)ID_EDIT_DESCRIPTION,
-        hMainInstance,
-        NULL
-    );
-
-    //Construct a new root node and copy it's data to the Tree View
-    CreateNewItem(hTreeView, NULL, L"Root", L"This is the root node!");
-}
-
-/*=============================================================================
-*   AddItemToTree [void]
-*       Add an item to a TreeView using a TreeView insert struct
-*
-*       Parameters:
-*           HWND hTreeView - Handle to the treeview window control
-*           HTREEITEM hParent - Handle to the new item's parent in the tree hierarchy
-*           TreeNodeData* - Pointer to TreeNodeData to be associated with the new item
-*
-=============================================================================*/
-void AddItemToTree(HWND hTreeView, HTREEITEM hParent, TreeNodeData* data)
-{
-    //Validate data input
-    if(!data)
-    {
-        MessageBox(NULL, L"Invalid data!", L"Oops", MB_OK);
-        return;
-    }
-
-    TVINSERTSTRUCT tvins;
-    ZeroMemory(&tvins, sizeof(tvins));
-    tvins.hParent = hParent;
-    tvins.hInsertAfter = TVI_LAST;
-    tvins.item.mask = TVIF_TEXT | TVIF_PARAM;
-    tvins.item.pszText = (LPWSTR)data->name;
-    tvins.item.lParam = (LPARAM)data;
-    HTREEITEM hItem = TreeView_InsertItem(hTreeView, &tvins);
-    
-    if(hParent != NULL)
-    {
-        TreeView_Expand(hTreeView, hParent, TVE_EXPAND);
-    }
-}
-
-/*=============================================================================
-*   CreateNewItem [void]
-*       Create and add a completely new item to the TreeView
-*
-*       Parameters:
-*           HWND hTreeView - Handle to the treeview window control
-*           HTREEITEM hParent - Handle to the new item's parent in the tree hierarchy
-*
-=============================================================================*/
-void CreateNewItem(HWND hTreeView, HTREEITEM hParent, wchar_t* name, wchar_t* description)
-{
-    //Allocate memory for the new TreeNodeData
-    TreeNodeData* data = (TreeNodeData*)malloc(sizeof(TreeNodeData));
-    //Set the default values
-    wcscpy(data->name, name);
-    wcscpy(data->description, description);
-    AddItemToTree(hTreeView, hSelectedItem, data);
-}
-
-/*=============================================================================
-*   OnSelectionChanged [void]
-*       Saves data from the editor for the previously selected item,
-*       then selects a new item and sets global values for the newly selected
-*       item and it's data.
-*
-*       Parameters:
-*           LPARAM lParam - pointer to the new item selection
-*
-=============================================================================*/
-void OnSelectionChanged(LPARAM lParam)
-{
-    //Check if a previous item was selected
-    if(hSelectedItem && hSelectedItemData)
-    {
-        //Copy the editor values of the previous selection to their correct locaton
-        SaveFieldsToSelectedItem();
-        //Ensure name is updated in treeview
-        UpdateTreeViewText();
-    }
-
-    //Select the item given by lParam
-    NMTREEVIEW* pnmtv = (NMTREEVIEW*)lParam;
-    hSelectedItem = pnmtv->itemNew.hItem;
-    hSelectedItemData = (TreeNodeData*)pnmtv->itemNew.lParam;
-}
-
-/*=============================================================================
-*   SaveFieldsToSelectedItem [void]
-*       Uses GetWindowText to copy data from the editor fields into the global
-*       handle of the selected item
-=============================================================================*/
-void SaveFieldsToSelectedItem()
-{
-    //Copy the editor values of the previous selection to their correct locaton
-    GetWindowText(hNameEditWindow, hSelectedItemData->name, MAX_LOADSTRING);
-    GetWindowText(hDescEditWindow, hSelectedItemData->description, MAX_LOADSTRING);
-}
-
-/*=============================================================================
-*   UpdateTreeViewText [void]
-*       Reflects changes of the hSelectedItem name onto the Treeview
-=============================================================================*/
-void UpdateTreeViewText()
-{
-    TVITEMW item = {0};
-    item.mask = TVIF_TEXT;
-    item.hItem = hSelectedItem;
-    wchar_t buffer[MAX_LOADSTRING] = {0};
-    GetWindowText(hNameEditWindow, buffer, MAX_LOADSTRING);
-    item.pszText = buffer;
-    item.cchTextMax = MAX_LOADSTRING;
-    TreeView_SetItem(hTreeView, &item);
-}
-
-/*=============================================================================
-*   DeleteItem [void]
-*       Removes a handle to a tree item from the treeview and frees the memory
-*       occupied by it's TreeNodeData
-*
-*       Parameters:
-*           HTREEITEM hItemToDelete - Handle of the item we are removing
-*
-*       ***WILL NOT DELETE CHILD NODES!!! USE RecursiveDeleteItem INSTEAD***
-=============================================================================*/
-void DeleteItem(HTREEITEM hItemToDelete)
-{
-    //Get pointer to the selected item data
-    TVITEMW item = {0};
-    item.mask = TVIF_TEXT | TVIF_PARAM;
-    item.hItem = hItemToDelete;
-
-    if(TreeView_GetItem(hTreeView, &item))
-    {
-        TreeNodeData* data = (TreeNodeData*)item.lParam;
-        if(data)
-        {
-            //Free the TreeNodeData malloc'ed in CreateNewItem()
-            free(data);
-        }
-        else
-        {
-            MessageBox(NULL, 
-                L"Could not free pointer to TreeNodeData!", 
-                L"Error", 
-                MB_OK);
-        }
-    }
-    //Remove it from the tree view
-    TreeView_DeleteItem(hTreeView, hItemToDelete);
-}
-
-/*=============================================================================
-*   RecursiveDeleteItem [void]
-*       Iterates through children of a given node, removes them,
-*       and then remvoes the node itself.
-*
-*       Parameters:
-*           HTREEITEM hItemToDelete - Handle of the item we are removing
-*
-=============================================================================*/
-void RecursiveDeleteItem(HTREEITEM hItemToDelete)
-{
-    //Check for the selected item and set it to null to prevent segfault
-    if(hItemToDelete == hSelectedItem)
-    {
-        hSelectedItem = NULL;
-        hSelectedItemData = NULL;
-    }
-    HTREEITEM hChild = TreeView_GetChild(hTreeView, hItemToDelete);
-    while(hChild)
-    {
-        HTREEITEM hNextChild = TreeView_GetNextSibling(hTreeView, hChild);
-        RecursiveDeleteItem(hChild);
-        hChild = hNextChild;
-    }
-    DeleteItem(hItemToDelete);
-}
-
-/*=============================================================================
-*   DeleteTree [void]
-*       Iterates through the treeview and frees heap allocated structs
-*       that are pointed to by the lParam values of each item
-*       Then calls TreeView_DeleteAllItems() macro to clear the treeview list
-*
-*       Parameters:
-*           HWND - The treeview we want to dismantle
-*
-=============================================================================*/
-void DeleteTree(HWND hTreeViewToDelete)
-{
-    HTREEITEM hRoot = TreeView_GetRoot(hTreeView);
-    while(hRoot)
-    {
-        HTREEITEM hNextRoot = TreeView_GetNextSibling(hTreeView, hRoot);
-        RecursiveDeleteItem(hRoot);
-        hRoot = hNextRoot;
-    }
-
-}
-
-/*=============================================================================
-*   UpdateEditFields [void]
-*       Used to copy the contents TreeItem to the editor controls
-*
-*       Parameters:
-*           HWND hTreeView - Handle to the TreeView window control
-*           HTREEITEM hItem - Handle to the TreeItem we are copying content from 
-*
-=============================================================================*/
-void UpdateEditFields()
-{
-    //Blank out the fields if no item is selected
-    if (hSelectedItem == NULL)
-    {
-        SetWindowText(hNameEditWindow, L"");
-        SetWindowText(hDescEditWindow, L"");
-        return;
-    }
-
-    TVITEMW item = {0};
-    item.mask  = TVIF_TEXT | TVIF_PARAM;
-    item.hItem = hSelectedItem;
-
-    if (!TreeView_GetItem(hTreeView, &item)) 
-    {
-        MessageBox(NULL, L"Couldn't get item!", L"Error", MB_OK);
-        return;
-    }
-
-    if (!hSelectedItemData) 
-    {
-        MessageBox(NULL, L"Couldn't get data!", L"Error", MB_OK);
-        return;
-    }
-
-    SetWindowText(hNameEditWindow, hSelectedItemData->name);
-    SetWindowText(hDescEditWindow, hSelectedItemData->description);
-}
-
-/*=============================================================================
-*   InsertTreeViewData [void]
-*       Inserts given treeviewdata into a given tree item lParam
-*
-*       Parameters:
-*           HWND hTreeView - Handle to the TreeView window control
-*           HTREEITEM hItem - Handle to the TreeItem we are saving data into
-*           TreeViewData data - The data we want to insert
-*
-=============================================================================*/
-void InsertTreeViewData(HWND hTreeView, HTREEITEM hItem, TreeNodeData* data)
-{
-    if(!hTreeView || !hItem)
-    {
-        return;
-    }
-
-    //Declare and init a new TVITEM
-    TVITEMW item = {0};
-    item.mask = TVIF_TEXT | TVIF_PARAM;
-    item.hItem = hItem;
-    item.lParam = (LPARAM)data;
-    item.pszText = data->name;
-    TreeView_SetItem(hTreeView, &item);
-}
-
-/*=============================================================================
-*   RecursiveSaveTree [HTREEITEM]
-*
-*       Parameters:
-*           HWND hTreeView - The TreeView that is to be saved
-*           HTREEITEM hItem - The root item we save from
-*           FILE* file - Pointer to file stream
-*           int level - How far into the hierarchy we are when this is called
-*
-=============================================================================*/
-HTREEITEM RecursiveSaveTree(HWND hTreeView, HTREEITEM hItem, FILE* file, int level)
-{
-    wchar_t escapedDesc[MAX_LOADSTRING * 2];
-    int j=0;
-
-    //End the recursion when we have iterated through the entire tree
-    if (hItem == NULL)
-    {
-        return NULL;
-    }
-
-    TVITEMA item = {0};
-    item.mask = TVIF_PARAM;
-    item.hItem = hItem;
-    
-    if (TreeView_GetItem(hTreeView, &item))
-    {
-        TreeNodeData* data = (TreeNodeData*)item.lParam;
-        if(data)
-        {
-            //Write the Tree to the file using fprintf and the provided ptr to file handle
-            for(int i = 0; i < level; i++)
-            {
-                //Tab indent to our level
-                fwprintf(file, L"\t");
-            }
-            //Name, then newline
-            fwprintf(file, L"%s\n", data->name);
-            
-            for(int i=0; i< level; i++)
-            {
-                //Tab indent to our level again
-                fwprintf(file, L"\t");
-            }
-            //Open bracket
-            fwprintf(file, L"{\n");
-
-            for(int i=0; i < level + 1; i++)
-            {
-                //Tab indent to our new level again
-                fwprintf(file, L"\t");
-            }
-
-            for(int i = 0; i< wcslen(data->description); i++)
-            {
-                if(data->description[i] == '\n')
-                {
-                    escapedDesc[j++] = '\\';
-                    escapedDesc[j++] = 'n';
-                }
-                else
-                {
-                    escapedDesc[j++] = data->description[i];
-                }
-                escapedDesc[j] = '\0';
-            }
-
-            fwprintf(file, L"%s\n", escapedDesc);
-
-            //Iterate through the children of each item
-            HTREEITEM hChild = TreeView_GetChild(hTreeView, hItem);
-            while(hChild != NULL)
-            {
-                hChild = RecursiveSaveTree(hTreeView, hChild, file, level+1);
-            }
-            for(int i=0; i< level; i++)
-            {
-                fwprintf(file, L"\t");
-            }
-            fwprintf(file, L"}\n");
-        }
-    }
-
-    //Will either return another root node or return NULL when we are finished saving
-    return TreeView_GetNextSibling(hTreeView, hItem);
-}
-
-/*=============================================================================
-*   SaveTreeToFile [void]
-*       Starts tthe RecursiveSaveTree procedure and checks when it is finished
-*       (when it returns NULL, it is done iterating)
-*
-*       Parameters:
-*           HWND hTreeView - The Tree we want to pass on to RecursiveSaveTree
-*           char* fileName - FileName used to construct a FILE handle
-*
-=============================================================================*/
-void SaveTreeToFile(HWND hTreeView, const wchar_t* fileName)
-{
-    FILE* file = _wfopen(fileName, L"w");
-    if(file)
-    {
-        HTREEITEM hRoot = TreeView_GetRoot(hTreeView);
-        while(hRoot != NULL)
-        {
-            hRoot = RecursiveSaveTree(hTreeView, hRoot, file, 0);
-        }
-        fclose(file);
-        MessageBox(hMainWindow, L"Tree saved successfully", L"Save", MB_OK | MB_ICONINFORMATION);
-    }
-    else
-    {
-        MessageBox(hMainWindow, L"Failed to save tree", L"Error", MB_OK | MB_ICONERROR);
-    }
-}
-
-/*=============================================================================
-*   ParseLine [void]
-*
-*       Parameters:
-*           char* line - Input line with escape sequence
-*           char* output - Processed line with correct newline chars
-*
-=============================================================================*/
-void ParseLine(wchar_t* line, wchar_t* output)
-{
-    int j = 0;
-    //Iterate each character
-    for(int i=0; i<wcslen(line); i++)
-    {
-        //Find escape sequence
-        if(line[i] == '\\' && line[i+1] == 'n')
-        {
-            //Output a newline character
-            output[j++] = '\n';
-            i++;
-        }
-        else
-        {
-            //copy directly to output if no escape sequence found
-            output[j++] = line[i];
-        }
-        //Terminate the output string with \0
-        output[j]='\0';
-    }
-}
-
-/*=============================================================================
-*   LoadTreeFromFile [void]
-*
-*       Parameters:
-*           HWND hTreeView - The TreeView we are going to load data into
-*           char* fileName - The open file name we received from the dialog
-*
-=============================================================================*/
-void LoadTreeFromFile(HWND hTreeView, const wchar_t* fileName)
-{
-    FILE* file = _wfopen(fileName, L"r");
-    if(file)
-    {
-        hSelectedItem = NULL;
-        DeleteTree(hTreeView);
-
-        wchar_t line[MAX_LOADSTRING * 2];
-        if(fgetws(line, sizeof(line), file))
-        {
-            line[wcscspn(line, L"\r\n")] = 0;
-
-            TreeNodeData* rootData = (TreeNodeData*)malloc(sizeof(TreeNodeData));
-            wcscpy(rootData->name, line);
-            
-            fgetws(line, sizeof(line), file);
-            fgetws(line, sizeof(line), file);
-            line[wcscspn(line, L"\r\n")] = 0;
-
-            ParseLine(line, rootData->description);
-
-            TVINSERTSTRUCT tvis;
-            tvis.hParent = NULL;
-            tvis.hInsertAfter = TVI_LAST;
-            tvis.item.mask = TVIF_TEXT | TVIF_PARAM;
-            tvis.item.pszText = rootData->name;
-            tvis.item.lParam = (LPARAM)rootData;
-            HTREEITEM hRoot = TreeView_InsertItem(hTreeView, &tvis);
-
-            TreeView_Expand(hTreeView, hRoot, TVE_EXPAND);
-            //Load children
-            RecursiveLoadTree(hTreeView, hRoot, file, 1);
-        }
-        fclose(file);
-    }
-    else
-    {
-        //Inform the user if for some reason loading fails.
-        MessageBox(hMainWindow, L"Failed to open file", L"Error", MB_OK | MB_ICONERROR);
-    }
-}
-
-/*=============================================================================
-*   RecursiveLoadTree [HTREEITEM]
-*
-*       Parameters:
-*           HWND hTreeView - The TreeView we are going to load data into
-*           HTREEITEM hItem - The current item being loaded
-*           FILE* file - Pointer to file stream
-*           int level - How far into the hierarchy we are when this is called
-*
-=============================================================================*/
-HTREEITEM RecursiveLoadTree(HWND hTreeView, HTREEITEM hParent, FILE* file, int level)
-{
-    wchar_t line[MAX_LOADSTRING * 2];
-    wchar_t indent[MAX_LOADSTRING];
-
-    //Create tab indents for whatever the current level is
-    for(int i=0; i< level; i++)
-    {
-        indent[i] = '\t';
-    }
-    indent[level] = '\0';
-
-    while(fgetws(line, sizeof(line), file))
-    {
-        line[wcscspn(line, L"\r\n")] = 0;
-
-        //check if this is the closing brace for our level
-        wchar_t closingBrace[MAX_LOADSTRING];
-        swprintf(closingBrace, MAX_LOADSTRING, L"%s}", indent);
-        closingBrace[level] = '}';
-        closingBrace[level + 1] = '\0';
-        if(wcscmp(line, closingBrace) == 0)
-        {
-            //End of the current level
-            return NULL;
-        }
-
-        //check if this is the node at our level
-        if(wcsncmp(line, indent, level) == 0 && line[level] != '\t' && line[level] != '{')
-        {
-            //Child Node
-            wchar_t* nodeName = &line[level];
-
-            //Skip the opening brace line
-            fgetws(line, sizeof(line), file);
-
-            //Load description
-            fgetws(line, sizeof(line), file);
-            line[wcscspn(line, L"\r\n")] = 0;
-
-            //Create a new TreeNodeData and copy the loaded line to it
-            TreeNodeData* nodeData = (TreeNodeData*)malloc(sizeof(TreeNodeData));
-            wcscpy(nodeData->name, nodeName);
-            
-            //Parse the description, skipping the indentation
-            ParseLine(&line[level + 1], nodeData->description);
-
-            //Add to TreeView
-            TVINSERTSTRUCTW tvis;
-            tvis.hParent = hParent;
-            tvis.hInsertAfter = TVI_LAST;
-            tvis.item.mask = TVIF_TEXT | TVIF_PARAM;
-            tvis.item.pszText = nodeData->name;
-            tvis.item.lParam = (LPARAM)nodeData;
-            HTREEITEM hItem = TreeView_InsertItem(hTreeView, &tvis);
-
-            //Continue loading children
-            RecursiveLoadTree(hTreeView, hItem, file, level + 1);
-        }
-    }
-    
-    return NULL;
-}
\ No newline at end of file
+/*=============================================================================
+*       dtree.c
+*       timwking1
+*       20-Mar 2025
+=============================================================================*/
+#ifndef UNICODE
+#define UNICODE
+#define _UNICODE
+#endif
+
+#include <windows.h>
+#include <commctrl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree.h"
+
+#pragma comment(lib, "comctl32.lib")
+
+/*=============================================================================
+*   Constants
+=============================================================================*/
+
+#define WINDOW_WIDTH 800
+#define WINDOW_HEIGHT 600
+
+#define TREEVIEW_WIDTH 250
+#define TREEVIEW_HEIGHT 600
+
+#define IDM_NEW 101
+#define IDM_OPEN 102
+#define IDM_SAVE 103
+#define IDM_EXIT 104
+#define IDM_STATS 105
+#define IDM_SAVEAS 106
+#define IDM_FIND 107
+#define IDM_FINDNEXT 108
+#define IDM_UNDO 109
+#define IDM_REDO 110
+#define IDM_CANCELOPEN 111
+#define IDM_MOVEUP 112
+#define IDM_MOVEDOWN 113
+#define IDM_MOVEOUT 114
+#define IDM_MOVEIN 115
+#define IDM_COMPARE 116
+#define IDM_MERGE 117
+
+#define ID_TREEVIEW 201
+#define ID_EDIT_NAME 202
+#define ID_EDIT_DESCRIPTION 203
+
+#define ID_AUTOSAVE_TIMER 301
+#define ID_LOAD_TIMER 302
+
+//How often an edited document with a file name is saved on its own, in ms
+#define AUTOSAVE_INTERVAL 60000
+
+//How often nodes parsed by an open in the background are shown, and for
+//how long at most each time, in ms
+#define LOAD_TICK 15
+#define LOAD_SLICE_MS 25
+
+//Nodes added between checks of the clock while showing them
+#define LOAD_APPLY_NODES 2048
+
+//Posted by the save thread when it is done
+#define WM_APP_SAVED (WM_APP + 1)
+
+//Longest text the Find dialog takes, and most matches it steps through
+#define FIND_TEXT_LENGTH 256
+#define FIND_MAX_RESULTS 10000
+
+//File dialog filter; the index of each entry is its TREE_FORMAT_* plus one
+#define FILE_FILTER L"Tree text (*.dat)\0*.dat\0Binary tree (*.dtb)\0*.dtb\0Compressed tree (*.dtz)\0*.dtz\0All files (*.*)\0*.*\0"
+
+/*=============================================================================
+*   Global Declarations
+=============================================================================*/
+
+HINSTANCE hMainInstance;
+HWND hMainWindow;
+HWND hTreeView;
+HWND hNameEditWindow;
+HWND hDescEditWindow;
+
+HTREEITEM hSelectedItem;
+TreeNodeId g_selectedNode = TREE_NIL;
+
+//Node being dragged to another place, TREE_NIL while nothing is
+TreeNodeId g_dragNode = TREE_NIL;
+
+//The document itself; the TreeView only mirrors it
+TreeModel g_tree;
+
+//TreeView items of the nodes shown so far, children appear on first expand
+TreeMirror g_mirror;
+
+//Worker threads used when saving, and decoding compressed files, 0 for one per processor
+int g_ioThreads = 0;
+
+wchar_t g_szFileName[MAX_PATH] = L"";
+
+//The TREE_FORMAT_* g_szFileName is written in
+int g_fileFormat = TREE_FORMAT_TEXT;
+
+//Edits since the file was opened or last written in full, and that file
+TreeJournal g_journal;
+wchar_t g_journalBase[MAX_PATH] = L"";
+
+//Appended to a file name for the name of its edit journal
+#define JOURNAL_SUFFIX L".jnl"
+
+//Appended to a file name for the file a full save writes before it is renamed over it
+#define TEMP_SUFFIX L".tmp"
+
+//Offered for the counters written by the Statistics box
+#define STATS_FILTER L"JSON (*.json)\0*.json\0All files (*.*)\0*.*\0"
+
+//Edits made to the document so far, and how many of them are on disk
+unsigned g_edits = 0;
+unsigned g_savedEdits = 0;
+
+/*
+*   Subtree hashes of the document, and the root's hash when it was last
+*   read or written, so edits that cancel out do not count as changes
+*/
+TreeHashCache g_hashes;
+uint64_t g_savedHash = 0;
+BOOL g_savedHashValid = FALSE;
+
+/*
+*   A full save in flight. The save thread writes a snapshot of the model
+*   while the UI thread goes on editing g_tree.
+*/
+typedef struct _SaveJob
+{
+    TreeThread thread;
+    TreeModel snapshot;
+    wchar_t fileName[MAX_PATH];
+    int format;
+    BOOL quiet;             //autosave, report failure in the title bar only
+    unsigned edits;         //g_edits when the snapshot was taken
+    uint64_t hash;          //root hash of the snapshot
+    BOOL hashed;            //hash is known
+    unsigned serial;        //sent along with its WM_APP_SAVED
+    uint64_t size;          //written by the thread
+    double seconds;         //written by the thread, time to write the file
+    int saved;              //written by the thread
+} SaveJob;
+
+SaveJob g_save;
+BOOL g_saving = FALSE;
+
+//A save asked for while another was in flight, started when that one is done
+BOOL g_saveQueued = FALSE;
+BOOL g_queuedRewrite = FALSE;
+BOOL g_queuedQuiet = TRUE;
+
+//Search over the document, built the first time it is used and kept up to date after
+TreeIndex g_index;
+TreePathIndex g_paths;
+
+//Edits that can be undone and redone
+TreeHistory g_history;
+
+//A text file being opened in the background, the size of that file and when it began
+TreeLoader* g_loader = NULL;
+uint64_t g_loadSize = 0;
+double g_loadStarted = 0;
+
+//Where time and memory went this session, see ShowStats
+TreeStats g_stats;
+
+//The modeless Find dialog, and the message it reports through
+HWND hFindDialog = NULL;
+UINT g_findMessage = 0;
+FINDREPLACE g_find;
+wchar_t g_findText[FIND_TEXT_LENGTH] = L"";
+
+//Matches of g_foundText as of g_findEdits, and the one Find Next goes to
+TreeNodeId* g_findResults = NULL;
+size_t g_findCount = 0;
+size_t g_findNext = 0;
+wchar_t g_foundText[FIND_TEXT_LENGTH] = L"";
+unsigned g_findEdits = 0;
+
+/*=============================================================================
+*   Declarations
+=============================================================================*/
+
+LRESULT CALLBACK WindowProc(HWND, UINT, WPARAM, LPARAM);
+void InitializeUI(HWND hwnd);
+HTREEITEM AddItemToTree(HWND hTreeView, HTREEITEM hParent, HTREEITEM hInsertAfter, TreeNodeId node);
+void* InsertViewItem(void* context, void* parent, void* after, TreeNodeId node);
+void MirrorTreeToView(HWND hTreeView);
+void SaveTreeToFile(HWND hTreeView, const wchar_t* fileName, BOOL rewrite, BOOL quiet);
+void SaveThread(void* arg);
+void FinishSave();
+void WaitForSave();
+void SetTitleStatus(const wchar_t* status);
+void ShowFindDialog(HWND hWnd);
+void FindNextItem();
+void LoadTreeFromFile(HWND hTreeView, const wchar_t* fileName);
+void LoadedNode(void* context, TreeNodeId node);
+void LoadTick();
+int StopLoad(BOOL cancel);
+void FinishLoad(BOOL cancel);
+BOOL JournalPathFor(const wchar_t* fileName, wchar_t* journalPath);
+BOOL AttachJournal(const wchar_t* fileName, uint64_t baseSize);
+void DetachJournal();
+BOOL PromptSaveFileName(HWND hWnd);
+BOOL PromptOpenFileName(HWND hWnd, const wchar_t* title, wchar_t* fileName);
+BOOL LoadModelFromFile(TreeModel* tree, const wchar_t* fileName);
+BOOL ResetFindResults();
+BOOL IsDocumentModified();
+void RememberSavedState();
+BOOL ConfirmDiscard(HWND hWnd);
+void CompareWithFile(HWND hWnd);
+void MergeWithFiles(HWND hWnd);
+void ShowStats(HWND hWnd);
+
+void OnSelectionChanged(LPARAM);
+void UpdateEditFields();
+void SaveFieldsToSelectedItem();
+void UpdateTreeViewText();
+
+void DeleteItem(HTREEITEM);
+void MoveItem(TreeNodeId node, TreeNodeId parent, TreeNodeId before);
+void MoveSelectedItem(int command);
+void ShowMovedItem(TreeNodeId node);
+HTREEITEM DropTargetAt(LPARAM lParam);
+void EndDrag(BOOL drop, LPARAM lParam);
+void DeleteTree(HWND);
+void UndoEdit(BOOL redo);
+void ApplyHistoryChange(const TreeChange* change);
+
+TreeNodeId GetItemNode(HTREEITEM);
+void CreateNewItem(HWND, HTREEITEM, wchar_t*, wchar_t*);
+char* WideToModelText(const wchar_t*, TreeStr*);
+wchar_t* ModelTextToWide(TreeStr);
+wchar_t* GetControlText(HWND);
+
+/*=============================================================================
+*   WinMain 
+*       The entry point of a win32 application
+*       ***gcc REQUIRES the -mwindows flag to recognize this as the entry point!***
+=============================================================================*/
+int FAR PASCAL WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevious, WCHAR *lpCmdLine, int nCmdShow)
+{
+    /*
+    *   Initialize the instance handle reference and the common controls
+    *   used in the window procedure.
+    */
+    hMainInstance = hInstance;
+    if(!TreeInit(&g_tree))
+    {
+        MessageBox(NULL, L"Out of memory", L"Error", MB_ICONERROR | MB_OK);
+        return 0;
+    }
+    INITCOMMONCONTROLSEX icex;
+    icex.dwSize = sizeof(INITCOMMONCONTROLSEX);
+    icex.dwICC = ICC_TREEVIEW_CLASSES;
+    InitCommonControlsEx(&icex);
+    
+    //Initialize the Window class
+    WNDCLASSEX wc;
+    wc.cbSize = sizeof(WNDCLASSEX);                    //class struct size in bytes
+    wc.style = CS_HREDRAW | CS_VREDRAW;                //class style (CS_)
+    wc.lpfnWndProc = WindowProc;                       //long pointer to window procedure function
+    wc.cbClsExtra = 0;                                 //extra bytes to allocate for the class
+    wc.cbWndExtra = 0;                                 //extra bytes to allocate for the window instance
+    wc.hInstance = hInstance;                          //instance handle
+    wc.hIcon = LoadIcon(NULL, IDI_APPLICATION);        //icon (IDI_)
+    wc.hCursor = LoadCursor(NULL, IDC_ARROW);          //curosr (IDC_)
+    wc.hbrBackground = (HBRUSH)(COLOR_WINDOW +1);      //background brush handle
+    wc.lpszMenuName = NULL;                            //resource name of class menu
+    wc.lpszClassName = L"Editor Class";                //class name string
+    wc.hIconSm = LoadIcon(NULL, IDI_APPLICATION);      //small version of the icon (IDI_)
+    
+    /*
+    *   The Window class only needs to be registered once.
+    *   If there is a previous instance handle we do not register the class again.
+    */
+    if (!hPrevious)
+    {
+        //Register the window class we just initialized (wc)
+        if(!RegisterClassEx(&wc))
+        {
+            //This should never happen, but we inform the user and return gracefully in case it does.
+            MessageBox(NULL, L"Window Registration Failed", L"Error", MB_ICONERROR | MB_OK);
+            return 0;
+        }
+    }
+
+    //Initialize the menu bar
+    HMENU hMenu = CreateMenu();
+
+    //Initialize the File submenu
+    HMENU hFileMenu = CreatePopupMenu();
+    AppendMenu(hFileMenu, MF_STRING, IDM_NEW, L"&New");
+    AppendMenu(hFileMenu, MF_STRING, IDM_OPEN, L"&Open...");
+    AppendMenu(hFileMenu, MF_STRING, IDM_SAVE, L"&Save...");
+    AppendMenu(hFileMenu, MF_STRING, IDM_SAVEAS, L"Save &As...");
+    AppendMenu(hFileMenu, MF_STRING, IDM_COMPARE, L"Co&mpare With...");
+    AppendMenu(hFileMenu, MF_STRING, IDM_MERGE, L"Mer&ge With...");
+    AppendMenu(hFileMenu, MF_STRING, IDM_CANCELOPEN, L"&Cancel Open\tEsc");
+    AppendMenu(hFileMenu, MF_STRING, IDM_EXIT, L"E&xit");
+
+    //Initialize the Edit submenu
+    HMENU hEditMenu = CreatePopupMenu();
+    AppendMenu(hEditMenu, MF_STRING, IDM_UNDO, L"&Undo\tCtrl+Z");
+    AppendMenu(hEditMenu, MF_STRING, IDM_REDO, L"&Redo\tCtrl+Y");
+    AppendMenu(hEditMenu, MF_SEPARATOR, 0, NULL);
+    AppendMenu(hEditMenu, MF_STRING, IDM_MOVEUP, L"Move U&p\tAlt+Up");
+    AppendMenu(hEditMenu, MF_STRING, IDM_MOVEDOWN, L"Move &Down\tAlt+Down");
+    AppendMenu(hEditMenu, MF_STRING, IDM_MOVEOUT, L"Move &Out\tAlt+Left");
+    AppendMenu(hEditMenu, MF_STRING, IDM_MOVEIN, L"Move &In\tAlt+Right");
+    AppendMenu(hEditMenu, MF_SEPARATOR, 0, NULL);
+    AppendMenu(hEditMenu, MF_STRING, IDM_FIND, L"&Find...");
+    AppendMenu(hEditMenu, MF_STRING, IDM_FINDNEXT, L"Find &Next");
+
+    //Append the File and Edit submenus and statistics button to the menu bar
+    AppendMenu(hMenu, MF_POPUP, (UINT_PTR)hFileMenu, L"&File");
+    AppendMenu(hMenu, MF_POPUP, (UINT_PTR)hEditMenu, L"&Edit");
+    AppendMenu(hMenu, MF_STRING, IDM_STATS, L"&Statistics");
+
+    //Initialize the main window
+    hMainWindow = CreateWindowEx
+    (
+        WS_EX_CLIENTEDGE,                              //Extended window style (WS_EX_)
+        L"Editor Class",                               //Class name
+        L"dtree",                                      //Title bar text
+        WS_OVERLAPPEDWINDOW,                           //Window style (WS_)
+        CW_USEDEFAULT, CW_USEDEFAULT,                  //Default X and Y screen position of window
+        WINDOW_WIDTH, WINDOW_HEIGHT,                   //Width and Height of the window
+        NULL,                                          //Parent window (there isn't one, this is the main window)
+        hMenu,                                         //Menu handle
+        hInstance,                                     //Instance Handle
+        NULL                                           //lParam (not used here)
+    );
+
+    if(hMainWindow == NULL)
+    {
+        //Again, this should never happen since we just created hMainWindow, but just in case, inform the user and return gracefully.
+        MessageBox(NULL, L"Window creation failed.", L"Error", MB_ICONERROR | MB_OK);
+        return 0;
+    }
+
+    /*
+    *   Now that the main window handle is set up, we can start initializing 
+    *   the individual ui-element "windows" in our main window
+    *   For organization sake, we do this in the InitializeUI function.
+    */
+    InitializeUI(hMainWindow);
+
+    /*
+    *   Finally, now that the window is fully initialized, we can show it 
+    *   and begin ticking the message loop.
+    */
+    ShowWindow(hMainWindow, nCmdShow);
+    UpdateWindow(hMainWindow);
+
+    //Undo, redo, move and cancel keys; the edit controls keep theirs for their own text
+    ACCEL accelerators[] =
+    {
+        {FVIRTKEY | FCONTROL, 'Z', IDM_UNDO},
+        {FVIRTKEY | FCONTROL, 'Y', IDM_REDO},
+        {FVIRTKEY | FALT, VK_UP, IDM_MOVEUP},
+        {FVIRTKEY | FALT, VK_DOWN, IDM_MOVEDOWN},
+        {FVIRTKEY | FALT, VK_LEFT, IDM_MOVEOUT},
+        {FVIRTKEY | FALT, VK_RIGHT, IDM_MOVEIN},
+        {FVIRTKEY, VK_ESCAPE, IDM_CANCELOPEN},
+    };
+    HACCEL hAccelerators = CreateAcceleratorTable(accelerators, sizeof(accelerators) / sizeof(accelerators[0]));
+
+    MSG msg;
+    while(GetMessage(&msg, NULL, 0, 0))
+    {
+        //The Find dialog is modeless and handles its own keys
+        if(hFindDialog && IsDialogMessage(hFindDialog, &msg))
+        {
+            continue;
+        }
+        if(hAccelerators && msg.hwnd != hNameEditWindow && msg.hwnd != hDescEditWindow &&
+           TranslateAccelerator(hMainWindow, hAccelerators, &msg))
+        {
+            continue;
+        }
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+    }
+    if(hAccelerators)
+    {
+        DestroyAcceleratorTable(hAccelerators);
+    }
+    if(g_loader)
+    {
+        StopLoad(TRUE);
+    }
+    TreeMirrorFree(&g_mirror);
+    TreeJournalFree(&g_journal);
+    TreeHistoryFree(&g_history);
+    TreeIndexFree(&g_index);
+    TreePathFree(&g_paths);
+    TreeHashFree(&g_hashes);
+    free(g_findResults);
+    TreeFree(&g_tree);
+    return (int)msg.wParam;
+}
+
+/*=============================================================================
+*   WindowProc [LRESULT]
+*       The win32 window procedure
+=============================================================================*/
+LRESULT CALLBACK WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+    switch(msg)
+    {
+        //When the Window is created:
+        case WM_CREATE:
+        {
+            //Do nothing... for now...
+            break;
+        }
+        
+        //When the Window is resized:
+        case WM_SIZE:
+        {
+            //lParam holds the new window size x and y as 16-bit WORDs
+            int width = LOWORD(lParam);
+            int height = HIWORD(lParam);
+
+            //If the window height is made shorter or longer, readjust the treeview height.
+            SetWindowPos(hTreeView, NULL, 0, 0, TREEVIEW_WIDTH, height, SWP_NOZORDER);
+
+            //If the window width is made narrower or wider, readjust the editor width.
+            int editLeft = TREEVIEW_WIDTH + 10;
+            int editWidth = width - TREEVIEW_WIDTH - 20;
+            SetWindowPos(hNameEditWindow, NULL, editLeft, 10, editWidth, 25, SWP_NOZORDER);
+            SetWindowPos(hDescEditWindow, NULL, editLeft, 70, editWidth, 100, SWP_NOZORDER);
+        }
+        break;
+
+        //When a Command is sent to the window:
+        case WM_COMMAND:
+        {
+            //wParam for a menu holds 
+            switch(LOWORD(wParam))
+            {
+
+                case IDM_NEW:
+                {
+                    if(!ConfirmDiscard(hWnd))
+                    {
+                        break;
+                    }
+                    hSelectedItem = NULL;
+                    DeleteTree(hTreeView);
+                    RememberSavedState();
+
+                    UpdateEditFields();
+                    wcscpy(g_szFileName, L"");
+                    g_fileFormat = TREE_FORMAT_TEXT;
+                    break;
+                }
+
+                case IDM_OPEN:
+                {
+                    wchar_t szFile[MAX_PATH] = {0};
+
+                    //Initialize an OPENFILENAME struct to be used by GetOpenFileName
+                    OPENFILENAME ofn = {0};
+                    ofn.lStructSize = sizeof(OPENFILENAME);
+                    ofn.hwndOwner = hWnd;
+                    ofn.lpstrFile = szFile;
+                    ofn.nMaxFile = MAX_PATH;
+                    ofn.lpstrFilter = FILE_FILTER;
+                    ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST;
+
+                    //Display an open file dialog
+                    if (ConfirmDiscard(hWnd) && GetOpenFileName(&ofn))
+                    {
+                        wcscpy(g_szFileName, szFile);
+
+                        //Load the file data into the treeview from the given path,
+                        //which drops the current document first
+                        LoadTreeFromFile(hTreeView, szFile);
+                    }
+                    break;
+                }
+
+                case IDM_SAVE:
+                case IDM_SAVEAS:
+                {
+                    //Half a document is not saved over the file it comes from
+                    if(g_loader)
+                    {
+                        MessageBeep(MB_OK);
+                        break;
+                    }
+
+                    //Pending edits of the selected item only reach the model on selection change
+                    if(g_selectedNode != TREE_NIL)
+                    {
+                        SaveFieldsToSelectedItem();
+                    }
+
+                    //Ask for a name for a new file or when saving as, which writes
+                    //the whole file; otherwise save the open file in its own
+                    //format, where recording the edits in its journal may do
+                    if(LOWORD(wParam) == IDM_SAVE && g_szFileName[0] != '\0')
+                    {
+                        //Nothing to write if the edits since the last save cancel out
+                        if(!g_saving && !IsDocumentModified())
+                        {
+                            g_savedEdits = g_edits;
+                            SetTitleStatus(L"No changes to save");
+                        }
+                        else
+                        {
+                            SaveTreeToFile(hTreeView, g_szFileName, FALSE, FALSE);
+                        }
+                    }
+                    else if(PromptSaveFileName(hWnd))
+                    {
+                        SaveTreeToFile(hTreeView, g_szFileName, TRUE, FALSE);
+                    }
+                }
+                break;
+
+                case IDM_EXIT:
+                {
+                    if(ConfirmDiscard(hWnd))
+                    {
+                        DestroyWindow(hWnd);
+                    }
+                    break;
+                }
+
+                case IDM_FIND:
+                {
+                    ShowFindDialog(hWnd);
+                    break;
+                }
+
+                case IDM_UNDO:
+                case IDM_REDO:
+                {
+                    UndoEdit(LOWORD(wParam) == IDM_REDO);
+                    break;
+                }
+
+                case IDM_MOVEUP:
+                case IDM_MOVEDOWN:
+                case IDM_MOVEOUT:
+                case IDM_MOVEIN:
+                {
+                    MoveSelectedItem(LOWORD(wParam));
+                    break;
+                }
+
+                case IDM_CANCELOPEN:
+                {
+                    if(g_loader)
+                    {
+                        FinishLoad(TRUE);
+                    }
+                    break;
+                }
+
+                case IDM_COMPARE:
+                {
+                    CompareWithFile(hWnd);
+                    break;
+                }
+
+                case IDM_MERGE:
+                {
+                    MergeWithFiles(hWnd);
+                    break;
+                }
+
+                case IDM_FINDNEXT:
+                {
+                    //Also steps through what Compare or Merge found
+                    if(g_findText[0] != L'\0' || (g_findCount && g_findEdits == g_edits))
+                    {
+                        FindNextItem();
+                    }
+                    else
+                    {
+                        ShowFindDialog(hWnd);
+                    }
+                    break;
+                }
+
+                case IDM_STATS:
+                {
+                    ShowStats(hWnd);
+                    break;
+                }
+
+                // Handle edit control changes
+                case ID_EDIT_NAME:
+                {
+                    if(HIWORD(wParam) == EN_CHANGE && hSelectedItem != NULL)
+                    {
+                        UpdateTreeViewText();
+                    }
+                    break;
+                }
+                case ID_EDIT_DESCRIPTION:
+                {
+                    if (HIWORD(wParam) == EN_CHANGE && hSelectedItem != NULL)
+                    {
+                        //OnItemChanges(hTreeView, hSelectedItem);
+                    }
+                    break;
+                }
+            }
+            break;
+        }
+
+        //Called on special window events
+        case WM_NOTIFY:
+        {
+            NMHDR* pnmhdr = (NMHDR*)lParam;
+            if(pnmhdr->idFrom == ID_TREEVIEW)
+            {
+                switch(pnmhdr->code)
+                {
+                    //Children are inserted the first time their parent opens
+                    case TVN_ITEMEXPANDING:
+                    {
+                        NMTREEVIEW* pnmtv = (NMTREEVIEW*)lParam;
+                        if(pnmtv->action & TVE_EXPAND)
+                        {
+                            TreeMirrorExpand(&g_mirror, (TreeNodeId)pnmtv->itemNew.lParam);
+                        }
+                    }
+                    break;
+
+                    //Items ask whether to show an expand button
+                    case TVN_GETDISPINFO:
+                    {
+                        NMTVDISPINFO* pdi = (NMTVDISPINFO*)lParam;
+                        if(pdi->item.mask & TVIF_CHILDREN)
+                        {
+                            TreeNodeId node = (TreeNodeId)pdi->item.lParam;
+                            pdi->item.cChildren = TreeIsLive(&g_tree, node) && g_tree.firstChild[node] != TREE_NIL;
+                        }
+                    }
+                    break;
+
+                    //Dragging an item moves it where it is dropped, see EndDrag
+                    case TVN_BEGINDRAG:
+                    {
+                        NMTREEVIEW* pnmtv = (NMTREEVIEW*)lParam;
+                        if(!g_loader)
+                        {
+                            g_dragNode = (TreeNodeId)pnmtv->itemNew.lParam;
+                            SetCapture(hWnd);
+                        }
+                    }
+                    break;
+
+                    //When the selection of our treeview is changed:
+                    case TVN_SELCHANGED:
+                    {
+                        OnSelectionChanged(lParam);
+                        UpdateEditFields(hTreeView);
+                    }
+                    break;
+
+                    //When the mouse right clicks our tree view
+                    case NM_RCLICK:
+                    {
+                        POINT pt;
+                        GetCursorPos(&pt);
+
+                        //The document is read-only until it is open
+                        if(g_loader)
+                        {
+                            break;
+                        }
+
+                        HMENU hPopupMenu = CreatePopupMenu();
+                        AppendMenu(hPopupMenu, MF_STRING, 1001, L"Add Child Item");
+                        AppendMenu(hPopupMenu, MF_STRING, 1002, L"Delete Item");
+
+                        //Create a popup menu at the mouse position
+                        int cmd = TrackPopupMenu(hPopupMenu, TPM_RETURNCMD | TPM_LEFTBUTTON, pt.x, pt.y, 0, hWnd, NULL);
+                        DestroyMenu(hPopupMenu);
+
+                        switch(cmd)
+                        {
+                            //Create an item:
+                            case 1001:
+                            {
+                                CreateNewItem(hTreeView, hSelectedItem, L"New Item", L"Description");
+                                UpdateWindow(hWnd);
+                                break;
+                            }
+                            //Delete an item:
+                            case 1002:
+                            {
+                                //Only if something is selected
+                                if(hSelectedItem != NULL)
+                                {
+                                    DeleteItem(hSelectedItem);
+                                    hSelectedItem = NULL;
+                                    g_selectedNode = TREE_NIL;
+                                    //Clear the contents of the editor
+                                    UpdateEditFields();
+                                }
+                                break;
+                            }
+                        }
+                    }
+                    break;
+                }
+            }
+        }
+        break;
+        //Highlight the item a dragged one would be dropped on
+        case WM_MOUSEMOVE:
+        {
+            if(g_dragNode != TREE_NIL)
+            {
+                TreeView_SelectDropTarget(hTreeView, DropTargetAt(lParam));
+            }
+            break;
+        }
+
+        case WM_LBUTTONUP:
+        {
+            if(g_dragNode != TREE_NIL)
+            {
+                EndDrag(TRUE, lParam);
+            }
+            break;
+        }
+
+        //Another window took the mouse, the drag is off
+        case WM_CAPTURECHANGED:
+        {
+            if(g_dragNode != TREE_NIL)
+            {
+                EndDrag(FALSE, 0);
+            }
+            break;
+        }
+
+        //Save the open file now and then while it is being edited
+        case WM_TIMER:
+        {
+            if(wParam == ID_LOAD_TIMER && g_loader)
+            {
+                LoadTick();
+            }
+            else if(wParam == ID_AUTOSAVE_TIMER && g_szFileName[0] != '\0' && !g_saving && !g_loader)
+            {
+                if(g_selectedNode != TREE_NIL)
+                {
+                    SaveFieldsToSelectedItem();
+                }
+                if(IsDocumentModified())
+                {
+                    SaveTreeToFile(hTreeView, g_szFileName, FALSE, TRUE);
+                }
+            }
+            break;
+        }
+
+        //The save thread is done with its file
+        case WM_APP_SAVED:
+        {
+            if(g_saving && (unsigned)wParam == g_save.serial)
+            {
+                FinishSave();
+            }
+            break;
+        }
+
+        //The close box, Alt+F4 or the system menu; the document may want saving first
+        case WM_CLOSE:
+        {
+            if(ConfirmDiscard(hWnd))
+            {
+                DestroyWindow(hWnd);
+            }
+            break;
+        }
+
+        //Called on DestroyWindow(hWnd)
+        case WM_DESTROY:
+        {
+            //Let a save in flight finish before the model goes away
+            KillTimer(hWnd, ID_AUTOSAVE_TIMER);
+            WaitForSave();
+            if(g_loader)
+            {
+                StopLoad(TRUE);
+            }
+
+            //Request that the system terminate the application thread
+            PostQuitMessage(0);
+            break;
+        }
+        default:
+        {
+            //The Find dialog reports through a registered message
+            if(g_findMessage != 0 && msg == g_findMessage)
+            {
+                FINDREPLACE* find = (FINDREPLACE*)lParam;
+                if(find->Flags & FR_DIALOGTERM)
+                {
+                    hFindDialog = NULL;
+                }
+                else if(find->Flags & FR_FINDNEXT)
+                {
+                    FindNextItem();
+                }
+                return 0;
+            }
+
+            //return the default window procedure
+            return DefWindowProc(hWnd, msg, wParam, lParam);
+        }
+    }
+    return 0;
+}
+
+/*=============================================================================
+*   InitializeUI [void]
+*       Construct/Create the "windows" for each of our individual UI elements
+*
+*       Parameters:
+*           HWND hWnd - The main window handle that will be used as the parent for the ui elements
+*
+=============================================================================*/
+void InitializeUI(HWND hWnd)
+{
+    //Create the Tree View box
+    hTreeView = CreateWindowEx
+    (
+        WS_EX_CLIENTEDGE,
+        WC_TREEVIEW,
+        L"",
+        WS_VISIBLE | WS_CHILD | WS_BORDER | TVS_HASLINES | TVS_LINESATROOT | TVS_HASBUTTONS | TVS_SHOWSELALWAYS,
+        0,
+        0,
+        TREEVIEW_WIDTH,
+        0,
+        hWnd,
+        (HMENU)ID_TREEVIEW,
+        hMainInstance,
+        NULL
+    );
+
+    //The model reaches the TreeView only through the mirror
+    static const TreeViewOps viewOps = {InsertViewItem};
+    TreeMirrorInit(&g_mirror, &g_tree, &viewOps, hTreeView);
+    TreeJournalInit(&g_journal);
+    TreeIndexInit(&g_index);
+    TreePathInit(&g_paths);
+    TreeHistoryInit(&g_history);
+    TreeHashInit(&g_hashes);
+    TreeStatsInit(&g_stats);
+    g_findMessage = RegisterWindowMessage(FINDMSGSTRING);
+    SetTimer(hWnd, ID_AUTOSAVE_TIMER, AUTOSAVE_INTERVAL, NULL);
+
+    //Create the Name TextBlock
+    HWND hNameLabel = CreateWindow
+    (
+        L"STATIC", 
+        L"Name:",
+        WS_VISIBLE | WS_CHILD,
+        TREEVIEW_WIDTH + 10, 10,
+        100, 20,
+        hWnd,
+        NULL,
+        hMainInstance,
+        NULL
+    );
+
+    //Create the Description TextBlock
+    HWND hDescLabel = CreateWindow
+    (
+        L"STATIC", 
+        L"Description:",
+        WS_VISIBLE | WS_CHILD,
+        TREEVIEW_WIDTH + 10, 50,
+        100, 20,
+        hWnd,
+        NULL,
+        hMainInstance,
+        NULL
+    );
+
+    //Create the Name editor TextBox
+    hNameEditWindow = CreateWindowEx
+    (
+        WS_EX_CLIENTEDGE,
+        L"EDIT",
+        L"",
+        WS_VISIBLE | WS_CHILD | WS_BORDER | ES_AUTOHSCROLL,
+        TREEVIEW_WIDTH + 10, 30,
+        300, 25,
+        hWnd,
+        (HMENU)ID_EDIT_NAME, 
+        hMainInstance,
+        NULL
+    );
+
+    //Create the Description editor TextBox
+    hDescEditWindow = CreateWindowEx
+    (
+        WS_EX_CLIENTEDGE,
+        L"EDIT",
+        L"",
+        WS_VISIBLE | WS_CHILD | WS_BORDER | ES_MULTILINE | ES_AUTOVSCROLL | WS_VSCROLL,
+        TREEVIEW_WIDTH + 10, 70,
+        300, 100,
+        hWnd,
+        (HMENU)ID_EDIT_DESCRIPTION,
+        hMainInstance,
+        NULL
+    );
+
+    //Construct a new root node and copy it's data to the Tree View
+    CreateNewItem(hTreeView, NULL, L"Root", L"This is the root node!");
+}
+
+/*=============================================================================
+*   WideToModelText [char*]
+*       Converts text from the edit controls into the model's UTF-8
+*
+*       Parameters:
+*           const wchar_t* in - NUL terminated text from a control
+*           TreeStr* text - Receives a handle to the converted bytes
+*
+*       Returns the malloc'ed buffer behind `text` for the caller to free,
+*       or NULL if out of memory
+=============================================================================*/
+char* WideToModelText(const wchar_t* in, TreeStr* text)
+{
+    size_t length = wcslen(in);
+    char* out = (char*)malloc(length * 3 + 1);
+    if(!out)
+    {
+        return NULL;
+    }
+    text->ptr = out;
+    text->len = (uint32_t)TreeUtf16ToUtf8(out, (const uint16_t*)in, length);
+    return out;
+}
+
+/*=============================================================================
+*   ModelTextToWide [wchar_t*]
+*       Converts model text into a NUL terminated wide string for the controls
+*
+*       Parameters:
+*           TreeStr text - Text from the model
+*
+*       Returns a malloc'ed buffer the caller frees, or NULL if out of memory
+=============================================================================*/
+wchar_t* ModelTextToWide(TreeStr text)
+{
+    wchar_t* out = (wchar_t*)malloc((text.len + 1) * sizeof(wchar_t));
+    if(!out)
+    {
+        return NULL;
+    }
+    size_t length = TreeUtf8ToUtf16((uint16_t*)out, text.ptr, text.len);
+    out[length] = L'\0';
+    return out;
+}
+
+/*=============================================================================
+*   GetControlText [wchar_t*]
+*       GetWindowText without a length limit
+*
+*       Returns a malloc'ed buffer the caller frees, or NULL if out of memory
+=============================================================================*/
+wchar_t* GetControlText(HWND hControl)
+{
+    int length = GetWindowTextLength(hControl);
+    wchar_t* text = (wchar_t*)malloc((length + 1) * sizeof(wchar_t));
+    if(text)
+    {
+        text[0] = L'\0';
+        GetWindowText(hControl, text, length + 1);
+    }
+    return text;
+}
+
+/*=============================================================================
+*   AddItemToTree [HTREEITEM]
+*       Add an item to a TreeView using a TreeView insert struct. Whether it
+*       can be expanded is asked for later through TVN_GETDISPINFO.
+*
+*       Parameters:
+*           HWND hTreeView - Handle to the treeview window control
+*           HTREEITEM hParent - Handle to the new item's parent in the tree hierarchy
+*           HTREEITEM hInsertAfter - The sibling it follows, or TVI_FIRST / TVI_LAST
+*           TreeNodeId node - Model node the new item mirrors, stored in its lParam
+*
+=============================================================================*/
+HTREEITEM AddItemToTree(HWND hTreeView, HTREEITEM hParent, HTREEITEM hInsertAfter, TreeNodeId node)
+{
+    wchar_t* name = ModelTextToWide(TreeName(&g_tree, node));
+
+    TVINSERTSTRUCT tvins;
+    ZeroMemory(&tvins, sizeof(tvins));
+    tvins.hParent = hParent;
+    tvins.hInsertAfter = hInsertAfter;
+    tvins.item.mask = TVIF_TEXT | TVIF_PARAM | TVIF_CHILDREN;
+    tvins.item.pszText = name ? name : L"";
+    tvins.item.cChildren = I_CHILDRENCALLBACK;
+    tvins.item.lParam = (LPARAM)node;
+    HTREEITEM hItem = TreeView_InsertItem(hTreeView, &tvins);
+    TreeStatsCount(&g_stats, viewCalls, 1);
+
+    free(name);
+    return hItem;
+}
+
+/*=============================================================================
+*   InsertViewItem [void*]
+*       TreeViewOps insert callback of g_mirror
+*
+*       Parameters:
+*           void* context - The TreeView window
+*           void* parent - Item to insert under, NULL for a top level item
+*           void* after - Item to insert after, NULL to insert first
+*           TreeNodeId node - The node to show
+*
+=============================================================================*/
+void* InsertViewItem(void* context, void* parent, void* after, TreeNodeId node)
+{
+    return AddItemToTree((HWND)context, (HTREEITEM)parent, after ? (HTREEITEM)after : TVI_FIRST, node);
+}
+
+/*=============================================================================
+*   GetItemNode [TreeNodeId]
+*       Looks up the model node behind a TreeView item
+*
+*       Parameters:
+*           HTREEITEM hItem - The item, or NULL for the invisible document root
+*
+=============================================================================*/
+TreeNodeId GetItemNode(HTREEITEM hItem)
+{
+    if(hItem == NULL)
+    {
+        return TREE_ROOT;
+    }
+
+    TVITEMW item = {0};
+    item.mask = TVIF_PARAM;
+    item.hItem = hItem;
+    if(!TreeView_GetItem(hTreeView, &item))
+    {
+        return TREE_NIL;
+    }
+    return (TreeNodeId)item.lParam;
+}
+
+/*=============================================================================
+*   CreateNewItem [void]
+*       Create and add a completely new item to the model and the TreeView
+*
+*       Parameters:
+*           HWND hTreeView - Handle to the treeview window control
+*           HTREEITEM hParent - Handle to the new item's parent in the tree hierarchy
+*           wchar_t* name - Initial name
+*           wchar_t* description - Initial description
+*
+=============================================================================*/
+void CreateNewItem(HWND hTreeView, HTREEITEM hParent, wchar_t* name, wchar_t* description)
+{
+    TreeNodeId parent = GetItemNode(hParent);
+    if(parent == TREE_NIL)
+    {
+        return;
+    }
+
+    TreeStr nameText;
+    TreeStr descText;
+    char* nameBytes = WideToModelText(name, &nameText);
+    char* descBytes = WideToModelText(description, &descText);
+
+    TreeNodeId node = TREE_NIL;
+    if(nameBytes && descBytes)
+    {
+        node = TreeAddNode(&g_tree, parent, nameText, descText);
+    }
+    free(nameBytes);
+    free(descBytes);
+
+    if(node == TREE_NIL)
+    {
+        MessageBox(NULL, L"Out of memory", L"Error", MB_OK | MB_ICONERROR);
+        return;
+    }
+
+    TreeMirrorAdded(&g_mirror, node);
+    TreeJournalInserted(&g_journal, &g_tree, node);
+    TreeIndexInserted(&g_index, &g_tree, node);
+    TreePathInserted(&g_paths, &g_tree, node);
+    TreeHashInserted(&g_hashes, &g_tree, node);
+    TreeHistoryInserted(&g_history, &g_tree, node);
+    g_edits++;
+    if(hParent != NULL)
+    {
+        TreeView_Expand(hTreeView, hParent, TVE_EXPAND);
+    }
+}
+
+/*=============================================================================
+*   OnSelectionChanged [void]
+*       Saves data from the editor for the previously selected item,
+*       then selects a new item and sets global values for the newly selected
+*       item and it's node.
+*
+*       Parameters:
+*           LPARAM lParam - pointer to the new item selection
+*
+=============================================================================*/
+void OnSelectionChanged(LPARAM lParam)
+{
+    //Check if a previous item was selected
+    if(hSelectedItem && g_selectedNode != TREE_NIL)
+    {
+        //Copy the editor values of the previous selection to their correct locaton
+        SaveFieldsToSelectedItem();
+        //Ensure name is updated in treeview
+        UpdateTreeViewText();
+    }
+
+    //Select the item given by lParam
+    NMTREEVIEW* pnmtv = (NMTREEVIEW*)lParam;
+    hSelectedItem = pnmtv->itemNew.hItem;
+    g_selectedNode = hSelectedItem ? (TreeNodeId)pnmtv->itemNew.lParam : TREE_NIL;
+}
+
+/*=============================================================================
+*   SaveFieldsToSelectedItem [void]
+*       Uses GetWindowText to copy data from the editor fields into the
+*       model node of the selected item
+=============================================================================*/
+void SaveFieldsToSelectedItem()
+{
+    TreeStr text;
+    TreeStr old;
+
+    //Copy the editor values of the previous selection to their correct locaton
+    wchar_t* buffer = GetControlText(hNameEditWindow);
+    char* bytes = buffer ? WideToModelText(buffer, &text) : NULL;
+    old = TreeName(&g_tree, g_selectedNode);
+    if(bytes && !TreeStrEqual(old, text) && TreeSetName(&g_tree, g_selectedNode, text))
+    {
+        TreeHistoryNameChanged(&g_history, &g_tree, g_selectedNode, old);
+        TreeJournalNameChanged(&g_journal, &g_tree, g_selectedNode);
+        TreeIndexChanged(&g_index, &g_tree, g_selectedNode);
+        TreePathRenamed(&g_paths, &g_tree, g_selectedNode);
+        TreeHashChanged(&g_hashes, &g_tree, g_selectedNode);
+        g_edits++;
+    }
+    free(bytes);
+    free(buffer);
+
+    buffer = GetControlText(hDescEditWindow);
+    bytes = buffer ? WideToModelText(buffer, &text) : NULL;
+    old = TreeDescription(&g_tree, g_selectedNode);
+    if(bytes && !TreeStrEqual(old, text) && TreeSetDescription(&g_tree, g_selectedNode, text))
+    {
+        TreeHistoryDescriptionChanged(&g_history, &g_tree, g_selectedNode, old);
+        TreeJournalDescriptionChanged(&g_journal, &g_tree, g_selectedNode);
+        TreeIndexChanged(&g_index, &g_tree, g_selectedNode);
+        TreeHashChanged(&g_hashes, &g_tree, g_selectedNode);
+        g_edits++;
+    }
+    free(bytes);
+    free(buffer);
+}
+
+/*=============================================================================
+*   UpdateTreeViewText [void]
+*       Reflects changes of the hSelectedItem name onto the Treeview
+=============================================================================*/
+void UpdateTreeViewText()
+{
+    TVITEMW item = {0};
+    item.mask = TVIF_TEXT;
+    item.hItem = hSelectedItem;
+    wchar_t* buffer = GetControlText(hNameEditWindow);
+    if(buffer)
+    {
+        item.pszText = buffer;
+        TreeView_SetItem(hTreeView, &item);
+        TreeStatsCount(&g_stats, viewCalls, 1);
+        free(buffer);
+    }
+}
+
+/*=============================================================================
+*   DeleteItem [void]
+*       Removes an item and all of its children from the model, then
+*       removes it from the treeview. The TreeView drops the child items
+*       of a deleted item on its own, so no walk is needed here. The
+*       subtree is only detached so that Undo can put it back.
+*
+*       Parameters:
+*           HTREEITEM hItemToDelete - Handle of the item we are removing
+*
+=============================================================================*/
+void DeleteItem(HTREEITEM hItemToDelete)
+{
+    TreeNodeId node = GetItemNode(hItemToDelete);
+    if(node == TREE_NIL || node == TREE_ROOT)
+    {
+        MessageBox(NULL, L"Could not find the item's node!", L"Error", MB_OK);
+        return;
+    }
+
+    //The selection may be inside the subtree we are removing
+    hSelectedItem = NULL;
+    g_selectedNode = TREE_NIL;
+
+    TreeMirrorRemoved(&g_mirror, node);
+    TreeJournalDeleted(&g_journal, &g_tree, node);
+    TreeIndexDeleted(&g_index, &g_tree, node);
+    TreePathDeleted(&g_paths, &g_tree, node);
+    TreeHashDeleted(&g_hashes, &g_tree, node);
+    TreeHistoryDelete(&g_history, &g_tree, node);
+    g_edits++;
+    TreeView_DeleteItem(hTreeView, hItemToDelete);
+    TreeStatsCount(&g_stats, viewCalls, 1);
+}
+
+/*=============================================================================
+*   MoveItem [void]
+*       Moves a node and everything below it to another place. The model
+*       only relinks the node, so the cost does not depend on how many
+*       nodes come along, and the view only redoes the items it had for
+*       them, see ShowMovedItem.
+*
+*       Parameters:
+*           TreeNodeId node - The node to move
+*           TreeNodeId parent - Its new parent, TREE_ROOT for the top level
+*           TreeNodeId before - The child of `parent` it goes in front of,
+*                               or TREE_NIL to make it the last child
+*
+=============================================================================*/
+void MoveItem(TreeNodeId node, TreeNodeId parent, TreeNodeId before)
+{
+    if(g_loader)
+    {
+        MessageBeep(MB_OK);
+        return;
+    }
+
+    //Pending edits of the selected item are an edit of their own, undone apart from the move
+    if(g_selectedNode != TREE_NIL)
+    {
+        SaveFieldsToSelectedItem();
+    }
+
+    TreeNodeId oldParent = g_tree.parent[node];
+    TreeNodeId oldBefore = g_tree.nextSibling[node];
+    if(parent == oldParent && (before == oldBefore || before == node))
+    {
+        return;
+    }
+
+    //Refused for TREE_ROOT, and for a place inside the node's own subtree
+    if(!TreeMoveNode(&g_tree, node, parent, before))
+    {
+        MessageBeep(MB_OK);
+        return;
+    }
+    TreeJournalMoved(&g_journal, &g_tree, node);
+    TreePathMoved(&g_paths, &g_tree, node);
+    TreeHashMoved(&g_hashes, &g_tree, node);
+    TreeHistoryMoved(&g_history, &g_tree, node, oldParent, oldBefore);
+    g_edits++;
+    ShowMovedItem(node);
+
+    HTREEITEM hItem = (HTREEITEM)TreeMirrorReveal(&g_mirror, node);
+    if(hItem)
+    {
+        TreeView_EnsureVisible(hTreeView, hItem);
+        TreeView_SelectItem(hTreeView, hItem);
+    }
+    else
+    {
+        UpdateEditFields();
+    }
+}
+
+/*=============================================================================
+*   MoveSelectedItem [void]
+*       Moves the selected item one step, for the Move menu commands
+*
+*       Parameters:
+*           int command - IDM_MOVEUP or IDM_MOVEDOWN to trade places with a
+*                         sibling, IDM_MOVEOUT to follow the parent, or
+*                         IDM_MOVEIN to become the previous sibling's last
+*                         child
+*
+=============================================================================*/
+void MoveSelectedItem(int command)
+{
+    TreeNodeId node = g_selectedNode;
+    if(node != TREE_NIL && node != TREE_ROOT)
+    {
+        TreeNodeId parent = g_tree.parent[node];
+        TreeNodeId prev = g_tree.prevSibling[node];
+        TreeNodeId next = g_tree.nextSibling[node];
+        if(command == IDM_MOVEUP && prev != TREE_NIL)
+        {
+            MoveItem(node, parent, prev);
+            return;
+        }
+        if(command == IDM_MOVEDOWN && next != TREE_NIL)
+        {
+            MoveItem(node, parent, g_tree.nextSibling[next]);
+            return;
+        }
+        if(command == IDM_MOVEOUT && parent != TREE_ROOT)
+        {
+            MoveItem(node, g_tree.parent[parent], g_tree.nextSibling[parent]);
+            return;
+        }
+        if(command == IDM_MOVEIN && prev != TREE_NIL)
+        {
+            MoveItem(node, prev, TREE_NIL);
+            return;
+        }
+    }
+    MessageBeep(MB_OK);
+}
+
+/*=============================================================================
+*   ShowMovedItem [void]
+*       Brings the TreeView in line with a node that was just moved. A
+*       TreeView item cannot be moved, so the node's item is deleted with
+*       the materialized items below it and inserted again in the new
+*       place, if that place is in the view. Nodes that were never
+*       materialized are not touched, however many there are.
+*
+*       Parameters:
+*           TreeNodeId node - The moved node
+*
+=============================================================================*/
+void ShowMovedItem(TreeNodeId node)
+{
+    //The selection may be among the items deleted; the caller selects the node again
+    hSelectedItem = NULL;
+    g_selectedNode = TREE_NIL;
+
+    HTREEITEM hItem = (HTREEITEM)TreeMirrorHandle(&g_mirror, node);
+    TreeMirrorRemoved(&g_mirror, node);
+    if(hItem)
+    {
+        TreeView_DeleteItem(hTreeView, hItem);
+    }
+    TreeMirrorAdded(&g_mirror, node);
+}
+
+/*=============================================================================
+*   DropTargetAt [HTREEITEM]
+*       The item under the mouse during a drag
+*
+*       Parameters:
+*           LPARAM lParam - Mouse position from a main window message
+*
+*       Returns NULL if the mouse is not over an item
+=============================================================================*/
+HTREEITEM DropTargetAt(LPARAM lParam)
+{
+    TVHITTESTINFO hit = {0};
+    hit.pt.x = (short)LOWORD(lParam);
+    hit.pt.y = (short)HIWORD(lParam);
+    MapWindowPoints(hMainWindow, hTreeView, &hit.pt, 1);
+    HTREEITEM hItem = TreeView_HitTest(hTreeView, &hit);
+    return (hit.flags & TVHT_ONITEM) ? hItem : NULL;
+}
+
+/*=============================================================================
+*   EndDrag [void]
+*       Ends the drag started in TVN_BEGINDRAG. Dropped on an item the node
+*       becomes that item's last child, or with Shift held its sibling in
+*       front of it; dropped below the items it goes to the end of the top
+*       level.
+*
+*       Parameters:
+*           BOOL drop - FALSE if the drag was called off
+*           LPARAM lParam - Mouse position from the main window message
+*
+=============================================================================*/
+void EndDrag(BOOL drop, LPARAM lParam)
+{
+    //Releasing the mouse reports WM_CAPTURECHANGED, which must find the drag over
+    TreeNodeId node = g_dragNode;
+    g_dragNode = TREE_NIL;
+    TreeView_SelectDropTarget(hTreeView, NULL);
+    ReleaseCapture();
+    if(!drop)
+    {
+        return;
+    }
+
+    HTREEITEM hTarget = DropTargetAt(lParam);
+    TreeNodeId target = GetItemNode(hTarget);
+    if(target == TREE_NIL || target == node || !TreeIsAttached(&g_tree, node))
+    {
+        return;
+    }
+    if(hTarget && GetKeyState(VK_SHIFT) < 0)
+    {
+        MoveItem(node, g_tree.parent[target], target);
+    }
+    else
+    {
+        MoveItem(node, target, TREE_NIL);
+    }
+}
+
+/*=============================================================================
+*   DeleteTree [void]
+*       Drops the whole document without visiting its nodes: the mirror
+*       forgets the few materialized items, the model releases its string
+*       arena and resets its counters, and the TreeView is emptied with a
+*       single TreeView_DeleteAllItems() call
+*
+*       Parameters:
+*           HWND - The treeview we want to dismantle
+*
+=============================================================================*/
+void DeleteTree(HWND hTreeViewToDelete)
+{
+    hSelectedItem = NULL;
+    g_selectedNode = TREE_NIL;
+
+    //So do the loader's worker and a save in flight
+    if(g_loader)
+    {
+        StopLoad(TRUE);
+    }
+    WaitForSave();
+    SetTitleStatus(NULL);
+
+    double start = TreeStatsStart();
+    TreeMirrorClear(&g_mirror);
+    DetachJournal();
+    TreeIndexClear(&g_index);
+    TreePathClear(&g_paths);
+    TreeHashClear(&g_hashes);
+    TreeHistoryClear(&g_history, NULL);
+    g_foundText[0] = L'\0';
+    g_findCount = 0;
+    TreeClear(&g_tree);
+    g_savedEdits = g_edits;
+    g_savedHashValid = FALSE;
+
+    SendMessage(hTreeViewToDelete, WM_SETREDRAW, FALSE, 0);
+    TreeView_DeleteAllItems(hTreeViewToDelete);
+    SendMessage(hTreeViewToDelete, WM_SETREDRAW, TRUE, 0);
+    TreeStatsCount(&g_stats, viewCalls, 3);
+    TreeStatsStop(&g_stats, TREE_PHASE_TEARDOWN, start);
+}
+
+/*=============================================================================
+*   UndoEdit [void]
+*       Undoes the last edit, or redoes the last undone one, and brings the
+*       view, journal and indexes in line with it
+*
+*       Parameters:
+*           BOOL redo - TRUE to redo instead
+*
+=============================================================================*/
+void UndoEdit(BOOL redo)
+{
+    if(g_loader)
+    {
+        MessageBeep(MB_OK);
+        return;
+    }
+
+    //Pending edits of the selected item are the last edit, if there are any
+    if(g_selectedNode != TREE_NIL)
+    {
+        SaveFieldsToSelectedItem();
+    }
+
+    TreeChange change;
+    if(redo ? !TreeHistoryRedo(&g_history, &g_tree, &change) : !TreeHistoryUndo(&g_history, &g_tree, &change))
+    {
+        MessageBeep(MB_OK);
+        return;
+    }
+    ApplyHistoryChange(&change);
+}
+
+/*=============================================================================
+*   ApplyHistoryChange [void]
+*       Passes a change an undo or redo made to the model on to everything
+*       that follows the model, like an edit of the user's, and selects the
+*       node it changed
+*
+*       Parameters:
+*           const TreeChange* change - What TreeHistoryUndo/Redo reported
+*
+=============================================================================*/
+void ApplyHistoryChange(const TreeChange* change)
+{
+    TreeNodeId node = change->node;
+    HTREEITEM hItem = (HTREEITEM)TreeMirrorHandle(&g_mirror, node);
+    switch(change->kind)
+    {
+        case TREE_CHANGE_DETACHED:
+        {
+            //The selection may be inside the subtree taken out
+            if(g_selectedNode != TREE_NIL && !TreeIsAttached(&g_tree, g_selectedNode))
+            {
+                hSelectedItem = NULL;
+                g_selectedNode = TREE_NIL;
+                UpdateEditFields();
+            }
+            TreeMirrorRemoved(&g_mirror, node);
+            TreeJournalDeleted(&g_journal, &g_tree, node);
+            TreeIndexDeleted(&g_index, &g_tree, node);
+            TreePathDeleted(&g_paths, &g_tree, node);
+            TreeHashDeleted(&g_hashes, &g_tree, node);
+            g_edits++;
+            if(hItem)
+            {
+                TreeView_DeleteItem(hTreeView, hItem);
+            }
+            return;
+        }
+
+        case TREE_CHANGE_ATTACHED:
+        {
+            TreeMirrorAdded(&g_mirror, node);
+            TreeJournalRestored(&g_journal, &g_tree, node);
+            TreeIndexInserted(&g_index, &g_tree, node);
+            TreePathInserted(&g_paths, &g_tree, node);
+            TreeHashInserted(&g_hashes, &g_tree, node);
+            break;
+        }
+
+        case TREE_CHANGE_NAME:
+        {
+            TreeJournalNameChanged(&g_journal, &g_tree, node);
+            TreeIndexChanged(&g_index, &g_tree, node);
+            TreePathRenamed(&g_paths, &g_tree, node);
+            TreeHashChanged(&g_hashes, &g_tree, node);
+            wchar_t* buffer = ModelTextToWide(TreeName(&g_tree, node));
+            if(hItem && buffer)
+            {
+                TVITEMW item = {0};
+                item.mask = TVIF_TEXT;
+                item.hItem = hItem;
+                item.pszText = buffer;
+                TreeView_SetItem(hTreeView, &item);
+            }
+            free(buffer);
+            break;
+        }
+
+        case TREE_CHANGE_DESCRIPTION:
+        {
+            TreeJournalDescriptionChanged(&g_journal, &g_tree, node);
+            TreeIndexChanged(&g_index, &g_tree, node);
+            TreeHashChanged(&g_hashes, &g_tree, node);
+            break;
+        }
+
+        case TREE_CHANGE_MOVED:
+        {
+            TreeJournalMoved(&g_journal, &g_tree, node);
+            TreePathMoved(&g_paths, &g_tree, node);
+            TreeHashMoved(&g_hashes, &g_tree, node);
+            ShowMovedItem(node);
+            break;
+        }
+    }
+    g_edits++;
+
+    hItem = (HTREEITEM)TreeMirrorReveal(&g_mirror, node);
+    if(hItem == hSelectedItem)
+    {
+        UpdateEditFields();
+    }
+    else if(hItem)
+    {
+        TreeView_EnsureVisible(hTreeView, hItem);
+        TreeView_SelectItem(hTreeView, hItem);
+    }
+}
+
+/*=============================================================================
+*   UpdateEditFields [void]
+*       Used to copy the contents of the selected node to the editor controls
+=============================================================================*/
+void UpdateEditFields()
+{
+    double start = TreeStatsStart();
+    TreeStatsCount(&g_stats, viewCalls, 2);
+
+    //Blank out the fields if no item is selected
+    if (hSelectedItem == NULL || g_selectedNode == TREE_NIL)
+    {
+        SetWindowText(hNameEditWindow, L"");
+        SetWindowText(hDescEditWindow, L"");
+        TreeStatsStop(&g_stats, TREE_PHASE_EDIT_FIELDS, start);
+        return;
+    }
+
+    if (!TreeIsLive(&g_tree, g_selectedNode))
+    {
+        MessageBox(NULL, L"Couldn't get data!", L"Error", MB_OK);
+        return;
+    }
+
+    wchar_t* buffer = ModelTextToWide(TreeName(&g_tree, g_selectedNode));
+    SetWindowText(hNameEditWindow, buffer ? buffer : L"");
+    free(buffer);
+    buffer = ModelTextToWide(TreeDescription(&g_tree, g_selectedNode));
+    SetWindowText(hDescEditWindow, buffer ? buffer : L"");
+    free(buffer);
+    TreeStatsStop(&g_stats, TREE_PHASE_EDIT_FIELDS, start);
+}
+
+/*=============================================================================
+*   PromptSaveFileName [BOOL]
+*       Shows a save file dialog and makes its choice the open file. The
+*       format follows the chosen filter, or a .dtb extension.
+*
+*       Parameters:
+*           HWND hWnd - Owner of the dialog
+*
+*       Returns TRUE if a file name was chosen
+=============================================================================*/
+BOOL PromptSaveFileName(HWND hWnd)
+{
+    wchar_t szFile[MAX_PATH] = {0};
+    wcscpy(szFile, g_szFileName[0] != '\0' ? g_szFileName : L"untitled.dat");
+
+    //Initialize an OPENFILENAME struct to be used by GetSaveFileName
+    OPENFILENAME ofn = {0};
+    ofn.lStructSize = sizeof(OPENFILENAME);
+    ofn.hwndOwner = hWnd;
+    ofn.lpstrFile = szFile;
+    ofn.nMaxFile = MAX_PATH;
+    ofn.lpstrFilter = FILE_FILTER;
+    ofn.nFilterIndex = g_fileFormat + 1;
+    ofn.Flags = OFN_OVERWRITEPROMPT;
+
+    //Display a save file dialog
+    if(!GetSaveFileName(&ofn))
+    {
+        return FALSE;
+    }
+
+    //The extension decides, then the filter chosen
+    size_t length = wcslen(szFile);
+    const wchar_t* extension = length >= 4 ? szFile + length - 4 : L"";
+    if(_wcsicmp(extension, L".dtz") == 0 || ofn.nFilterIndex == TREE_FORMAT_COMPRESSED + 1)
+    {
+        g_fileFormat = TREE_FORMAT_COMPRESSED;
+    }
+    else if(_wcsicmp(extension, L".dtb") == 0 || ofn.nFilterIndex == TREE_FORMAT_BINARY + 1)
+    {
+        g_fileFormat = TREE_FORMAT_BINARY;
+    }
+    else
+    {
+        g_fileFormat = TREE_FORMAT_TEXT;
+    }
+    wcscpy(g_szFileName, szFile);
+    return TRUE;
+}
+
+/*=============================================================================
+*   JournalPathFor [BOOL]
+*       Builds the name of a file's edit journal, the file name plus
+*       JOURNAL_SUFFIX
+*
+*       Returns FALSE if that would not fit in MAX_PATH; the file then
+*       gets no journal and every save rewrites it
+=============================================================================*/
+BOOL JournalPathFor(const wchar_t* fileName, wchar_t* journalPath)
+{
+    size_t length = wcslen(fileName);
+    if(length + wcslen(JOURNAL_SUFFIX) >= MAX_PATH)
+    {
+        return FALSE;
+    }
+    wcscpy(journalPath, fileName);
+    wcscpy(journalPath + length, JOURNAL_SUFFIX);
+    return TRUE;
+}
+
+/*=============================================================================
+*   AttachJournal [BOOL]
+*       Starts recording edits against a file that holds exactly the model,
+*       and replays the file's journal if it has one
+*
+*       Parameters:
+*           const wchar_t* fileName - The base file
+*           uint64_t baseSize - Its size in bytes
+*
+*       Returns TRUE if a journal was replayed, which may have changed the model
+=============================================================================*/
+BOOL AttachJournal(const wchar_t* fileName, uint64_t baseSize)
+{
+    wchar_t journalPath[MAX_PATH];
+    if(!JournalPathFor(fileName, journalPath) || !TreeJournalReset(&g_journal, &g_tree, baseSize))
+    {
+        DetachJournal();
+        return FALSE;
+    }
+    wcscpy(g_journalBase, fileName);
+
+    FILE* log = _wfopen(journalPath, L"rb");
+    if(log)
+    {
+        double start = TreeStatsStart();
+        int replayed = TreeJournalReplay(&g_journal, &g_tree, log);
+        TreeStatsStop(&g_stats, TREE_PHASE_REPLAY, start);
+        TreeStatsCount(&g_stats, bytesRead, TreeStreamSize(log));
+        if(!replayed)
+        {
+            MessageBox(hMainWindow, L"Some saved edits could not be applied; the next save rewrites the file",
+                       L"Warning", MB_OK | MB_ICONWARNING);
+        }
+        fclose(log);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/*=============================================================================
+*   DetachJournal [void]
+*       Stops recording edits, so the next save rewrites the whole file
+=============================================================================*/
+void DetachJournal()
+{
+    TreeJournalClear(&g_journal);
+    g_journalBase[0] = L'\0';
+}
+
+/*=============================================================================
+*   SaveTreeToFile [void]
+*       Saves the open file by appending the edits since the last save to
+*       its journal, which costs as much as the edits. The whole model is
+*       written instead, in the format selected by g_fileFormat, when
+*       `rewrite` is set, the file is a different one, or the journal has
+*       grown past its share of the file. That happens on a save thread
+*       from a snapshot of the model, so editing goes on meanwhile; a save
+*       asked for while one is in flight follows when it is done.
+*
+*       Parameters:
+*           HWND hTreeView - The TreeView that mirrors the model being saved
+*           wchar_t* fileName - FileName used to construct a FILE handle
+*           BOOL rewrite - Write the whole file even if a journal would do
+*           BOOL quiet - An autosave; failure is shown in the title bar
+*
+=============================================================================*/
+void SaveTreeToFile(HWND hTreeView, const wchar_t* fileName, BOOL rewrite, BOOL quiet)
+{
+    if(g_saving)
+    {
+        g_queuedRewrite = g_saveQueued ? (g_queuedRewrite || rewrite) : rewrite;
+        g_queuedQuiet = g_saveQueued ? (g_queuedQuiet && quiet) : quiet;
+        g_saveQueued = TRUE;
+        return;
+    }
+
+    //What the file will hold, for telling later whether the document still matches it
+    uint64_t hash = 0;
+    BOOL hashed = TreeHashSubtree(&g_hashes, &g_tree, TREE_ROOT, &hash);
+
+    wchar_t journalPath[MAX_PATH];
+    if(!rewrite && JournalPathFor(fileName, journalPath) && wcscmp(fileName, g_journalBase) == 0 &&
+       !TreeJournalNeedsCompaction(&g_journal))
+    {
+        unsigned edits = g_edits;
+        size_t pending = g_journal.pendingLength;
+        double start = TreeStatsStart();
+        FILE* log = _wfopen(journalPath, L"ab");
+        int appended = log && TreeJournalAppend(&g_journal, log);
+        if(log && fclose(log) != 0)
+        {
+            appended = 0;
+        }
+        TreeStatsStop(&g_stats, TREE_PHASE_JOURNAL, start);
+        if(appended)
+        {
+            TreeStatsCount(&g_stats, bytesWritten, pending);
+            g_savedEdits = edits;
+            g_savedHash = hash;
+            g_savedHashValid = hashed;
+            SetTitleStatus(L"Saved");
+            return;
+        }
+    }
+
+    /*
+    *   The document may still be reading its strings from the file we are
+    *   about to replace, and a mapped file cannot be renamed over. This
+    *   copies them once, the first time a mapped document is saved.
+    */
+    double start = TreeStatsStart();
+    if(!TreeReleaseMapping(&g_tree))
+    {
+        MessageBox(hMainWindow, L"Out of memory", L"Error", MB_OK | MB_ICONERROR);
+        return;
+    }
+
+    int snapshot = wcslen(fileName) + wcslen(TEMP_SUFFIX) < MAX_PATH && TreeSnapshot(&g_save.snapshot, &g_tree);
+    TreeStatsStop(&g_stats, TREE_PHASE_SNAPSHOT, start);
+    if(!snapshot)
+    {
+        DetachJournal();
+        MessageBox(hMainWindow, L"Failed to save tree", L"Error", MB_OK | MB_ICONERROR);
+        return;
+    }
+    wcscpy(g_save.fileName, fileName);
+    g_save.format = g_fileFormat;
+    g_save.quiet = quiet;
+    g_save.edits = g_edits;
+    g_save.hash = hash;
+    g_save.hashed = hashed;
+    g_save.size = 0;
+    g_save.seconds = 0;
+    g_save.saved = 0;
+    g_save.serial++;
+    g_save.thread.handle = NULL;
+
+    //The file is about to be replaced, edits meanwhile are not journaled
+    DetachJournal();
+    if(!TreeThreadStart(&g_save.thread, SaveThread, &g_save))
+    {
+        //Without a thread the snapshot is written right here
+        SaveThread(&g_save);
+        g_saving = TRUE;
+        FinishSave();
+        return;
+    }
+    g_saving = TRUE;
+    SetTitleStatus(L"Saving...");
+}
+
+/*=============================================================================
+*   SaveThread [void]
+*       Body of the save thread. Writes the snapshot next to the file, puts
+*       it on disk, then renames it over the file, so a crash leaves either
+*       the old file or the new one in place and never a partial one. The
+*       old file's journal goes once the new file is in place.
+*
+*       Parameters:
+*           void* arg - The SaveJob
+*
+=============================================================================*/
+void SaveThread(void* arg)
+{
+    SaveJob* job = (SaveJob*)arg;
+
+    wchar_t tempPath[MAX_PATH];
+    wcscpy(tempPath, job->fileName);
+    wcscat(tempPath, TEMP_SUFFIX);
+
+    double start = TreeStatsStart();
+    FILE* file = _wfopen(tempPath, L"wb");
+    if(file)
+    {
+        int saved = job->format == TREE_FORMAT_COMPRESSED ? TreeSaveCompressed(&job->snapshot, file, g_ioThreads) :
+                    job->format == TREE_FORMAT_BINARY ? TreeSaveBinary(&job->snapshot, file) :
+                    TreeSaveToStreamParallel(&job->snapshot, file, g_ioThreads);
+        job->size = TreeStreamSize(file);
+        saved = TreeStreamSync(file) && saved;
+        if(fclose(file) == 0 && saved &&
+           MoveFileExW(tempPath, job->fileName, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+        {
+            wchar_t journalPath[MAX_PATH];
+            if(JournalPathFor(job->fileName, journalPath))
+            {
+                _wremove(journalPath);
+            }
+            job->saved = 1;
+        }
+        else
+        {
+            _wremove(tempPath);
+        }
+    }
+    job->seconds = TreeStatsStart() - start;
+    PostMessage(hMainWindow, WM_APP_SAVED, (WPARAM)job->serial, 0);
+}
+
+/*=============================================================================
+*   FinishSave [void]
+*       Collects the save thread once it is done, or waits for it. The file
+*       holds the document as it was when the save began, so journaling
+*       resumes against it only if nothing was edited since; otherwise the
+*       next save is a full one.
+=============================================================================*/
+void FinishSave()
+{
+    if(g_save.thread.handle)
+    {
+        TreeThreadJoin(&g_save.thread);
+    }
+    TreeFree(&g_save.snapshot);
+    g_saving = FALSE;
+    TreeStatsAdd(&g_stats, TREE_PHASE_SERIALIZE, g_save.seconds);
+
+    if(g_save.saved)
+    {
+        TreeStatsCount(&g_stats, bytesWritten, g_save.size);
+        g_savedEdits = g_save.edits;
+        g_savedHash = g_save.hash;
+        g_savedHashValid = g_save.hashed;
+        if(g_edits == g_save.edits && wcscmp(g_save.fileName, g_szFileName) == 0)
+        {
+            AttachJournal(g_save.fileName, g_save.size);
+        }
+        SetTitleStatus(L"Saved");
+    }
+    else if(g_save.quiet)
+    {
+        SetTitleStatus(L"Autosave failed");
+    }
+    else
+    {
+        SetTitleStatus(NULL);
+        MessageBox(hMainWindow, L"Failed to save tree", L"Error", MB_OK | MB_ICONERROR);
+    }
+
+    if(g_saveQueued && g_szFileName[0] != '\0')
+    {
+        g_saveQueued = FALSE;
+        SaveTreeToFile(hTreeView, g_szFileName, g_queuedRewrite, g_queuedQuiet);
+    }
+}
+
+/*=============================================================================
+*   WaitForSave [void]
+*       Blocks until a save in flight is done. Needed before the model is
+*       cleared or freed, since the snapshot shares its strings.
+=============================================================================*/
+void WaitForSave()
+{
+    if(g_saving)
+    {
+        g_saveQueued = FALSE;
+        FinishSave();
+    }
+}
+
+/*=============================================================================
+*   IsDocumentModified [BOOL]
+*       Whether the document differs from the file it was last read from
+*       or written to. No edits since means no; otherwise the root's hash
+*       decides, so edits that were undone or typed back do not count.
+*       Only the nodes above the edits are hashed again.
+*
+*       Returns TRUE if it differs, or if that cannot be told
+=============================================================================*/
+BOOL IsDocumentModified()
+{
+    if(g_edits == g_savedEdits)
+    {
+        return FALSE;
+    }
+    uint64_t hash;
+    return !g_savedHashValid || !TreeHashSubtree(&g_hashes, &g_tree, TREE_ROOT, &hash) || hash != g_savedHash;
+}
+
+/*=============================================================================
+*   RememberSavedState [void]
+*       Takes the document as it is now as the one on disk, e.g. once a
+*       file is read. The first call after a new document hashes all of it.
+=============================================================================*/
+void RememberSavedState()
+{
+    g_savedEdits = g_edits;
+    g_savedHashValid = TreeHashSubtree(&g_hashes, &g_tree, TREE_ROOT, &g_savedHash);
+}
+
+/*=============================================================================
+*   ConfirmDiscard [BOOL]
+*       Asks whether to save a modified document before it is closed or
+*       replaced, and saves it if so. Waits for the save, so that a failed
+*       one keeps the document open.
+*
+*       Parameters:
+*           HWND hWnd - Owner of the question and of a save file dialog
+*
+*       Returns TRUE if the document may go
+=============================================================================*/
+BOOL ConfirmDiscard(HWND hWnd)
+{
+    //Nothing can be edited while a file is being opened
+    if(g_loader)
+    {
+        return TRUE;
+    }
+    if(g_selectedNode != TREE_NIL)
+    {
+        SaveFieldsToSelectedItem();
+    }
+    if(!IsDocumentModified())
+    {
+        return TRUE;
+    }
+
+    int answer = MessageBox(hWnd, L"Save changes to the document?", L"dtree", MB_YESNOCANCEL | MB_ICONQUESTION);
+    if(answer == IDNO)
+    {
+        return TRUE;
+    }
+    if(answer != IDYES)
+    {
+        return FALSE;
+    }
+
+    //A save in flight holds an older state, the one started here the current one
+    WaitForSave();
+    if(g_szFileName[0] != '\0')
+    {
+        SaveTreeToFile(hTreeView, g_szFileName, FALSE, FALSE);
+    }
+    else if(PromptSaveFileName(hWnd))
+    {
+        SaveTreeToFile(hTreeView, g_szFileName, TRUE, FALSE);
+    }
+    else
+    {
+        return FALSE;
+    }
+    WaitForSave();
+    return !IsDocumentModified();
+}
+
+/*=============================================================================
+*   SetTitleStatus [void]
+*       Shows how the last save went after the window title
+*
+*       Parameters:
+*           const wchar_t* status - Text to show, NULL for none
+*
+=============================================================================*/
+void SetTitleStatus(const wchar_t* status)
+{
+    wchar_t title[64] = L"dtree";
+    if(status)
+    {
+        wcscat(title, L" - ");
+        wcsncat(title, status, 64 - wcslen(title) - 1);
+    }
+    SetWindowText(hMainWindow, title);
+}
+
+/*=============================================================================
+*   ShowFindDialog [void]
+*       Opens the Find dialog, or brings it back to the front
+*
+*       Parameters:
+*           HWND hWnd - Owner of the dialog
+*
+=============================================================================*/
+void ShowFindDialog(HWND hWnd)
+{
+    if(hFindDialog)
+    {
+        SetFocus(hFindDialog);
+        return;
+    }
+
+    //Matching ignores case and goes through the document in one direction
+    memset(&g_find, 0, sizeof(g_find));
+    g_find.lStructSize = sizeof(g_find);
+    g_find.hwndOwner = hWnd;
+    g_find.lpstrFindWhat = g_findText;
+    g_find.wFindWhatLen = FIND_TEXT_LENGTH;
+    g_find.Flags = FR_DOWN | FR_HIDEUPDOWN | FR_HIDEMATCHCASE | FR_HIDEWHOLEWORD;
+    hFindDialog = FindText(&g_find);
+}
+
+/*=============================================================================
+*   FindNextItem [void]
+*       Selects the next item whose name or description contains the text
+*       of the Find dialog, or has a word starting with it if the text ends
+*       in '*'. Text starting with '/' is a path such as /Servers/db01 and
+*       selects that item. The matches are looked up again once the text
+*       or the document has changed; the indexes are built on first use.
+=============================================================================*/
+void FindNextItem()
+{
+    //Pending edits of the selected item only reach the model on selection change
+    if(g_selectedNode != TREE_NIL)
+    {
+        SaveFieldsToSelectedItem();
+    }
+
+    if(g_findEdits != g_edits || wcscmp(g_findText, g_foundText) != 0)
+    {
+        if(!g_findResults)
+        {
+            g_findResults = (TreeNodeId*)malloc(FIND_MAX_RESULTS * sizeof(TreeNodeId));
+        }
+
+        TreeStr query;
+        char* bytes = WideToModelText(g_findText, &query);
+        g_findCount = 0;
+        if(bytes && g_findResults && query.len > 0 && query.ptr[0] == '/')
+        {
+            //A path goes straight to its one item
+            if(!g_paths.built)
+            {
+                TreePathBuild(&g_paths, &g_tree);
+            }
+            g_findResults[0] = TreePathFind(&g_paths, &g_tree, query.ptr + 1, query.len - 1);
+            g_findCount = g_findResults[0] != TREE_NIL;
+        }
+        else if(bytes && g_findResults)
+        {
+            if(!g_index.built)
+            {
+                HCURSOR hCursor = SetCursor(LoadCursor(NULL, IDC_WAIT));
+                TreeIndexBuild(&g_index, &g_tree);
+                SetCursor(hCursor);
+            }
+            int flags = 0;
+            if(query.len > 1 && query.ptr[query.len - 1] == '*')
+            {
+                query.len--;
+                flags = TREE_FIND_PREFIX;
+            }
+            g_findCount = TreeIndexFind(&g_index, &g_tree, query.ptr, query.len, flags, g_findResults, FIND_MAX_RESULTS);
+        }
+        free(bytes);
+
+        wcscpy(g_foundText, g_findText);
+        g_findEdits = g_edits;
+        g_findNext = 0;
+    }
+
+    if(g_findCount == 0)
+    {
+        MessageBox(hFindDialog ? hFindDialog : hMainWindow, L"No item matches the text", L"Find", MB_OK | MB_ICONINFORMATION);
+        return;
+    }
+
+    TreeNodeId node = g_findResults[g_findNext];
+    g_findNext = (g_findNext + 1) % g_findCount;
+    HTREEITEM hItem = (HTREEITEM)TreeMirrorReveal(&g_mirror, node);
+    if(hItem)
+    {
+        TreeView_EnsureVisible(hTreeView, hItem);
+        TreeView_SelectItem(hTreeView, hItem);
+    }
+}
+
+/*=============================================================================
+*   ResetFindResults [BOOL]
+*       Empties the list Find Next steps through, for Compare and Merge to
+*       fill with the items they found. The list lasts until the next edit
+*       or a new search.
+*
+*       Returns FALSE if there is no memory for the list
+=============================================================================*/
+BOOL ResetFindResults()
+{
+    if(!g_findResults)
+    {
+        g_findResults = (TreeNodeId*)malloc(FIND_MAX_RESULTS * sizeof(TreeNodeId));
+    }
+    wcscpy(g_foundText, g_findText);
+    g_findEdits = g_edits;
+    g_findCount = 0;
+    g_findNext = 0;
+    return g_findResults != NULL;
+}
+
+/*=============================================================================
+*   PromptOpenFileName [BOOL]
+*       Shows an open file dialog
+*
+*       Parameters:
+*           HWND hWnd - Owner of the dialog
+*           const wchar_t* title - Title of the dialog
+*           wchar_t* fileName - Receives the file chosen, MAX_PATH characters
+*
+*       Returns TRUE if a file was chosen
+=============================================================================*/
+BOOL PromptOpenFileName(HWND hWnd, const wchar_t* title, wchar_t* fileName)
+{
+    fileName[0] = L'\0';
+    OPENFILENAME ofn = {0};
+    ofn.lStructSize = sizeof(OPENFILENAME);
+    ofn.hwndOwner = hWnd;
+    ofn.lpstrFile = fileName;
+    ofn.nMaxFile = MAX_PATH;
+    ofn.lpstrFilter = FILE_FILTER;
+    ofn.lpstrTitle = title;
+    ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST;
+    return GetOpenFileName(&ofn);
+}
+
+/*=============================================================================
+*   LoadModelFromFile [BOOL]
+*       Reads a file of any format into a model of its own, along with the
+*       edits in its journal, without touching the open document
+*
+*       Parameters:
+*           TreeModel* tree - Receives the file; free it with TreeFree
+*           const wchar_t* fileName - The file
+*
+*       Returns FALSE if the file could not be read; tree is then freed
+=============================================================================*/
+BOOL LoadModelFromFile(TreeModel* tree, const wchar_t* fileName)
+{
+    FILE* file = _wfopen(fileName, L"rb");
+    if(!file || !TreeInit(tree))
+    {
+        if(file)
+        {
+            fclose(file);
+        }
+        return FALSE;
+    }
+
+    int format = TreeStreamFormat(file);
+    int loaded = format == TREE_FORMAT_COMPRESSED ? TreeLoadCompressed(tree, file, g_ioThreads) :
+                 format == TREE_FORMAT_BINARY ? TreeLoadBinary(tree, file) :
+                 format == TREE_FORMAT_TEXT && TreeLoadParallel(tree, file, g_ioThreads);
+    if(!loaded && format == TREE_FORMAT_TEXT && !tree->mapping.data)
+    {
+        rewind(file);
+        loaded = TreeLoadFromStream(tree, file);
+    }
+
+    wchar_t journalPath[MAX_PATH];
+    TreeJournal journal;
+    TreeJournalInit(&journal);
+    if(loaded && JournalPathFor(fileName, journalPath) && TreeJournalReset(&journal, tree, TreeStreamSize(file)))
+    {
+        FILE* log = _wfopen(journalPath, L"rb");
+        if(log)
+        {
+            TreeJournalReplay(&journal, tree, log);
+            fclose(log);
+        }
+    }
+    TreeJournalFree(&journal);
+    fclose(file);
+
+    if(!loaded)
+    {
+        TreeFree(tree);
+    }
+    return loaded;
+}
+
+/*=============================================================================
+*   CompareWithFile [void]
+*       Diffs a file against the document and tells how they differ. Find
+*       Next then steps through the items that differ: those inserted,
+*       moved or changed since the file, and the parents of those deleted.
+*
+*       Parameters:
+*           HWND hWnd - Owner of the dialogs
+*
+=============================================================================*/
+void CompareWithFile(HWND hWnd)
+{
+    wchar_t fileName[MAX_PATH];
+    if(g_loader)
+    {
+        MessageBeep(MB_OK);
+        return;
+    }
+    if(!PromptOpenFileName(hWnd, L"Compare With", fileName))
+    {
+        return;
+    }
+
+    //Pending edits of the selected item only reach the model on selection change
+    if(g_selectedNode != TREE_NIL)
+    {
+        SaveFieldsToSelectedItem();
+    }
+
+    HCURSOR hCursor = SetCursor(LoadCursor(NULL, IDC_WAIT));
+    TreeModel other;
+    if(!LoadModelFromFile(&other, fileName))
+    {
+        SetCursor(hCursor);
+        MessageBox(hWnd, L"The file could not be read", L"Error", MB_OK | MB_ICONERROR);
+        return;
+    }
+    TreeDiff diff;
+    BOOL built = TreeDiffBuild(&diff, &other, &g_tree);
+    SetCursor(hCursor);
+    if(!built)
+    {
+        TreeFree(&other);
+        MessageBox(hWnd, L"Out of memory", L"Error", MB_OK | MB_ICONERROR);
+        return;
+    }
+
+    unsigned counts[TREE_DIFF_MOVE + 1] = {0};
+    BOOL listed = ResetFindResults();
+    for(size_t i = 0; i < diff.count; i++)
+    {
+        const TreeDiffEdit* edit = &diff.edits[i];
+        counts[edit->kind]++;
+        TreeNodeId node = edit->kind == TREE_DIFF_DELETE ? diff.oldToNew[other.parent[edit->oldNode]] : edit->newNode;
+        if(listed && node != TREE_ROOT && node != TREE_NIL && g_findCount < FIND_MAX_RESULTS)
+        {
+            g_findResults[g_findCount++] = node;
+        }
+    }
+    size_t edits = diff.count;
+    TreeDiffFree(&diff);
+    TreeFree(&other);
+
+    if(!edits)
+    {
+        MessageBox(hWnd, L"The document and the file are the same", L"Compare", MB_OK | MB_ICONINFORMATION);
+        return;
+    }
+    wchar_t message[256];
+    wsprintf(message, L"Since the file, %u items were inserted, %u deleted, %u moved and %u changed.\n"
+                      L"Find Next goes through them.",
+             counts[TREE_DIFF_INSERT], counts[TREE_DIFF_DELETE], counts[TREE_DIFF_MOVE], counts[TREE_DIFF_UPDATE]);
+    MessageBox(hWnd, message, L"Compare", MB_OK | MB_ICONINFORMATION);
+    if(g_findCount)
+    {
+        FindNextItem();
+    }
+}
+
+/*=============================================================================
+*   MergeWithFiles [void]
+*       Three-way merge of the document with another revision of it, given
+*       the revision both came from: what the other one changed is added
+*       to the document. Where both changed the same thing the document
+*       wins, and Find Next steps through those items. The merge replaces
+*       the whole document, so it cannot be undone; the next save writes
+*       the whole file.
+*
+*       Parameters:
+*           HWND hWnd - Owner of the dialogs
+*
+=============================================================================*/
+void MergeWithFiles(HWND hWnd)
+{
+    wchar_t theirsName[MAX_PATH];
+    wchar_t baseName[MAX_PATH];
+    if(g_loader)
+    {
+        MessageBeep(MB_OK);
+        return;
+    }
+    if(!PromptOpenFileName(hWnd, L"Merge With", theirsName) ||
+       !PromptOpenFileName(hWnd, L"Merge: the revision both came from", baseName))
+    {
+        return;
+    }
+
+    //Pending edits of the selected item only reach the model on selection change
+    if(g_selectedNode != TREE_NIL)
+    {
+        SaveFieldsToSelectedItem();
+    }
+
+    HCURSOR hCursor = SetCursor(LoadCursor(NULL, IDC_WAIT));
+    TreeModel theirs;
+    TreeModel merged;
+    if(!LoadModelFromFile(&theirs, theirsName))
+    {
+        SetCursor(hCursor);
+        MessageBox(hWnd, L"The file could not be read", L"Error", MB_OK | MB_ICONERROR);
+        return;
+    }
+    if(!LoadModelFromFile(&merged, baseName))
+    {
+        TreeFree(&theirs);
+        SetCursor(hCursor);
+        MessageBox(hWnd, L"The file could not be read", L"Error", MB_OK | MB_ICONERROR);
+        return;
+    }
+
+    //The base becomes the merged document
+    TreeMergeResult result;
+    BOOL done = TreeMerge(&merged, &g_tree, &theirs, &result);
+    TreeFree(&theirs);
+    if(!done)
+    {
+        TreeFree(&merged);
+        SetCursor(hCursor);
+        MessageBox(hWnd, L"Out of memory", L"Error", MB_OK | MB_ICONERROR);
+        return;
+    }
+
+    DeleteTree(hTreeView);
+    TreeFree(&g_tree);
+    g_tree = merged;
+    MirrorTreeToView(hTreeView);
+    UpdateEditFields();
+    g_edits++;
+    SetCursor(hCursor);
+
+    if(ResetFindResults())
+    {
+        for(size_t i = 0; i < result.count && g_findCount < FIND_MAX_RESULTS; i++)
+        {
+            g_findResults[g_findCount++] = result.conflicts[i].node;
+        }
+    }
+    wchar_t message[256];
+    if(result.count)
+    {
+        wsprintf(message, L"%u changes were merged, with %u conflicts: where both sides changed an item the "
+                          L"document's change was kept, and items one side deleted and the other changed were "
+                          L"kept.\nFind Next goes through them.", (unsigned)result.edits, (unsigned)result.count);
+    }
+    else
+    {
+        wsprintf(message, L"%u changes were merged.", (unsigned)result.edits);
+    }
+    TreeMergeResultFree(&result);
+    MessageBox(hWnd, message, L"Merge", MB_OK | (g_findCount ? MB_ICONWARNING : MB_ICONINFORMATION));
+    if(g_findCount)
+    {
+        FindNextItem();
+    }
+}
+
+/*=============================================================================
+*   ShowStats [void]
+*       Shows where this session's time and memory went: the size of the
+*       model and what is kept next to it, the process's peak memory, the
+*       calls into the controls and every timed phase. The counters can be
+*       written to a file as one JSON object, see TreeStatsWrite.
+*
+*       Parameters:
+*           HWND hWnd - Owner of the box and of a save file dialog
+*
+=============================================================================*/
+void ShowStats(HWND hWnd)
+{
+    size_t strings;
+    size_t nodes = TreeModelMemory(&g_tree, &strings);
+    g_stats.indexBytes = TreeIndexMemory(&g_index) + TreePathMemory(&g_paths) + TreeHashMemory(&g_hashes) +
+                         TreeHistoryMemory(&g_history) +
+                         (size_t)g_mirror.capacity * (sizeof(void*) + sizeof(uint8_t));
+
+    wchar_t message[2048];
+    int length = wsprintf(message,
+        L"Nodes: %u\n"
+        L"Node data: %u KB\nStrings: %u KB\nMapped file: %u KB\nIndexes and history: %u KB\n"
+        L"Peak memory: %u KB\n"
+        L"Read: %u KB\nWritten: %u KB\n"
+        L"Calls into the controls: %u\n\n",
+        (unsigned)g_tree.count, (unsigned)(nodes / 1024), (unsigned)(strings / 1024),
+        (unsigned)(g_tree.mapping.size / 1024), (unsigned)(g_stats.indexBytes / 1024),
+        (unsigned)(TreePeakMemory() / 1024), (unsigned)(g_stats.bytesRead / 1024),
+        (unsigned)(g_stats.bytesWritten / 1024), (unsigned)g_stats.viewCalls);
+
+    //wsprintf has no floating point, times are shown in whole milliseconds
+    for(int phase = 0; phase < TREE_PHASE_COUNT; phase++)
+    {
+        const TreePhaseStats* entry = &g_stats.phases[phase];
+        length += wsprintf(message + length, L"%hs: %u runs, %u ms in all, %u ms last, %u ms longest\n",
+                           TreeStatsPhaseName(phase), (unsigned)entry->runs, (unsigned)(entry->seconds * 1000),
+                           (unsigned)(entry->last * 1000), (unsigned)(entry->longest * 1000));
+    }
+    wcscat(message, L"\nWrite these counters to a file as JSON?");
+    if(MessageBox(hWnd, message, L"Statistics", MB_YESNO | MB_ICONINFORMATION) != IDYES)
+    {
+        return;
+    }
+
+    wchar_t szFile[MAX_PATH] = L"dtree-stats.json";
+    OPENFILENAME ofn = {0};
+    ofn.lStructSize = sizeof(OPENFILENAME);
+    ofn.hwndOwner = hWnd;
+    ofn.lpstrFile = szFile;
+    ofn.nMaxFile = MAX_PATH;
+    ofn.lpstrFilter = STATS_FILTER;
+    ofn.Flags = OFN_OVERWRITEPROMPT;
+    if(!GetSaveFileName(&ofn))
+    {
+        return;
+    }
+    FILE* file = _wfopen(szFile, L"w");
+    int written = file && TreeStatsWrite(&g_stats, &g_tree, file);
+    if(!file || fclose(file) != 0 || !written)
+    {
+        MessageBox(hWnd, L"Failed to write the statistics", L"Error", MB_OK | MB_ICONERROR);
+    }
+}
+
+/*=============================================================================
+*   MirrorTreeToView [void]
+*       Shows a freshly loaded model in the TreeView emptied by DeleteTree.
+*       Only the top level items are inserted; deeper ones follow as they
+*       are expanded.
+*
+*       Parameters:
+*           HWND hTreeView - The TreeView we are going to fill
+*
+=============================================================================*/
+void MirrorTreeToView(HWND hTreeView)
+{
+    double start = TreeStatsStart();
+    SendMessage(hTreeView, WM_SETREDRAW, FALSE, 0);
+    if(!TreeMirrorReset(&g_mirror))
+    {
+        MessageBox(hMainWindow, L"Out of memory", L"Error", MB_OK | MB_ICONERROR);
+    }
+    SendMessage(hTreeView, WM_SETREDRAW, TRUE, 0);
+    TreeStatsCount(&g_stats, viewCalls, 2);
+    TreeStatsStop(&g_stats, TREE_PHASE_VIEW, start);
+}
+
+/*=============================================================================
+*   LoadTreeFromFile [void]
+*       Opens any format, telling them apart by their magic numbers, then
+*       replays the file's edit journal.
+*       Text is mapped and parsed in the background: the nodes show up as
+*       the worker hands them over on ID_LOAD_TIMER, and the journal is
+*       replayed by FinishLoad once the whole file is in. If the worker
+*       cannot be started the file is loaded right away with
+*       TreeLoadParallel on g_ioThreads threads, or with the buffered
+*       reader if it cannot be mapped either. Binary files
+*       need no parsing and are loaded right away; compressed ones are
+*       decoded on g_ioThreads worker threads.
+*
+*       Parameters:
+*           HWND hTreeView - The TreeView we are going to load data into
+*           wchar_t* fileName - The open file name we received from the dialog
+*
+=============================================================================*/
+void LoadTreeFromFile(HWND hTreeView, const wchar_t* fileName)
+{
+    FILE* file = _wfopen(fileName, L"rb");
+    if(file)
+    {
+        DeleteTree(hTreeView);
+
+        double start = TreeStatsStart();
+        g_fileFormat = TreeStreamFormat(file);
+        if(g_fileFormat == TREE_FORMAT_TEXT)
+        {
+            g_loadSize = TreeStreamSize(file);
+            g_loader = TreeLoaderStart(&g_tree, file);
+            if(g_loader)
+            {
+                g_loadStarted = start;
+                fclose(file);
+
+                //Read-only until the whole file is in
+                SendMessage(hNameEditWindow, EM_SETREADONLY, TRUE, 0);
+                SendMessage(hDescEditWindow, EM_SETREADONLY, TRUE, 0);
+                MirrorTreeToView(hTreeView);
+                SetTimer(hMainWindow, ID_LOAD_TIMER, LOAD_TICK, NULL);
+                SetTitleStatus(L"Loading 0%");
+                return;
+            }
+            rewind(file);
+        }
+
+        int loaded = g_fileFormat == TREE_FORMAT_COMPRESSED ? TreeLoadCompressed(&g_tree, file, g_ioThreads) :
+                     g_fileFormat == TREE_FORMAT_BINARY ? TreeLoadBinary(&g_tree, file) :
+                     g_fileFormat == TREE_FORMAT_TEXT && TreeLoadParallel(&g_tree, file, g_ioThreads);
+        if(!loaded && g_fileFormat == TREE_FORMAT_TEXT && !g_tree.mapping.data)
+        {
+            rewind(file);
+            loaded = TreeLoadFromStream(&g_tree, file);
+        }
+        TreeStatsStop(&g_stats, TREE_PHASE_LOAD, start);
+        TreeStatsCount(&g_stats, bytesRead, TreeStreamSize(file));
+        if(loaded)
+        {
+            //Edits saved since the file was last written in full
+            AttachJournal(fileName, TreeStreamSize(file));
+            RememberSavedState();
+        }
+        else
+        {
+            //What was read stays, but only Save As may write it, never autosave
+            g_szFileName[0] = L'\0';
+            g_fileFormat = TREE_FORMAT_TEXT;
+            MessageBox(hMainWindow, L"The file could not be read completely", L"Error", MB_OK | MB_ICONERROR);
+        }
+        fclose(file);
+
+        MirrorTreeToView(hTreeView);
+    }
+    else
+    {
+        //The document open before stays, but not under the name of this file
+        g_szFileName[0] = L'\0';
+        g_fileFormat = TREE_FORMAT_TEXT;
+
+        //Inform the user if for some reason loading fails.
+        MessageBox(hMainWindow, L"Failed to open file", L"Error", MB_OK | MB_ICONERROR);
+    }
+}
+
+/*=============================================================================
+*   LoadedNode [void]
+*       Called by TreeLoaderApply for every node it adds to the model; puts
+*       it in the view if its parent is shown, and in the search indexes if
+*       they have been built meanwhile
+*
+*       Parameters:
+*           void* context - Unused
+*           TreeNodeId node - The node just added
+*
+=============================================================================*/
+void LoadedNode(void* context, TreeNodeId node)
+{
+    (void)context;
+    if(!TreeMirrorAppended(&g_mirror, node))
+    {
+        TreeLoaderCancel(g_loader);
+    }
+    TreeIndexInserted(&g_index, &g_tree, node);
+    TreePathInserted(&g_paths, &g_tree, node);
+    TreeHashInserted(&g_hashes, &g_tree, node);
+}
+
+/*=============================================================================
+*   LoadTick [void]
+*       Adds the nodes the worker has parsed so far, for at most
+*       LOAD_SLICE_MS so the window stays responsive, and shows how far
+*       into the file it is
+=============================================================================*/
+void LoadTick()
+{
+    DWORD started = GetTickCount();
+    size_t added = 0;
+    size_t count;
+
+    SendMessage(hTreeView, WM_SETREDRAW, FALSE, 0);
+    do
+    {
+        count = TreeLoaderApply(g_loader, &g_tree, LOAD_APPLY_NODES, LoadedNode, NULL);
+        added += count;
+    }
+    while(count && GetTickCount() - started < LOAD_SLICE_MS);
+    SendMessage(hTreeView, WM_SETREDRAW, TRUE, 0);
+    TreeStatsCount(&g_stats, viewCalls, 2);
+    if(added)
+    {
+        InvalidateRect(hTreeView, NULL, TRUE);
+    }
+
+    if(TreeLoaderDone(g_loader))
+    {
+        FinishLoad(FALSE);
+        return;
+    }
+    wchar_t status[32];
+    wsprintf(status, L"Loading %d%%", (int)(TreeLoaderProgress(g_loader) * 100.0));
+    SetTitleStatus(status);
+}
+
+/*=============================================================================
+*   StopLoad [int]
+*       Ends the open in the background and makes the document editable.
+*       The nodes added so far stay in the model.
+*
+*       Parameters:
+*           BOOL cancel - Stop the worker instead of waiting for the end
+*
+*       Returns what TreeLoaderFinish reports
+=============================================================================*/
+int StopLoad(BOOL cancel)
+{
+    KillTimer(hMainWindow, ID_LOAD_TIMER);
+    if(cancel)
+    {
+        TreeLoaderCancel(g_loader);
+    }
+    int result = TreeLoaderFinish(g_loader);
+    g_loader = NULL;
+
+    SendMessage(hNameEditWindow, EM_SETREADONLY, FALSE, 0);
+    SendMessage(hDescEditWindow, EM_SETREADONLY, FALSE, 0);
+    return result;
+}
+
+/*=============================================================================
+*   FinishLoad [void]
+*       Ends the open in the background. A complete file gets its journal
+*       replayed, after which the view is mirrored again since the replay
+*       does not go through it. A cancelled open leaves an empty document.
+*
+*       Parameters:
+*           BOOL cancel - The user cancelled the open
+*
+=============================================================================*/
+void FinishLoad(BOOL cancel)
+{
+    int result = StopLoad(cancel);
+    SetTitleStatus(NULL);
+
+    //From the start of the open to the last node in the view
+    TreeStatsStop(&g_stats, TREE_PHASE_LOAD, g_loadStarted);
+    if(result == TREE_PARSE_OK)
+    {
+        TreeStatsCount(&g_stats, bytesRead, g_loadSize);
+        //Edits saved since the file was last written in full
+        if(AttachJournal(g_szFileName, g_loadSize))
+        {
+            hSelectedItem = NULL;
+            g_selectedNode = TREE_NIL;
+            TreeMirrorClear(&g_mirror);
+            TreeIndexClear(&g_index);
+            TreePathClear(&g_paths);
+            TreeHashClear(&g_hashes);
+
+            SendMessage(hTreeView, WM_SETREDRAW, FALSE, 0);
+            TreeView_DeleteAllItems(hTreeView);
+            SendMessage(hTreeView, WM_SETREDRAW, TRUE, 0);
+            MirrorTreeToView(hTreeView);
+            UpdateEditFields();
+        }
+        RememberSavedState();
+    }
+    else if(result == TREE_PARSE_ABORTED)
+    {
+        //Half a document is not worth keeping under the file's name
+        DeleteTree(hTreeView);
+        g_szFileName[0] = L'\0';
+        g_fileFormat = TREE_FORMAT_TEXT;
+        UpdateEditFields();
+    }
+    else
+    {
+        //What was read stays, but only Save As may write it, never autosave
+        g_szFileName[0] = L'\0';
+        g_fileFormat = TREE_FORMAT_TEXT;
+        MessageBox(hMainWindow, L"The file could not be read completely", L"Error", MB_OK | MB_ICONERROR);
+    }
+}
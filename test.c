@@ -0,0 +1,1859 @@
+/*=============================================================================
+*       test.c
+*       Headless checks of the model, run with `make test`. The one argument
+*       is the directory holding the fixtures; every failed check prints a
+*       line and the exit code is the number of failures.
+=============================================================================*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree.h"
+
+/*=============================================================================
+*   Globals
+=============================================================================*/
+
+static const char* g_fixtures = "tests";
+static int g_failures;
+
+#define CHECK(condition) Check((condition) != 0, #condition, __FILE__, __LINE__)
+
+/*=============================================================================
+*   Check [int]
+*       Counts and reports a failed check; returns the condition
+=============================================================================*/
+static int Check(int condition, const char* text, const char* file, int line)
+{
+    if(!condition)
+    {
+        fprintf(stderr, "%s:%d: failed: %s\n", file, line, text);
+        g_failures++;
+    }
+    return condition;
+}
+
+/*=============================================================================
+*   OpenFixture [FILE*]
+*       Opens a file from the fixture directory for reading
+=============================================================================*/
+static FILE* OpenFixture(const char* name)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", g_fixtures, name);
+    FILE* file = fopen(path, "rb");
+    if(!file)
+    {
+        fprintf(stderr, "cannot open %s\n", path);
+    }
+    return file;
+}
+
+/*=============================================================================
+*   StrIs [int]
+*       Nonzero if `str` holds exactly the C string `text`
+=============================================================================*/
+static int StrIs(TreeStr str, const char* text)
+{
+    return str.len == strlen(text) && memcmp(str.ptr, text, str.len) == 0;
+}
+
+/*=============================================================================
+*   Legacy text files
+=============================================================================*/
+
+typedef struct _LegacyNode
+{
+    int depth;
+    const char* name;
+    const char* description;
+} LegacyNode;
+
+/*
+*   What tests/legacy.dat holds once decoded, in preorder. Files without a
+*   byte order mark wrote names as is and turned only a line break into
+*   "\n", so every other backslash is part of the text, and so is every
+*   tab after a description's indent.
+*/
+static const LegacyNode g_legacy[] =
+{
+    { 0, "C:\\temp\\new", "\\\\server\\share\nsecond line" },
+    { 1, "Child\\{1\\}", "caf\xC3\xA9\\t" },
+    { 2, "Indented", "\t\ttwo tabs kept" },
+    { 0, "A", "\tindented desc" },
+};
+
+#define LEGACY_NODES ((int)(sizeof(g_legacy) / sizeof(g_legacy[0])))
+
+/*=============================================================================
+*   CheckLegacyNode [int]
+*       TreeScanEvent checking each node of tests/legacy.dat in turn
+=============================================================================*/
+static int CheckLegacyNode(void* context, int depth, TreeStr name, TreeStr description)
+{
+    int* seen = (int*)context;
+    if(CHECK(*seen < LEGACY_NODES))
+    {
+        const LegacyNode* expected = &g_legacy[*seen];
+        CHECK(depth == expected->depth);
+        CHECK(StrIs(name, expected->name));
+        CHECK(StrIs(description, expected->description));
+    }
+    (*seen)++;
+    return TREE_SCAN_NEXT;
+}
+
+/*=============================================================================
+*   CheckLegacyModel [void]
+*       Checks a model loaded from tests/legacy.dat
+=============================================================================*/
+static void CheckLegacyModel(const TreeModel* tree, const char* loader)
+{
+    int failures = g_failures;
+    int seen = 0;
+    for(TreeNodeId node = TreeNextPreorder(tree, TREE_ROOT, TREE_ROOT); node != TREE_NIL; node = TreeNextPreorder(tree, node, TREE_ROOT))
+    {
+        int depth = 0;
+        for(TreeNodeId parent = tree->parent[node]; parent != TREE_ROOT; parent = tree->parent[parent])
+        {
+            depth++;
+        }
+        CheckLegacyNode(&seen, depth, TreeName(tree, node), TreeDescription(tree, node));
+    }
+    CHECK(seen == LEGACY_NODES);
+    if(g_failures != failures)
+    {
+        fprintf(stderr, "    loaded with %s\n", loader);
+    }
+}
+
+/*=============================================================================
+*   TestLegacyText [void]
+*       Every reader of .dat files keeps the old escape rules for a file
+*       without a byte order mark
+=============================================================================*/
+static void TestLegacyText(void)
+{
+    for(int loader = 0; loader < 4; loader++)
+    {
+        static const char* const names[4] = { "TreeLoadFromStream", "TreeLoadMapped", "TreeLoadParallel below its threshold", "TreeLoaderStart" };
+        FILE* file = OpenFixture("legacy.dat");
+        TreeModel tree;
+        if(!CHECK(file && TreeInit(&tree)))
+        {
+            if(file)
+            {
+                fclose(file);
+            }
+            return;
+        }
+
+        int loaded = 0;
+        if(loader == 0)
+        {
+            loaded = TreeLoadFromStream(&tree, file);
+        }
+        else if(loader == 1)
+        {
+            loaded = TreeLoadMapped(&tree, file);
+        }
+        else if(loader == 2)
+        {
+            loaded = TreeLoadParallel(&tree, file, 2);
+        }
+        else
+        {
+            TreeLoader* background = TreeLoaderStart(&tree, file);
+            if(background)
+            {
+                while(!TreeLoaderDone(background))
+                {
+                    TreeLoaderApply(background, &tree, 1024, NULL, NULL);
+                }
+                TreeLoaderApply(background, &tree, 1024, NULL, NULL);
+                loaded = TreeLoaderFinish(background) == TREE_PARSE_OK;
+            }
+        }
+
+        if(CHECK(loaded))
+        {
+            CheckLegacyModel(&tree, names[loader]);
+        }
+        else
+        {
+            fprintf(stderr, "    loaded with %s\n", names[loader]);
+        }
+        TreeFree(&tree);
+        fclose(file);
+    }
+
+    FILE* file = OpenFixture("legacy.dat");
+    if(!CHECK(file))
+    {
+        return;
+    }
+    int seen = 0;
+    CHECK(TreeScanStream(file, TREE_FORMAT_TEXT, CheckLegacyNode, &seen) == TREE_PARSE_OK);
+    CHECK(seen == LEGACY_NODES);
+    fclose(file);
+}
+
+/*=============================================================================
+*   View mirror
+=============================================================================*/
+
+/*=============================================================================
+*   AddNamed [TreeNodeId]
+*       Adds a node with a name and no description as the last child
+=============================================================================*/
+static TreeNodeId AddNamed(TreeModel* tree, TreeNodeId parent, const char* name)
+{
+    return TreeAddNode(tree, parent, TreeStrFromC(name), TreeStrFromC(""));
+}
+
+/*=============================================================================
+*   CountHandles [int64_t]
+*       Nodes the mirror has a handle for, counted the slow way
+=============================================================================*/
+static int64_t CountHandles(const TreeMirror* mirror)
+{
+    int64_t count = 0;
+    for(TreeNodeId node = 0; node < mirror->tree->used; node++)
+    {
+        count += TreeMirrorHandle(mirror, node) != NULL;
+    }
+    return count;
+}
+
+/*=============================================================================
+*   CheckMaterialized [void]
+*       The mirror counts `expected` items, and holds as many handles
+=============================================================================*/
+static void CheckMaterialized(const TreeMirror* mirror, int64_t expected, int line)
+{
+    if(mirror->materialized != expected || CountHandles(mirror) != expected)
+    {
+        fprintf(stderr, "%s:%d: failed: materialized %lld, %lld handles, expected %lld\n", __FILE__, line,
+                (long long)mirror->materialized, (long long)CountHandles(mirror), (long long)expected);
+        g_failures++;
+    }
+}
+
+#define CHECK_MATERIALIZED(mirror, expected) CheckMaterialized((mirror), (expected), __LINE__)
+
+/*=============================================================================
+*   TestMirror [void]
+*       Only what has been expanded, added below an expanded parent or
+*       revealed is put in the view, and removals give it back
+=============================================================================*/
+static void TestMirror(void)
+{
+    TreeModel tree;
+    if(!CHECK(TreeInit(&tree)))
+    {
+        return;
+    }
+
+    //A { A1 { A1a A1b } A2 A3 { A3a } }  B { B1 }  C
+    TreeNodeId a = AddNamed(&tree, TREE_ROOT, "A");
+    TreeNodeId a1 = AddNamed(&tree, a, "A1");
+    TreeNodeId a1a = AddNamed(&tree, a1, "A1a");
+    AddNamed(&tree, a1, "A1b");
+    AddNamed(&tree, a, "A2");
+    TreeNodeId a3 = AddNamed(&tree, a, "A3");
+    TreeNodeId a3a = AddNamed(&tree, a3, "A3a");
+    TreeNodeId b = AddNamed(&tree, TREE_ROOT, "B");
+    TreeNodeId b1 = AddNamed(&tree, b, "B1");
+    AddNamed(&tree, TREE_ROOT, "C");
+
+    TreeMirror mirror;
+    TreeMirrorInit(&mirror, &tree, &TreeCountingViewOps, NULL);
+    CHECK_MATERIALIZED(&mirror, 0);
+
+    //The top level only
+    CHECK(TreeMirrorReset(&mirror));
+    CHECK_MATERIALIZED(&mirror, 3);
+    CHECK(TreeMirrorHandle(&mirror, a1) == NULL);
+
+    //Expanding inserts the children once, however often it is repeated
+    CHECK(TreeMirrorExpand(&mirror, a));
+    CHECK_MATERIALIZED(&mirror, 6);
+    CHECK(TreeMirrorExpand(&mirror, a));
+    CHECK_MATERIALIZED(&mirror, 6);
+    CHECK(TreeMirrorExpand(&mirror, a1));
+    CHECK_MATERIALIZED(&mirror, 8);
+    CHECK(!TreeMirrorExpand(&mirror, a3a));
+    CHECK_MATERIALIZED(&mirror, 8);
+
+    //Below an expanded parent only the new node goes in
+    TreeNodeId a4 = AddNamed(&tree, a, "A4");
+    CHECK(TreeMirrorAdded(&mirror, a4));
+    CHECK_MATERIALIZED(&mirror, 9);
+    CHECK(TreeMirrorHandle(&mirror, a4) != NULL);
+
+    //Below a collapsed parent in the view all its children go in
+    TreeNodeId b2 = AddNamed(&tree, b, "B2");
+    CHECK(TreeMirrorAdded(&mirror, b2));
+    CHECK_MATERIALIZED(&mirror, 11);
+    CHECK(TreeMirrorHandle(&mirror, b1) != NULL && TreeMirrorHandle(&mirror, b2) != NULL);
+
+    //Below a parent not in the view nothing does
+    TreeNodeId deep = AddNamed(&tree, a3a, "A3a1");
+    CHECK(TreeMirrorAdded(&mirror, deep));
+    CHECK_MATERIALIZED(&mirror, 11);
+    CHECK(TreeMirrorHandle(&mirror, deep) == NULL);
+
+    //Removing a subtree gives back its materialized part
+    TreeMirrorRemoved(&mirror, a1);
+    TreeDeleteSubtree(&tree, a1);
+    CHECK_MATERIALIZED(&mirror, 8);
+    CHECK(TreeMirrorHandle(&mirror, a1a) == NULL);
+
+    //Removing a node that is not in the view changes nothing
+    TreeMirrorRemoved(&mirror, deep);
+    CHECK_MATERIALIZED(&mirror, 8);
+
+    //Revealing inserts the children of every ancestor on the way down
+    void* handle = TreeMirrorReveal(&mirror, deep);
+    CHECK(handle != NULL && handle == TreeMirrorHandle(&mirror, deep));
+    CHECK_MATERIALIZED(&mirror, 10);
+    CHECK(TreeMirrorReveal(&mirror, deep) == handle);
+    CHECK_MATERIALIZED(&mirror, 10);
+
+    //Clearing forgets everything; a reset starts over from the top level
+    TreeMirrorClear(&mirror);
+    CHECK_MATERIALIZED(&mirror, 0);
+    CHECK(TreeMirrorReset(&mirror));
+    CHECK_MATERIALIZED(&mirror, 3);
+
+    TreeMirrorFree(&mirror);
+    TreeFree(&tree);
+}
+
+/*=============================================================================
+*   Generated trees
+=============================================================================*/
+
+/*=============================================================================
+*   NextRandom [uint64_t]
+*       xorshift64*, the same generator as bench.c
+=============================================================================*/
+static uint64_t NextRandom(uint64_t* state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/*=============================================================================
+*   RandomText [TreeStr]
+*       Up to `max` bytes of text at `out`, with the bytes the text format
+*       has to escape and some that are not ASCII
+=============================================================================*/
+static TreeStr RandomText(uint64_t* state, char* out, uint32_t max)
+{
+    static const char* const pieces[] = { "a", "b", "c", "d", "e", " ", "\\", "{", "}", "\t", "\n", "\r", "\xC3\xA9", "\xE2\x82\xAC", "node" };
+    uint32_t length = 0;
+    uint32_t count = (uint32_t)(NextRandom(state) % max);
+    for(uint32_t i = 0; i < count; i++)
+    {
+        const char* piece = pieces[NextRandom(state) % (sizeof(pieces) / sizeof(pieces[0]))];
+        size_t size = strlen(piece);
+        if(length + size > max)
+        {
+            break;
+        }
+        memcpy(out + length, piece, size);
+        length += (uint32_t)size;
+    }
+    TreeStr text = { out, length };
+    return text;
+}
+
+/*=============================================================================
+*   BuildTree [int]
+*       Fills an empty model with `count` nodes under random parents, so
+*       ids are not in preorder. Every eighth node is added under a node
+*       close to the last one, which makes the tree deep in places.
+=============================================================================*/
+static int BuildTree(TreeModel* tree, int32_t count, uint64_t seed)
+{
+    uint64_t state = seed * 0x9E3779B97F4A7C15ULL + 1;
+    char name[64];
+    char description[256];
+    for(int32_t i = 0; i < count; i++)
+    {
+        TreeNodeId parent = TREE_ROOT;
+        uint64_t pick = NextRandom(&state);
+        if(tree->used > 1 && pick % 8 == 0)
+        {
+            parent = tree->used - 1 - (TreeNodeId)(NextRandom(&state) % 4 % (uint64_t)(tree->used - 1));
+        }
+        else if(tree->used > 1 && pick % 8 > 1)
+        {
+            parent = 1 + (TreeNodeId)(NextRandom(&state) % (uint64_t)(tree->used - 1));
+        }
+        if(TreeAddNode(tree, parent, RandomText(&state, name, sizeof(name)), RandomText(&state, description, sizeof(description))) == TREE_NIL)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   SaveToMemory [char*]
+*       Saves a model as text through a temporary file and reads it back;
+*       `threads` 0 for TreeSaveToStream, else TreeSaveToStreamParallel
+*
+*       Returns the bytes, to be freed, or NULL on failure
+=============================================================================*/
+static char* SaveToMemory(const TreeModel* tree, int threads, size_t* size)
+{
+    FILE* file = tmpfile();
+    if(!file)
+    {
+        return NULL;
+    }
+    int saved = threads ? TreeSaveToStreamParallel(tree, file, threads) : TreeSaveToStream(tree, file);
+    *size = (size_t)TreeStreamSize(file);
+    char* bytes = (char*)malloc(*size + 1);
+    rewind(file);
+    if(!saved || !bytes || fread(bytes, 1, *size, file) != *size)
+    {
+        free(bytes);
+        bytes = NULL;
+    }
+    fclose(file);
+    return bytes;
+}
+
+//LOAD_PARALLEL_MIN_BYTES in treeio.c; smaller files are not split
+#define LARGE_TEXT_BYTES (4 * 1024 * 1024)
+
+/*=============================================================================
+*   LargeText [char*]
+*       The text of a generated tree big enough for TreeLoadParallel to
+*       split among threads. All of it is under one top level node, so the
+*       split is below the top and the stitched nodes above the blocks get
+*       ids after theirs.
+*
+*       Returns the bytes, to be freed, or NULL on failure
+=============================================================================*/
+static char* LargeText(size_t* size)
+{
+    TreeModel tree;
+    char* text = NULL;
+    if(TreeInit(&tree) && BuildTree(&tree, 40000, 5))
+    {
+        TreeNodeId top = TreeAddNode(&tree, TREE_ROOT, TreeStrFromC("top"), TreeStrFromC(""));
+        int moved = top != TREE_NIL;
+        while(moved && tree.firstChild[TREE_ROOT] != top)
+        {
+            moved = TreeMoveNode(&tree, tree.firstChild[TREE_ROOT], top, TREE_NIL);
+        }
+        text = moved ? SaveToMemory(&tree, 0, size) : NULL;
+    }
+    TreeFree(&tree);
+    if(text && *size <= LARGE_TEXT_BYTES)
+    {
+        free(text);
+        text = NULL;
+    }
+    return text;
+}
+
+/*=============================================================================
+*   SameText [int]
+*       Nonzero if two models save to the same bytes
+=============================================================================*/
+static int SameText(const TreeModel* a, const TreeModel* b)
+{
+    size_t sizeA = 0;
+    size_t sizeB = 0;
+    char* textA = SaveToMemory(a, 0, &sizeA);
+    char* textB = SaveToMemory(b, 0, &sizeB);
+    int same = textA && textB && sizeA == sizeB && memcmp(textA, textB, sizeA) == 0;
+    free(textA);
+    free(textB);
+    return same;
+}
+
+/*=============================================================================
+*   TempFileOf [FILE*]
+*       A temporary file holding `bytes`, positioned at the start
+=============================================================================*/
+static FILE* TempFileOf(const char* bytes, size_t size)
+{
+    FILE* file = tmpfile();
+    if(file && (fwrite(bytes, 1, size, file) != size || fflush(file) != 0))
+    {
+        fclose(file);
+        return NULL;
+    }
+    if(file)
+    {
+        rewind(file);
+    }
+    return file;
+}
+
+/*=============================================================================
+*   LoadText [int]
+*       Loads a model from .dat bytes held in memory
+=============================================================================*/
+static int LoadText(TreeModel* tree, const char* bytes, size_t size)
+{
+    FILE* file = TempFileOf(bytes, size);
+    int loaded = file && TreeLoadFromStream(tree, file);
+    if(file)
+    {
+        fclose(file);
+    }
+    return loaded;
+}
+
+/*=============================================================================
+*   LoadParallelText [int]
+*       Loads a model from .dat bytes held in memory with TreeLoadParallel
+=============================================================================*/
+static int LoadParallelText(TreeModel* tree, const char* bytes, size_t size, int threads)
+{
+    FILE* file = TempFileOf(bytes, size);
+    int loaded = file && TreeLoadParallel(tree, file, threads);
+    if(file)
+    {
+        fclose(file);
+    }
+    return loaded;
+}
+
+/*=============================================================================
+*   InPreorder [int]
+*       Nonzero if ids grow along the preorder, as they do after a
+*       sequential load
+=============================================================================*/
+static int InPreorder(const TreeModel* tree)
+{
+    TreeNodeId last = TREE_ROOT;
+    for(TreeNodeId node = TreeNextPreorder(tree, TREE_ROOT, TREE_ROOT); node != TREE_NIL;
+        node = TreeNextPreorder(tree, node, TREE_ROOT))
+    {
+        if(node < last)
+        {
+            return 0;
+        }
+        last = node;
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   Editing
+=============================================================================*/
+
+/*
+*   A document as the window keeps it: the model and everything that
+*   follows its edits, each told about an edit the way dtree.c does
+*/
+typedef struct _Document
+{
+    TreeModel tree;
+    TreeJournal journal;
+    TreeIndex index;
+    TreePathIndex paths;
+    TreeHashCache hashes;
+    TreeHistory history;
+    uint64_t state;         //random state of RandomEdits
+} Document;
+
+/*=============================================================================
+*   DocInit [int]
+*       An empty document, its journal not attached
+=============================================================================*/
+static int DocInit(Document* doc, uint64_t seed)
+{
+    TreeJournalInit(&doc->journal);
+    TreeIndexInit(&doc->index);
+    TreePathInit(&doc->paths);
+    TreeHashInit(&doc->hashes);
+    TreeHistoryInit(&doc->history);
+    doc->state = seed * 0x9E3779B97F4A7C15ULL + 7;
+    return TreeInit(&doc->tree);
+}
+
+/*=============================================================================
+*   DocFree [void]
+=============================================================================*/
+static void DocFree(Document* doc)
+{
+    TreeHistoryFree(&doc->history);
+    TreeHashFree(&doc->hashes);
+    TreePathFree(&doc->paths);
+    TreeIndexFree(&doc->index);
+    TreeJournalFree(&doc->journal);
+    TreeFree(&doc->tree);
+}
+
+/*=============================================================================
+*   DocInsert [TreeNodeId]
+*       AddItemToTree: adds a node as the last child of `parent`
+=============================================================================*/
+static TreeNodeId DocInsert(Document* doc, TreeNodeId parent, const char* name, const char* description)
+{
+    TreeNodeId node = TreeAddNode(&doc->tree, parent, TreeStrFromC(name), TreeStrFromC(description));
+    if(node != TREE_NIL)
+    {
+        TreeJournalInserted(&doc->journal, &doc->tree, node);
+        TreeIndexInserted(&doc->index, &doc->tree, node);
+        TreePathInserted(&doc->paths, &doc->tree, node);
+        TreeHashInserted(&doc->hashes, &doc->tree, node);
+        TreeHistoryInserted(&doc->history, &doc->tree, node);
+    }
+    return node;
+}
+
+/*=============================================================================
+*   DocRename [void]
+*       SaveFieldsToSelectedItem for the name
+=============================================================================*/
+static void DocRename(Document* doc, TreeNodeId node, const char* name)
+{
+    TreeStr old = TreeName(&doc->tree, node);
+    TreeStr text = TreeStrFromC(name);
+    if(!TreeStrEqual(old, text) && TreeSetName(&doc->tree, node, text))
+    {
+        TreeHistoryNameChanged(&doc->history, &doc->tree, node, old);
+        TreeJournalNameChanged(&doc->journal, &doc->tree, node);
+        TreeIndexChanged(&doc->index, &doc->tree, node);
+        TreePathRenamed(&doc->paths, &doc->tree, node);
+        TreeHashChanged(&doc->hashes, &doc->tree, node);
+    }
+}
+
+/*=============================================================================
+*   DocDescribe [void]
+*       SaveFieldsToSelectedItem for the description
+=============================================================================*/
+static void DocDescribe(Document* doc, TreeNodeId node, const char* description)
+{
+    TreeStr old = TreeDescription(&doc->tree, node);
+    TreeStr text = TreeStrFromC(description);
+    if(!TreeStrEqual(old, text) && TreeSetDescription(&doc->tree, node, text))
+    {
+        TreeHistoryDescriptionChanged(&doc->history, &doc->tree, node, old);
+        TreeJournalDescriptionChanged(&doc->journal, &doc->tree, node);
+        TreeIndexChanged(&doc->index, &doc->tree, node);
+        TreeHashChanged(&doc->hashes, &doc->tree, node);
+    }
+}
+
+/*=============================================================================
+*   DocDelete [void]
+*       DeleteItem: takes a subtree out, kept detached by the history
+=============================================================================*/
+static void DocDelete(Document* doc, TreeNodeId node)
+{
+    TreeJournalDeleted(&doc->journal, &doc->tree, node);
+    TreeIndexDeleted(&doc->index, &doc->tree, node);
+    TreePathDeleted(&doc->paths, &doc->tree, node);
+    TreeHashDeleted(&doc->hashes, &doc->tree, node);
+    TreeHistoryDelete(&doc->history, &doc->tree, node);
+}
+
+/*=============================================================================
+*   DocMove [int]
+*       MoveItem; returns 0 if the model refused the place
+=============================================================================*/
+static int DocMove(Document* doc, TreeNodeId node, TreeNodeId parent, TreeNodeId before)
+{
+    TreeNodeId oldParent = doc->tree.parent[node];
+    TreeNodeId oldBefore = doc->tree.nextSibling[node];
+    if(!TreeMoveNode(&doc->tree, node, parent, before))
+    {
+        return 0;
+    }
+    TreeJournalMoved(&doc->journal, &doc->tree, node);
+    TreePathMoved(&doc->paths, &doc->tree, node);
+    TreeHashMoved(&doc->hashes, &doc->tree, node);
+    TreeHistoryMoved(&doc->history, &doc->tree, node, oldParent, oldBefore);
+    return 1;
+}
+
+/*=============================================================================
+*   DocUndo [int]
+*       UndoEdit and ApplyHistoryChange; returns 0 if there was nothing
+*       to undo or redo
+=============================================================================*/
+static int DocUndo(Document* doc, int redo)
+{
+    TreeChange change;
+    if(redo ? !TreeHistoryRedo(&doc->history, &doc->tree, &change) : !TreeHistoryUndo(&doc->history, &doc->tree, &change))
+    {
+        return 0;
+    }
+    switch(change.kind)
+    {
+        case TREE_CHANGE_DETACHED:
+            TreeJournalDeleted(&doc->journal, &doc->tree, change.node);
+            TreeIndexDeleted(&doc->index, &doc->tree, change.node);
+            TreePathDeleted(&doc->paths, &doc->tree, change.node);
+            TreeHashDeleted(&doc->hashes, &doc->tree, change.node);
+            break;
+        case TREE_CHANGE_ATTACHED:
+            TreeJournalRestored(&doc->journal, &doc->tree, change.node);
+            TreeIndexInserted(&doc->index, &doc->tree, change.node);
+            TreePathInserted(&doc->paths, &doc->tree, change.node);
+            TreeHashInserted(&doc->hashes, &doc->tree, change.node);
+            break;
+        case TREE_CHANGE_NAME:
+            TreeJournalNameChanged(&doc->journal, &doc->tree, change.node);
+            TreeIndexChanged(&doc->index, &doc->tree, change.node);
+            TreePathRenamed(&doc->paths, &doc->tree, change.node);
+            TreeHashChanged(&doc->hashes, &doc->tree, change.node);
+            break;
+        case TREE_CHANGE_DESCRIPTION:
+            TreeJournalDescriptionChanged(&doc->journal, &doc->tree, change.node);
+            TreeIndexChanged(&doc->index, &doc->tree, change.node);
+            TreeHashChanged(&doc->hashes, &doc->tree, change.node);
+            break;
+        case TREE_CHANGE_MOVED:
+            TreeJournalMoved(&doc->journal, &doc->tree, change.node);
+            TreePathMoved(&doc->paths, &doc->tree, change.node);
+            TreeHashMoved(&doc->hashes, &doc->tree, change.node);
+            break;
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   RandomNode [TreeNodeId]
+*       An attached node picked at random, TREE_NIL if there is none
+=============================================================================*/
+static TreeNodeId RandomNode(Document* doc)
+{
+    const TreeModel* tree = &doc->tree;
+    for(int tries = 0; tree->count && tries < 1000; tries++)
+    {
+        TreeNodeId node = 1 + (TreeNodeId)(NextRandom(&doc->state) % (uint64_t)(tree->used - 1));
+        if(TreeIsAttached(tree, node))
+        {
+            return node;
+        }
+    }
+    return TREE_NIL;
+}
+
+/*=============================================================================
+*   RandomEdits [void]
+*       Makes `count` edits of every kind at random places, undoing and
+*       redoing now and then
+=============================================================================*/
+static void RandomEdits(Document* doc, int count)
+{
+    char text[64];
+    for(int i = 0; i < count; i++)
+    {
+        TreeNodeId node = RandomNode(doc);
+        TreeNodeId other = RandomNode(doc);
+        snprintf(text, sizeof(text), "edit %d", i);
+        switch(NextRandom(&doc->state) % 8)
+        {
+            case 0:
+            case 1:
+                DocInsert(doc, node == TREE_NIL ? TREE_ROOT : node, text, "inserted");
+                break;
+            case 2:
+                if(node != TREE_NIL)
+                {
+                    DocRename(doc, node, text);
+                }
+                break;
+            case 3:
+                if(node != TREE_NIL)
+                {
+                    DocDescribe(doc, node, text);
+                }
+                break;
+            case 4:
+                if(node != TREE_NIL)
+                {
+                    DocDelete(doc, node);
+                }
+                break;
+            case 5:
+                if(node != TREE_NIL && other != TREE_NIL && node != other)
+                {
+                    //In front of `other`, or as the last child of it
+                    if(NextRandom(&doc->state) % 2)
+                    {
+                        DocMove(doc, node, doc->tree.parent[other], other);
+                    }
+                    else
+                    {
+                        DocMove(doc, node, other, TREE_NIL);
+                    }
+                }
+                break;
+            case 6:
+                DocUndo(doc, 0);
+                break;
+            case 7:
+                DocUndo(doc, 1);
+                break;
+        }
+    }
+}
+
+/*=============================================================================
+*   Text format
+=============================================================================*/
+
+/*=============================================================================
+*   TestParallelSave [void]
+*       Saving on several threads writes the same bytes as the plain save,
+*       for a tree large enough that the threads are used
+=============================================================================*/
+static void TestParallelSave(void)
+{
+    TreeModel tree;
+    if(!CHECK(TreeInit(&tree)) || !CHECK(BuildTree(&tree, 50000, 1)))
+    {
+        TreeFree(&tree);
+        return;
+    }
+
+    size_t size = 0;
+    char* expected = SaveToMemory(&tree, 0, &size);
+    CHECK(expected != NULL);
+    for(int threads = 2; expected && threads <= 16; threads *= 2)
+    {
+        size_t parallelSize = 0;
+        char* parallel = SaveToMemory(&tree, threads, &parallelSize);
+        if(!CHECK(parallel && parallelSize == size && memcmp(parallel, expected, size) == 0))
+        {
+            fprintf(stderr, "    saved on %d threads\n", threads);
+        }
+        free(parallel);
+    }
+    free(expected);
+    TreeFree(&tree);
+}
+
+/*=============================================================================
+*   TestParallelLoad [void]
+*       Loading a file over the threshold on several threads gives the
+*       model the sequential load gives
+=============================================================================*/
+static void TestParallelLoad(void)
+{
+    size_t size = 0;
+    char* text = LargeText(&size);
+    TreeModel expected;
+    TreeInit(&expected);
+    if(CHECK(text != NULL) && CHECK(LoadText(&expected, text, size)))
+    {
+        for(int threads = 2; threads <= 16; threads *= 2)
+        {
+            TreeModel tree;
+            TreeInit(&tree);
+            //Ids out of preorder show the file was split
+            if(!CHECK(LoadParallelText(&tree, text, size, threads) && !InPreorder(&tree) &&
+                      tree.count == expected.count && SameText(&tree, &expected)))
+            {
+                fprintf(stderr, "    loaded on %d threads\n", threads);
+            }
+            TreeFree(&tree);
+        }
+    }
+    TreeFree(&expected);
+    free(text);
+}
+
+/*=============================================================================
+*   Journal
+=============================================================================*/
+
+/*=============================================================================
+*   ReadAll [char*]
+*       Everything in a file, from its start; the caller frees it
+=============================================================================*/
+static char* ReadAll(FILE* file, size_t* size)
+{
+    long length = (fflush(file) == 0 && fseek(file, 0, SEEK_END) == 0) ? ftell(file) : -1;
+    char* bytes = length >= 0 ? malloc((size_t)length + 1) : NULL;
+    rewind(file);
+    if(bytes && fread(bytes, 1, (size_t)length, file) != (size_t)length)
+    {
+        free(bytes);
+        return NULL;
+    }
+    *size = (size_t)length;
+    return bytes;
+}
+
+/*=============================================================================
+*   ReplayJournal [int]
+*       Loads `tree` from the base text, then replays `log` over it as
+*       AttachJournal does; returns what TreeJournalReplay did
+=============================================================================*/
+static int ReplayJournal(TreeModel* tree, const char* base, size_t baseSize, uint64_t journalSize,
+                         const char* log, size_t logSize, int* torn)
+{
+    TreeJournal journal;
+    TreeJournalInit(&journal);
+    FILE* file = TempFileOf(log, logSize);
+    int replayed = file && LoadText(tree, base, baseSize) &&
+                   TreeJournalReset(&journal, tree, journalSize) &&
+                   TreeJournalReplay(&journal, tree, file);
+    *torn = journal.torn;
+    if(file)
+    {
+        fclose(file);
+    }
+    TreeJournalFree(&journal);
+    return replayed;
+}
+
+/*=============================================================================
+*   TestJournal [void]
+*       Edits recorded against a base file and replayed over it give the
+*       model they were made to; a record cut short by a crash stops the
+*       replay after the ones before it, and a log written against another
+*       base is not applied at all
+=============================================================================*/
+static void TestJournal(void)
+{
+    TreeModel source;
+    size_t baseSize = 0;
+    char* base = NULL;
+    if(CHECK(TreeInit(&source)) && CHECK(BuildTree(&source, 2000, 2)))
+    {
+        base = SaveToMemory(&source, 0, &baseSize);
+    }
+    TreeFree(&source);
+
+    Document live;
+    FILE* log = tmpfile();
+    if(!CHECK(DocInit(&live, 2)) || !CHECK(base && log) || !CHECK(LoadText(&live.tree, base, baseSize)) ||
+       !CHECK(TreeJournalReset(&live.journal, &live.tree, baseSize)))
+    {
+        if(log)
+        {
+            fclose(log);
+        }
+        DocFree(&live);
+        free(base);
+        return;
+    }
+
+    //Every kind of edit once, then a mix of them
+    TreeNodeId first = live.tree.firstChild[TREE_ROOT];
+    TreeNodeId added = DocInsert(&live, TREE_ROOT, "added", "new\nnode");
+    TreeNodeId nested = DocInsert(&live, added, "nested", "below added");
+    DocRename(&live, first, "renamed");
+    DocDescribe(&live, first, "described");
+    DocDelete(&live, live.tree.nextSibling[first]);
+    CHECK(DocUndo(&live, 0));                       //restores the deleted subtree
+    DocDelete(&live, first);
+    CHECK(DocUndo(&live, 0));
+    CHECK(DocUndo(&live, 1));                       //deletes it again
+    CHECK(DocMove(&live, nested, TREE_ROOT, live.tree.firstChild[TREE_ROOT]));
+    CHECK(DocUndo(&live, 0));
+    CHECK(DocUndo(&live, 1));
+    RandomEdits(&live, 400);
+    CHECK(TreeJournalAppend(&live.journal, log));
+
+    size_t beforeSize = 0;
+    char* before = SaveToMemory(&live.tree, 0, &beforeSize);
+    TreeNodeId last = RandomNode(&live);
+    DocRename(&live, last == TREE_NIL ? nested : last, "last edit");
+    CHECK(TreeJournalAppend(&live.journal, log));
+    CHECK(!live.journal.failed && !live.journal.torn);
+
+    size_t logSize = 0;
+    char* logBytes = ReadAll(log, &logSize);
+    fclose(log);
+    CHECK(before && logBytes);
+    for(int step = 0; before && logBytes && step < 4; step++)
+    {
+        TreeModel replayed;
+        int torn = 0;
+        int applied = 0;
+        TreeInit(&replayed);
+        switch(step)
+        {
+            case 0:
+                //The whole log
+                applied = ReplayJournal(&replayed, base, baseSize, baseSize, logBytes, logSize, &torn);
+                CHECK(applied && !torn && SameText(&replayed, &live.tree));
+                break;
+            case 1:
+            {
+                //The last record cut short
+                applied = ReplayJournal(&replayed, base, baseSize, baseSize, logBytes, logSize - 3, &torn);
+                size_t size = 0;
+                char* text = SaveToMemory(&replayed, 0, &size);
+                CHECK(!applied && torn && text && size == beforeSize && memcmp(text, before, size) == 0);
+                free(text);
+                break;
+            }
+            case 2:
+            {
+                //A base of another size
+                applied = ReplayJournal(&replayed, base, baseSize, baseSize + 1, logBytes, logSize, &torn);
+                size_t size = 0;
+                char* text = SaveToMemory(&replayed, 0, &size);
+                CHECK(!applied && torn && text && size == baseSize && memcmp(text, base, size) == 0);
+                free(text);
+                break;
+            }
+            case 3:
+            {
+                //A base with another node count
+                TreeJournal journal;
+                TreeJournalInit(&journal);
+                FILE* file = TempFileOf(logBytes, logSize);
+                CHECK(file && LoadText(&replayed, base, baseSize));
+                CHECK(TreeAddNode(&replayed, TREE_ROOT, TreeStrFromC("extra"), TreeStrFromC("")) != TREE_NIL);
+                size_t size = 0;
+                char* expected = SaveToMemory(&replayed, 0, &size);
+                applied = file && TreeJournalReset(&journal, &replayed, baseSize) &&
+                          TreeJournalReplay(&journal, &replayed, file);
+                size_t textSize = 0;
+                char* text = SaveToMemory(&replayed, 0, &textSize);
+                CHECK(!applied && journal.torn && expected && text && textSize == size &&
+                      memcmp(text, expected, size) == 0);
+                free(expected);
+                free(text);
+                if(file)
+                {
+                    fclose(file);
+                }
+                TreeJournalFree(&journal);
+                break;
+            }
+        }
+        TreeFree(&replayed);
+    }
+    free(logBytes);
+    free(before);
+    DocFree(&live);
+    free(base);
+}
+
+/*=============================================================================
+*   Undo history
+=============================================================================*/
+
+/*=============================================================================
+*   TestHistory [void]
+*       A deleted subtree comes back to the exact place it left, and the
+*       subtrees the history holds detached are freed once no step can
+*       bring them back
+=============================================================================*/
+static void TestHistory(void)
+{
+    Document doc;
+    TreeModel original;
+    TreeNodeId children[5];
+    char name[16];
+    if(!CHECK(DocInit(&doc, 3)) || !CHECK(TreeInit(&original)))
+    {
+        DocFree(&doc);
+        return;
+    }
+    TreeNodeId parent = DocInsert(&doc, TREE_ROOT, "parent", "");
+    for(int i = 0; i < 5; i++)
+    {
+        snprintf(name, sizeof(name), "child %d", i);
+        children[i] = DocInsert(&doc, parent, name, "");
+        DocInsert(&doc, children[i], "grandchild", "");
+    }
+    CHECK(TreeSnapshot(&original, &doc.tree));
+
+    //First, middle and last place among the siblings
+    for(int i = 0; i < 5; i += 2)
+    {
+        TreeNodeId prev = doc.tree.prevSibling[children[i]];
+        TreeNodeId next = doc.tree.nextSibling[children[i]];
+        DocDelete(&doc, children[i]);
+        CHECK(doc.tree.parent[children[i]] == TREE_NIL);
+        CHECK(DocUndo(&doc, 0) && SameText(&doc.tree, &original));
+        CHECK(doc.tree.prevSibling[children[i]] == prev && doc.tree.nextSibling[children[i]] == next);
+        CHECK(DocUndo(&doc, 1) && doc.tree.parent[children[i]] == TREE_NIL);
+        CHECK(DocUndo(&doc, 0) && SameText(&doc.tree, &original));
+    }
+
+    //Room for 64 steps: the deletion is dropped by the 64 edits after it
+    TreeHistoryClear(&doc.history, &doc.tree);
+    doc.history.maxBytes = 64 * TreeHistoryStepSize();
+    TreeNodeId grandchild = doc.tree.firstChild[children[1]];
+    DocDelete(&doc, children[1]);
+    for(int i = 0; i < 63; i++)
+    {
+        snprintf(name, sizeof(name), "edit %d", i);
+        DocRename(&doc, parent, name);
+    }
+    CHECK(doc.history.dropped == 0 && TreeIsLive(&doc.tree, children[1]));
+    DocRename(&doc, parent, "one more");
+    CHECK(doc.history.dropped == 1 && doc.history.undoCount == 64);
+    CHECK(!TreeIsLive(&doc.tree, children[1]) && !TreeIsLive(&doc.tree, grandchild));
+
+    //Undone insertions are freed once a new edit makes them unreachable
+    int32_t count = doc.tree.count;
+    TreeNodeId inserted = DocInsert(&doc, parent, "inserted", "");
+    TreeNodeId below = DocInsert(&doc, inserted, "below", "");
+    CHECK(DocUndo(&doc, 0) && DocUndo(&doc, 0) && doc.history.redoCount == 2);
+    CHECK(TreeIsLive(&doc.tree, inserted) && TreeIsLive(&doc.tree, below));
+    DocRename(&doc, parent, "new edit");
+    CHECK(doc.history.redoCount == 0 && !TreeIsLive(&doc.tree, inserted) && !TreeIsLive(&doc.tree, below));
+    CHECK(doc.tree.count == count);
+
+    TreeFree(&original);
+    DocFree(&doc);
+}
+
+/*=============================================================================
+*   Subtree hashes
+=============================================================================*/
+
+/*=============================================================================
+*   CachedHashIsFresh [int]
+*       Nonzero if the cache's hash of the root is the one TreeHashTree
+*       computes from scratch
+=============================================================================*/
+static int CachedHashIsFresh(Document* doc)
+{
+    uint64_t cached = 0;
+    uint64_t* hashes = (uint64_t*)malloc((size_t)doc->tree.used * sizeof(uint64_t));
+    int fresh = hashes && TreeHashSubtree(&doc->hashes, &doc->tree, TREE_ROOT, &cached) &&
+                TreeHashTree(&doc->tree, hashes) && hashes[TREE_ROOT] == cached;
+    free(hashes);
+    return fresh;
+}
+
+/*=============================================================================
+*   TestHashCache [void]
+*       The cached root hash keeps up with every kind of edit, and an edit
+*       followed by its inverse leaves the document unmodified
+=============================================================================*/
+static void TestHashCache(void)
+{
+    Document doc;
+    uint64_t saved = 0;
+    uint64_t hash = 0;
+    if(!CHECK(DocInit(&doc, 4)) || !CHECK(BuildTree(&doc.tree, 3000, 4)) ||
+       !CHECK(TreeHashSubtree(&doc.hashes, &doc.tree, TREE_ROOT, &saved)))
+    {
+        DocFree(&doc);
+        return;
+    }
+
+    //RememberSavedState, then edits that each undo the one before
+    TreeNodeId node = RandomNode(&doc);
+    TreeNodeId other = RandomNode(&doc);
+    TreeNodeId added = DocInsert(&doc, node, "added", "");
+    CHECK(CachedHashIsFresh(&doc));
+    CHECK(DocUndo(&doc, 0) && TreeHashSubtree(&doc.hashes, &doc.tree, TREE_ROOT, &hash) && hash == saved);
+    CHECK(DocUndo(&doc, 1) && CachedHashIsFresh(&doc) && TreeIsAttached(&doc.tree, added));
+    DocDelete(&doc, added);
+    CHECK(TreeHashSubtree(&doc.hashes, &doc.tree, TREE_ROOT, &hash) && hash == saved);
+
+    TreeStr name = TreeName(&doc.tree, node);
+    char* old = (char*)malloc(name.len + 1);
+    if(CHECK(old != NULL))
+    {
+        memcpy(old, name.ptr, name.len);
+        old[name.len] = '\0';
+        DocRename(&doc, node, "renamed");
+        CHECK(CachedHashIsFresh(&doc) && TreeHashSubtree(&doc.hashes, &doc.tree, TREE_ROOT, &hash) && hash != saved);
+        DocRename(&doc, node, old);
+        CHECK(TreeHashSubtree(&doc.hashes, &doc.tree, TREE_ROOT, &hash) && hash == saved);
+        free(old);
+    }
+
+    if(node != other && DocMove(&doc, other, TREE_ROOT, TREE_NIL))
+    {
+        CHECK(CachedHashIsFresh(&doc));
+        CHECK(DocUndo(&doc, 0) && TreeHashSubtree(&doc.hashes, &doc.tree, TREE_ROOT, &hash) && hash == saved);
+    }
+
+    //Every kind of edit, checked against a fresh hash as it goes
+    for(int round = 0; round < 20; round++)
+    {
+        RandomEdits(&doc, 25);
+        if(!CHECK(CachedHashIsFresh(&doc)))
+        {
+            fprintf(stderr, "    after round %d\n", round);
+            break;
+        }
+    }
+    DocFree(&doc);
+}
+
+/*=============================================================================
+*   Search index
+=============================================================================*/
+
+/*=============================================================================
+*   CompareIds [int]
+*       qsort order of node ids
+=============================================================================*/
+static int CompareIds(const void* a, const void* b)
+{
+    TreeNodeId x = *(const TreeNodeId*)a;
+    TreeNodeId y = *(const TreeNodeId*)b;
+    return (x > y) - (x < y);
+}
+
+/*=============================================================================
+*   Folded [int]
+*       A byte with ASCII letters folded to lowercase
+=============================================================================*/
+static int Folded(unsigned char byte)
+{
+    return byte >= 'A' && byte <= 'Z' ? byte - 'A' + 'a' : byte;
+}
+
+/*=============================================================================
+*   IsWordByte [int]
+*       Letters, digits and any byte of a multibyte character
+=============================================================================*/
+static int IsWordByte(unsigned char byte)
+{
+    return (byte >= 'a' && byte <= 'z') || (byte >= 'A' && byte <= 'Z') ||
+           (byte >= '0' && byte <= '9') || byte >= 0x80;
+}
+
+/*=============================================================================
+*   Contains [int]
+*       Whether `text` holds `query` ignoring ASCII case, at a word start
+*       if `prefix`
+=============================================================================*/
+static int Contains(TreeStr text, const char* query, size_t length, int prefix)
+{
+    const unsigned char* bytes = (const unsigned char*)text.ptr;
+    for(size_t i = 0; i + length <= text.len; i++)
+    {
+        size_t j = 0;
+        while(j < length && Folded(bytes[i + j]) == Folded((unsigned char)query[j]))
+        {
+            j++;
+        }
+        if(j == length && (!prefix || i == 0 || !IsWordByte(bytes[i - 1])))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*=============================================================================
+*   CheckFind [int]
+*       TreeIndexFind finds the same nodes as a scan of every attached
+*       node of the model
+=============================================================================*/
+static int CheckFind(const Document* doc, const char* query, size_t length, int flags, TreeNodeId* found, TreeNodeId* expected)
+{
+    const TreeModel* tree = &doc->tree;
+    size_t count = 0;
+    for(TreeNodeId node = TreeNextPreorder(tree, TREE_ROOT, TREE_ROOT); node != TREE_NIL;
+        node = TreeNextPreorder(tree, node, TREE_ROOT))
+    {
+        if(Contains(TreeName(tree, node), query, length, flags & TREE_FIND_PREFIX) ||
+           Contains(TreeDescription(tree, node), query, length, flags & TREE_FIND_PREFIX))
+        {
+            expected[count++] = node;
+        }
+    }
+    qsort(expected, count, sizeof(TreeNodeId), CompareIds);
+    size_t foundCount = TreeIndexFind(&doc->index, tree, query, length, flags, found, (size_t)tree->count + 1);
+    qsort(found, foundCount, sizeof(TreeNodeId), CompareIds);
+    if(foundCount != count || memcmp(found, expected, count * sizeof(TreeNodeId)) != 0)
+    {
+        fprintf(stderr, "    query \"%.*s\"%s: %zu found, %zu expected\n", (int)length, query,
+                flags & TREE_FIND_PREFIX ? " as a prefix" : "", foundCount, count);
+        return 0;
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   CheckQueries [void]
+*       Checks queries cut from the text of random nodes: substrings of
+*       three bytes and more, some in upper case, and word starts of one
+*       and two bytes as prefixes
+=============================================================================*/
+static void CheckQueries(Document* doc, int count)
+{
+    size_t capacity = (size_t)doc->tree.used + 1;
+    TreeNodeId* found = (TreeNodeId*)malloc(capacity * sizeof(TreeNodeId));
+    TreeNodeId* expected = (TreeNodeId*)malloc(capacity * sizeof(TreeNodeId));
+    if(!CHECK(found && expected))
+    {
+        free(found);
+        free(expected);
+        return;
+    }
+    CHECK(CheckFind(doc, "zzz", 3, 0, found, expected));
+    for(int i = 0; i < count; i++)
+    {
+        TreeNodeId node = RandomNode(doc);
+        if(node == TREE_NIL)
+        {
+            break;
+        }
+        TreeStr text = i % 2 ? TreeName(&doc->tree, node) : TreeDescription(&doc->tree, node);
+        char query[8];
+        uint32_t start = text.len ? (uint32_t)(NextRandom(&doc->state) % text.len) : 0;
+        if(i % 3 == 2)
+        {
+            //A word start, as a prefix
+            while(start < text.len && (!IsWordByte((unsigned char)text.ptr[start]) ||
+                  (start > 0 && IsWordByte((unsigned char)text.ptr[start - 1]))))
+            {
+                start++;
+            }
+            size_t length = 1 + i % 2;
+            if(start + length <= text.len)
+            {
+                memcpy(query, text.ptr + start, length);
+                if(!CHECK(CheckFind(doc, query, length, TREE_FIND_PREFIX, found, expected)))
+                {
+                    break;
+                }
+            }
+            continue;
+        }
+        size_t length = 3 + (size_t)(NextRandom(&doc->state) % 4);
+        if(start + length > text.len)
+        {
+            continue;
+        }
+        for(size_t j = 0; j < length; j++)
+        {
+            char byte = text.ptr[start + j];
+            query[j] = i % 5 == 0 && byte >= 'a' && byte <= 'z' ? (char)(byte - 'a' + 'A') : byte;
+        }
+        if(!CHECK(CheckFind(doc, query, length, 0, found, expected)))
+        {
+            break;
+        }
+    }
+    free(found);
+    free(expected);
+}
+
+/*=============================================================================
+*   TestSearchIndex [void]
+*       The index finds what a scan of the model finds, built over a tree
+*       whose ids are not in preorder, kept up through edits and moves,
+*       and built over a tree loaded on several threads
+=============================================================================*/
+static void TestSearchIndex(void)
+{
+    Document doc;
+    if(CHECK(DocInit(&doc, 6)) && CHECK(BuildTree(&doc.tree, 5000, 6)) && CHECK(TreeIndexBuild(&doc.index, &doc.tree)))
+    {
+        CheckQueries(&doc, 100);
+        for(int round = 0; round < 5; round++)
+        {
+            RandomEdits(&doc, 200);
+            CheckQueries(&doc, 40);
+        }
+        CHECK(TreeIndexBuild(&doc.index, &doc.tree));
+        CheckQueries(&doc, 40);
+    }
+    DocFree(&doc);
+
+    //TreeAdoptModel leaves the ids of a parallel load out of preorder
+    size_t size = 0;
+    char* text = LargeText(&size);
+    if(CHECK(text != NULL) && CHECK(DocInit(&doc, 7)))
+    {
+        if(CHECK(LoadParallelText(&doc.tree, text, size, 4)) && CHECK(!InPreorder(&doc.tree)) &&
+           CHECK(TreeIndexBuild(&doc.index, &doc.tree)))
+        {
+            CheckQueries(&doc, 40);
+            RandomEdits(&doc, 500);
+            CheckQueries(&doc, 40);
+        }
+        DocFree(&doc);
+    }
+    free(text);
+}
+
+/*=============================================================================
+*   Path index
+=============================================================================*/
+
+/*=============================================================================
+*   ResolveSlowly [TreeNodeId]
+*       The node TreePathFind should find for the path of `node`: from the
+*       top, the first sibling in order with the name of each node on the
+*       way down. That is TREE_NIL if an earlier sibling of the same name
+*       has no child of the next name.
+=============================================================================*/
+static TreeNodeId ResolveSlowly(const TreeModel* tree, TreeNodeId node, TreeNodeId* way)
+{
+    size_t depth = 0;
+    for(TreeNodeId up = node; up != TREE_ROOT; up = tree->parent[up])
+    {
+        way[depth++] = up;
+    }
+    TreeNodeId found = TREE_ROOT;
+    while(depth-- > 0 && found != TREE_NIL)
+    {
+        TreeNodeId child = tree->firstChild[found];
+        while(child != TREE_NIL && !TreeStrEqual(TreeName(tree, child), TreeName(tree, way[depth])))
+        {
+            child = tree->nextSibling[child];
+        }
+        found = child;
+    }
+    return found;
+}
+
+/*=============================================================================
+*   CheckPaths [void]
+*       The paths of random nodes and of `extra` lead where a walk over
+*       the siblings leads; a path one step past them, to a name no node
+*       has, is not found
+=============================================================================*/
+static void CheckPaths(Document* doc, int count, TreeNodeId extra)
+{
+    const TreeModel* tree = &doc->tree;
+    TreeNodeId* way = (TreeNodeId*)malloc(((size_t)tree->used + 1) * sizeof(TreeNodeId));
+    if(!CHECK(way != NULL))
+    {
+        return;
+    }
+    for(int i = 0; i <= count; i++)
+    {
+        TreeNodeId node = i < count ? RandomNode(doc) : extra;
+        if(node == TREE_NIL || !TreeIsAttached(tree, node))
+        {
+            continue;
+        }
+        size_t length = TreePathFormat(tree, node, NULL, 0);
+        char* path = (char*)malloc(length + sizeof("/no such node"));
+        if(!CHECK(path && TreePathFormat(tree, node, path, length + 1) == length))
+        {
+            free(path);
+            break;
+        }
+        TreeNodeId expected = ResolveSlowly(tree, node, way);
+        TreeNodeId found = TreePathFind(&doc->paths, tree, path, length);
+        memcpy(path + length, "/no such node", sizeof("/no such node"));
+        int missing = TreePathFind(&doc->paths, tree, path, length + sizeof("/no such node") - 1) == TREE_NIL;
+        free(path);
+        if(!CHECK(found == expected && missing))
+        {
+            fprintf(stderr, "    path of node %d found %d, expected %d\n", (int)node, (int)found, (int)expected);
+            break;
+        }
+    }
+    free(way);
+}
+
+/*=============================================================================
+*   TestPathIndex [void]
+*       The path index finds what a walk over the siblings finds, built over
+*       a tree whose ids are not in preorder, kept up through edits and
+*       moves, and built over a tree loaded on several threads
+=============================================================================*/
+static void TestPathIndex(void)
+{
+    Document doc;
+    if(CHECK(DocInit(&doc, 8)) && CHECK(BuildTree(&doc.tree, 5000, 8)) && CHECK(TreePathBuild(&doc.paths, &doc.tree)))
+    {
+        //A name with both characters a path escapes
+        TreeNodeId escaped = DocInsert(&doc, RandomNode(&doc), "a/b\\c", "");
+        CheckPaths(&doc, 500, escaped);
+        for(int round = 0; round < 5; round++)
+        {
+            RandomEdits(&doc, 200);
+            CheckPaths(&doc, 200, escaped);
+        }
+        CHECK(TreePathBuild(&doc.paths, &doc.tree));
+        CheckPaths(&doc, 200, escaped);
+    }
+    DocFree(&doc);
+
+    size_t size = 0;
+    char* text = LargeText(&size);
+    if(CHECK(text != NULL) && CHECK(DocInit(&doc, 9)))
+    {
+        if(CHECK(LoadParallelText(&doc.tree, text, size, 4)) && CHECK(!InPreorder(&doc.tree)) &&
+           CHECK(TreePathBuild(&doc.paths, &doc.tree)))
+        {
+            CheckPaths(&doc, 500, TREE_NIL);
+            RandomEdits(&doc, 500);
+            CheckPaths(&doc, 500, TREE_NIL);
+        }
+        DocFree(&doc);
+    }
+    free(text);
+}
+
+/*=============================================================================
+*   Diff and merge
+=============================================================================*/
+
+/*=============================================================================
+*   FindNamed [TreeNodeId]
+*       The first attached node in preorder with the given name
+=============================================================================*/
+static TreeNodeId FindNamed(const TreeModel* tree, const char* name)
+{
+    for(TreeNodeId node = TreeNextPreorder(tree, TREE_ROOT, TREE_ROOT); node != TREE_NIL;
+        node = TreeNextPreorder(tree, node, TREE_ROOT))
+    {
+        if(StrIs(TreeName(tree, node), name))
+        {
+            return node;
+        }
+    }
+    return TREE_NIL;
+}
+
+/*=============================================================================
+*   CountNamed [int]
+*       Attached nodes with the given name
+=============================================================================*/
+static int CountNamed(const TreeModel* tree, const char* name)
+{
+    int count = 0;
+    for(TreeNodeId node = TreeNextPreorder(tree, TREE_ROOT, TREE_ROOT); node != TREE_NIL;
+        node = TreeNextPreorder(tree, node, TREE_ROOT))
+    {
+        count += StrIs(TreeName(tree, node), name);
+    }
+    return count;
+}
+
+/*=============================================================================
+*   ReachesRoot [int]
+*       Nonzero if the parents of `node` lead to TREE_ROOT, without
+*       trusting them not to form a cycle
+=============================================================================*/
+static int ReachesRoot(const TreeModel* tree, TreeNodeId node)
+{
+    for(int32_t steps = 0; steps <= tree->used; steps++)
+    {
+        if(node == TREE_ROOT)
+        {
+            return 1;
+        }
+        if(node == TREE_NIL)
+        {
+            return 0;
+        }
+        node = tree->parent[node];
+    }
+    return 0;
+}
+
+/*
+*   A three-way merge under test: a common base, and ours and theirs
+*   edited from copies of it
+*/
+typedef struct _MergeCase
+{
+    TreeModel base;
+    TreeModel ours;
+    TreeModel theirs;
+    TreeMergeResult result;
+} MergeCase;
+
+/*=============================================================================
+*   MergeStart [int]
+*       A base of four subtrees, A to D, and ours and theirs as its copies
+=============================================================================*/
+static int MergeStart(MergeCase* merge)
+{
+    memset(merge, 0, sizeof(*merge));
+    TreeModel* base = &merge->base;
+    if(!TreeInit(base) || !TreeInit(&merge->ours) || !TreeInit(&merge->theirs))
+    {
+        return 0;
+    }
+    TreeNodeId a = AddNamed(base, TREE_ROOT, "A");
+    TreeNodeId b = AddNamed(base, TREE_ROOT, "B");
+    TreeNodeId c = AddNamed(base, TREE_ROOT, "C");
+    AddNamed(base, TREE_ROOT, "D");
+    AddNamed(base, a, "A1");
+    AddNamed(base, a, "A2");
+    AddNamed(base, b, "B1");
+    AddNamed(base, b, "B2");
+    AddNamed(base, c, "C1");
+    return TreeSnapshot(&merge->ours, base) && TreeSnapshot(&merge->theirs, base);
+}
+
+/*=============================================================================
+*   MergeFinish [int]
+*       Merges ours and theirs into the base; nonzero on success
+=============================================================================*/
+static int MergeFinish(MergeCase* merge)
+{
+    return TreeMerge(&merge->base, &merge->ours, &merge->theirs, &merge->result);
+}
+
+/*=============================================================================
+*   MergeFree [void]
+=============================================================================*/
+static void MergeFree(MergeCase* merge)
+{
+    TreeMergeResultFree(&merge->result);
+    TreeFree(&merge->theirs);
+    TreeFree(&merge->ours);
+    TreeFree(&merge->base);
+}
+
+/*=============================================================================
+*   TestDiff [void]
+*       Identical models differ by nothing, and one changed name is one
+*       update
+=============================================================================*/
+static void TestDiff(void)
+{
+    MergeCase merge;
+    TreeDiff diff;
+    if(CHECK(MergeStart(&merge)) && CHECK(TreeDiffBuild(&diff, &merge.base, &merge.ours)))
+    {
+        CHECK(diff.count == 0);
+        TreeDiffFree(&diff);
+
+        TreeNodeId a2 = FindNamed(&merge.ours, "A2");
+        CHECK(TreeSetName(&merge.ours, a2, TreeStrFromC("renamed")));
+        if(CHECK(TreeDiffBuild(&diff, &merge.base, &merge.ours)))
+        {
+            CHECK(diff.count == 1 && diff.edits[0].kind == TREE_DIFF_UPDATE &&
+                  diff.edits[0].flags == TREE_DIFF_NAME && diff.edits[0].newNode == a2);
+            TreeDiffFree(&diff);
+        }
+    }
+    MergeFree(&merge);
+}
+
+/*=============================================================================
+*   TestMerge [void]
+*       Edits that do not touch each other are all kept; a subtree one
+*       side deleted and the other changed, and reparents that would make
+*       a cycle, are reported; a subtree both inserted is kept once
+=============================================================================*/
+static void TestMerge(void)
+{
+    MergeCase merge;
+
+    //Disjoint edits
+    if(CHECK(MergeStart(&merge)))
+    {
+        TreeModel expected;
+        CHECK(TreeInit(&expected) && TreeSnapshot(&expected, &merge.base));
+        TreeSetDescription(&merge.ours, FindNamed(&merge.ours, "A1"), TreeStrFromC("ours"));
+        TreeSetDescription(&expected, FindNamed(&expected, "A1"), TreeStrFromC("ours"));
+        AddNamed(&merge.theirs, FindNamed(&merge.theirs, "C"), "C2");
+        AddNamed(&expected, FindNamed(&expected, "C"), "C2");
+        TreeDeleteSubtree(&merge.theirs, FindNamed(&merge.theirs, "D"));
+        TreeDeleteSubtree(&expected, FindNamed(&expected, "D"));
+        CHECK(MergeFinish(&merge) && merge.result.count == 0 && SameText(&merge.base, &expected));
+        TreeFree(&expected);
+    }
+    MergeFree(&merge);
+
+    //Delete against edit
+    if(CHECK(MergeStart(&merge)))
+    {
+        TreeDeleteSubtree(&merge.ours, FindNamed(&merge.ours, "B"));
+        TreeSetDescription(&merge.theirs, FindNamed(&merge.theirs, "B1"), TreeStrFromC("theirs"));
+        if(CHECK(MergeFinish(&merge)) && CHECK(merge.result.count == 1))
+        {
+            TreeNodeId b1 = FindNamed(&merge.base, "B1");
+            CHECK(merge.result.conflicts[0].kind == TREE_MERGE_DELETED);
+            CHECK(FindNamed(&merge.base, "B") != TREE_NIL && b1 != TREE_NIL &&
+                  StrIs(TreeDescription(&merge.base, b1), "theirs"));
+        }
+    }
+    MergeFree(&merge);
+
+    //Crossing reparents: A under B in ours, B under A in theirs
+    if(CHECK(MergeStart(&merge)))
+    {
+        CHECK(TreeMoveNode(&merge.ours, FindNamed(&merge.ours, "A"), FindNamed(&merge.ours, "B"), TREE_NIL));
+        CHECK(TreeMoveNode(&merge.theirs, FindNamed(&merge.theirs, "B"), FindNamed(&merge.theirs, "A"), TREE_NIL));
+        if(CHECK(MergeFinish(&merge)) && CHECK(merge.result.count >= 1))
+        {
+            TreeNodeId a = FindNamed(&merge.base, "A");
+            TreeNodeId b = FindNamed(&merge.base, "B");
+            CHECK(merge.result.conflicts[0].kind == TREE_MERGE_MOVED);
+            CHECK(a != TREE_NIL && b != TREE_NIL && ReachesRoot(&merge.base, a) && ReachesRoot(&merge.base, b));
+            CHECK(merge.base.parent[a] == b);       //ours wins
+        }
+    }
+    MergeFree(&merge);
+
+    //The same subtree inserted on both sides
+    if(CHECK(MergeStart(&merge)))
+    {
+        TreeNodeId ours = TreeAddNode(&merge.ours, FindNamed(&merge.ours, "D"), TreeStrFromC("N"), TreeStrFromC("same"));
+        TreeNodeId theirs = TreeAddNode(&merge.theirs, FindNamed(&merge.theirs, "D"), TreeStrFromC("N"), TreeStrFromC("same"));
+        AddNamed(&merge.ours, ours, "N1");
+        AddNamed(&merge.theirs, theirs, "N1");
+        CHECK(MergeFinish(&merge) && merge.result.count == 0 && SameText(&merge.base, &merge.ours));
+        CHECK(CountNamed(&merge.base, "N") == 1 && CountNamed(&merge.base, "N1") == 1);
+    }
+    MergeFree(&merge);
+}
+
+/*=============================================================================
+*   Binary formats
+=============================================================================*/
+
+/*=============================================================================
+*   Reload [int]
+*       Saves a model in a binary format and loads it back into `out`,
+*       a .dtz file on `threads` both ways
+=============================================================================*/
+static int Reload(const TreeModel* tree, int format, int threads, TreeModel* out)
+{
+    FILE* file = tmpfile();
+    if(!file)
+    {
+        return 0;
+    }
+    int loaded = 0;
+    if(format == TREE_FORMAT_BINARY && TreeSaveBinary(tree, file) && fflush(file) == 0)
+    {
+        rewind(file);
+        loaded = TreeLoadBinary(out, file);
+    }
+    else if(format == TREE_FORMAT_COMPRESSED && TreeSaveCompressed(tree, file, threads) && fflush(file) == 0)
+    {
+        rewind(file);
+        loaded = TreeLoadCompressed(out, file, threads);
+    }
+    fclose(file);
+    return loaded;
+}
+
+/*=============================================================================
+*   EditedTree [int]
+*       A generated tree after random edits, so besides ids out of
+*       preorder it has holes left by deletions and subtrees the history
+*       holds detached
+=============================================================================*/
+static int EditedTree(Document* doc, uint64_t seed)
+{
+    if(!DocInit(doc, seed) || !BuildTree(&doc->tree, 20000, seed))
+    {
+        return 0;
+    }
+    RandomEdits(doc, 2000);
+    for(TreeNodeId node = 1; node < doc->tree.used; node++)
+    {
+        if(TreeIsLive(&doc->tree, node) && doc->tree.parent[node] == TREE_NIL)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*=============================================================================
+*   CheckReload [void]
+*       The text of a model after a trip through a binary format is the
+*       text of the model, whether the model was edited or loaded from
+*       that text
+=============================================================================*/
+static void CheckReload(Document* doc, int format, int threads, const char* name)
+{
+    TreeModel copy;
+    TreeModel loaded;
+    size_t size = 0;
+    char* text = SaveToMemory(&doc->tree, 0, &size);
+    TreeInit(&copy);
+    TreeInit(&loaded);
+    if(CHECK(text && LoadText(&loaded, text, size)))
+    {
+        if(!CHECK(Reload(&doc->tree, format, threads, &copy) && SameText(&copy, &doc->tree)) ||
+           !CHECK(Reload(&loaded, format, threads, &copy) && SameText(&copy, &doc->tree)))
+        {
+            fprintf(stderr, "    through %s on %d threads\n", name, threads);
+        }
+    }
+    TreeFree(&loaded);
+    TreeFree(&copy);
+    free(text);
+}
+
+/*=============================================================================
+*   TestBinary [void]
+*       A round trip through .dtb keeps the text
+=============================================================================*/
+static void TestBinary(void)
+{
+    Document doc;
+    if(CHECK(EditedTree(&doc, 10)))
+    {
+        CheckReload(&doc, TREE_FORMAT_BINARY, 1, ".dtb");
+    }
+    DocFree(&doc);
+}
+
+/*=============================================================================
+*   TestCompressed [void]
+*       A round trip through .dtz keeps the text, with the blocks coded
+*       and decoded on one thread and on several
+=============================================================================*/
+static void TestCompressed(void)
+{
+    Document doc;
+    if(CHECK(EditedTree(&doc, 11)))
+    {
+        for(int threads = 1; threads <= 8; threads *= 2)
+        {
+            CheckReload(&doc, TREE_FORMAT_COMPRESSED, threads, ".dtz");
+        }
+    }
+    DocFree(&doc);
+}
+
+/*=============================================================================
+*   main [int]
+=============================================================================*/
+int main(int argc, char** argv)
+{
+    if(argc > 1)
+    {
+        g_fixtures = argv[1];
+    }
+
+    TestLegacyText();
+    TestMirror();
+    TestParallelSave();
+    TestParallelLoad();
+    TestJournal();
+    TestHistory();
+    TestHashCache();
+    TestSearchIndex();
+    TestPathIndex();
+    TestBinary();
+    TestCompressed();
+    TestDiff();
+    TestMerge();
+
+    if(g_failures)
+    {
+        fprintf(stderr, "%d checks failed\n", g_failures);
+    }
+    else
+    {
+        printf("all checks passed\n");
+    }
+    return g_failures;
+}
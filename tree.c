@@ -0,0 +1,823 @@
+/*=============================================================================
+*       tree.c
+*       Portable tree model: index-linked hierarchy and string storage
+=============================================================================*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree.h"
+
+/*=============================================================================
+*   Strings
+=============================================================================*/
+
+struct _TreeArenaChunk
+{
+    TreeArenaChunk* next;
+    size_t size;
+    size_t used;
+    char bytes[];
+};
+
+#define TREE_ARENA_FIRST_CHUNK (64 * 1024)
+#define TREE_ARENA_MAX_CHUNK (64 * 1024 * 1024)
+
+/*=============================================================================
+*   TreeStrFromC [TreeStr]
+*       Wraps a NUL terminated string without copying it
+=============================================================================*/
+TreeStr TreeStrFromC(const char* text)
+{
+    TreeStr str;
+    str.ptr = text;
+    str.len = (uint32_t)strlen(text);
+    return str;
+}
+
+/*=============================================================================
+*   TreeStrEqual [int]
+=============================================================================*/
+int TreeStrEqual(TreeStr a, TreeStr b)
+{
+    return a.len == b.len && (a.len == 0 || memcmp(a.ptr, b.ptr, a.len) == 0);
+}
+
+/*=============================================================================
+*   TreeArenaInit [void]
+=============================================================================*/
+void TreeArenaInit(TreeArena* arena)
+{
+    arena->head = NULL;
+    arena->nextChunkSize = TREE_ARENA_FIRST_CHUNK;
+    arena->allocated = 0;
+}
+
+/*=============================================================================
+*   TreeArenaAlloc [void*]
+*       Bump allocates `size` bytes
+*
+*       Parameters:
+*           TreeArena* arena - The arena to allocate from
+*           size_t size - Number of bytes
+*           size_t align - Required alignment, a power of two (1 for strings)
+*
+*       Returns NULL if out of memory
+=============================================================================*/
+void* TreeArenaAlloc(TreeArena* arena, size_t size, size_t align)
+{
+    TreeArenaChunk* chunk = arena->head;
+    if(chunk)
+    {
+        chunk->used = (chunk->used + align - 1) & ~(align - 1);
+    }
+    if(!chunk || chunk->used > chunk->size || chunk->size - chunk->used < size)
+    {
+        //Oversized requests get a chunk of their own
+        size_t chunkSize = arena->nextChunkSize;
+        if(chunkSize < size)
+        {
+            chunkSize = size;
+        }
+        chunk = (TreeArenaChunk*)malloc(sizeof(TreeArenaChunk) + chunkSize);
+        if(!chunk)
+        {
+            return NULL;
+        }
+        chunk->size = chunkSize;
+        chunk->used = 0;
+        chunk->next = arena->head;
+        arena->head = chunk;
+        arena->allocated += sizeof(TreeArenaChunk) + chunkSize;
+        if(arena->nextChunkSize < TREE_ARENA_MAX_CHUNK)
+        {
+            arena->nextChunkSize *= 2;
+        }
+    }
+
+    void* bytes = chunk->bytes + chunk->used;
+    chunk->used += size;
+    return bytes;
+}
+
+/*=============================================================================
+*   TreeArenaFree [void]
+*       Releases every chunk at once
+=============================================================================*/
+void TreeArenaFree(TreeArena* arena)
+{
+    TreeArenaChunk* chunk = arena->head;
+    while(chunk)
+    {
+        TreeArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    TreeArenaInit(arena);
+}
+
+/*=============================================================================
+*   TreeArenaAdopt [void]
+*       Moves every chunk of `other` into `arena`, leaving `other` empty.
+*       Pointers into the moved chunks stay valid.
+=============================================================================*/
+void TreeArenaAdopt(TreeArena* arena, TreeArena* other)
+{
+    if(!other->head)
+    {
+        return;
+    }
+    if(!arena->head)
+    {
+        *arena = *other;
+        TreeArenaInit(other);
+        return;
+    }
+
+    //Keep our current chunk at the head so bump allocation continues in it
+    TreeArenaChunk* tail = other->head;
+    while(tail->next)
+    {
+        tail = tail->next;
+    }
+    tail->next = arena->head->next;
+    arena->head->next = other->head;
+    arena->allocated += other->allocated;
+    TreeArenaInit(other);
+}
+
+/*=============================================================================
+*   HashBytes [uint32_t]
+*       FNV-1a, plenty for the short strings that get interned
+=============================================================================*/
+static uint32_t HashBytes(const char* text, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*=============================================================================
+*   TreeStrPoolInit [void]
+=============================================================================*/
+void TreeStrPoolInit(TreeStrPool* pool)
+{
+    TreeArenaInit(&pool->arena);
+    pool->slots = NULL;
+    pool->slotMask = 0;
+    pool->slotUsed = 0;
+}
+
+/*=============================================================================
+*   TreeStrPoolFree [void]
+*       Releases every string in the pool; all handles become invalid
+=============================================================================*/
+void TreeStrPoolFree(TreeStrPool* pool)
+{
+    TreeArenaFree(&pool->arena);
+    free(pool->slots);
+    TreeStrPoolInit(pool);
+}
+
+/*=============================================================================
+*   GrowSlots [int]
+*       Doubles the intern table and rehashes the strings already in it
+=============================================================================*/
+static int GrowSlots(TreeStrPool* pool)
+{
+    uint32_t newCount = pool->slots ? (pool->slotMask + 1) * 2 : 1024;
+    TreeStr* slots = (TreeStr*)calloc(newCount, sizeof(TreeStr));
+    if(!slots)
+    {
+        return 0;
+    }
+
+    for(uint32_t i = 0; pool->slots && i <= pool->slotMask; i++)
+    {
+        TreeStr str = pool->slots[i];
+        if(!str.ptr)
+        {
+            continue;
+        }
+        uint32_t slot = HashBytes(str.ptr, str.len) & (newCount - 1);
+        while(slots[slot].ptr)
+        {
+            slot = (slot + 1) & (newCount - 1);
+        }
+        slots[slot] = str;
+    }
+
+    free(pool->slots);
+    pool->slots = slots;
+    pool->slotMask = newCount - 1;
+    return 1;
+}
+
+/*=============================================================================
+*   TreeStrPoolAdd [int]
+*       Copies a string into the pool. Strings of up to TREE_INTERN_MAX
+*       bytes are looked up first and shared if already present.
+*
+*       Parameters:
+*           TreeStrPool* pool - The pool receiving the string
+*           const char* text - The bytes to store, need not be terminated
+*           size_t length - Number of bytes
+*           TreeStr* out - Receives the handle
+*
+*       Returns nonzero on success, 0 if out of memory
+=============================================================================*/
+int TreeStrPoolAdd(TreeStrPool* pool, const char* text, size_t length, TreeStr* out)
+{
+    //The empty string needs no storage at all
+    if(length == 0)
+    {
+        out->ptr = "";
+        out->len = 0;
+        return 1;
+    }
+
+    uint32_t slot = 0;
+    int intern = length <= TREE_INTERN_MAX;
+    if(intern)
+    {
+        //Keep the table at most half full
+        if(pool->slotUsed * 2 >= pool->slotMask && !GrowSlots(pool))
+        {
+            return 0;
+        }
+
+        slot = HashBytes(text, length) & pool->slotMask;
+        while(pool->slots[slot].ptr)
+        {
+            TreeStr existing = pool->slots[slot];
+            if(existing.len == length && memcmp(existing.ptr, text, length) == 0)
+            {
+                *out = existing;
+                return 1;
+            }
+            slot = (slot + 1) & pool->slotMask;
+        }
+    }
+
+    char* bytes = (char*)TreeArenaAlloc(&pool->arena, length, 1);
+    if(!bytes)
+    {
+        return 0;
+    }
+    memcpy(bytes, text, length);
+    out->ptr = bytes;
+    out->len = (uint32_t)length;
+
+    if(intern)
+    {
+        pool->slots[slot] = *out;
+        pool->slotUsed++;
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   TreeReserve [int]
+*       Grows every link array so that at least `capacity` ids fit
+*
+*       Parameters:
+*           TreeModel* tree - The model to grow
+*           int32_t capacity - Minimum number of ids required
+*
+*       Returns nonzero on success, 0 if out of memory (the model is untouched)
+=============================================================================*/
+int TreeReserve(TreeModel* tree, int32_t capacity)
+{
+    if(capacity <= tree->capacity)
+    {
+        return 1;
+    }
+
+    //Grow geometrically so repeated appends stay amortized O(1)
+    int32_t newCapacity = tree->capacity ? tree->capacity : 64;
+    while(newCapacity < capacity)
+    {
+        newCapacity *= 2;
+    }
+
+    TreeNodeId** links[] =
+    {
+        &tree->parent, &tree->firstChild, &tree->lastChild,
+        &tree->nextSibling, &tree->prevSibling
+    };
+    for(size_t i = 0; i < sizeof(links) / sizeof(links[0]); i++)
+    {
+        TreeNodeId* grown = (TreeNodeId*)realloc(*links[i], newCapacity * sizeof(TreeNodeId));
+        if(!grown)
+        {
+            return 0;
+        }
+        *links[i] = grown;
+    }
+
+    TreeNodeData* data = (TreeNodeData*)realloc(tree->data, newCapacity * sizeof(TreeNodeData));
+    if(!data)
+    {
+        return 0;
+    }
+    tree->data = data;
+    tree->capacity = newCapacity;
+    return 1;
+}
+
+/*=============================================================================
+*   TreeInit [int]
+*       Prepares an empty model holding only the invisible TREE_ROOT
+=============================================================================*/
+int TreeInit(TreeModel* tree)
+{
+    memset(tree, 0, sizeof(*tree));
+    TreeStrPoolInit(&tree->strings);
+    if(!TreeReserve(tree, 1))
+    {
+        return 0;
+    }
+    TreeClear(tree);
+    return 1;
+}
+
+/*=============================================================================
+*   TreeFree [void]
+*       Releases every array owned by the model
+=============================================================================*/
+void TreeFree(TreeModel* tree)
+{
+    free(tree->parent);
+    free(tree->firstChild);
+    free(tree->lastChild);
+    free(tree->nextSibling);
+    free(tree->prevSibling);
+    free(tree->data);
+    TreeStrPoolFree(&tree->strings);
+    TreeUnmap(&tree->mapping);
+    memset(tree, 0, sizeof(*tree));
+}
+
+/*=============================================================================
+*   TreeClear [void]
+*       Drops every node by resetting the id counters and releasing the
+*       string arena in one go. The link arrays are kept so the next
+*       document can reuse them.
+=============================================================================*/
+void TreeClear(TreeModel* tree)
+{
+    TreeStrPoolFree(&tree->strings);
+    TreeUnmap(&tree->mapping);
+
+    tree->used = 1;
+    tree->count = 0;
+    tree->freeList = TREE_NIL;
+
+    tree->parent[TREE_ROOT] = TREE_NIL;
+    tree->firstChild[TREE_ROOT] = TREE_NIL;
+    tree->lastChild[TREE_ROOT] = TREE_NIL;
+    tree->nextSibling[TREE_ROOT] = TREE_NIL;
+    tree->prevSibling[TREE_ROOT] = TREE_NIL;
+    tree->data[TREE_ROOT].name = TreeStrFromC("");
+    tree->data[TREE_ROOT].description = TreeStrFromC("");
+}
+
+/*=============================================================================
+*   TreeIsLive [int]
+*       Returns nonzero if `node` currently refers to a node in the model
+=============================================================================*/
+int TreeIsLive(const TreeModel* tree, TreeNodeId node)
+{
+    return node >= 0 && node < tree->used && tree->parent[node] != TREE_FREE;
+}
+
+/*=============================================================================
+*   TreeSetName [int]
+*       Stores a copy of `name` in the string pool and points the node at it.
+*       Nothing is copied if the name did not change, so a string borrowed
+*       from a mapped file is only copied on its first real modification.
+*       The previous string stays in the arena until the document is cleared.
+*
+*       Returns nonzero on success, 0 if out of memory (the node is untouched)
+=============================================================================*/
+int TreeSetName(TreeModel* tree, TreeNodeId node, TreeStr name)
+{
+    if(TreeStrEqual(tree->data[node].name, name))
+    {
+        return 1;
+    }
+    return TreeStrPoolAdd(&tree->strings, name.ptr, name.len, &tree->data[node].name);
+}
+
+/*=============================================================================
+*   TreeSetDescription [int]
+*       Same as TreeSetName, for the description
+=============================================================================*/
+int TreeSetDescription(TreeModel* tree, TreeNodeId node, TreeStr description)
+{
+    if(TreeStrEqual(tree->data[node].description, description))
+    {
+        return 1;
+    }
+    return TreeStrPoolAdd(&tree->strings, description.ptr, description.len, &tree->data[node].description);
+}
+
+/*=============================================================================
+*   TreeAddNode [TreeNodeId]
+*       Creates a node and appends it as the last child of `parent`
+*
+*       Parameters:
+*           TreeModel* tree - The model to insert into
+*           TreeNodeId parent - Parent node, TREE_ROOT for a top level item
+*           TreeStr name - Initial name, copied into the string pool
+*           TreeStr description - Initial description, copied as well
+*
+*       Returns the new id, or TREE_NIL if out of memory
+=============================================================================*/
+TreeNodeId TreeAddNode(TreeModel* tree, TreeNodeId parent, TreeStr name, TreeStr description)
+{
+    TreeNodeData data;
+    if(!TreeStrPoolAdd(&tree->strings, name.ptr, name.len, &data.name) ||
+       !TreeStrPoolAdd(&tree->strings, description.ptr, description.len, &data.description))
+    {
+        return TREE_NIL;
+    }
+    return TreeAddNodeBorrowed(tree, parent, data.name, data.description);
+}
+
+/*=============================================================================
+*   TreeAddNodeBorrowed [TreeNodeId]
+*       TreeAddNode without copying the strings. The handles are stored as
+*       given, so they must stay valid for as long as the document does,
+*       e.g. because they point into tree->mapping.
+=============================================================================*/
+TreeNodeId TreeAddNodeBorrowed(TreeModel* tree, TreeNodeId parent, TreeStr name, TreeStr description)
+{
+    TreeNodeId node;
+
+    //Reuse a freed id before growing the arrays
+    if(tree->freeList != TREE_NIL)
+    {
+        node = tree->freeList;
+        tree->freeList = tree->nextSibling[node];
+    }
+    else
+    {
+        if(!TreeReserve(tree, tree->used + 1))
+        {
+            return TREE_NIL;
+        }
+        node = tree->used++;
+    }
+
+    tree->parent[node] = TREE_NIL;
+    tree->firstChild[node] = TREE_NIL;
+    tree->lastChild[node] = TREE_NIL;
+    tree->data[node].name = name;
+    tree->data[node].description = description;
+    tree->count++;
+
+    TreeAttachLast(tree, parent, node);
+    return node;
+}
+
+/*=============================================================================
+*   TreeAttachLast [void]
+*       Links a detached node (parent == TREE_NIL), together with anything
+*       below it, in as the last child of `parent`
+=============================================================================*/
+void TreeAttachLast(TreeModel* tree, TreeNodeId parent, TreeNodeId node)
+{
+    tree->parent[node] = parent;
+    tree->nextSibling[node] = TREE_NIL;
+    tree->prevSibling[node] = tree->lastChild[parent];
+
+    //Link in after the current last child
+    if(tree->lastChild[parent] != TREE_NIL)
+    {
+        tree->nextSibling[tree->lastChild[parent]] = node;
+    }
+    else
+    {
+        tree->firstChild[parent] = node;
+    }
+    tree->lastChild[parent] = node;
+}
+
+/*=============================================================================
+*   TreeNextPreorder [TreeNodeId]
+*       Steps to the next node of a depth-first walk without recursion
+*
+*       Parameters:
+*           const TreeModel* tree - The model being walked
+*           TreeNodeId node - The current position
+*           TreeNodeId top - The walk never leaves this node's subtree
+*
+*       Returns TREE_NIL once the subtree of `top` is exhausted
+=============================================================================*/
+TreeNodeId TreeNextPreorder(const TreeModel* tree, TreeNodeId node, TreeNodeId top)
+{
+    if(tree->firstChild[node] != TREE_NIL)
+    {
+        return tree->firstChild[node];
+    }
+    while(node != top)
+    {
+        if(tree->nextSibling[node] != TREE_NIL)
+        {
+            return tree->nextSibling[node];
+        }
+        node = tree->parent[node];
+    }
+    return TREE_NIL;
+}
+
+/*=============================================================================
+*   Unlink [void]
+*       Takes a node out of its parent's child list, leaving it detached
+*       (parent == TREE_NIL) with its own subtree intact
+=============================================================================*/
+static void Unlink(TreeModel* tree, TreeNodeId node)
+{
+    TreeNodeId parent = tree->parent[node];
+    if(parent == TREE_NIL)
+    {
+        return;
+    }
+    TreeNodeId prev = tree->prevSibling[node];
+    TreeNodeId next = tree->nextSibling[node];
+    if(prev != TREE_NIL)
+    {
+        tree->nextSibling[prev] = next;
+    }
+    else
+    {
+        tree->firstChild[parent] = next;
+    }
+    if(next != TREE_NIL)
+    {
+        tree->prevSibling[next] = prev;
+    }
+    else
+    {
+        tree->lastChild[parent] = prev;
+    }
+    tree->parent[node] = TREE_NIL;
+    tree->nextSibling[node] = TREE_NIL;
+    tree->prevSibling[node] = TREE_NIL;
+}
+
+/*=============================================================================
+*   TreeDetach [void]
+*       Takes a node and everything below it out of the document without
+*       freeing them, e.g. so a deletion can be undone. TreeMoveNode puts
+*       it back; TreeDeleteSubtree frees it for good.
+=============================================================================*/
+void TreeDetach(TreeModel* tree, TreeNodeId node)
+{
+    if(node != TREE_ROOT && TreeIsLive(tree, node))
+    {
+        Unlink(tree, node);
+    }
+}
+
+/*=============================================================================
+*   TreeIsAttached [int]
+*       Returns nonzero if `node` is live and in the document, not below a
+*       node taken out with TreeDetach. Costs the depth of the node.
+=============================================================================*/
+int TreeIsAttached(const TreeModel* tree, TreeNodeId node)
+{
+    if(!TreeIsLive(tree, node))
+    {
+        return 0;
+    }
+    while(node != TREE_ROOT && node != TREE_NIL)
+    {
+        node = tree->parent[node];
+    }
+    return node == TREE_ROOT;
+}
+
+/*=============================================================================
+*   TreeMoveNode [int]
+*       Moves a node and everything below it to a new place. Only the links
+*       around the node change; the cost is the depth of `parent`, which is
+*       walked to refuse moving a node into its own subtree.
+*
+*       Parameters:
+*           TreeModel* tree - The model
+*           TreeNodeId node - The node to move, not TREE_ROOT; may be
+*                             detached, which puts it back
+*           TreeNodeId parent - Its new parent
+*           TreeNodeId before - The sibling it is placed in front of, a
+*                               child of `parent`, or TREE_NIL for last
+*
+*       Returns nonzero on success; otherwise nothing changed
+=============================================================================*/
+int TreeMoveNode(TreeModel* tree, TreeNodeId node, TreeNodeId parent, TreeNodeId before)
+{
+    if(node == TREE_ROOT || node == before || !TreeIsLive(tree, node) || !TreeIsLive(tree, parent) ||
+       (before != TREE_NIL && (!TreeIsLive(tree, before) || tree->parent[before] != parent)))
+    {
+        return 0;
+    }
+    for(TreeNodeId up = parent; up != TREE_NIL; up = tree->parent[up])
+    {
+        if(up == node)
+        {
+            return 0;
+        }
+    }
+
+    Unlink(tree, node);
+    if(before == TREE_NIL)
+    {
+        TreeAttachLast(tree, parent, node);
+        return 1;
+    }
+
+    TreeNodeId prev = tree->prevSibling[before];
+    tree->parent[node] = parent;
+    tree->prevSibling[node] = prev;
+    tree->nextSibling[node] = before;
+    tree->prevSibling[before] = node;
+    if(prev != TREE_NIL)
+    {
+        tree->nextSibling[prev] = node;
+    }
+    else
+    {
+        tree->firstChild[parent] = node;
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   TreeDeleteSubtree [void]
+*       Unlinks a node from its parent, if it is not detached already, and
+*       frees it and all of its children
+*
+*       ***TREE_ROOT cannot be deleted, use TreeClear instead***
+=============================================================================*/
+void TreeDeleteSubtree(TreeModel* tree, TreeNodeId node)
+{
+    if(node == TREE_ROOT || !TreeIsLive(tree, node))
+    {
+        return;
+    }
+
+    Unlink(tree, node);
+
+    //The walk still needs parent and nextSibling of nodes it has left, so
+    //it only chains the visited nodes through prevSibling, which it never
+    //reads. The chain is then pushed onto the free list.
+    TreeNodeId visited = TREE_NIL;
+    for(TreeNodeId current = node; current != TREE_NIL; current = TreeNextPreorder(tree, current, node))
+    {
+        tree->prevSibling[current] = visited;
+        visited = current;
+    }
+    while(visited != TREE_NIL)
+    {
+        TreeNodeId current = visited;
+        visited = tree->prevSibling[current];
+        tree->parent[current] = TREE_FREE;
+        tree->nextSibling[current] = tree->freeList;
+        tree->freeList = current;
+        tree->count--;
+    }
+}
+
+/*=============================================================================
+*   TreeIsBorrowed [int]
+*       Returns nonzero if a string points into the model's mapped file
+=============================================================================*/
+int TreeIsBorrowed(const TreeModel* tree, TreeStr str)
+{
+    const char* base = tree->mapping.data;
+    return base && str.ptr >= base && str.ptr < base + tree->mapping.size;
+}
+
+/*=============================================================================
+*   TreeReleaseMapping [int]
+*       Copies every string still borrowed from the mapped file into the
+*       string pool, then unmaps the file. Needed before the file itself
+*       can be overwritten.
+*
+*       Returns nonzero on success, 0 if out of memory (the mapping is kept)
+=============================================================================*/
+int TreeReleaseMapping(TreeModel* tree)
+{
+    if(!tree->mapping.data)
+    {
+        return 1;
+    }
+
+    for(TreeNodeId node = 1; node < tree->used; node++)
+    {
+        if(tree->parent[node] == TREE_FREE)
+        {
+            continue;
+        }
+        TreeNodeData* data = &tree->data[node];
+        if(TreeIsBorrowed(tree, data->name) &&
+           !TreeStrPoolAdd(&tree->strings, data->name.ptr, data->name.len, &data->name))
+        {
+            return 0;
+        }
+        if(TreeIsBorrowed(tree, data->description) &&
+           !TreeStrPoolAdd(&tree->strings, data->description.ptr, data->description.len, &data->description))
+        {
+            return 0;
+        }
+    }
+
+    TreeUnmap(&tree->mapping);
+    return 1;
+}
+
+/*=============================================================================
+*   TreeSnapshot [int]
+*       Copies the structure of `tree` into `snapshot`, so it can be written
+*       out on another thread while `tree` keeps being edited. Only the link
+*       and data arrays are copied; stored strings never change or move, so
+*       the snapshot shares them. It owns no strings and is never edited.
+*
+*       ***The shared strings stay valid only until `tree` is cleared, freed
+*       or released from its mapping***
+*
+*       Parameters:
+*           TreeModel* snapshot - Receives the copy, not initialized
+*           const TreeModel* tree - The model to copy
+*
+*       Returns nonzero on success; release the snapshot with TreeFree
+=============================================================================*/
+int TreeSnapshot(TreeModel* snapshot, const TreeModel* tree)
+{
+    memset(snapshot, 0, sizeof(*snapshot));
+    TreeStrPoolInit(&snapshot->strings);
+    if(!TreeReserve(snapshot, tree->used))
+    {
+        TreeFree(snapshot);
+        return 0;
+    }
+
+    const TreeNodeId* from[] = { tree->parent, tree->firstChild, tree->lastChild, tree->nextSibling, tree->prevSibling };
+    TreeNodeId* to[] = { snapshot->parent, snapshot->firstChild, snapshot->lastChild, snapshot->nextSibling, snapshot->prevSibling };
+    for(size_t array = 0; array < sizeof(from) / sizeof(from[0]); array++)
+    {
+        memcpy(to[array], from[array], tree->used * sizeof(TreeNodeId));
+    }
+    memcpy(snapshot->data, tree->data, tree->used * sizeof(TreeNodeData));
+
+    snapshot->used = tree->used;
+    snapshot->count = tree->count;
+    snapshot->freeList = tree->freeList;
+    return 1;
+}
+
+/*=============================================================================
+*   TreeAdoptModel [TreeNodeId]
+*       Moves every node of `other` into `tree` in one bulk copy. The nodes
+*       keep their links among each other; the top level nodes of `other`
+*       arrive detached (parent TREE_NIL) for the caller to attach with
+*       TreeAttachLast. The strings of `other` move along with its arena,
+*       so no string is copied. `other` is left empty.
+*
+*       ***`other` must not have deleted any node, its ids have to be dense***
+*
+*       Returns the offset added to every id of `other` (its node n is now
+*       node n + offset), or TREE_NIL if out of memory
+=============================================================================*/
+TreeNodeId TreeAdoptModel(TreeModel* tree, TreeModel* other)
+{
+    int32_t added = other->used - 1;
+    if(!TreeReserve(tree, tree->used + added))
+    {
+        return TREE_NIL;
+    }
+
+    //Node n of `other` becomes node n + offset, its root is not copied
+    TreeNodeId offset = tree->used - 1;
+    const TreeNodeId* from[] = { other->parent, other->firstChild, other->lastChild, other->nextSibling, other->prevSibling };
+    TreeNodeId* to[] = { tree->parent, tree->firstChild, tree->lastChild, tree->nextSibling, tree->prevSibling };
+    for(size_t array = 0; array < sizeof(from) / sizeof(from[0]); array++)
+    {
+        for(TreeNodeId node = 1; node < other->used; node++)
+        {
+            TreeNodeId link = from[array][node];
+            to[array][node + offset] = (link == TREE_NIL || link == TREE_ROOT) ? TREE_NIL : link + offset;
+        }
+    }
+    memcpy(&tree->data[tree->used], &other->data[1], added * sizeof(TreeNodeData));
+
+    tree->used += added;
+    tree->count += added;
+    TreeArenaAdopt(&tree->strings.arena, &other->strings.arena);
+    TreeClear(other);
+    return offset;
+}
@@ -0,0 +1,792 @@
+/*=============================================================================
+*       tree.h
+*       Portable tree model shared by the dtree GUI and headless tools.
+*       Nothing in here depends on Win32; the TreeView only mirrors it.
+=============================================================================*/
+#ifndef DTREE_TREE_H
+#define DTREE_TREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*=============================================================================
+*   Constants
+=============================================================================*/
+
+//Node handles are indices into the model's link arrays
+typedef int32_t TreeNodeId;
+
+#define TREE_NIL  ((TreeNodeId)-1)
+#define TREE_FREE ((TreeNodeId)-2)
+
+/*
+*   Node 0 is an invisible document root that is never deleted.
+*   Top level items (the TreeView's root items) are its children.
+*/
+#define TREE_ROOT ((TreeNodeId)0)
+
+//Strings up to this many bytes are deduplicated by the string pool
+#define TREE_INTERN_MAX 64
+
+/*=============================================================================
+*   Struct Definitions
+=============================================================================*/
+
+/*
+*   A string handle: a pointer into storage that never moves plus a length.
+*   The bytes are immutable UTF-8 and not NUL terminated; an edit stores a
+*   new string and swaps the handle.
+*/
+typedef struct _TreeStr
+{
+    const char* ptr;
+    uint32_t len;
+} TreeStr;
+
+/*
+*   Bump allocator. Chunks grow geometrically and are never moved or
+*   freed individually, so pointers into them stay valid until the whole
+*   arena is released.
+*/
+typedef struct _TreeArenaChunk TreeArenaChunk;
+
+typedef struct _TreeArena
+{
+    TreeArenaChunk* head;
+    size_t nextChunkSize;
+    size_t allocated;       //bytes obtained from malloc, including headers
+} TreeArena;
+
+/*
+*   Arena-backed string store. Short strings are interned through an open
+*   addressed hash table so repeated names ("New Item") share one copy.
+*/
+typedef struct _TreeStrPool
+{
+    TreeArena arena;
+    TreeStr* slots;
+    uint32_t slotMask;
+    uint32_t slotUsed;
+} TreeStrPool;
+
+/*
+*   A read-only view of a whole file, see treeplat.c
+*/
+typedef struct _TreeMapping
+{
+    const char* data;
+    size_t size;
+} TreeMapping;
+
+typedef struct _TreeNodeData
+{
+    TreeStr name;
+    TreeStr description;
+} TreeNodeData;
+
+/*
+*   The hierarchy is kept as parallel index arrays so that every traversal
+*   is plain array access. Freed ids are chained through nextSibling and
+*   marked with parent == TREE_FREE until they are reused.
+*/
+typedef struct _TreeModel
+{
+    TreeNodeId* parent;
+    TreeNodeId* firstChild;
+    TreeNodeId* lastChild;
+    TreeNodeId* nextSibling;
+    TreeNodeId* prevSibling;
+    TreeNodeData* data;
+    TreeStrPool strings;
+    TreeMapping mapping;    //file opened with TreeLoadMapped, strings may point into it
+
+    int32_t capacity;       //allocated length of every array
+    int32_t used;           //ids below this have been handed out at least once
+    int32_t count;          //live nodes, not counting TREE_ROOT
+    TreeNodeId freeList;
+} TreeModel;
+
+/*=============================================================================
+*   Strings
+=============================================================================*/
+
+TreeStr TreeStrFromC(const char* text);
+int TreeStrEqual(TreeStr a, TreeStr b);
+
+void TreeArenaInit(TreeArena* arena);
+void* TreeArenaAlloc(TreeArena* arena, size_t size, size_t align);
+void TreeArenaFree(TreeArena* arena);
+void TreeArenaAdopt(TreeArena* arena, TreeArena* other);
+
+void TreeStrPoolInit(TreeStrPool* pool);
+void TreeStrPoolFree(TreeStrPool* pool);
+int TreeStrPoolAdd(TreeStrPool* pool, const char* text, size_t length, TreeStr* out);
+
+/*=============================================================================
+*   Model
+=============================================================================*/
+
+int TreeInit(TreeModel* tree);
+void TreeFree(TreeModel* tree);
+void TreeClear(TreeModel* tree);
+int TreeReserve(TreeModel* tree, int32_t capacity);
+
+TreeNodeId TreeAddNode(TreeModel* tree, TreeNodeId parent, TreeStr name, TreeStr description);
+TreeNodeId TreeAddNodeBorrowed(TreeModel* tree, TreeNodeId parent, TreeStr name, TreeStr description);
+void TreeDeleteSubtree(TreeModel* tree, TreeNodeId node);
+void TreeAttachLast(TreeModel* tree, TreeNodeId parent, TreeNodeId node);
+int TreeMoveNode(TreeModel* tree, TreeNodeId node, TreeNodeId parent, TreeNodeId before);
+void TreeDetach(TreeModel* tree, TreeNodeId node);
+TreeNodeId TreeAdoptModel(TreeModel* tree, TreeModel* other);
+int TreeSnapshot(TreeModel* snapshot, const TreeModel* tree);
+
+int TreeSetName(TreeModel* tree, TreeNodeId node, TreeStr name);
+int TreeSetDescription(TreeModel* tree, TreeNodeId node, TreeStr description);
+
+TreeNodeId TreeNextPreorder(const TreeModel* tree, TreeNodeId node, TreeNodeId top);
+int TreeIsLive(const TreeModel* tree, TreeNodeId node);
+int TreeIsAttached(const TreeModel* tree, TreeNodeId node);
+
+int TreeIsBorrowed(const TreeModel* tree, TreeStr str);
+int TreeReleaseMapping(TreeModel* tree);
+
+#define TreeName(tree, node)        ((tree)->data[(node)].name)
+#define TreeDescription(tree, node) ((tree)->data[(node)].description)
+
+/*=============================================================================
+*   Platform
+=============================================================================*/
+
+typedef void (*TreeThreadProc)(void* arg);
+
+typedef struct _TreeThread
+{
+    TreeThreadProc proc;
+    void* arg;
+    void* handle;
+} TreeThread;
+
+int TreeMapStream(FILE* file, TreeMapping* mapping);
+void TreeUnmap(TreeMapping* mapping);
+uint64_t TreeStreamSize(FILE* file);
+int TreeStreamIsFile(FILE* file);
+int TreeStreamSeek(FILE* file, uint64_t offset);
+int TreeStreamSync(FILE* file);
+
+int TreeThreadStart(TreeThread* thread, TreeThreadProc proc, void* arg);
+void TreeThreadJoin(TreeThread* thread);
+void TreeSleep(unsigned milliseconds);
+int TreeCpuCount(void);
+double TreeSeconds(void);
+size_t TreePeakMemory(void);
+
+/*=============================================================================
+*   Encoding, see treeutf.c
+=============================================================================*/
+
+//Starts every .dat file written since the format became UTF-8
+#define TREE_UTF8_BOM        "\xEF\xBB\xBF"
+#define TREE_UTF8_BOM_LENGTH 3
+
+int TreeUtf8Valid(const char* in, size_t length);
+size_t TreeUtf8ToUtf16(uint16_t* out, const char* in, size_t length);
+size_t TreeUtf16ToUtf8(char* out, const uint16_t* in, size_t length);
+size_t TreeLegacyToUtf8(char* out, const char* in, size_t length);
+
+/*=============================================================================
+*   Text format (.dat)
+=============================================================================*/
+
+#define TREE_PARSE_OK        0
+#define TREE_PARSE_MALFORMED 1
+#define TREE_PARSE_ABORTED   2     //a callback returned 0
+#define TREE_PARSE_NO_MEMORY 3
+#define TREE_PARSE_IO        4
+
+/*
+*   Called for every node in file order. `depth` is 0 for a top level node.
+*   Both strings point into the parser's input and are only valid during
+*   the call; both are still escaped. Return 0 to stop parsing.
+*/
+typedef int (*TreeNodeEvent)(void* context, int depth, TreeStr name, TreeStr description);
+
+typedef struct _TreeParser
+{
+    TreeNodeEvent onNode;
+    void* context;
+    int depth;              //nodes currently open
+    int untilClosed;        //stop as soon as depth returns to 0
+    int error;              //TREE_PARSE_*
+    int started;            //the start of the input has been seen
+    int utf8;               //the input began with TREE_UTF8_BOM
+} TreeParser;
+
+void TreeParserInit(TreeParser* parser, TreeNodeEvent onNode, void* context);
+size_t TreeParseText(TreeParser* parser, const char* text, size_t length, int final);
+int TreeParseStream(TreeParser* parser, FILE* file);
+
+//Escaping of names and descriptions, vectorized where the CPU allows
+size_t TreeEscape(char* out, const char* in, size_t length);
+size_t TreeUnescape(char* out, const char* in, size_t length);
+size_t TreeUnescapeLegacy(char* out, const char* in, size_t length);
+const char* TreeEscapeKernel(void);
+
+int TreeSaveToStream(const TreeModel* tree, FILE* file);
+int TreeSaveToStreamParallel(const TreeModel* tree, FILE* file, int threads);
+int TreeLoadFromStream(TreeModel* tree, FILE* file);
+int TreeLoadMapped(TreeModel* tree, FILE* file);
+int TreeLoadParallel(TreeModel* tree, FILE* file, int threads);
+
+/*
+*   A background open, see treeload.c. Called on the consumer's thread for
+*   every node TreeLoaderApply adds.
+*/
+typedef struct _TreeLoader TreeLoader;
+typedef void (*TreeLoadEvent)(void* context, TreeNodeId node);
+
+TreeLoader* TreeLoaderStart(TreeModel* tree, FILE* file);
+size_t TreeLoaderApply(TreeLoader* loader, TreeModel* tree, size_t max, TreeLoadEvent onNode, void* context);
+double TreeLoaderProgress(const TreeLoader* loader);
+int TreeLoaderDone(const TreeLoader* loader);
+void TreeLoaderCancel(TreeLoader* loader);
+int TreeLoaderFinish(TreeLoader* loader);
+
+/*=============================================================================
+*   Binary format (.dtb), see treebin.c
+=============================================================================*/
+
+#define TREE_BIN_MAGIC   "DTREEBIN"
+#define TREE_BIN_VERSION 2
+
+//Version 1 heaps hold the ANSI text of the old .dat files, not UTF-8
+#define TREE_BIN_VERSION_LEGACY 1
+
+typedef struct _TreeBinHeader
+{
+    char magic[8];          //TREE_BIN_MAGIC, no terminator
+    uint32_t version;
+    uint32_t recordSize;    //sizeof(TreeBinNode)
+    uint32_t nodeCount;     //records, including TREE_ROOT
+    uint32_t reserved;
+    uint64_t recordOffset;  //file offsets of the two sections
+    uint64_t heapOffset;
+    uint64_t heapSize;
+} TreeBinHeader;
+
+/*
+*   One node. Links are record indices or TREE_NIL; string offsets are
+*   relative to the start of the heap.
+*/
+typedef struct _TreeBinNode
+{
+    int32_t parent;
+    int32_t firstChild;
+    int32_t nextSibling;
+    uint32_t nameLength;
+    uint64_t nameOffset;
+    uint64_t descriptionOffset;
+    uint32_t descriptionLength;
+    uint32_t reserved;
+} TreeBinNode;
+
+typedef struct _TreeBinView
+{
+    const char* data;
+    size_t size;
+    TreeBinHeader header;
+} TreeBinView;
+
+//Takes the next bytes of an image being written; returns 0 on failure
+typedef int (*TreeBinSink)(void* context, const void* bytes, size_t size);
+
+int TreeBinOpen(TreeBinView* view, const char* data, size_t size);
+int TreeBinNodeAt(const TreeBinView* view, TreeNodeId node, TreeBinNode* record);
+int TreeBinNodeValid(const TreeBinHeader* header, const TreeBinNode* record);
+int TreeBinLoadView(TreeModel* tree, const TreeBinView* view, const char* heap, int borrow);
+
+int TreeIsBinaryStream(FILE* file);
+int TreeSaveBinary(const TreeModel* tree, FILE* file);
+int TreeSaveBinaryTo(const TreeModel* tree, TreeBinSink sink, void* context);
+int TreeLoadBinary(TreeModel* tree, FILE* file);
+
+/*=============================================================================
+*   Compressed format (.dtz), see treezip.c
+=============================================================================*/
+
+#define TREE_ZIP_MAGIC   "DTREEZIP"
+#define TREE_ZIP_VERSION 1
+
+//Bytes of the .dtb image per block; the codec reaches back at most 64 KB
+#define TREE_ZIP_BLOCK (64 * 1024)
+
+typedef struct _TreeZipHeader
+{
+    char magic[8];          //TREE_ZIP_MAGIC, no terminator
+    uint32_t version;
+    uint32_t blockSize;     //image bytes in every block but the last
+} TreeZipHeader;
+
+/*
+*   Where a block is in the file. A block whose size equals its rawSize
+*   did not compress and is stored as is.
+*/
+typedef struct _TreeZipBlock
+{
+    uint64_t offset;
+    uint32_t size;
+    uint32_t rawSize;
+} TreeZipBlock;
+
+//Last bytes of the file, written after the block index
+typedef struct _TreeZipTrailer
+{
+    uint64_t indexOffset;   //TreeZipBlock[blockCount]
+    uint64_t rawSize;       //bytes of the .dtb image
+    uint32_t blockCount;
+    uint32_t reserved;
+    char magic[8];          //TREE_ZIP_MAGIC again
+} TreeZipTrailer;
+
+/*
+*   A .dtz file held in memory, read a block at a time. The last two
+*   blocks decoded are kept, so walking the records while reading their
+*   strings decodes each block once.
+*/
+typedef struct _TreeZipView
+{
+    const char* data;
+    size_t size;
+    TreeZipHeader header;
+    TreeZipTrailer trailer;
+    TreeBinHeader image;    //header of the .dtb image inside
+    char* cache[2];
+    int64_t cached[2];      //block held in each cache, -1 for none
+    int recent;             //the cache used last
+} TreeZipView;
+
+int TreeIsCompressedStream(FILE* file);
+int TreeSaveCompressed(const TreeModel* tree, FILE* file, int threads);
+int TreeLoadCompressed(TreeModel* tree, FILE* file, int threads);
+int TreeCompressStream(FILE* in, FILE* out, int threads);
+
+int TreeZipOpen(TreeZipView* view, const char* data, size_t size);
+void TreeZipClose(TreeZipView* view);
+int TreeZipRead(TreeZipView* view, uint64_t offset, void* out, size_t length);
+int TreeZipNodeAt(TreeZipView* view, TreeNodeId node, TreeBinNode* record);
+TreeNodeId TreeZipLoadSubtree(TreeModel* tree, TreeZipView* view, TreeNodeId node, TreeNodeId parent);
+
+/*=============================================================================
+*   Streaming over any format, see treestream.c
+=============================================================================*/
+
+#define TREE_FORMAT_TEXT       0
+#define TREE_FORMAT_BINARY     1
+#define TREE_FORMAT_COMPRESSED 2
+#define TREE_FORMAT_ERROR      -1  //TreeStreamFormat could not rewind the stream
+
+//What a TreeScanEvent returns
+#define TREE_SCAN_STOP 0       //end the scan
+#define TREE_SCAN_NEXT 1       //go on with the node's children
+#define TREE_SCAN_SKIP 2       //go on after the node's subtree
+
+/*
+*   Called for every node in preorder. `depth` is 0 for a top level node.
+*   Both strings are decoded UTF-8 and only valid during the call.
+*/
+typedef int (*TreeScanEvent)(void* context, int depth, TreeStr name, TreeStr description);
+
+/*
+*   Writes nodes given in preorder to a file of any format, holding no
+*   more than a window of records in memory. Binary output is patched in
+*   place, so a file that cannot seek goes through a temporary one.
+*/
+typedef struct _TreeStreamWriter
+{
+    int format;
+    int threads;
+    FILE* out;              //the destination
+    FILE* file;             //where the records go: out, or a temporary file
+    FILE* heap;             //strings, appended to the records at the end
+    TreeBinNode* window;    //records not written yet, from windowStart
+    int32_t windowStart;
+    int32_t windowCount;
+    int32_t count;          //nodes so far, TREE_ROOT included
+    uint64_t heapSize;
+    TreeNodeId* last;       //last node at every level, level 0 is TREE_ROOT
+    int levels;             //open levels, TREE_ROOT included
+    int levelCapacity;
+    char* text;             //escaped text
+    size_t textCapacity;
+    int failed;
+} TreeStreamWriter;
+
+int TreeStreamFormat(FILE* file);
+int TreeScanStream(FILE* file, int format, TreeScanEvent onNode, void* context);
+
+int TreeStreamWriterOpen(TreeStreamWriter* writer, FILE* out, int format, int threads);
+int TreeStreamWriterNode(TreeStreamWriter* writer, int depth, TreeStr name, TreeStr description);
+int TreeStreamWriterClose(TreeStreamWriter* writer);
+
+/*=============================================================================
+*   View mirror, see treemirror.c
+=============================================================================*/
+
+/*
+*   How the mirror reaches a view. insert adds `node` as a child of the
+*   item `parent` (NULL for a top level item), right after the item
+*   `after` or first if that is NULL, and returns the new item's handle,
+*   or NULL on failure.
+*/
+typedef struct _TreeViewOps
+{
+    void* (*insert)(void* context, void* parent, void* after, TreeNodeId node);
+} TreeViewOps;
+
+typedef struct _TreeMirror
+{
+    TreeModel* tree;
+    const TreeViewOps* ops;
+    void* context;
+    void** handles;         //view item of every node, NULL if not inserted
+    uint8_t* populated;     //nonzero once a node's children were inserted
+    int32_t capacity;
+    int64_t materialized;   //items currently in the view
+} TreeMirror;
+
+extern const TreeViewOps TreeCountingViewOps;
+
+void TreeMirrorInit(TreeMirror* mirror, TreeModel* tree, const TreeViewOps* ops, void* context);
+void TreeMirrorFree(TreeMirror* mirror);
+void TreeMirrorClear(TreeMirror* mirror);
+int TreeMirrorReset(TreeMirror* mirror);
+int TreeMirrorExpand(TreeMirror* mirror, TreeNodeId node);
+int TreeMirrorAdded(TreeMirror* mirror, TreeNodeId node);
+int TreeMirrorAppended(TreeMirror* mirror, TreeNodeId node);
+void TreeMirrorRemoved(TreeMirror* mirror, TreeNodeId node);
+void* TreeMirrorHandle(const TreeMirror* mirror, TreeNodeId node);
+void* TreeMirrorReveal(TreeMirror* mirror, TreeNodeId node);
+
+/*=============================================================================
+*   Edit journal, see treejournal.c
+=============================================================================*/
+
+//Journal size, as a share of the base file, at which a save rewrites the base
+#ifndef TREE_JOURNAL_COMPACT_RATIO
+#define TREE_JOURNAL_COMPACT_RATIO 0.25
+#endif
+
+typedef struct _TreeJournal
+{
+    TreeNodeId* nodes;      //node of every serial
+    uint8_t* deleted;       //nonzero for a serial whose subtree is deleted
+    uint32_t* serials;      //serial of every live node id
+    uint32_t serialCount;
+    uint32_t serialCapacity;
+    int32_t idCapacity;
+
+    char* pending;          //records of the edits since the last save
+    size_t pendingLength;
+    size_t pendingCapacity;
+
+    uint64_t baseSize;      //the base file the serials refer to
+    uint32_t baseCount;
+    uint64_t logSize;       //bytes in the sidecar, 0 if there is none yet
+    double compactRatio;    //TREE_JOURNAL_COMPACT_RATIO unless changed
+
+    int attached;           //edits are being recorded against a base file
+    int failed;             //an edit could not be recorded
+    int torn;               //the sidecar cannot be appended to
+} TreeJournal;
+
+void TreeJournalInit(TreeJournal* journal);
+void TreeJournalFree(TreeJournal* journal);
+void TreeJournalClear(TreeJournal* journal);
+int TreeJournalReset(TreeJournal* journal, const TreeModel* tree, uint64_t baseSize);
+int TreeJournalReplay(TreeJournal* journal, TreeModel* tree, FILE* log);
+
+void TreeJournalInserted(TreeJournal* journal, const TreeModel* tree, TreeNodeId node);
+void TreeJournalDeleted(TreeJournal* journal, const TreeModel* tree, TreeNodeId node);
+void TreeJournalNameChanged(TreeJournal* journal, const TreeModel* tree, TreeNodeId node);
+void TreeJournalDescriptionChanged(TreeJournal* journal, const TreeModel* tree, TreeNodeId node);
+void TreeJournalMoved(TreeJournal* journal, const TreeModel* tree, TreeNodeId node);
+void TreeJournalRestored(TreeJournal* journal, const TreeModel* tree, TreeNodeId node);
+
+int TreeJournalNeedsCompaction(const TreeJournal* journal);
+int TreeJournalAppend(TreeJournal* journal, FILE* log);
+
+/*=============================================================================
+*   Search index, see treeindex.c
+=============================================================================*/
+
+//Match only where a word starts
+#define TREE_FIND_PREFIX 1
+
+typedef struct _TreeIndexList TreeIndexList;
+
+typedef struct _TreeIndex
+{
+    TreeIndexList* lists;   //open addressed by key
+    uint32_t listMask;
+    uint32_t listUsed;
+    uint32_t* entries;      //entries added for each node id
+    int32_t nodeCapacity;
+    uint64_t count;         //entries in all lists
+    uint64_t stale;         //of those, left behind by edits and deletions
+    size_t bytes;           //allocated for the lists' entries
+    int built;
+} TreeIndex;
+
+void TreeIndexInit(TreeIndex* index);
+void TreeIndexFree(TreeIndex* index);
+void TreeIndexClear(TreeIndex* index);
+int TreeIndexBuild(TreeIndex* index, const TreeModel* tree);
+
+void TreeIndexInserted(TreeIndex* index, const TreeModel* tree, TreeNodeId node);
+void TreeIndexChanged(TreeIndex* index, const TreeModel* tree, TreeNodeId node);
+void TreeIndexDeleted(TreeIndex* index, const TreeModel* tree, TreeNodeId node);
+
+size_t TreeIndexFind(const TreeIndex* index, const TreeModel* tree, const char* query, size_t length, int flags, TreeNodeId* out, size_t max);
+size_t TreeIndexMemory(const TreeIndex* index);
+
+/*=============================================================================
+*   Path index, see treepath.c
+=============================================================================*/
+
+typedef struct _TreePathSlot TreePathSlot;
+
+typedef struct _TreePathIndex
+{
+    TreePathSlot* slots;    //open addressed by parent and name hash
+    uint32_t slotMask;
+    uint32_t slotUsed;
+    uint32_t* hashes;       //name hash every node was filed under
+    TreeNodeId* next;       //siblings filed in the same slot
+    TreeNodeId* prev;       //TREE_FREE for a node not filed
+    TreeNodeId* parents;    //parent every node was filed under
+    int32_t nodeCapacity;
+    int built;
+} TreePathIndex;
+
+void TreePathInit(TreePathIndex* index);
+void TreePathFree(TreePathIndex* index);
+void TreePathClear(TreePathIndex* index);
+int TreePathBuild(TreePathIndex* index, const TreeModel* tree);
+
+void TreePathInserted(TreePathIndex* index, const TreeModel* tree, TreeNodeId node);
+void TreePathRenamed(TreePathIndex* index, const TreeModel* tree, TreeNodeId node);
+void TreePathMoved(TreePathIndex* index, const TreeModel* tree, TreeNodeId node);
+void TreePathDeleted(TreePathIndex* index, const TreeModel* tree, TreeNodeId node);
+
+TreeNodeId TreePathFind(const TreePathIndex* index, const TreeModel* tree, const char* path, size_t length);
+size_t TreePathFormat(const TreeModel* tree, TreeNodeId node, char* out, size_t size);
+size_t TreePathMemory(const TreePathIndex* index);
+
+
+/*=============================================================================
+*   Undo history, see treehistory.c
+=============================================================================*/
+
+//Most bytes of steps a history keeps before it drops the oldest
+#ifndef TREE_HISTORY_MAX_BYTES
+#define TREE_HISTORY_MAX_BYTES (4 * 1024 * 1024)
+#endif
+
+//What an undo or redo did to the model
+#define TREE_CHANGE_DETACHED    1   //node was taken out with everything below it
+#define TREE_CHANGE_ATTACHED    2   //node was put back with everything below it
+#define TREE_CHANGE_NAME        3
+#define TREE_CHANGE_DESCRIPTION 4
+#define TREE_CHANGE_MOVED       5   //node went to another place with everything below it
+
+typedef struct _TreeChange
+{
+    int kind;
+    TreeNodeId node;
+} TreeChange;
+
+typedef struct _TreeHistoryStep TreeHistoryStep;
+
+typedef struct _TreeHistory
+{
+    TreeHistoryStep* steps; //ring, oldest at first
+    uint32_t capacity;
+    uint32_t first;
+    uint32_t undoCount;     //steps that can be undone
+    uint32_t redoCount;     //after them, steps that can be redone
+    uint64_t dropped;       //oldest steps given up to stay under maxBytes
+    size_t maxBytes;        //TREE_HISTORY_MAX_BYTES unless changed
+} TreeHistory;
+
+void TreeHistoryInit(TreeHistory* history);
+void TreeHistoryFree(TreeHistory* history);
+void TreeHistoryClear(TreeHistory* history, TreeModel* tree);
+
+void TreeHistoryInserted(TreeHistory* history, TreeModel* tree, TreeNodeId node);
+void TreeHistoryDelete(TreeHistory* history, TreeModel* tree, TreeNodeId node);
+void TreeHistoryMoved(TreeHistory* history, TreeModel* tree, TreeNodeId node, TreeNodeId parent, TreeNodeId before);
+void TreeHistoryNameChanged(TreeHistory* history, TreeModel* tree, TreeNodeId node, TreeStr old);
+void TreeHistoryDescriptionChanged(TreeHistory* history, TreeModel* tree, TreeNodeId node, TreeStr old);
+
+int TreeHistoryUndo(TreeHistory* history, TreeModel* tree, TreeChange* change);
+int TreeHistoryRedo(TreeHistory* history, TreeModel* tree, TreeChange* change);
+
+size_t TreeHistoryMemory(const TreeHistory* history);
+size_t TreeHistoryStepSize(void);
+
+
+/*=============================================================================
+*   Diff and merge, see treediff.c
+=============================================================================*/
+
+//Edit kinds, in a TreeDiffEdit
+#define TREE_DIFF_DELETE 1     //oldNode went with everything below it
+#define TREE_DIFF_INSERT 2     //newNode came with everything below it, but for nodes moved into it
+#define TREE_DIFF_UPDATE 3     //oldNode became newNode, see flags
+#define TREE_DIFF_MOVE   4     //oldNode went to where newNode is, with everything below it
+
+//What an update changed
+#define TREE_DIFF_NAME        1
+#define TREE_DIFF_DESCRIPTION 2
+
+//Conflict kinds, in a TreeMergeConflict
+#define TREE_MERGE_CHANGED 1   //both changed a name or description; ours was kept
+#define TREE_MERGE_MOVED   2   //both moved a node to different places; ours was kept
+#define TREE_MERGE_DELETED 3   //one deleted a subtree the other changed; it was kept
+
+typedef struct _TreeDiffEdit
+{
+    uint8_t kind;
+    uint8_t flags;
+    TreeNodeId oldNode;
+    TreeNodeId newNode;
+} TreeDiffEdit;
+
+/*
+*   An edit script between two models, plus the node matching it came
+*   from. Nodes inside subtrees that matched whole are left unmatched.
+*/
+typedef struct _TreeDiff
+{
+    const TreeModel* oldTree;
+    const TreeModel* newTree;
+    uint64_t* oldHashes;    //per node, hash of its subtree
+    uint64_t* newHashes;
+    TreeNodeId* oldToNew;   //TREE_NIL for an old node not matched
+    TreeNodeId* newToOld;
+    TreeDiffEdit* edits;
+    size_t count;
+    size_t capacity;
+    int64_t compared;       //nodes looked at past the hashing
+} TreeDiff;
+
+typedef struct _TreeMergeConflict
+{
+    int kind;
+    TreeNodeId node;        //in the merged model
+} TreeMergeConflict;
+
+typedef struct _TreeMergeResult
+{
+    TreeMergeConflict* conflicts;
+    size_t count;
+    size_t capacity;
+    size_t edits;           //edits of both sides applied
+} TreeMergeResult;
+
+uint64_t TreeHashNode(const TreeModel* tree, TreeNodeId node, const uint64_t* hashes);
+int TreeHashTree(const TreeModel* tree, uint64_t* hashes);
+
+int TreeDiffBuild(TreeDiff* diff, const TreeModel* oldTree, const TreeModel* newTree);
+void TreeDiffFree(TreeDiff* diff);
+
+int TreeMerge(TreeModel* base, const TreeModel* ours, const TreeModel* theirs, TreeMergeResult* result);
+void TreeMergeResultFree(TreeMergeResult* result);
+
+/*=============================================================================
+*   Subtree hash cache, see treehash.c
+=============================================================================*/
+
+/*
+*   The hash of every subtree, as TreeHashTree computes it, kept from one
+*   edit to the next. An edit marks the nodes above it stale; only those
+*   are hashed again, so the root's hash after an edit costs about the
+*   depth of the tree and the width of the parents on the way.
+*/
+typedef struct _TreeHashCache
+{
+    uint64_t* hashes;       //per node, hash of its subtree unless stale
+    TreeNodeId* parents;    //parent every node was last seen under
+    uint8_t* stale;         //nonzero for a node to hash again; the nodes above it are stale too
+    int32_t nodeCapacity;
+    TreeNodeId* order;      //scratch for hashing the stale nodes
+    size_t orderCapacity;
+    int built;
+} TreeHashCache;
+
+void TreeHashInit(TreeHashCache* cache);
+void TreeHashFree(TreeHashCache* cache);
+void TreeHashClear(TreeHashCache* cache);
+int TreeHashBuild(TreeHashCache* cache, const TreeModel* tree);
+
+void TreeHashInserted(TreeHashCache* cache, const TreeModel* tree, TreeNodeId node);
+void TreeHashChanged(TreeHashCache* cache, const TreeModel* tree, TreeNodeId node);
+void TreeHashMoved(TreeHashCache* cache, const TreeModel* tree, TreeNodeId node);
+void TreeHashDeleted(TreeHashCache* cache, const TreeModel* tree, TreeNodeId node);
+
+int TreeHashSubtree(TreeHashCache* cache, const TreeModel* tree, TreeNodeId node, uint64_t* hash);
+size_t TreeHashMemory(const TreeHashCache* cache);
+
+/*=============================================================================
+*   Performance counters, see treestats.c
+=============================================================================*/
+
+//Set to 0 to build without counters; the calls below then do nothing
+#ifndef TREE_STATS
+#define TREE_STATS 1
+#endif
+
+//Timed phases
+#define TREE_PHASE_LOAD        0   //reading and parsing a file into the model
+#define TREE_PHASE_REPLAY      1   //replaying its edit journal
+#define TREE_PHASE_VIEW        2   //putting a model in the view
+#define TREE_PHASE_EDIT_FIELDS 3   //showing the selected node in the edit controls
+#define TREE_PHASE_SNAPSHOT    4   //copying the model for a save
+#define TREE_PHASE_SERIALIZE   5   //writing and syncing a file
+#define TREE_PHASE_JOURNAL     6   //appending edits to a journal
+#define TREE_PHASE_TEARDOWN    7   //dropping a document
+#define TREE_PHASE_COUNT       8
+
+typedef struct _TreePhaseStats
+{
+    uint64_t runs;
+    double seconds;         //all runs together
+    double last;
+    double longest;
+} TreePhaseStats;
+
+typedef struct _TreeStats
+{
+    TreePhaseStats phases[TREE_PHASE_COUNT];
+    uint64_t viewCalls;     //calls into the view and edit controls
+    uint64_t bytesRead;     //files opened
+    uint64_t bytesWritten;  //files and journals saved
+    uint64_t indexBytes;    //held next to the model, e.g. by search indexes; set by the owner
+} TreeStats;
+
+#if TREE_STATS
+#define TreeStatsCount(stats, counter, n) ((stats)->counter += (n))
+#else
+#define TreeStatsCount(stats, counter, n) ((void)0)
+#endif
+
+void TreeStatsInit(TreeStats* stats);
+double TreeStatsStart(void);
+void TreeStatsStop(TreeStats* stats, int phase, double start);
+void TreeStatsAdd(TreeStats* stats, int phase, double seconds);
+const char* TreeStatsPhaseName(int phase);
+
+size_t TreeModelMemory(const TreeModel* tree, size_t* strings);
+int TreeStatsWrite(const TreeStats* stats, const TreeModel* tree, FILE* file);
+
+#endif
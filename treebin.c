@@ -0,0 +1,440 @@
+/*=============================================================================
+*       treebin.c
+*       The binary .dtb format: fixed-size node records and a string heap
+*       that are used in place, with no parsing
+=============================================================================*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree.h"
+
+/*
+*   Layout, little endian:
+*       TreeBinHeader
+*       TreeBinNode[nodeCount]  at recordOffset, record 0 is TREE_ROOT
+*       string heap             at heapOffset, raw unescaped UTF-8
+*
+*   Records are written in preorder. Every firstChild and nextSibling
+*   link points forward to a higher index, which is what lets the loader
+*   prove the links form a tree in one pass.
+*/
+
+//Bytes gathered before each fwrite
+#define BIN_WRITE_BUFFER (1024 * 1024)
+
+typedef struct _BinWriter
+{
+    TreeBinSink sink;
+    void* context;
+    char* buffer;
+    size_t length;
+    int failed;
+} BinWriter;
+
+/*=============================================================================
+*   BinFlush [void]
+*       Hands bytes to the sink, remembering if it failed
+=============================================================================*/
+static void BinFlush(BinWriter* writer, const void* bytes, size_t size)
+{
+    if(size && !writer->sink(writer->context, bytes, size))
+    {
+        writer->failed = 1;
+    }
+}
+
+/*=============================================================================
+*   BinPut [void]
+*       Appends bytes to the output, flushing the buffer when it is full
+=============================================================================*/
+static void BinPut(BinWriter* writer, const void* bytes, size_t size)
+{
+    if(writer->length + size > BIN_WRITE_BUFFER)
+    {
+        BinFlush(writer, writer->buffer, writer->length);
+        writer->length = 0;
+    }
+    if(size > BIN_WRITE_BUFFER)
+    {
+        BinFlush(writer, bytes, size);
+        return;
+    }
+    memcpy(writer->buffer + writer->length, bytes, size);
+    writer->length += size;
+}
+
+/*=============================================================================
+*   FileSink [int]
+*       TreeBinSink that writes to a stream
+=============================================================================*/
+static int FileSink(void* context, const void* bytes, size_t size)
+{
+    return fwrite(bytes, 1, size, (FILE*)context) == size;
+}
+
+/*=============================================================================
+*   TreeSaveBinary [int]
+*       Writes the model as a .dtb file. Ids are renumbered densely in
+*       preorder, so the file never contains holes left by deletions.
+*
+*       Parameters:
+*           const TreeModel* tree - The model to write
+*           FILE* file - Stream opened for binary writing
+*
+*       Returns nonzero on success
+=============================================================================*/
+int TreeSaveBinary(const TreeModel* tree, FILE* file)
+{
+    return TreeSaveBinaryTo(tree, FileSink, file);
+}
+
+/*=============================================================================
+*   TreeSaveBinaryTo [int]
+*       TreeSaveBinary for any destination: the image is handed to `sink`
+*       in order, a buffer of up to BIN_WRITE_BUFFER bytes at a time
+*
+*       Parameters:
+*           const TreeModel* tree - The model to write
+*           TreeBinSink sink - Takes the bytes of the image
+*           void* context - Passed to sink
+*
+*       Returns nonzero on success
+=============================================================================*/
+int TreeSaveBinaryTo(const TreeModel* tree, TreeBinSink sink, void* context)
+{
+    BinWriter writer = {sink, context, (char*)malloc(BIN_WRITE_BUFFER), 0, 0};
+    TreeNodeId* index = (TreeNodeId*)malloc(tree->used * sizeof(TreeNodeId));
+    if(!writer.buffer || !index)
+    {
+        free(writer.buffer);
+        free(index);
+        return 0;
+    }
+
+    //First walk: file index of every node and the size of the heap
+    int32_t nodeCount = 0;
+    uint64_t heapSize = 0;
+    for(TreeNodeId node = TREE_ROOT; node != TREE_NIL; node = TreeNextPreorder(tree, node, TREE_ROOT))
+    {
+        index[node] = nodeCount++;
+        heapSize += TreeName(tree, node).len + TreeDescription(tree, node).len;
+    }
+
+    TreeBinHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TREE_BIN_MAGIC, sizeof(header.magic));
+    header.version = TREE_BIN_VERSION;
+    header.recordSize = sizeof(TreeBinNode);
+    header.nodeCount = (uint32_t)nodeCount;
+    header.recordOffset = sizeof(TreeBinHeader);
+    header.heapOffset = header.recordOffset + (uint64_t)nodeCount * sizeof(TreeBinNode);
+    header.heapSize = heapSize;
+    BinPut(&writer, &header, sizeof(header));
+
+    //Second walk: the records, with links translated to file indices
+    uint64_t heapUsed = 0;
+    for(TreeNodeId node = TREE_ROOT; node != TREE_NIL; node = TreeNextPreorder(tree, node, TREE_ROOT))
+    {
+        TreeBinNode record;
+        memset(&record, 0, sizeof(record));
+        record.parent = node == TREE_ROOT ? TREE_NIL : index[tree->parent[node]];
+        record.firstChild = tree->firstChild[node] == TREE_NIL ? TREE_NIL : index[tree->firstChild[node]];
+        record.nextSibling = tree->nextSibling[node] == TREE_NIL ? TREE_NIL : index[tree->nextSibling[node]];
+        record.nameOffset = heapUsed;
+        record.nameLength = TreeName(tree, node).len;
+        heapUsed += record.nameLength;
+        record.descriptionOffset = heapUsed;
+        record.descriptionLength = TreeDescription(tree, node).len;
+        heapUsed += record.descriptionLength;
+        BinPut(&writer, &record, sizeof(record));
+    }
+
+    //Third walk: the heap, in the same order as the offsets above
+    for(TreeNodeId node = TREE_ROOT; node != TREE_NIL; node = TreeNextPreorder(tree, node, TREE_ROOT))
+    {
+        BinPut(&writer, TreeName(tree, node).ptr, TreeName(tree, node).len);
+        BinPut(&writer, TreeDescription(tree, node).ptr, TreeDescription(tree, node).len);
+    }
+
+    BinFlush(&writer, writer.buffer, writer.length);
+    free(writer.buffer);
+    free(index);
+    return !writer.failed;
+}
+
+/*=============================================================================
+*   TreeBinOpen [int]
+*       Checks the header of a .dtb image held in memory
+*
+*       Parameters:
+*           TreeBinView* view - Receives the image and its header
+*           const char* data - The whole file, or at least its records
+*           size_t size - Length of the whole file in bytes
+*
+*       Returns nonzero if the header is valid and every section lies
+*       inside the image
+=============================================================================*/
+int TreeBinOpen(TreeBinView* view, const char* data, size_t size)
+{
+    view->data = data;
+    view->size = size;
+    if(size < sizeof(TreeBinHeader))
+    {
+        return 0;
+    }
+
+    TreeBinHeader* header = &view->header;
+    memcpy(header, data, sizeof(TreeBinHeader));
+    if(memcmp(header->magic, TREE_BIN_MAGIC, sizeof(header->magic)) != 0 ||
+       (header->version != TREE_BIN_VERSION && header->version != TREE_BIN_VERSION_LEGACY) ||
+       header->recordSize != sizeof(TreeBinNode) ||
+       header->nodeCount < 1 || header->nodeCount > INT32_MAX)
+    {
+        return 0;
+    }
+
+    uint64_t recordBytes = (uint64_t)header->nodeCount * sizeof(TreeBinNode);
+    return header->recordOffset <= size && recordBytes <= size - header->recordOffset &&
+           header->heapOffset <= size && header->heapSize <= size - header->heapOffset;
+}
+
+/*=============================================================================
+*   TreeBinNodeAt [int]
+*       Reads one record straight from its fixed position in the image
+*
+*       Parameters:
+*           const TreeBinView* view - An image accepted by TreeBinOpen
+*           TreeNodeId node - File index of the record
+*           TreeBinNode* record - Receives the record
+*
+*       Returns nonzero if the record exists and its links and strings
+*       are in range
+=============================================================================*/
+int TreeBinNodeAt(const TreeBinView* view, TreeNodeId node, TreeBinNode* record)
+{
+    int32_t count = (int32_t)view->header.nodeCount;
+    if(node < 0 || node >= count)
+    {
+        return 0;
+    }
+    memcpy(record, view->data + view->header.recordOffset + (uint64_t)node * sizeof(TreeBinNode), sizeof(TreeBinNode));
+    return TreeBinNodeValid(&view->header, record);
+}
+
+/*=============================================================================
+*   TreeBinNodeValid [int]
+*       Checks that a record's links and strings are in range of the image
+*       described by `header`
+=============================================================================*/
+int TreeBinNodeValid(const TreeBinHeader* header, const TreeBinNode* record)
+{
+    int32_t count = (int32_t)header->nodeCount;
+    uint64_t heapSize = header->heapSize;
+    return record->parent >= TREE_NIL && record->parent < count &&
+           record->firstChild >= TREE_NIL && record->firstChild < count &&
+           record->nextSibling >= TREE_NIL && record->nextSibling < count &&
+           record->nameOffset <= heapSize && record->nameLength <= heapSize - record->nameOffset &&
+           record->descriptionOffset <= heapSize && record->descriptionLength <= heapSize - record->descriptionOffset;
+}
+
+/*=============================================================================
+*   ConvertLegacy [int]
+*       Replaces a string from a version 1 heap that is not UTF-8 with its
+*       UTF-8 form in the string pool
+=============================================================================*/
+static int ConvertLegacy(TreeModel* tree, TreeStr* text, char** buffer, size_t* capacity)
+{
+    if(TreeUtf8Valid(text->ptr, text->len))
+    {
+        return 1;
+    }
+    size_t needed = (size_t)text->len * 3;
+    if(needed > *capacity)
+    {
+        char* grown = (char*)realloc(*buffer, needed);
+        if(!grown)
+        {
+            return 0;
+        }
+        *buffer = grown;
+        *capacity = needed;
+    }
+    size_t length = TreeLegacyToUtf8(*buffer, text->ptr, text->len);
+    return TreeStrPoolAdd(&tree->strings, *buffer, length, text);
+}
+
+/*=============================================================================
+*   TreeBinLoadView [int]
+*       Fills the model from a .dtb image. Only the records need to be at
+*       view->data; the heap may be held elsewhere.
+*
+*       Parameters:
+*           TreeModel* tree - The model to load into, holding TREE_ROOT only
+*           const TreeBinView* view - An image accepted by TreeBinOpen
+*           const char* heap - Its string heap
+*           int borrow - Keep the strings where they are, which must then be
+*                        memory that lives as long as the model: its mapping
+*                        or its string arena. Otherwise they are copied.
+*
+*       Returns nonzero on success; on failure the model is left with
+*       TREE_ROOT only
+=============================================================================*/
+int TreeBinLoadView(TreeModel* tree, const TreeBinView* view, const char* heap, int borrow)
+{
+    if(!TreeReserve(tree, (int32_t)view->header.nodeCount))
+    {
+        return 0;
+    }
+
+    int32_t count = (int32_t)view->header.nodeCount;
+    int legacy = view->header.version == TREE_BIN_VERSION_LEGACY;
+    char* converted = NULL;
+    size_t convertedCapacity = 0;
+    int valid = 1;
+    for(TreeNodeId node = 0; node < count && valid; node++)
+    {
+        TreeBinNode record;
+        if(!TreeBinNodeAt(view, node, &record) ||
+           (record.firstChild != TREE_NIL && record.firstChild <= node) ||
+           (record.nextSibling != TREE_NIL && record.nextSibling <= node))
+        {
+            valid = 0;
+            break;
+        }
+
+        //The child lists are authoritative and parents are derived from
+        //them below; TREE_FREE marks a node not reached yet
+        tree->parent[node] = node == TREE_ROOT ? TREE_NIL : TREE_FREE;
+        tree->firstChild[node] = record.firstChild;
+        tree->nextSibling[node] = record.nextSibling;
+        tree->lastChild[node] = TREE_NIL;
+        tree->prevSibling[node] = TREE_NIL;
+
+        TreeNodeData* nodeData = &tree->data[node];
+        nodeData->name.ptr = heap + record.nameOffset;
+        nodeData->name.len = record.nameLength;
+        nodeData->description.ptr = heap + record.descriptionOffset;
+        nodeData->description.len = record.descriptionLength;
+        if(!borrow)
+        {
+            valid = TreeStrPoolAdd(&tree->strings, nodeData->name.ptr, nodeData->name.len, &nodeData->name) &&
+                    TreeStrPoolAdd(&tree->strings, nodeData->description.ptr, nodeData->description.len, &nodeData->description);
+        }
+        if(legacy && valid)
+        {
+            valid = ConvertLegacy(tree, &nodeData->name, &converted, &convertedCapacity) &&
+                    ConvertLegacy(tree, &nodeData->description, &converted, &convertedCapacity);
+        }
+    }
+
+    free(converted);
+
+    //Every node but the root must be reached exactly once from a child list
+    int32_t reached = 0;
+    for(TreeNodeId node = 0; node < count && valid; node++)
+    {
+        TreeNodeId previous = TREE_NIL;
+        for(TreeNodeId child = tree->firstChild[node]; child != TREE_NIL; child = tree->nextSibling[child])
+        {
+            if(tree->parent[child] != TREE_FREE)
+            {
+                valid = 0;
+                break;
+            }
+            tree->parent[child] = node;
+            tree->prevSibling[child] = previous;
+            previous = child;
+            reached++;
+        }
+        tree->lastChild[node] = previous;
+    }
+
+    if(!valid || reached != count - 1)
+    {
+        TreeClear(tree);
+        return 0;
+    }
+    tree->used = count;
+    tree->count = count - 1;
+    tree->freeList = TREE_NIL;
+    return 1;
+}
+
+/*=============================================================================
+*   LoadImage [int]
+*       TreeBinLoadView for a whole image held in memory
+=============================================================================*/
+static int LoadImage(TreeModel* tree, const char* data, size_t size, int borrow)
+{
+    TreeBinView view;
+    return TreeBinOpen(&view, data, size) && TreeBinLoadView(tree, &view, data + view.header.heapOffset, borrow);
+}
+
+/*=============================================================================
+*   TreeIsBinaryStream [int]
+*       Peeks at the start of a stream for the .dtb magic number and
+*       rewinds it
+*
+*       Returns -1 if the stream could not be rewound (a pipe), after which
+*       the bytes peeked at are lost
+=============================================================================*/
+int TreeIsBinaryStream(FILE* file)
+{
+    char magic[8];
+    size_t read = fread(magic, 1, sizeof(magic), file);
+    if(fseek(file, 0, SEEK_SET) != 0)
+    {
+        return -1;
+    }
+    return read == sizeof(magic) && memcmp(magic, TREE_BIN_MAGIC, sizeof(magic)) == 0;
+}
+
+/*=============================================================================
+*   TreeLoadBinary [int]
+*       Loads a .dtb file. The file is mapped and the strings are used in
+*       place, so opening costs one pass over the records. A stream that
+*       cannot be mapped (a pipe) is read into memory and the strings copied.
+*
+*       Parameters:
+*           TreeModel* tree - The model to load into
+*           FILE* file - Stream opened for binary reading
+*
+*       Returns nonzero on success; otherwise the model is left empty
+=============================================================================*/
+int TreeLoadBinary(TreeModel* tree, FILE* file)
+{
+    TreeClear(tree);
+    if(TreeMapStream(file, &tree->mapping) && tree->mapping.data)
+    {
+        return LoadImage(tree, tree->mapping.data, tree->mapping.size, 1);
+    }
+
+    rewind(file);
+    size_t size = 0;
+    size_t capacity = 0;
+    char* image = NULL;
+    for(;;)
+    {
+        if(size == capacity)
+        {
+            capacity = capacity ? capacity * 2 : BIN_WRITE_BUFFER;
+            char* grown = (char*)realloc(image, capacity);
+            if(!grown)
+            {
+                free(image);
+                return 0;
+            }
+            image = grown;
+        }
+        size_t read = fread(image + size, 1, capacity - size, file);
+        size += read;
+        if(read == 0)
+        {
+            break;
+        }
+    }
+
+    int loaded = !ferror(file) && LoadImage(tree, image, size, 0);
+    free(image);
+    return loaded;
+}
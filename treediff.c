@@ -0,0 +1,1265 @@
+/*=============================================================================
+*       treediff.c
+*       Structural diff and three-way merge. Every subtree is summed up by a
+*       hash of its names, descriptions and children, so two subtrees with
+*       the same hash are taken to be equal and skipped without a look
+*       inside; only the nodes on the way down to a change are matched
+*       child by child.
+=============================================================================*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree.h"
+
+//An old node above one that FindMoves matched, so it cannot be matched whole
+#define DIFF_SPLIT ((TreeNodeId)-2)
+
+//An old node below one that FindMoves matched, and matched with it
+#define DIFF_INSIDE ((TreeNodeId)-3)
+
+//What a side did to a base node, see MarkEdits; shifted left by the side
+#define MARK_NAME       0x001
+#define MARK_DESC       0x004
+#define MARK_MOVED      0x010   //moved, maybe only among its siblings
+#define MARK_CHILDREN   0x040   //got new children, or moved ones
+#define MARK_DELETED    0x100
+#define MARK_REPARENTED 0x400   //moved to another parent
+
+#define SIDE_OURS   0
+#define SIDE_THEIRS 1
+
+/*=============================================================================
+*   Hashing
+=============================================================================*/
+
+/*=============================================================================
+*   Mix [uint64_t]
+*       Spreads every bit of a word over all of them (the MurmurHash3
+*       finalizer)
+=============================================================================*/
+static inline uint64_t Mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+/*=============================================================================
+*   HashText [uint64_t]
+*       Hashes a string eight bytes at a time
+=============================================================================*/
+static uint64_t HashText(TreeStr text, uint64_t seed)
+{
+    uint64_t h = seed ^ ((uint64_t)text.len * 0x9E3779B97F4A7C15ull);
+    uint32_t i = 0;
+    for(; i + 8 <= text.len; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, text.ptr + i, 8);
+        h = (h ^ Mix(word)) * 0x9E3779B97F4A7C15ull;
+    }
+    uint64_t tail = 0;
+    if(i < text.len)
+    {
+        memcpy(&tail, text.ptr + i, text.len - i);
+    }
+    return Mix(h ^ Mix(tail ^ (text.len - i)));
+}
+
+/*=============================================================================
+*   TreeHashNode [uint64_t]
+*       Hashes a node's subtree from its name, description and the hashes
+*       of its children, in order
+*
+*       Parameters:
+*           const TreeModel* tree - The model
+*           TreeNodeId node - A live node
+*           const uint64_t* hashes - Holds the finished hash of every child
+*
+*       Returns the hash
+=============================================================================*/
+uint64_t TreeHashNode(const TreeModel* tree, TreeNodeId node, const uint64_t* hashes)
+{
+    uint64_t h = HashText(TreeName(tree, node), 0x6E616D65ull) ^ (HashText(TreeDescription(tree, node), 0x64657363ull) << 1);
+    for(TreeNodeId child = tree->firstChild[node]; child != TREE_NIL; child = tree->nextSibling[child])
+    {
+        h = Mix(h ^ hashes[child]) + 0x9E3779B97F4A7C15ull;
+    }
+    return h;
+}
+
+/*=============================================================================
+*   TreeHashTree [int]
+*       Hashes every subtree of a model. The nodes are listed in preorder
+*       and hashed back to front, so each node folds in the finished hashes
+*       of its children, in order. Costs one visit per node.
+*
+*       Parameters:
+*           const TreeModel* tree - The model
+*           uint64_t* hashes - Receives the hash of every attached node,
+*                              tree->used entries; the rest are left alone
+*
+*       Returns 0 if out of memory
+=============================================================================*/
+int TreeHashTree(const TreeModel* tree, uint64_t* hashes)
+{
+    TreeNodeId* order = (TreeNodeId*)malloc(((size_t)tree->count + 1) * sizeof(TreeNodeId));
+    if(!order)
+    {
+        return 0;
+    }
+    int32_t count = 0;
+    for(TreeNodeId node = TREE_ROOT; node != TREE_NIL && count <= tree->count; node = TreeNextPreorder(tree, node, TREE_ROOT))
+    {
+        order[count++] = node;
+    }
+
+    while(count-- > 0)
+    {
+        hashes[order[count]] = TreeHashNode(tree, order[count], hashes);
+    }
+    free(order);
+    return 1;
+}
+
+/*=============================================================================
+*   Building a diff
+=============================================================================*/
+
+/*
+*   Nodes looked up by a 64-bit key, each key's nodes chained in the order
+*   they were added so that the first is taken in O(1)
+*/
+typedef struct _KeyTable
+{
+    uint64_t* keys;
+    int32_t* heads;         //first entry of each key, -1 for an empty slot, -2 once all are taken
+    int32_t* tails;
+    int32_t* next;          //next entry of the same key
+    TreeNodeId* nodes;      //node of every entry
+    uint32_t mask;
+    int32_t count;
+    int32_t capacity;       //entries
+} KeyTable;
+
+typedef struct _DiffBuilder
+{
+    TreeDiff* diff;
+    TreeNodeId* stack;      //matched pairs whose children are still to be matched, old then new
+    size_t stackCount;
+    size_t stackCapacity;
+    TreeNodeId* changed;    //every matched pair that was not equal, old then new
+    size_t changedCount;
+    size_t changedCapacity;
+    TreeNodeId* deleted;    //old nodes left over under a matched parent
+    size_t deletedCount;
+    size_t deletedCapacity;
+    TreeNodeId* inserted;   //new nodes left over under a matched parent
+    size_t insertedCount;
+    size_t insertedCapacity;
+
+    TreeNodeId* oldKids;    //children of the pair at hand
+    TreeNodeId* newKids;
+    int32_t* order;         //per new child: old position, for the longest run kept in order
+    int32_t* tails;
+    int32_t* links;
+    size_t kidCapacity;
+    int32_t* position;      //per old node: position among its siblings, for the pair at hand
+    KeyTable table;
+} DiffBuilder;
+
+/*=============================================================================
+*   Grow [int]
+*       Makes room for `needed` items of `size` bytes in a growing array
+=============================================================================*/
+static int Grow(void** array, size_t* capacity, size_t needed, size_t size)
+{
+    if(needed <= *capacity)
+    {
+        return 1;
+    }
+    size_t grown = *capacity ? *capacity * 2 : 256;
+    while(grown < needed)
+    {
+        grown *= 2;
+    }
+    void* bigger = realloc(*array, grown * size);
+    if(!bigger)
+    {
+        return 0;
+    }
+    *array = bigger;
+    *capacity = grown;
+    return 1;
+}
+
+/*=============================================================================
+*   PushNode [int]
+*       Appends a node to a growing list
+=============================================================================*/
+static int PushNode(TreeNodeId** nodes, size_t* count, size_t* capacity, TreeNodeId node)
+{
+    if(!Grow((void**)nodes, capacity, *count + 1, sizeof(TreeNodeId)))
+    {
+        return 0;
+    }
+    (*nodes)[(*count)++] = node;
+    return 1;
+}
+
+/*=============================================================================
+*   SkipSubtree [TreeNodeId]
+*       The node after `node` in preorder once its subtree is left out,
+*       TREE_NIL at the end of `top`
+=============================================================================*/
+static TreeNodeId SkipSubtree(const TreeModel* tree, TreeNodeId node, TreeNodeId top)
+{
+    while(node != top)
+    {
+        if(tree->nextSibling[node] != TREE_NIL)
+        {
+            return tree->nextSibling[node];
+        }
+        node = tree->parent[node];
+    }
+    return TREE_NIL;
+}
+
+/*=============================================================================
+*   TableReset [int]
+*       Empties a key table and sizes it for `entries` nodes
+=============================================================================*/
+static int TableReset(KeyTable* table, size_t entries)
+{
+    if(entries > INT32_MAX / 2)
+    {
+        return 0;
+    }
+    uint32_t slots = 16;
+    while(slots < entries * 2)
+    {
+        slots *= 2;
+    }
+    if(!table->keys || slots > table->mask + 1)
+    {
+        free(table->keys);
+        free(table->heads);
+        free(table->tails);
+        table->keys = (uint64_t*)malloc(slots * sizeof(uint64_t));
+        table->heads = (int32_t*)malloc(slots * sizeof(int32_t));
+        table->tails = (int32_t*)malloc(slots * sizeof(int32_t));
+        table->mask = slots - 1;
+        if(!table->keys || !table->heads || !table->tails)
+        {
+            return 0;
+        }
+    }
+    if((int32_t)entries > table->capacity || !table->next)
+    {
+        free(table->next);
+        free(table->nodes);
+        table->capacity = (int32_t)entries;
+        table->next = (int32_t*)malloc((entries + 1) * sizeof(int32_t));
+        table->nodes = (TreeNodeId*)malloc((entries + 1) * sizeof(TreeNodeId));
+        if(!table->next || !table->nodes)
+        {
+            table->capacity = 0;
+            return 0;
+        }
+    }
+    memset(table->heads, 0xFF, ((size_t)table->mask + 1) * sizeof(int32_t));
+    table->count = 0;
+    return 1;
+}
+
+/*=============================================================================
+*   TableFree [void]
+=============================================================================*/
+static void TableFree(KeyTable* table)
+{
+    free(table->keys);
+    free(table->heads);
+    free(table->tails);
+    free(table->next);
+    free(table->nodes);
+    memset(table, 0, sizeof(*table));
+}
+
+/*=============================================================================
+*   TableSlot [uint32_t]
+*       The slot of a key, or the empty slot where it would go
+=============================================================================*/
+static uint32_t TableSlot(const KeyTable* table, uint64_t key)
+{
+    uint32_t slot = (uint32_t)Mix(key) & table->mask;
+    while(table->heads[slot] != -1 && table->keys[slot] != key)
+    {
+        slot = (slot + 1) & table->mask;
+    }
+    return slot;
+}
+
+/*=============================================================================
+*   TableAdd [void]
+*       Chains a node after the others of its key. All of a key's nodes
+*       are added before the first of them is taken.
+=============================================================================*/
+static void TableAdd(KeyTable* table, uint64_t key, TreeNodeId node)
+{
+    int32_t entry = table->count++;
+    table->nodes[entry] = node;
+    table->next[entry] = -1;
+    uint32_t slot = TableSlot(table, key);
+    if(table->heads[slot] == -1)
+    {
+        table->keys[slot] = key;
+        table->heads[slot] = entry;
+    }
+    else
+    {
+        table->next[table->tails[slot]] = entry;
+    }
+    table->tails[slot] = entry;
+}
+
+/*=============================================================================
+*   TableTake [TreeNodeId]
+*       Takes the first node of a key that is still unmatched, dropping
+*       the ones before it, which no later lookup could use either
+*
+*       Parameters:
+*           KeyTable* table - The table
+*           uint64_t key - The key
+*           const TreeNodeId* matched - Per node, TREE_NIL if the node can
+*                                       be taken; NULL to take any
+=============================================================================*/
+static TreeNodeId TableTake(KeyTable* table, uint64_t key, const TreeNodeId* matched)
+{
+    if(!table->count)
+    {
+        return TREE_NIL;
+    }
+    uint32_t slot = TableSlot(table, key);
+    while(table->heads[slot] >= 0)
+    {
+        int32_t entry = table->heads[slot];
+        TreeNodeId node = table->nodes[entry];
+        table->heads[slot] = table->next[entry] >= 0 ? table->next[entry] : -2;
+        if(!matched || matched[node] == TREE_NIL)
+        {
+            return node;
+        }
+    }
+    return TREE_NIL;
+}
+
+/*=============================================================================
+*   Pair [int]
+*       Matches an old node with a new one. Equal subtrees are done with;
+*       the others have their children matched later.
+=============================================================================*/
+static int Pair(DiffBuilder* builder, TreeNodeId oldNode, TreeNodeId newNode)
+{
+    TreeDiff* diff = builder->diff;
+    diff->oldToNew[oldNode] = newNode;
+    diff->newToOld[newNode] = oldNode;
+    if(diff->oldHashes[oldNode] == diff->newHashes[newNode])
+    {
+        return 1;
+    }
+    return PushNode(&builder->stack, &builder->stackCount, &builder->stackCapacity, oldNode) &&
+           PushNode(&builder->stack, &builder->stackCount, &builder->stackCapacity, newNode) &&
+           PushNode(&builder->changed, &builder->changedCount, &builder->changedCapacity, oldNode) &&
+           PushNode(&builder->changed, &builder->changedCount, &builder->changedCapacity, newNode);
+}
+
+/*=============================================================================
+*   GrowChildren [int]
+*       Makes room in the builder's per child arrays for one more child
+=============================================================================*/
+static int GrowChildren(DiffBuilder* builder)
+{
+    size_t needed = builder->kidCapacity + 1;
+    size_t capacity = builder->kidCapacity;
+    if(!Grow((void**)&builder->oldKids, &capacity, needed, sizeof(TreeNodeId)))
+    {
+        return 0;
+    }
+    capacity = builder->kidCapacity;
+    if(!Grow((void**)&builder->newKids, &capacity, needed, sizeof(TreeNodeId)))
+    {
+        return 0;
+    }
+    capacity = builder->kidCapacity;
+    if(!Grow((void**)&builder->order, &capacity, needed, sizeof(int32_t)))
+    {
+        return 0;
+    }
+    capacity = builder->kidCapacity;
+    if(!Grow((void**)&builder->tails, &capacity, needed, sizeof(int32_t)))
+    {
+        return 0;
+    }
+    capacity = builder->kidCapacity;
+    if(!Grow((void**)&builder->links, &capacity, needed, sizeof(int32_t)))
+    {
+        return 0;
+    }
+    builder->kidCapacity = capacity;
+    return 1;
+}
+
+/*=============================================================================
+*   ListChildren [int]
+*       Copies the children of a pair into the builder's scratch arrays
+=============================================================================*/
+static int ListChildren(DiffBuilder* builder, TreeNodeId oldParent, TreeNodeId newParent, int32_t* oldCount, int32_t* newCount)
+{
+    const TreeModel* oldTree = builder->diff->oldTree;
+    const TreeModel* newTree = builder->diff->newTree;
+    int32_t count = 0;
+    for(TreeNodeId child = oldTree->firstChild[oldParent]; child != TREE_NIL; child = oldTree->nextSibling[child])
+    {
+        if((size_t)count == builder->kidCapacity && !GrowChildren(builder))
+        {
+            return 0;
+        }
+        builder->oldKids[count++] = child;
+    }
+    *oldCount = count;
+
+    count = 0;
+    for(TreeNodeId child = newTree->firstChild[newParent]; child != TREE_NIL; child = newTree->nextSibling[child])
+    {
+        if((size_t)count == builder->kidCapacity && !GrowChildren(builder))
+        {
+            return 0;
+        }
+        builder->newKids[count++] = child;
+    }
+    *newCount = count;
+    builder->diff->compared += *oldCount + *newCount;
+    return 1;
+}
+
+/*=============================================================================
+*   MatchChildren [int]
+*       Matches the children of a matched pair. Equal subtrees are found
+*       first: the common start and end, then by hash in between. What is
+*       left is matched by name, then by position between matched
+*       neighbours, e.g. a node that was renamed. The rest was deleted or
+*       inserted, unless FindMoves finds it elsewhere.
+=============================================================================*/
+static int MatchChildren(DiffBuilder* builder, TreeNodeId oldParent, TreeNodeId newParent)
+{
+    TreeDiff* diff = builder->diff;
+    const TreeModel* oldTree = diff->oldTree;
+    const TreeModel* newTree = diff->newTree;
+    int32_t oldCount;
+    int32_t newCount;
+    if(!ListChildren(builder, oldParent, newParent, &oldCount, &newCount))
+    {
+        return 0;
+    }
+    TreeNodeId* oldKids = builder->oldKids;
+    TreeNodeId* newKids = builder->newKids;
+
+    //The common start and end, equal so nothing is pushed
+    int32_t start = 0;
+    while(start < oldCount && start < newCount && diff->oldHashes[oldKids[start]] == diff->newHashes[newKids[start]])
+    {
+        Pair(builder, oldKids[start], newKids[start]);
+        start++;
+    }
+    int32_t oldEnd = oldCount;
+    int32_t newEnd = newCount;
+    while(oldEnd > start && newEnd > start && diff->oldHashes[oldKids[oldEnd - 1]] == diff->newHashes[newKids[newEnd - 1]])
+    {
+        oldEnd--;
+        newEnd--;
+        Pair(builder, oldKids[oldEnd], newKids[newEnd]);
+    }
+
+    if(oldEnd > start && newEnd > start)
+    {
+        //Equal subtrees in between, then equal names
+        KeyTable* table = &builder->table;
+        for(int byName = 0; byName < 2; byName++)
+        {
+            if(!TableReset(table, (size_t)(oldEnd - start)))
+            {
+                return 0;
+            }
+            for(int32_t i = start; i < oldEnd; i++)
+            {
+                TreeNodeId node = oldKids[i];
+                if(diff->oldToNew[node] == TREE_NIL)
+                {
+                    TableAdd(table, byName ? HashText(TreeName(oldTree, node), 0) : diff->oldHashes[node], node);
+                }
+            }
+            for(int32_t i = start; i < newEnd; i++)
+            {
+                TreeNodeId node = newKids[i];
+                if(diff->newToOld[node] != TREE_NIL)
+                {
+                    continue;
+                }
+                uint64_t key = byName ? HashText(TreeName(newTree, node), 0) : diff->newHashes[node];
+                TreeNodeId match = TableTake(table, key, diff->oldToNew);
+                if(match != TREE_NIL && (!byName || TreeStrEqual(TreeName(oldTree, match), TreeName(newTree, node))) &&
+                   !Pair(builder, match, node))
+                {
+                    return 0;
+                }
+            }
+        }
+
+        //By position: a node left over right after the old counterpart of
+        //its left neighbour, or first in both
+        for(int32_t i = start; i < newEnd; i++)
+        {
+            TreeNodeId node = newKids[i];
+            if(diff->newToOld[node] != TREE_NIL)
+            {
+                continue;
+            }
+            TreeNodeId candidate = TREE_NIL;
+            if(i == 0)
+            {
+                candidate = oldKids[0];
+            }
+            else
+            {
+                TreeNodeId left = diff->newToOld[newKids[i - 1]];
+                if(left != TREE_NIL && oldTree->parent[left] == oldParent)
+                {
+                    candidate = oldTree->nextSibling[left];
+                }
+            }
+            if(candidate != TREE_NIL && diff->oldToNew[candidate] == TREE_NIL && !Pair(builder, candidate, node))
+            {
+                return 0;
+            }
+        }
+    }
+
+    //What is left over
+    for(int32_t i = 0; i < oldCount; i++)
+    {
+        if(diff->oldToNew[oldKids[i]] == TREE_NIL &&
+           !PushNode(&builder->deleted, &builder->deletedCount, &builder->deletedCapacity, oldKids[i]))
+        {
+            return 0;
+        }
+    }
+    for(int32_t i = 0; i < newCount; i++)
+    {
+        if(diff->newToOld[newKids[i]] == TREE_NIL &&
+           !PushNode(&builder->inserted, &builder->insertedCount, &builder->insertedCapacity, newKids[i]))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   FindMoves [int]
+*       Looks for subtrees that went to another parent: a deleted subtree,
+*       or one inside it, equal to an inserted one or one inside that. The
+*       old node's subtree is marked DIFF_INSIDE and its ancestors up to
+*       the deleted one DIFF_SPLIT, so that none of them is matched again.
+=============================================================================*/
+static int FindMoves(DiffBuilder* builder)
+{
+    TreeDiff* diff = builder->diff;
+    const TreeModel* oldTree = diff->oldTree;
+    const TreeModel* newTree = diff->newTree;
+    if(!builder->deletedCount || !builder->insertedCount)
+    {
+        return 1;
+    }
+
+    size_t entries = 0;
+    for(size_t i = 0; i < builder->deletedCount; i++)
+    {
+        TreeNodeId top = builder->deleted[i];
+        for(TreeNodeId node = top; node != TREE_NIL; node = TreeNextPreorder(oldTree, node, top))
+        {
+            entries++;
+        }
+    }
+    if(!TableReset(&builder->table, entries))
+    {
+        return 0;
+    }
+    for(size_t i = 0; i < builder->deletedCount; i++)
+    {
+        TreeNodeId top = builder->deleted[i];
+        for(TreeNodeId node = top; node != TREE_NIL; node = TreeNextPreorder(oldTree, node, top))
+        {
+            TableAdd(&builder->table, diff->oldHashes[node], node);
+        }
+    }
+    diff->compared += entries;
+
+    TreeNodeId* marked = NULL;
+    size_t markedCount = 0;
+    size_t markedCapacity = 0;
+    int ok = 1;
+    for(size_t i = 0; ok && i < builder->insertedCount; i++)
+    {
+        TreeNodeId top = builder->inserted[i];
+        TreeNodeId node = top;
+        while(ok && node != TREE_NIL)
+        {
+            diff->compared++;
+            TreeNodeId match = TableTake(&builder->table, diff->newHashes[node], diff->oldToNew);
+            if(match == TREE_NIL)
+            {
+                node = TreeNextPreorder(newTree, node, top);
+                continue;
+            }
+
+            diff->oldToNew[match] = node;
+            diff->newToOld[node] = match;
+            for(TreeNodeId up = oldTree->parent[match]; ok && diff->oldToNew[up] == TREE_NIL; up = oldTree->parent[up])
+            {
+                diff->oldToNew[up] = DIFF_SPLIT;
+                ok = PushNode(&marked, &markedCount, &markedCapacity, up);
+            }
+            for(TreeNodeId below = TreeNextPreorder(oldTree, match, match); ok && below != TREE_NIL;
+                below = TreeNextPreorder(oldTree, below, match))
+            {
+                diff->oldToNew[below] = DIFF_INSIDE;
+                ok = PushNode(&marked, &markedCount, &markedCapacity, below);
+            }
+            node = SkipSubtree(newTree, node, top);
+        }
+    }
+
+    for(size_t i = 0; i < markedCount; i++)
+    {
+        diff->oldToNew[marked[i]] = TREE_NIL;
+    }
+    free(marked);
+    return ok;
+}
+
+/*=============================================================================
+*   AddEdit [int]
+=============================================================================*/
+static int AddEdit(TreeDiff* diff, int kind, int flags, TreeNodeId oldNode, TreeNodeId newNode)
+{
+    if(!Grow((void**)&diff->edits, &diff->capacity, diff->count + 1, sizeof(TreeDiffEdit)))
+    {
+        return 0;
+    }
+    TreeDiffEdit* edit = &diff->edits[diff->count++];
+    edit->kind = (uint8_t)kind;
+    edit->flags = (uint8_t)flags;
+    edit->oldNode = oldNode;
+    edit->newNode = newNode;
+    return 1;
+}
+
+/*=============================================================================
+*   EmitInsert [int]
+*       An inserted subtree, followed by moves for the nodes in it that
+*       FindMoves matched, in preorder
+=============================================================================*/
+static int EmitInsert(TreeDiff* diff, TreeNodeId top)
+{
+    const TreeModel* newTree = diff->newTree;
+    if(!AddEdit(diff, TREE_DIFF_INSERT, 0, TREE_NIL, top))
+    {
+        return 0;
+    }
+    TreeNodeId node = TreeNextPreorder(newTree, top, top);
+    while(node != TREE_NIL)
+    {
+        if(diff->newToOld[node] == TREE_NIL)
+        {
+            node = TreeNextPreorder(newTree, node, top);
+            continue;
+        }
+        if(!AddEdit(diff, TREE_DIFF_MOVE, 0, diff->newToOld[node], node))
+        {
+            return 0;
+        }
+        node = SkipSubtree(newTree, node, top);
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   EmitChildren [int]
+*       The edits of a pair that was not equal: its own update, then its
+*       children in the new order. Of the children that stayed under it,
+*       the longest run that kept its order is left alone and the others
+*       are moved.
+=============================================================================*/
+static int EmitChildren(DiffBuilder* builder, TreeNodeId oldParent, TreeNodeId newParent)
+{
+    TreeDiff* diff = builder->diff;
+    const TreeModel* oldTree = diff->oldTree;
+    const TreeModel* newTree = diff->newTree;
+
+    int flags = (TreeStrEqual(TreeName(oldTree, oldParent), TreeName(newTree, newParent)) ? 0 : TREE_DIFF_NAME) |
+                (TreeStrEqual(TreeDescription(oldTree, oldParent), TreeDescription(newTree, newParent)) ? 0 : TREE_DIFF_DESCRIPTION);
+    if(oldParent != TREE_ROOT && flags && !AddEdit(diff, TREE_DIFF_UPDATE, flags, oldParent, newParent))
+    {
+        return 0;
+    }
+
+    int32_t oldCount;
+    int32_t newCount;
+    if(!ListChildren(builder, oldParent, newParent, &oldCount, &newCount))
+    {
+        return 0;
+    }
+    for(int32_t i = 0; i < oldCount; i++)
+    {
+        builder->position[builder->oldKids[i]] = i;
+    }
+
+    //Longest run of old positions that increases, by patience sorting:
+    //tails[k] is the child ending the best run of length k + 1 so far
+    int32_t* order = builder->order;
+    int32_t length = 0;
+    for(int32_t i = 0; i < newCount; i++)
+    {
+        TreeNodeId match = diff->newToOld[builder->newKids[i]];
+        order[i] = -1;
+        if(match == TREE_NIL || oldTree->parent[match] != oldParent)
+        {
+            continue;
+        }
+        order[i] = builder->position[match];
+
+        int32_t low = 0;
+        int32_t high = length;
+        while(low < high)
+        {
+            int32_t middle = (low + high) / 2;
+            if(order[builder->tails[middle]] < order[i])
+            {
+                low = middle + 1;
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+        builder->links[i] = low > 0 ? builder->tails[low - 1] : -1;
+        builder->tails[low] = i;
+        if(low == length)
+        {
+            length++;
+        }
+    }
+    for(int32_t i = length ? builder->tails[length - 1] : -1; i >= 0; i = builder->links[i])
+    {
+        order[i] = -2;
+    }
+
+    for(int32_t i = 0; i < newCount; i++)
+    {
+        TreeNodeId node = builder->newKids[i];
+        TreeNodeId match = diff->newToOld[node];
+        if(match == TREE_NIL)
+        {
+            if(!EmitInsert(diff, node))
+            {
+                return 0;
+            }
+        }
+        else if(order[i] != -2 && !AddEdit(diff, TREE_DIFF_MOVE, 0, match, node))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   TreeDiffBuild [int]
+*       Finds the edits that turn one model into another: subtrees deleted,
+*       inserted and moved, and nodes whose name or description changed.
+*       Subtrees with equal hashes are skipped whole, so two revisions
+*       that differ in a few nodes cost little more than hashing both.
+*
+*       The edits come in an order they can be applied in: each changed
+*       parent's update and then its children in the new order, where an
+*       insert is followed by the moves into it. Deletes come last, once
+*       the nodes moved out of the deleted subtrees are gone from them.
+*
+*       Parameters:
+*           TreeDiff* diff - Receives the edits; free it with TreeDiffFree
+*           const TreeModel* oldTree - The model before
+*           const TreeModel* newTree - The model after
+*
+*       Returns 0 if out of memory
+=============================================================================*/
+int TreeDiffBuild(TreeDiff* diff, const TreeModel* oldTree, const TreeModel* newTree)
+{
+    memset(diff, 0, sizeof(*diff));
+    diff->oldTree = oldTree;
+    diff->newTree = newTree;
+    diff->oldHashes = (uint64_t*)malloc(oldTree->used * sizeof(uint64_t));
+    diff->newHashes = (uint64_t*)malloc(newTree->used * sizeof(uint64_t));
+    diff->oldToNew = (TreeNodeId*)malloc(oldTree->used * sizeof(TreeNodeId));
+    diff->newToOld = (TreeNodeId*)malloc(newTree->used * sizeof(TreeNodeId));
+
+    DiffBuilder builder;
+    memset(&builder, 0, sizeof(builder));
+    builder.diff = diff;
+    builder.position = (int32_t*)malloc(oldTree->used * sizeof(int32_t));
+
+    int ok = diff->oldHashes && diff->newHashes && diff->oldToNew && diff->newToOld && builder.position &&
+             TreeHashTree(oldTree, diff->oldHashes) && TreeHashTree(newTree, diff->newHashes);
+    if(ok)
+    {
+        memset(diff->oldToNew, 0xFF, oldTree->used * sizeof(TreeNodeId));
+        memset(diff->newToOld, 0xFF, newTree->used * sizeof(TreeNodeId));
+        ok = Pair(&builder, TREE_ROOT, TREE_ROOT);
+    }
+    while(ok && builder.stackCount)
+    {
+        builder.stackCount -= 2;
+        ok = MatchChildren(&builder, builder.stack[builder.stackCount], builder.stack[builder.stackCount + 1]);
+    }
+    ok = ok && FindMoves(&builder);
+    for(size_t i = 0; ok && i < builder.changedCount; i += 2)
+    {
+        ok = EmitChildren(&builder, builder.changed[i], builder.changed[i + 1]);
+    }
+    for(size_t i = 0; ok && i < builder.deletedCount; i++)
+    {
+        TreeNodeId node = builder.deleted[i];
+        ok = diff->oldToNew[node] != TREE_NIL || AddEdit(diff, TREE_DIFF_DELETE, 0, node, TREE_NIL);
+    }
+
+    free(builder.stack);
+    free(builder.changed);
+    free(builder.deleted);
+    free(builder.inserted);
+    free(builder.oldKids);
+    free(builder.newKids);
+    free(builder.order);
+    free(builder.tails);
+    free(builder.links);
+    free(builder.position);
+    TableFree(&builder.table);
+    if(!ok)
+    {
+        TreeDiffFree(diff);
+    }
+    return ok;
+}
+
+/*=============================================================================
+*   TreeDiffFree [void]
+=============================================================================*/
+void TreeDiffFree(TreeDiff* diff)
+{
+    free(diff->oldHashes);
+    free(diff->newHashes);
+    free(diff->oldToNew);
+    free(diff->newToOld);
+    free(diff->edits);
+    memset(diff, 0, sizeof(*diff));
+}
+
+/*=============================================================================
+*   Merging
+=============================================================================*/
+
+typedef struct _MergeState
+{
+    TreeModel* base;
+    TreeDiff diffs[2];          //base to ours, base to theirs
+    uint16_t* marks;            //per base node, MARK_* << side
+    TreeNodeId* toMerged[2];    //per inserted node of a side, its copy in base
+    TreeNodeId* detached;       //deleted subtrees, freed once both sides are in
+    size_t detachedCount;
+    size_t detachedCapacity;
+    KeyTable added;             //subtrees ours inserted, by hash and parent
+    TreeMergeResult* result;
+} MergeState;
+
+/*=============================================================================
+*   AddConflict [int]
+=============================================================================*/
+static int AddConflict(MergeState* state, int kind, TreeNodeId node)
+{
+    TreeMergeResult* result = state->result;
+    if(!Grow((void**)&result->conflicts, &result->capacity, result->count + 1, sizeof(TreeMergeConflict)))
+    {
+        return 0;
+    }
+    result->conflicts[result->count].kind = kind;
+    result->conflicts[result->count].node = node;
+    result->count++;
+    return 1;
+}
+
+/*=============================================================================
+*   BaseAbove [TreeNodeId]
+*       The nearest base node at or above a node of one side, i.e. where
+*       an inserted subtree hangs from in base
+=============================================================================*/
+static TreeNodeId BaseAbove(const TreeDiff* diff, TreeNodeId node)
+{
+    while(node != TREE_ROOT && diff->newToOld[node] == TREE_NIL)
+    {
+        node = diff->newTree->parent[node];
+    }
+    return node == TREE_ROOT ? TREE_ROOT : diff->newToOld[node];
+}
+
+/*=============================================================================
+*   MarkEdits [void]
+*       Notes on every base node what one side did to it, before base
+*       changes
+=============================================================================*/
+static void MarkEdits(MergeState* state, int side)
+{
+    const TreeDiff* diff = &state->diffs[side];
+    for(size_t i = 0; i < diff->count; i++)
+    {
+        const TreeDiffEdit* edit = &diff->edits[i];
+        TreeNodeId node = edit->oldNode;
+        TreeNodeId parent;
+        switch(edit->kind)
+        {
+            case TREE_DIFF_DELETE:
+                state->marks[node] |= MARK_DELETED << side;
+                break;
+            case TREE_DIFF_UPDATE:
+                state->marks[node] |= ((edit->flags & TREE_DIFF_NAME ? MARK_NAME : 0) |
+                                       (edit->flags & TREE_DIFF_DESCRIPTION ? MARK_DESC : 0)) << side;
+                break;
+            case TREE_DIFF_MOVE:
+                parent = BaseAbove(diff, diff->newTree->parent[edit->newNode]);
+                state->marks[node] |= (parent == state->base->parent[node] ? MARK_MOVED : MARK_MOVED | MARK_REPARENTED) << side;
+                state->marks[parent] |= MARK_CHILDREN << side;
+                break;
+            case TREE_DIFF_INSERT:
+                state->marks[BaseAbove(diff, diff->newTree->parent[edit->newNode])] |= MARK_CHILDREN << side;
+                break;
+        }
+    }
+}
+
+/*=============================================================================
+*   KeepsDeleted [int]
+*       Returns nonzero if the other side changed something in a subtree
+*       one side deleted, which keeps it: the name, description or
+*       children of a node in it, or where the subtree itself is
+=============================================================================*/
+static int KeepsDeleted(const MergeState* state, int side, TreeNodeId top)
+{
+    int other = side ^ 1;
+    if(state->marks[top] & (MARK_MOVED << other))
+    {
+        return 1;
+    }
+    if(state->marks[top] & (MARK_DELETED << other))
+    {
+        return 0;
+    }
+    uint16_t changed = (uint16_t)((MARK_NAME | MARK_DESC | MARK_CHILDREN) << other);
+    for(TreeNodeId node = top; node != TREE_NIL; node = TreeNextPreorder(state->base, node, top))
+    {
+        if(state->marks[node] & changed)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*=============================================================================
+*   Resolve [TreeNodeId]
+*       The merged node for a node of one side
+=============================================================================*/
+static TreeNodeId Resolve(const MergeState* state, int side, TreeNodeId node)
+{
+    if(node == TREE_ROOT)
+    {
+        return TREE_ROOT;
+    }
+    TreeNodeId match = state->diffs[side].newToOld[node];
+    return match != TREE_NIL ? match : state->toMerged[side][node];
+}
+
+/*=============================================================================
+*   PlaceNode [int]
+*       Moves a merged node to where a node of one side is: under its
+*       parent, after the nearest of its left siblings that is there too
+*
+*       Returns 0 if it cannot go there, e.g. into its own subtree
+=============================================================================*/
+static int PlaceNode(MergeState* state, int side, TreeNodeId node, TreeNodeId merged)
+{
+    const TreeModel* tree = state->diffs[side].newTree;
+    TreeModel* base = state->base;
+    TreeNodeId parent = Resolve(state, side, tree->parent[node]);
+    if(parent == TREE_NIL)
+    {
+        return 0;
+    }
+    TreeNodeId before = base->firstChild[parent];
+    for(TreeNodeId left = tree->prevSibling[node]; left != TREE_NIL; left = tree->prevSibling[left])
+    {
+        TreeNodeId anchor = Resolve(state, side, left);
+        if(anchor != TREE_NIL && anchor != merged && base->parent[anchor] == parent)
+        {
+            before = base->nextSibling[anchor];
+            break;
+        }
+    }
+    return (before == merged && base->parent[merged] == parent) || TreeMoveNode(base, merged, parent, before);
+}
+
+/*=============================================================================
+*   CopySubtree [int]
+*       Copies a subtree one side inserted into base, leaving out the
+*       nodes in it that were moved there, which follow as moves
+=============================================================================*/
+static int CopySubtree(MergeState* state, int side, TreeNodeId top)
+{
+    const TreeDiff* diff = &state->diffs[side];
+    const TreeModel* tree = diff->newTree;
+    TreeModel* base = state->base;
+    TreeNodeId parent = Resolve(state, side, tree->parent[top]);
+    if(parent == TREE_NIL)
+    {
+        return 1;
+    }
+
+    //The same subtree inserted by both sides in the same place is kept
+    //once. Both copies have the same shape, so they are walked together
+    //to find the merged node for each of theirs.
+    uint64_t key = diff->newHashes[top] ^ Mix((uint64_t)parent);
+    if(side == SIDE_THEIRS)
+    {
+        TreeNodeId twin = TableTake(&state->added, key, NULL);
+        if(twin != TREE_NIL && base->parent[twin] == parent)
+        {
+            TreeNodeId mine = twin;
+            for(TreeNodeId node = top; node != TREE_NIL && mine != TREE_NIL; node = TreeNextPreorder(tree, node, top))
+            {
+                if(diff->newToOld[node] == TREE_NIL)
+                {
+                    state->toMerged[side][node] = mine;
+                }
+                mine = TreeNextPreorder(base, mine, twin);
+            }
+            return 1;
+        }
+    }
+
+    TreeNodeId merged = TreeAddNode(base, parent, TreeName(tree, top), TreeDescription(tree, top));
+    if(merged == TREE_NIL)
+    {
+        return 0;
+    }
+    state->toMerged[side][top] = merged;
+    PlaceNode(state, side, top, merged);
+    if(side == SIDE_OURS)
+    {
+        TableAdd(&state->added, key, merged);
+    }
+
+    TreeNodeId node = TreeNextPreorder(tree, top, top);
+    while(node != TREE_NIL)
+    {
+        if(diff->newToOld[node] != TREE_NIL)
+        {
+            node = SkipSubtree(tree, node, top);
+            continue;
+        }
+        TreeNodeId copy = TreeAddNode(base, state->toMerged[side][tree->parent[node]], TreeName(tree, node), TreeDescription(tree, node));
+        if(copy == TREE_NIL)
+        {
+            return 0;
+        }
+        state->toMerged[side][node] = copy;
+        node = TreeNextPreorder(tree, node, top);
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   ApplyEdits [int]
+*       Applies one side's edits to base. Ours go first and win wherever
+*       theirs disagree, which is noted as a conflict.
+=============================================================================*/
+static int ApplyEdits(MergeState* state, int side)
+{
+    const TreeDiff* diff = &state->diffs[side];
+    const TreeModel* tree = diff->newTree;
+    TreeModel* base = state->base;
+    int other = side ^ 1;
+    for(size_t i = 0; i < diff->count; i++)
+    {
+        const TreeDiffEdit* edit = &diff->edits[i];
+        TreeNodeId node = edit->oldNode;
+        uint16_t marks = node == TREE_NIL ? 0 : state->marks[node];
+        int ok = 1;
+        switch(edit->kind)
+        {
+            case TREE_DIFF_DELETE:
+                if(side == SIDE_THEIRS && (marks & (MARK_DELETED << SIDE_OURS)))
+                {
+                    continue;
+                }
+                if(KeepsDeleted(state, side, node))
+                {
+                    ok = AddConflict(state, TREE_MERGE_DELETED, node);
+                    break;
+                }
+                TreeDetach(base, node);
+                ok = PushNode(&state->detached, &state->detachedCount, &state->detachedCapacity, node);
+                break;
+
+            case TREE_DIFF_UPDATE:
+                if(edit->flags & TREE_DIFF_NAME)
+                {
+                    TreeStr name = TreeName(tree, edit->newNode);
+                    if(!(marks & (MARK_NAME << other)) || side == SIDE_OURS)
+                    {
+                        ok = TreeSetName(base, node, name);
+                    }
+                    else if(!TreeStrEqual(TreeName(base, node), name))
+                    {
+                        ok = AddConflict(state, TREE_MERGE_CHANGED, node);
+                    }
+                }
+                if(ok && (edit->flags & TREE_DIFF_DESCRIPTION))
+                {
+                    TreeStr description = TreeDescription(tree, edit->newNode);
+                    if(!(marks & (MARK_DESC << other)) || side == SIDE_OURS)
+                    {
+                        ok = TreeSetDescription(base, node, description);
+                    }
+                    else if(!TreeStrEqual(TreeDescription(base, node), description))
+                    {
+                        ok = AddConflict(state, TREE_MERGE_CHANGED, node);
+                    }
+                }
+                break;
+
+            case TREE_DIFF_MOVE:
+                //Where both moved a node ours wins, unless ours only
+                //reordered it and theirs took it elsewhere
+                if(side == SIDE_THEIRS && (marks & (MARK_MOVED << SIDE_OURS)) &&
+                   ((marks & (MARK_REPARENTED << SIDE_OURS)) || !(marks & (MARK_REPARENTED << SIDE_THEIRS))))
+                {
+                    if((marks & (MARK_REPARENTED << SIDE_THEIRS)) &&
+                       Resolve(state, side, tree->parent[edit->newNode]) != base->parent[node])
+                    {
+                        ok = AddConflict(state, TREE_MERGE_MOVED, node);
+                    }
+                }
+                else if(!PlaceNode(state, side, edit->newNode, node))
+                {
+                    ok = AddConflict(state, TREE_MERGE_MOVED, node);
+                }
+                break;
+
+            case TREE_DIFF_INSERT:
+                ok = CopySubtree(state, side, edit->newNode);
+                break;
+        }
+        if(!ok)
+        {
+            return 0;
+        }
+        state->result->edits++;
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   TreeMerge [int]
+*       Three-way merge: applies what ours and theirs each changed since
+*       base to base itself, which then holds the result. Changes that do
+*       not touch each other are all kept. Where both changed the same
+*       thing ours wins, and a subtree one side deleted is kept if the
+*       other changed something in it; each of those is listed as a
+*       conflict.
+*
+*       Parameters:
+*           TreeModel* base - The common ancestor, merged in place
+*           const TreeModel* ours - One side, e.g. the open document
+*           const TreeModel* theirs - The other side
+*           TreeMergeResult* result - Receives the conflicts; free it with
+*                                     TreeMergeResultFree
+*
+*       Returns 0 if out of memory, in which case base is half merged and
+*       should be thrown away
+=============================================================================*/
+int TreeMerge(TreeModel* base, const TreeModel* ours, const TreeModel* theirs, TreeMergeResult* result)
+{
+    memset(result, 0, sizeof(*result));
+    MergeState state;
+    memset(&state, 0, sizeof(state));
+    state.base = base;
+    state.result = result;
+
+    int ok = TreeDiffBuild(&state.diffs[SIDE_OURS], base, ours) && TreeDiffBuild(&state.diffs[SIDE_THEIRS], base, theirs);
+    if(ok)
+    {
+        state.marks = (uint16_t*)calloc(base->used, sizeof(uint16_t));
+        state.toMerged[SIDE_OURS] = (TreeNodeId*)malloc(ours->used * sizeof(TreeNodeId));
+        state.toMerged[SIDE_THEIRS] = (TreeNodeId*)malloc(theirs->used * sizeof(TreeNodeId));
+        ok = state.marks && state.toMerged[SIDE_OURS] && state.toMerged[SIDE_THEIRS] &&
+             TableReset(&state.added, state.diffs[SIDE_OURS].count);
+    }
+    if(ok)
+    {
+        memset(state.toMerged[SIDE_OURS], 0xFF, ours->used * sizeof(TreeNodeId));
+        memset(state.toMerged[SIDE_THEIRS], 0xFF, theirs->used * sizeof(TreeNodeId));
+        MarkEdits(&state, SIDE_OURS);
+        MarkEdits(&state, SIDE_THEIRS);
+        ok = ApplyEdits(&state, SIDE_OURS) && ApplyEdits(&state, SIDE_THEIRS);
+    }
+
+    //Nodes the other side moved out of a deleted subtree are elsewhere by now
+    for(size_t i = 0; ok && i < state.detachedCount; i++)
+    {
+        if(base->parent[state.detached[i]] == TREE_NIL)
+        {
+            TreeDeleteSubtree(base, state.detached[i]);
+        }
+    }
+
+    TreeDiffFree(&state.diffs[SIDE_OURS]);
+    TreeDiffFree(&state.diffs[SIDE_THEIRS]);
+    free(state.marks);
+    free(state.toMerged[SIDE_OURS]);
+    free(state.toMerged[SIDE_THEIRS]);
+    free(state.detached);
+    TableFree(&state.added);
+    if(!ok)
+    {
+        TreeMergeResultFree(result);
+    }
+    return ok;
+}
+
+/*=============================================================================
+*   TreeMergeResultFree [void]
+=============================================================================*/
+void TreeMergeResultFree(TreeMergeResult* result)
+{
+    free(result->conflicts);
+    memset(result, 0, sizeof(*result));
+}
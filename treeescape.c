@@ -0,0 +1,369 @@
+/*=============================================================================
+*       treeescape.c
+*       Escaping of names and descriptions for the .dat text format.
+*       Clean runs are found and copied a vector at a time with AVX2 or
+*       SSE2 where available, falling back to a table driven scalar loop.
+=============================================================================*/
+#include <string.h>
+
+#include "tree.h"
+
+/*
+*   Escape sequences. Newlines and carriage returns would end the line,
+*   leading tabs would read as indentation and a leading brace as
+*   structure, so all of them are written as a backslash and a letter.
+*   Unknown sequences are kept as they are.
+*
+*       \\  backslash       \n  newline         \r  carriage return
+*       \t  tab             \{  {               \}  }
+*
+*   These rules hold only in files that start with TREE_UTF8_BOM. Older
+*   files wrote names as is and descriptions with "\n" as the one escape,
+*   so there "\\", "\t", "\r", "\{" and "\}" are plain text, and
+*   TreeUnescapeLegacy reads them. The byte order mark is the version.
+*/
+#if !defined(TREE_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ESCAPE_AVX2 1
+#include <immintrin.h>
+#endif
+#if !defined(TREE_NO_SIMD) && defined(__SSE2__)
+#define ESCAPE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+//Letter written after the backslash for each byte, 0 if it needs no escape
+static const char escapeLetter[256] =
+{
+    ['\t'] = 't', ['\n'] = 'n', ['\r'] = 'r',
+    ['\\'] = '\\', ['{'] = '{', ['}'] = '}'
+};
+
+//Byte an escape letter stands for, 0 for an unknown sequence
+static const char escapeByte[256] =
+{
+    ['t'] = '\t', ['n'] = '\n', ['r'] = '\r',
+    ['\\'] = '\\', ['{'] = '{', ['}'] = '}'
+};
+
+/*=============================================================================
+*   EscapeScalar [size_t]
+*       One byte at a time; also finishes the tail of the vector kernels
+=============================================================================*/
+static size_t EscapeScalar(char* out, const char* in, size_t length)
+{
+    char* cursor = out;
+    for(size_t i = 0; i < length; i++)
+    {
+        char letter = escapeLetter[(unsigned char)in[i]];
+        if(letter)
+        {
+            *cursor++ = '\\';
+            *cursor++ = letter;
+        }
+        else
+        {
+            *cursor++ = in[i];
+        }
+    }
+    return cursor - out;
+}
+
+/*=============================================================================
+*   UnescapeScalar [size_t]
+=============================================================================*/
+static size_t UnescapeScalar(char* out, const char* in, size_t length)
+{
+    size_t j = 0;
+    for(size_t i = 0; i < length; i++)
+    {
+        char byte = in[i] == '\\' && i + 1 < length ? escapeByte[(unsigned char)in[i + 1]] : 0;
+        if(byte)
+        {
+            out[j++] = byte;
+            i++;
+        }
+        else
+        {
+            out[j++] = in[i];
+        }
+    }
+    return j;
+}
+
+/*
+*   The vector kernels load a block, store it whole to the output and
+*   advance past its clean prefix. Output has room for 2 * length bytes,
+*   so a whole block always fits even when only part of it is kept; the
+*   rest is overwritten by what follows. Unescaping may run in place, so
+*   there only fully clean blocks are stored whole.
+*/
+
+#ifdef ESCAPE_SSE2
+/*=============================================================================
+*   SpecialMask128 [unsigned]
+*       Bit i is set if byte i of the block needs escaping
+=============================================================================*/
+static inline unsigned SpecialMask128(__m128i block)
+{
+    __m128i hits = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('\t')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\n'))),
+        _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\\'))));
+    hits = _mm_or_si128(hits,
+        _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('{')), _mm_cmpeq_epi8(block, _mm_set1_epi8('}'))));
+    return (unsigned)_mm_movemask_epi8(hits);
+}
+
+/*=============================================================================
+*   EscapeSse2 [size_t]
+=============================================================================*/
+static size_t EscapeSse2(char* out, const char* in, size_t length)
+{
+    char* cursor = out;
+    size_t i = 0;
+    while(i + 16 <= length)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i*)(in + i));
+        unsigned mask = SpecialMask128(block);
+        _mm_storeu_si128((__m128i*)cursor, block);
+        if(!mask)
+        {
+            cursor += 16;
+            i += 16;
+            continue;
+        }
+        unsigned clean = (unsigned)__builtin_ctz(mask);
+        cursor += clean;
+        i += clean;
+        *cursor++ = '\\';
+        *cursor++ = escapeLetter[(unsigned char)in[i++]];
+    }
+    return (cursor - out) + EscapeScalar(cursor, in + i, length - i);
+}
+
+/*=============================================================================
+*   UnescapeSse2 [size_t]
+=============================================================================*/
+static size_t UnescapeSse2(char* out, const char* in, size_t length)
+{
+    const __m128i backslash = _mm_set1_epi8('\\');
+    size_t i = 0;
+    size_t j = 0;
+    while(i + 16 <= length)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i*)(in + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, backslash));
+        if(!mask)
+        {
+            _mm_storeu_si128((__m128i*)(out + j), block);
+            i += 16;
+            j += 16;
+            continue;
+        }
+        unsigned clean = (unsigned)__builtin_ctz(mask);
+        memmove(out + j, in + i, clean);
+        i += clean;
+        j += clean;
+        if(i + 1 >= length)
+        {
+            break;
+        }
+        char byte = escapeByte[(unsigned char)in[i + 1]];
+        out[j++] = byte ? byte : '\\';
+        i += byte ? 2 : 1;
+    }
+    return j + UnescapeScalar(out + j, in + i, length - i);
+}
+#endif
+
+#ifdef ESCAPE_AVX2
+/*=============================================================================
+*   SpecialMask256 [unsigned]
+=============================================================================*/
+__attribute__((target("avx2")))
+static inline unsigned SpecialMask256(__m256i block)
+{
+    __m256i hits = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8('\t')), _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\n'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8('\r')), _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\\'))));
+    hits = _mm256_or_si256(hits,
+        _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(block, _mm256_set1_epi8('}'))));
+    return (unsigned)_mm256_movemask_epi8(hits);
+}
+
+/*=============================================================================
+*   EscapeAvx2 [size_t]
+=============================================================================*/
+__attribute__((target("avx2")))
+static size_t EscapeAvx2(char* out, const char* in, size_t length)
+{
+    char* cursor = out;
+    size_t i = 0;
+    while(i + 32 <= length)
+    {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(in + i));
+        unsigned mask = SpecialMask256(block);
+        _mm256_storeu_si256((__m256i*)cursor, block);
+        if(!mask)
+        {
+            cursor += 32;
+            i += 32;
+            continue;
+        }
+        unsigned clean = (unsigned)__builtin_ctz(mask);
+        cursor += clean;
+        i += clean;
+        *cursor++ = '\\';
+        *cursor++ = escapeLetter[(unsigned char)in[i++]];
+    }
+    return (cursor - out) + EscapeScalar(cursor, in + i, length - i);
+}
+
+/*=============================================================================
+*   UnescapeAvx2 [size_t]
+=============================================================================*/
+__attribute__((target("avx2")))
+static size_t UnescapeAvx2(char* out, const char* in, size_t length)
+{
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    size_t i = 0;
+    size_t j = 0;
+    while(i + 32 <= length)
+    {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(in + i));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, backslash));
+        if(!mask)
+        {
+            _mm256_storeu_si256((__m256i*)(out + j), block);
+            i += 32;
+            j += 32;
+            continue;
+        }
+        unsigned clean = (unsigned)__builtin_ctz(mask);
+        memmove(out + j, in + i, clean);
+        i += clean;
+        j += clean;
+        if(i + 1 >= length)
+        {
+            break;
+        }
+        char byte = escapeByte[(unsigned char)in[i + 1]];
+        out[j++] = byte ? byte : '\\';
+        i += byte ? 2 : 1;
+    }
+    return j + UnescapeScalar(out + j, in + i, length - i);
+}
+
+/*=============================================================================
+*   HasAvx2 [int]
+=============================================================================*/
+static inline int HasAvx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+/*=============================================================================
+*   TreeEscapeKernel [const char*]
+*       Name of the kernel TreeEscape and TreeUnescape use on this machine
+=============================================================================*/
+const char* TreeEscapeKernel(void)
+{
+#ifdef ESCAPE_AVX2
+    if(HasAvx2())
+    {
+        return "avx2";
+    }
+#endif
+#ifdef ESCAPE_SSE2
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+/*=============================================================================
+*   TreeEscape [size_t]
+*       Escapes a name or description for the text format
+*
+*       Parameters:
+*           char* out - Destination, at least 2 * `length` bytes
+*           const char* in - Text as stored in the model
+*           size_t length - Number of bytes in `in`
+*
+*       Returns the escaped length
+=============================================================================*/
+size_t TreeEscape(char* out, const char* in, size_t length)
+{
+#ifdef ESCAPE_AVX2
+    if(length >= 32 && HasAvx2())
+    {
+        return EscapeAvx2(out, in, length);
+    }
+#endif
+#ifdef ESCAPE_SSE2
+    if(length >= 16)
+    {
+        return EscapeSse2(out, in, length);
+    }
+#endif
+    return EscapeScalar(out, in, length);
+}
+
+/*=============================================================================
+*   TreeUnescape [size_t]
+*       Turns escape sequences back into the bytes they stand for
+*
+*       Parameters:
+*           char* out - Destination, at least `length` bytes; may equal `in`
+*           const char* in - Escaped text as found in the file
+*           size_t length - Number of bytes in `in`
+*
+*       Returns the unescaped length
+=============================================================================*/
+size_t TreeUnescape(char* out, const char* in, size_t length)
+{
+#ifdef ESCAPE_AVX2
+    if(length >= 32 && HasAvx2())
+    {
+        return UnescapeAvx2(out, in, length);
+    }
+#endif
+#ifdef ESCAPE_SSE2
+    if(length >= 16)
+    {
+        return UnescapeSse2(out, in, length);
+    }
+#endif
+    return UnescapeScalar(out, in, length);
+}
+
+/*=============================================================================
+*   TreeUnescapeLegacy [size_t]
+*       Resolves the one escape of files written before the byte order
+*       mark: "\n" in a description. Every other backslash, and everything
+*       in a name, was written as is and is kept as is.
+*
+*       Parameters:
+*           char* out - Destination, at least `length` bytes; may equal `in`
+*           const char* in - A description as found in the file
+*           size_t length - Number of bytes in `in`
+*
+*       Returns the unescaped length
+=============================================================================*/
+size_t TreeUnescapeLegacy(char* out, const char* in, size_t length)
+{
+    size_t j = 0;
+    for(size_t i = 0; i < length; i++)
+    {
+        if(in[i] == '\\' && i + 1 < length && in[i + 1] == 'n')
+        {
+            out[j++] = '\n';
+            i++;
+        }
+        else
+        {
+            out[j++] = in[i];
+        }
+    }
+    return j;
+}
@@ -0,0 +1,290 @@
+/*=============================================================================
+*       treehash.c
+*       Subtree hashes kept up to date across edits. Each node's hash folds
+*       in those of its children, so an edit only changes the hashes on its
+*       way up to the root. Those are marked stale when the edit is
+*       reported and hashed again the next time a hash is asked for, which
+*       makes "has the document changed since it was saved" a comparison
+*       of the root's hash with the one taken when it was saved.
+=============================================================================*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree.h"
+
+/*=============================================================================
+*   ReserveNodes [int]
+*       Makes room in the per node arrays for every id the model handed
+*       out. New entries are stale, so nothing is read from them before it
+*       is hashed.
+=============================================================================*/
+static int ReserveNodes(TreeHashCache* cache, const TreeModel* tree)
+{
+    if(tree->used <= cache->nodeCapacity)
+    {
+        return 1;
+    }
+    int32_t capacity = cache->nodeCapacity ? cache->nodeCapacity : 64;
+    while(capacity < tree->used)
+    {
+        capacity *= 2;
+    }
+
+    uint64_t* hashes = (uint64_t*)realloc(cache->hashes, capacity * sizeof(uint64_t));
+    if(hashes)
+    {
+        cache->hashes = hashes;
+    }
+    TreeNodeId* parents = (TreeNodeId*)realloc(cache->parents, capacity * sizeof(TreeNodeId));
+    if(parents)
+    {
+        cache->parents = parents;
+    }
+    uint8_t* stale = (uint8_t*)realloc(cache->stale, capacity);
+    if(stale)
+    {
+        cache->stale = stale;
+    }
+    if(!hashes || !parents || !stale)
+    {
+        return 0;
+    }
+
+    for(int32_t i = cache->nodeCapacity; i < capacity; i++)
+    {
+        cache->parents[i] = TREE_NIL;
+    }
+    memset(cache->stale + cache->nodeCapacity, 1, capacity - cache->nodeCapacity);
+    cache->nodeCapacity = capacity;
+    return 1;
+}
+
+/*=============================================================================
+*   MarkStale [void]
+*       Marks a node and the nodes above it stale. It stops at the first
+*       one already stale, as the nodes above that are stale too, so a run
+*       of edits under the same parent walks up once.
+*
+*       Parameters:
+*           TreeNodeId node - Where to start, may be TREE_NIL or the
+*                             parent of a freed node
+=============================================================================*/
+static void MarkStale(TreeHashCache* cache, const TreeModel* tree, TreeNodeId node)
+{
+    while(node >= 0 && node < cache->nodeCapacity && !cache->stale[node])
+    {
+        cache->stale[node] = 1;
+        node = tree->parent[node];
+    }
+}
+
+/*=============================================================================
+*   TreeHashInit [void]
+*       Prepares a cache that is not built yet
+=============================================================================*/
+void TreeHashInit(TreeHashCache* cache)
+{
+    memset(cache, 0, sizeof(*cache));
+}
+
+/*=============================================================================
+*   TreeHashClear [void]
+*       Drops every hash, e.g. for a new document. Edits are not tracked
+*       until it is built again, which the next TreeHashSubtree does.
+=============================================================================*/
+void TreeHashClear(TreeHashCache* cache)
+{
+    free(cache->hashes);
+    free(cache->parents);
+    free(cache->stale);
+    free(cache->order);
+    memset(cache, 0, sizeof(*cache));
+}
+
+/*=============================================================================
+*   TreeHashFree [void]
+=============================================================================*/
+void TreeHashFree(TreeHashCache* cache)
+{
+    TreeHashClear(cache);
+}
+
+/*=============================================================================
+*   TreeHashBuild [int]
+*       Hashes the whole document, one visit per node
+*
+*       Returns nonzero on success; out of memory leaves it not built
+=============================================================================*/
+int TreeHashBuild(TreeHashCache* cache, const TreeModel* tree)
+{
+    TreeHashClear(cache);
+    if(!ReserveNodes(cache, tree) || !TreeHashTree(tree, cache->hashes))
+    {
+        TreeHashClear(cache);
+        return 0;
+    }
+    for(TreeNodeId node = TREE_ROOT; node != TREE_NIL; node = TreeNextPreorder(tree, node, TREE_ROOT))
+    {
+        cache->stale[node] = 0;
+        cache->parents[node] = tree->parent[node];
+    }
+    cache->built = 1;
+    return 1;
+}
+
+/*=============================================================================
+*   TreeHashInserted [void]
+*       Marks a node just added to the model, or a detached subtree just
+*       put back, stale with everything below it and above it. An id may
+*       have been freed and handed out again since it was hashed, so the
+*       nodes below are not trusted to be unchanged.
+=============================================================================*/
+void TreeHashInserted(TreeHashCache* cache, const TreeModel* tree, TreeNodeId node)
+{
+    if(!cache->built)
+    {
+        return;
+    }
+    if(!ReserveNodes(cache, tree))
+    {
+        TreeHashClear(cache);
+        return;
+    }
+    for(TreeNodeId current = node; current != TREE_NIL; current = TreeNextPreorder(tree, current, node))
+    {
+        cache->stale[current] = 1;
+        cache->parents[current] = tree->parent[current];
+    }
+    MarkStale(cache, tree, tree->parent[node]);
+}
+
+/*=============================================================================
+*   TreeHashChanged [void]
+*       Marks a node whose name or description just changed stale, with
+*       the nodes above it
+=============================================================================*/
+void TreeHashChanged(TreeHashCache* cache, const TreeModel* tree, TreeNodeId node)
+{
+    if(cache->built)
+    {
+        MarkStale(cache, tree, node);
+    }
+}
+
+/*=============================================================================
+*   TreeHashMoved [void]
+*       Marks the nodes above a node just moved stale, at the place it
+*       left and at the one it went to. The nodes below it came along and
+*       keep their hashes.
+=============================================================================*/
+void TreeHashMoved(TreeHashCache* cache, const TreeModel* tree, TreeNodeId node)
+{
+    if(!cache->built || node >= cache->nodeCapacity)
+    {
+        return;
+    }
+    MarkStale(cache, tree, cache->parents[node]);
+    MarkStale(cache, tree, tree->parent[node]);
+    cache->parents[node] = tree->parent[node];
+}
+
+/*=============================================================================
+*   TreeHashDeleted [void]
+*       Marks the nodes above a subtree about to be deleted, or just
+*       detached, stale. Its own hashes are left behind; they are not
+*       used again before the subtree is put back, which marks it stale.
+=============================================================================*/
+void TreeHashDeleted(TreeHashCache* cache, const TreeModel* tree, TreeNodeId node)
+{
+    if(!cache->built || node >= cache->nodeCapacity)
+    {
+        return;
+    }
+    MarkStale(cache, tree, cache->parents[node]);
+    MarkStale(cache, tree, tree->parent[node]);
+}
+
+/*=============================================================================
+*   TreeHashSubtree [int]
+*       The hash of a node's subtree, equal to what TreeHashTree gives.
+*       The stale nodes below it are listed parents first, descending only
+*       into stale children, then hashed back to front; each costs a look
+*       at its children. The first call builds the cache.
+*
+*       Parameters:
+*           TreeHashCache* cache - The cache of `tree`
+*           const TreeModel* tree - The model
+*           TreeNodeId node - An attached node, TREE_ROOT for the document
+*           uint64_t* hash - Receives the hash
+*
+*       Returns 0 if out of memory
+=============================================================================*/
+int TreeHashSubtree(TreeHashCache* cache, const TreeModel* tree, TreeNodeId node, uint64_t* hash)
+{
+    if(!cache->built && !TreeHashBuild(cache, tree))
+    {
+        return 0;
+    }
+    if(!ReserveNodes(cache, tree))
+    {
+        TreeHashClear(cache);
+        return 0;
+    }
+
+    size_t count = 0;
+    if(cache->stale[node])
+    {
+        if(!cache->order)
+        {
+            cache->order = (TreeNodeId*)malloc(64 * sizeof(TreeNodeId));
+            if(!cache->order)
+            {
+                return 0;
+            }
+            cache->orderCapacity = 64;
+        }
+        cache->order[count++] = node;
+    }
+    for(size_t i = 0; i < count; i++)
+    {
+        TreeNodeId parent = cache->order[i];
+        for(TreeNodeId child = tree->firstChild[parent]; child != TREE_NIL; child = tree->nextSibling[child])
+        {
+            cache->parents[child] = parent;
+            if(!cache->stale[child])
+            {
+                continue;
+            }
+            if(count == cache->orderCapacity)
+            {
+                TreeNodeId* order = (TreeNodeId*)realloc(cache->order, count * 2 * sizeof(TreeNodeId));
+                if(!order)
+                {
+                    return 0;
+                }
+                cache->order = order;
+                cache->orderCapacity = count * 2;
+            }
+            cache->order[count++] = child;
+        }
+    }
+
+    while(count-- > 0)
+    {
+        TreeNodeId current = cache->order[count];
+        cache->hashes[current] = TreeHashNode(tree, current, cache->hashes);
+        cache->stale[current] = 0;
+    }
+    *hash = cache->hashes[node];
+    return 1;
+}
+
+/*=============================================================================
+*   TreeHashMemory [size_t]
+*       Bytes the cache holds, for reporting
+=============================================================================*/
+size_t TreeHashMemory(const TreeHashCache* cache)
+{
+    return (size_t)cache->nodeCapacity * (sizeof(uint64_t) + sizeof(TreeNodeId) + 1) +
+           cache->orderCapacity * sizeof(TreeNodeId);
+}
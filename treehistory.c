@@ -0,0 +1,412 @@
+/*=============================================================================
+*       treehistory.c
+*       Undo and redo. A step records only what an edit changed: the one
+*       string it replaced, or the links of the node it added, removed or
+*       moved.
+*       Deleted subtrees are detached from the model rather than freed, so
+*       a step shares them instead of copying them, and undoing a deletion
+*       relinks one node however many are below it.
+=============================================================================*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree.h"
+
+#define HISTORY_INSERT      1   //node was added
+#define HISTORY_DELETE      2   //node was taken out with everything below it
+#define HISTORY_NAME        3   //text is the name on the other side of the step
+#define HISTORY_DESCRIPTION 4   //text is the description on the other side
+#define HISTORY_MOVE        5   //parent and before are the place on the other side
+
+/*
+*   One edit. Applying a step in either direction swaps the model's state
+*   with the step's: a detached node is put back where parent and before
+*   say, an attached one is taken out and its place remembered, and a
+*   string is exchanged with text. A moved node trades places with the
+*   one parent and before say.
+*/
+struct _TreeHistoryStep
+{
+    int32_t kind;
+    TreeNodeId node;
+    TreeNodeId parent;
+    TreeNodeId before;
+    TreeStr text;
+};
+
+/*=============================================================================
+*   StepAt [TreeHistoryStep*]
+*       The i-th step from the oldest one
+=============================================================================*/
+static inline TreeHistoryStep* StepAt(const TreeHistory* history, uint32_t i)
+{
+    return &history->steps[(history->first + i) & (history->capacity - 1)];
+}
+
+/*=============================================================================
+*   Release [void]
+*       Frees the subtree a step keeps detached when the step is dropped.
+*       Only a deletion that can still be undone, or an insertion that can
+*       still be redone, holds its node; no other step refers to it then.
+=============================================================================*/
+static void Release(TreeModel* tree, const TreeHistoryStep* step, int undone)
+{
+    int32_t holder = undone ? HISTORY_INSERT : HISTORY_DELETE;
+    if(tree && step->kind == holder && TreeIsLive(tree, step->node) && tree->parent[step->node] == TREE_NIL)
+    {
+        TreeDeleteSubtree(tree, step->node);
+    }
+}
+
+/*=============================================================================
+*   DiscardRedo [void]
+*       Drops the undone steps, which a new edit makes unreachable
+=============================================================================*/
+static void DiscardRedo(TreeHistory* history, TreeModel* tree)
+{
+    for(uint32_t i = 0; i < history->redoCount; i++)
+    {
+        Release(tree, StepAt(history, history->undoCount + i), 1);
+    }
+    history->redoCount = 0;
+}
+
+/*=============================================================================
+*   Push [TreeHistoryStep*]
+*       Makes room for a new step after the last one that can be undone.
+*       Past history->maxBytes the oldest step is dropped to make room.
+*
+*       Returns the step to fill in, NULL if out of memory; the history is
+*       then cleared
+=============================================================================*/
+static TreeHistoryStep* Push(TreeHistory* history, TreeModel* tree)
+{
+    DiscardRedo(history, tree);
+
+    if(history->undoCount == history->capacity)
+    {
+        uint32_t capacity = history->capacity ? history->capacity * 2 : 64;
+        if((size_t)capacity * sizeof(TreeHistoryStep) <= history->maxBytes)
+        {
+            TreeHistoryStep* steps = (TreeHistoryStep*)malloc(capacity * sizeof(TreeHistoryStep));
+            if(!steps)
+            {
+                TreeHistoryClear(history, tree);
+                return NULL;
+            }
+            for(uint32_t i = 0; i < history->undoCount; i++)
+            {
+                steps[i] = *StepAt(history, i);
+            }
+            free(history->steps);
+            history->steps = steps;
+            history->capacity = capacity;
+            history->first = 0;
+        }
+        else if(history->capacity)
+        {
+            Release(tree, StepAt(history, 0), 0);
+            history->first = (history->first + 1) & (history->capacity - 1);
+            history->undoCount--;
+            history->dropped++;
+        }
+        else
+        {
+            //Not even one step fits
+            return NULL;
+        }
+    }
+
+    TreeHistoryStep* step = StepAt(history, history->undoCount++);
+    memset(step, 0, sizeof(*step));
+    return step;
+}
+
+/*=============================================================================
+*   Apply [int]
+*       Takes a step in either direction and reports what changed
+*
+*       Returns nonzero on success
+=============================================================================*/
+static int Apply(TreeModel* tree, TreeHistoryStep* step, TreeChange* change)
+{
+    TreeNodeId node = step->node;
+    if(!TreeIsLive(tree, node))
+    {
+        return 0;
+    }
+    change->node = node;
+
+    TreeStr* field;
+    switch(step->kind)
+    {
+        case HISTORY_INSERT:
+        case HISTORY_DELETE:
+            if(tree->parent[node] == TREE_NIL)
+            {
+                //The sibling it stood in front of is always back by now; the
+                //end of the list is only a fallback
+                if(!TreeMoveNode(tree, node, step->parent, step->before) &&
+                   !TreeMoveNode(tree, node, step->parent, TREE_NIL))
+                {
+                    return 0;
+                }
+                change->kind = TREE_CHANGE_ATTACHED;
+            }
+            else
+            {
+                step->parent = tree->parent[node];
+                step->before = tree->nextSibling[node];
+                TreeDetach(tree, node);
+                change->kind = TREE_CHANGE_DETACHED;
+            }
+            return 1;
+
+        case HISTORY_MOVE:
+        {
+            TreeNodeId parent = tree->parent[node];
+            TreeNodeId before = tree->nextSibling[node];
+            if(!TreeMoveNode(tree, node, step->parent, step->before) &&
+               !TreeMoveNode(tree, node, step->parent, TREE_NIL))
+            {
+                return 0;
+            }
+            step->parent = parent;
+            step->before = before;
+            change->kind = TREE_CHANGE_MOVED;
+            return 1;
+        }
+
+        case HISTORY_NAME:
+            field = &tree->data[node].name;
+            change->kind = TREE_CHANGE_NAME;
+            break;
+
+        case HISTORY_DESCRIPTION:
+            field = &tree->data[node].description;
+            change->kind = TREE_CHANGE_DESCRIPTION;
+            break;
+
+        default:
+            return 0;
+    }
+
+    TreeStr text = *field;
+    *field = step->text;
+    step->text = text;
+    return 1;
+}
+
+/*=============================================================================
+*   RecordText [void]
+*       Records the string an edit replaced. It is kept in the model's
+*       string pool, copied there first if it points into a mapped file
+*       that a save may release.
+=============================================================================*/
+static void RecordText(TreeHistory* history, TreeModel* tree, int32_t kind, TreeNodeId node, TreeStr old)
+{
+    TreeStr text = old;
+    if(TreeIsBorrowed(tree, old) && !TreeStrPoolAdd(&tree->strings, old.ptr, old.len, &text))
+    {
+        TreeHistoryClear(history, tree);
+        return;
+    }
+
+    TreeHistoryStep* step = Push(history, tree);
+    if(step)
+    {
+        step->kind = kind;
+        step->node = node;
+        step->text = text;
+    }
+}
+
+/*=============================================================================
+*   TreeHistoryInit [void]
+*       Prepares an empty history capped at TREE_HISTORY_MAX_BYTES
+=============================================================================*/
+void TreeHistoryInit(TreeHistory* history)
+{
+    memset(history, 0, sizeof(*history));
+    history->maxBytes = TREE_HISTORY_MAX_BYTES;
+}
+
+/*=============================================================================
+*   TreeHistoryFree [void]
+*       Releases the steps. The subtrees they hold stay in the model as
+*       detached nodes; use TreeHistoryClear first if the model lives on.
+=============================================================================*/
+void TreeHistoryFree(TreeHistory* history)
+{
+    free(history->steps);
+    memset(history, 0, sizeof(*history));
+}
+
+/*=============================================================================
+*   TreeHistoryClear [void]
+*       Forgets every step and frees the detached subtrees they held
+*
+*       Parameters:
+*           TreeHistory* history - The history
+*           TreeModel* tree - The model, or NULL if it is about to be
+*                             cleared anyway and nothing needs freeing
+=============================================================================*/
+void TreeHistoryClear(TreeHistory* history, TreeModel* tree)
+{
+    DiscardRedo(history, tree);
+    for(uint32_t i = 0; i < history->undoCount; i++)
+    {
+        Release(tree, StepAt(history, i), 0);
+    }
+    history->undoCount = 0;
+    history->first = 0;
+}
+
+/*=============================================================================
+*   TreeHistoryInserted [void]
+*       Records a node just added to the model
+=============================================================================*/
+void TreeHistoryInserted(TreeHistory* history, TreeModel* tree, TreeNodeId node)
+{
+    TreeHistoryStep* step = Push(history, tree);
+    if(step)
+    {
+        step->kind = HISTORY_INSERT;
+        step->node = node;
+    }
+}
+
+/*=============================================================================
+*   TreeHistoryDelete [void]
+*       Deletes a node and everything below it so that it can be undone:
+*       the subtree is only detached and the step keeps it. If the step
+*       cannot be recorded the subtree is freed as TreeDeleteSubtree would.
+*
+*       ***The node must not be TREE_ROOT***
+=============================================================================*/
+void TreeHistoryDelete(TreeHistory* history, TreeModel* tree, TreeNodeId node)
+{
+    if(node == TREE_ROOT || !TreeIsLive(tree, node))
+    {
+        return;
+    }
+    TreeHistoryStep* step = Push(history, tree);
+    if(!step)
+    {
+        TreeDeleteSubtree(tree, node);
+        return;
+    }
+    step->kind = HISTORY_DELETE;
+    step->node = node;
+    step->parent = tree->parent[node];
+    step->before = tree->nextSibling[node];
+    TreeDetach(tree, node);
+}
+
+/*=============================================================================
+*   TreeHistoryMoved [void]
+*       Records a move, after TreeMoveNode. The step holds two links
+*       however many nodes came along.
+*
+*       Parameters:
+*           TreeHistory* history - The history
+*           TreeModel* tree - The model
+*           TreeNodeId node - The moved node
+*           TreeNodeId parent - Its parent before the move
+*           TreeNodeId before - Its next sibling before the move, TREE_NIL
+*                               if it was the last child
+=============================================================================*/
+void TreeHistoryMoved(TreeHistory* history, TreeModel* tree, TreeNodeId node, TreeNodeId parent, TreeNodeId before)
+{
+    TreeHistoryStep* step = Push(history, tree);
+    if(step)
+    {
+        step->kind = HISTORY_MOVE;
+        step->node = node;
+        step->parent = parent;
+        step->before = before;
+    }
+}
+
+/*=============================================================================
+*   TreeHistoryNameChanged [void]
+*       Records a rename, after TreeSetName
+*
+*       Parameters:
+*           TreeHistory* history - The history
+*           TreeModel* tree - The model
+*           TreeNodeId node - The renamed node
+*           TreeStr old - Its name before, as read before TreeSetName
+=============================================================================*/
+void TreeHistoryNameChanged(TreeHistory* history, TreeModel* tree, TreeNodeId node, TreeStr old)
+{
+    RecordText(history, tree, HISTORY_NAME, node, old);
+}
+
+/*=============================================================================
+*   TreeHistoryDescriptionChanged [void]
+*       Same as TreeHistoryNameChanged, for the description
+=============================================================================*/
+void TreeHistoryDescriptionChanged(TreeHistory* history, TreeModel* tree, TreeNodeId node, TreeStr old)
+{
+    RecordText(history, tree, HISTORY_DESCRIPTION, node, old);
+}
+
+/*=============================================================================
+*   TreeHistoryUndo [int]
+*       Reverts the last edit that has not been undone. The caller brings
+*       the view, journal and indexes in line with the reported change.
+*
+*       Parameters:
+*           TreeHistory* history - The history
+*           TreeModel* tree - The model
+*           TreeChange* change - Receives what changed in the model
+*
+*       Returns nonzero if an edit was undone
+=============================================================================*/
+int TreeHistoryUndo(TreeHistory* history, TreeModel* tree, TreeChange* change)
+{
+    if(!history->undoCount || !Apply(tree, StepAt(history, history->undoCount - 1), change))
+    {
+        return 0;
+    }
+    history->undoCount--;
+    history->redoCount++;
+    return 1;
+}
+
+/*=============================================================================
+*   TreeHistoryRedo [int]
+*       Makes the last undone edit again, see TreeHistoryUndo
+*
+*       Returns nonzero if an edit was redone
+=============================================================================*/
+int TreeHistoryRedo(TreeHistory* history, TreeModel* tree, TreeChange* change)
+{
+    if(!history->redoCount || !Apply(tree, StepAt(history, history->undoCount), change))
+    {
+        return 0;
+    }
+    history->undoCount++;
+    history->redoCount--;
+    return 1;
+}
+
+/*=============================================================================
+*   TreeHistoryMemory [size_t]
+*       Bytes allocated for steps. The nodes of deleted subtrees are not
+*       counted; they were in the model already and are not copied.
+=============================================================================*/
+size_t TreeHistoryMemory(const TreeHistory* history)
+{
+    return (size_t)history->capacity * sizeof(TreeHistoryStep);
+}
+
+/*=============================================================================
+*   TreeHistoryStepSize [size_t]
+*       Bytes one step takes, whatever the edit
+=============================================================================*/
+size_t TreeHistoryStepSize(void)
+{
+    return sizeof(TreeHistoryStep);
+}
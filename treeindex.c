@@ -0,0 +1,596 @@
+/*=============================================================================
+*       treeindex.c
+*       Inverted index for searching names and descriptions. Every run of
+*       three bytes (a trigram) maps to the nodes whose text contains it,
+*       so a substring query only looks at the nodes that have its rarest
+*       trigram. Edits add to the index as they happen; what they leave
+*       behind is skipped by the queries and dropped by a rebuild once it
+*       outweighs the rest.
+=============================================================================*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree.h"
+
+/*
+*   Keys. Text is folded to lowercase ASCII first, other bytes are kept.
+*   Besides the trigrams, the one and two bytes at every word start get
+*   keys of their own, so short prefix queries need no scan either.
+*/
+#define KEY_TRIGRAM(a, b, c) (((uint32_t)(a) << 16) | ((uint32_t)(b) << 8) | (uint32_t)(c))
+#define KEY_PREFIX1(a)       ((1u << 24) | (uint32_t)(a))
+#define KEY_PREFIX2(a, b)    ((2u << 24) | ((uint32_t)(a) << 8) | (uint32_t)(b))
+#define KEY_EMPTY            0xFFFFFFFFu
+
+//A rebuild is not worth it below this many stale entries
+#define INDEX_COMPACT_MIN 65536
+
+/*
+*   The nodes of one key in the order they were added, each stored as the
+*   zigzag varint of its difference to the one before. A node whose text
+*   changed or that was deleted stays in its old lists until a rebuild;
+*   queries check every candidate against the model anyway.
+*/
+struct _TreeIndexList
+{
+    uint32_t key;           //KEY_EMPTY for a free slot
+    uint32_t count;         //entries, stale ones included
+    uint32_t length;        //bytes used
+    uint32_t capacity;
+    TreeNodeId last;        //the last entry, base of the next difference
+    unsigned char* bytes;
+};
+
+//Bytes folded for matching, ASCII letters to lowercase
+static unsigned char fold[256];
+
+/*=============================================================================
+*   InitFold [void]
+=============================================================================*/
+static void InitFold(void)
+{
+    if(fold['A'] == 'a')
+    {
+        return;
+    }
+    for(int i = 0; i < 256; i++)
+    {
+        fold[i] = (unsigned char)(i >= 'A' && i <= 'Z' ? i - 'A' + 'a' : i);
+    }
+}
+
+/*=============================================================================
+*   IsWordByte [int]
+*       Letters, digits and any byte of a multibyte character
+=============================================================================*/
+static inline int IsWordByte(unsigned char byte)
+{
+    return (byte >= 'a' && byte <= 'z') || (byte >= 'A' && byte <= 'Z') ||
+           (byte >= '0' && byte <= '9') || byte >= 0x80;
+}
+
+/*=============================================================================
+*   HashKey [uint32_t]
+=============================================================================*/
+static inline uint32_t HashKey(uint32_t key)
+{
+    key ^= key >> 15;
+    key *= 0x2C1B3C6Du;
+    key ^= key >> 12;
+    return key;
+}
+
+/*=============================================================================
+*   FindList [TreeIndexList*]
+*       The list of a key, NULL if no node ever had it
+=============================================================================*/
+static TreeIndexList* FindList(const TreeIndex* index, uint32_t key)
+{
+    if(!index->lists)
+    {
+        return NULL;
+    }
+    for(uint32_t slot = HashKey(key) & index->listMask; ; slot = (slot + 1) & index->listMask)
+    {
+        TreeIndexList* list = &index->lists[slot];
+        if(list->key == key)
+        {
+            return list;
+        }
+        if(list->key == KEY_EMPTY)
+        {
+            return NULL;
+        }
+    }
+}
+
+/*=============================================================================
+*   GrowLists [int]
+*       Doubles the key table and rehashes the lists already in it
+=============================================================================*/
+static int GrowLists(TreeIndex* index)
+{
+    uint32_t newCount = index->lists ? (index->listMask + 1) * 2 : 4096;
+    TreeIndexList* lists = (TreeIndexList*)malloc(newCount * sizeof(TreeIndexList));
+    if(!lists)
+    {
+        return 0;
+    }
+    for(uint32_t i = 0; i < newCount; i++)
+    {
+        lists[i].key = KEY_EMPTY;
+    }
+
+    uint32_t newMask = newCount - 1;
+    for(uint32_t i = 0; index->lists && i <= index->listMask; i++)
+    {
+        if(index->lists[i].key == KEY_EMPTY)
+        {
+            continue;
+        }
+        uint32_t slot = HashKey(index->lists[i].key) & newMask;
+        while(lists[slot].key != KEY_EMPTY)
+        {
+            slot = (slot + 1) & newMask;
+        }
+        lists[slot] = index->lists[i];
+    }
+    free(index->lists);
+    index->lists = lists;
+    index->listMask = newMask;
+    return 1;
+}
+
+/*=============================================================================
+*   AddEntry [int]
+*       Appends a node to the list of a key, once per node and key
+*
+*       Returns 0 if out of memory
+=============================================================================*/
+static int AddEntry(TreeIndex* index, uint32_t key, TreeNodeId node, uint32_t* added)
+{
+    //Keep the table at most half full
+    if(!index->lists || (index->listUsed + 1) * 2 > index->listMask + 1)
+    {
+        if(!GrowLists(index))
+        {
+            return 0;
+        }
+    }
+
+    uint32_t slot = HashKey(key) & index->listMask;
+    while(index->lists[slot].key != key && index->lists[slot].key != KEY_EMPTY)
+    {
+        slot = (slot + 1) & index->listMask;
+    }
+    TreeIndexList* list = &index->lists[slot];
+    if(list->key == KEY_EMPTY)
+    {
+        memset(list, 0, sizeof(*list));
+        list->key = key;
+        index->listUsed++;
+    }
+    else if(list->last == node)
+    {
+        return 1;
+    }
+
+    if(list->length + 5 > list->capacity)
+    {
+        uint32_t capacity = list->capacity ? list->capacity : 16;
+        while(capacity < list->length + 5)
+        {
+            capacity *= 2;
+        }
+        unsigned char* bytes = (unsigned char*)realloc(list->bytes, capacity);
+        if(!bytes)
+        {
+            return 0;
+        }
+        index->bytes += capacity - list->capacity;
+        list->bytes = bytes;
+        list->capacity = capacity;
+    }
+
+    //Zigzag, so the ids of nodes added later may also go down
+    int32_t delta = node - list->last;
+    uint32_t value = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+    while(value >= 0x80)
+    {
+        list->bytes[list->length++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    list->bytes[list->length++] = (unsigned char)value;
+    list->last = node;
+    list->count++;
+    (*added)++;
+    return 1;
+}
+
+/*=============================================================================
+*   NextEntry [TreeNodeId]
+*       Decodes the entry at *offset and advances past it
+=============================================================================*/
+static inline TreeNodeId NextEntry(const TreeIndexList* list, uint32_t* offset, TreeNodeId previous)
+{
+    uint32_t value = 0;
+    int shift = 0;
+    unsigned char byte;
+    do
+    {
+        byte = list->bytes[(*offset)++];
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        shift += 7;
+    }
+    while(byte & 0x80);
+    int32_t delta = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+    return previous + delta;
+}
+
+/*=============================================================================
+*   AddText [int]
+*       Adds the keys of one name or description. Trigrams never reach
+*       across from one text into the other.
+=============================================================================*/
+static int AddText(TreeIndex* index, TreeNodeId node, TreeStr text, uint32_t* added)
+{
+    const unsigned char* bytes = (const unsigned char*)text.ptr;
+    for(uint32_t i = 0; i < text.len; i++)
+    {
+        unsigned char a = fold[bytes[i]];
+        if(i == 0 || !IsWordByte(bytes[i - 1]))
+        {
+            if(!AddEntry(index, KEY_PREFIX1(a), node, added) ||
+               (i + 1 < text.len && !AddEntry(index, KEY_PREFIX2(a, fold[bytes[i + 1]]), node, added)))
+            {
+                return 0;
+            }
+        }
+        if(i + 2 < text.len && !AddEntry(index, KEY_TRIGRAM(a, fold[bytes[i + 1]], fold[bytes[i + 2]]), node, added))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   AddNode [int]
+*       Adds the keys of a node's name and description
+=============================================================================*/
+static int AddNode(TreeIndex* index, const TreeModel* tree, TreeNodeId node)
+{
+    if(tree->used > index->nodeCapacity)
+    {
+        int32_t capacity = index->nodeCapacity ? index->nodeCapacity : 64;
+        while(capacity < tree->used)
+        {
+            capacity *= 2;
+        }
+        uint32_t* entries = (uint32_t*)realloc(index->entries, capacity * sizeof(uint32_t));
+        if(!entries)
+        {
+            return 0;
+        }
+        memset(entries + index->nodeCapacity, 0, (capacity - index->nodeCapacity) * sizeof(uint32_t));
+        index->entries = entries;
+        index->nodeCapacity = capacity;
+    }
+
+    uint32_t added = 0;
+    int ok = AddText(index, node, TreeName(tree, node), &added) &&
+             AddText(index, node, TreeDescription(tree, node), &added);
+    index->entries[node] += added;
+    index->count += added;
+    return ok;
+}
+
+/*=============================================================================
+*   Matches [int]
+*       Whether text contains the folded query, at a word start if `prefix`
+=============================================================================*/
+static int Matches(TreeStr text, const unsigned char* query, size_t length, int prefix)
+{
+    const unsigned char* bytes = (const unsigned char*)text.ptr;
+    if(length > text.len)
+    {
+        return 0;
+    }
+    for(size_t i = 0; i + length <= text.len; i++)
+    {
+        if(fold[bytes[i]] != query[0] || (prefix && i > 0 && IsWordByte(bytes[i - 1])))
+        {
+            continue;
+        }
+        size_t j = 1;
+        while(j < length && fold[bytes[i + j]] == query[j])
+        {
+            j++;
+        }
+        if(j == length)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*=============================================================================
+*   TreeIndexInit [void]
+*       Prepares an index that is not built yet
+=============================================================================*/
+void TreeIndexInit(TreeIndex* index)
+{
+    InitFold();
+    memset(index, 0, sizeof(*index));
+}
+
+/*=============================================================================
+*   TreeIndexClear [void]
+*       Drops everything, e.g. for a new document. Edits are not indexed
+*       and queries scan the model until it is built again.
+=============================================================================*/
+void TreeIndexClear(TreeIndex* index)
+{
+    for(uint32_t i = 0; index->lists && i <= index->listMask; i++)
+    {
+        if(index->lists[i].key != KEY_EMPTY)
+        {
+            free(index->lists[i].bytes);
+        }
+    }
+    free(index->lists);
+    free(index->entries);
+    memset(index, 0, sizeof(*index));
+}
+
+/*=============================================================================
+*   TreeIndexFree [void]
+=============================================================================*/
+void TreeIndexFree(TreeIndex* index)
+{
+    TreeIndexClear(index);
+}
+
+/*=============================================================================
+*   TreeIndexBuild [int]
+*       Indexes every node in the document. Nodes are visited in preorder,
+*       which skips detached and freed ids without a walk up from each;
+*       a loaded file hands out ids in that order, so the differences in
+*       every list start out small.
+*
+*       Returns nonzero on success; out of memory leaves it not built
+=============================================================================*/
+int TreeIndexBuild(TreeIndex* index, const TreeModel* tree)
+{
+    TreeIndexClear(index);
+    for(TreeNodeId node = TreeNextPreorder(tree, TREE_ROOT, TREE_ROOT); node != TREE_NIL; node = TreeNextPreorder(tree, node, TREE_ROOT))
+    {
+        if(!AddNode(index, tree, node))
+        {
+            TreeIndexClear(index);
+            return 0;
+        }
+    }
+
+    //Lists grow by doubling; give back what the build did not use
+    for(uint32_t i = 0; index->lists && i <= index->listMask; i++)
+    {
+        TreeIndexList* list = &index->lists[i];
+        if(list->key == KEY_EMPTY || list->capacity == list->length)
+        {
+            continue;
+        }
+        unsigned char* bytes = (unsigned char*)realloc(list->bytes, list->length);
+        if(bytes)
+        {
+            index->bytes -= list->capacity - list->length;
+            list->bytes = bytes;
+            list->capacity = list->length;
+        }
+    }
+    index->built = 1;
+    return 1;
+}
+
+/*=============================================================================
+*   Update [void]
+*       Indexes a node added or changed, or a whole subtree put back, then
+*       rebuilds if stale entries have come to outnumber the live ones. Out
+*       of memory drops the index, which is then rebuilt on demand.
+=============================================================================*/
+static void Update(TreeIndex* index, const TreeModel* tree, TreeNodeId node, int subtree)
+{
+    int ok = 1;
+    for(TreeNodeId current = node; current != TREE_NIL && ok; current = subtree ? TreeNextPreorder(tree, current, node) : TREE_NIL)
+    {
+        ok = AddNode(index, tree, current);
+    }
+    if(!ok ||
+       (index->stale > INDEX_COMPACT_MIN && index->stale * 2 > index->count && !TreeIndexBuild(index, tree)))
+    {
+        TreeIndexClear(index);
+    }
+}
+
+/*=============================================================================
+*   TreeIndexInserted [void]
+*       Indexes a node just added to the model, or a detached subtree just
+*       put back, with everything below it
+=============================================================================*/
+void TreeIndexInserted(TreeIndex* index, const TreeModel* tree, TreeNodeId node)
+{
+    if(index->built)
+    {
+        Update(index, tree, node, 1);
+    }
+}
+
+/*=============================================================================
+*   TreeIndexChanged [void]
+*       Indexes the new name or description of a node. Its old entries
+*       stay behind as stale ones.
+=============================================================================*/
+void TreeIndexChanged(TreeIndex* index, const TreeModel* tree, TreeNodeId node)
+{
+    if(index->built)
+    {
+        index->stale += index->entries[node];
+        index->entries[node] = 0;
+        Update(index, tree, node, 0);
+    }
+}
+
+/*=============================================================================
+*   TreeIndexDeleted [void]
+*       Counts the entries of a subtree about to be deleted, or just
+*       detached, as stale
+*
+*       ***Call it before TreeDeleteSubtree, while the nodes are still live***
+=============================================================================*/
+void TreeIndexDeleted(TreeIndex* index, const TreeModel* tree, TreeNodeId node)
+{
+    if(!index->built)
+    {
+        return;
+    }
+    for(TreeNodeId current = node; current != TREE_NIL; current = TreeNextPreorder(tree, current, node))
+    {
+        if(current < index->nodeCapacity)
+        {
+            index->stale += index->entries[current];
+            index->entries[current] = 0;
+        }
+    }
+}
+
+/*=============================================================================
+*   TreeIndexFind [size_t]
+*       Finds nodes whose name or description contains `query`, ignoring
+*       the case of ASCII letters. Queries of three bytes or more, and
+*       prefix queries, read only the shortest list of the query's keys;
+*       other queries, or any before the index is built, scan the model.
+*
+*       Parameters:
+*           const TreeIndex* index - The index of `tree`
+*           const TreeModel* tree - The model
+*           const char* query - UTF-8 text to look for
+*           size_t length - Number of bytes in `query`
+*           int flags - TREE_FIND_PREFIX to match at word starts only
+*           TreeNodeId* out - Receives the nodes found
+*           size_t max - Stop after this many
+*
+*       Returns the number of nodes written to `out`
+=============================================================================*/
+size_t TreeIndexFind(const TreeIndex* index, const TreeModel* tree, const char* query, size_t length, int flags, TreeNodeId* out, size_t max)
+{
+    int prefix = (flags & TREE_FIND_PREFIX) != 0;
+    unsigned char* folded = length ? (unsigned char*)malloc(length) : NULL;
+    if(!folded || !max)
+    {
+        free(folded);
+        return 0;
+    }
+    for(size_t i = 0; i < length; i++)
+    {
+        folded[i] = fold[(unsigned char)query[i]];
+    }
+
+    //The shortest list of any key the matches must have
+    const TreeIndexList* best = NULL;
+    int usable = 0;
+    if(index->built)
+    {
+        uint32_t keys[3];
+        size_t keyCount = 0;
+        if(prefix)
+        {
+            keys[keyCount++] = length == 1 ? KEY_PREFIX1(folded[0]) : KEY_PREFIX2(folded[0], folded[1]);
+        }
+        for(size_t i = 0; i + 2 < length; i++)
+        {
+            const TreeIndexList* list = FindList(index, KEY_TRIGRAM(folded[i], folded[i + 1], folded[i + 2]));
+            if(!list)
+            {
+                free(folded);
+                return 0;
+            }
+            if(!best || list->count < best->count)
+            {
+                best = list;
+            }
+            usable = 1;
+        }
+        for(size_t i = 0; i < keyCount; i++)
+        {
+            const TreeIndexList* list = FindList(index, keys[i]);
+            if(!list)
+            {
+                free(folded);
+                return 0;
+            }
+            if(!best || list->count < best->count)
+            {
+                best = list;
+            }
+            usable = 1;
+        }
+    }
+
+    size_t found = 0;
+    if(usable)
+    {
+        //A node may be in a list more than once after edits
+        uint8_t* seen = (uint8_t*)calloc(((size_t)tree->used + 7) / 8, 1);
+        if(!seen)
+        {
+            free(folded);
+            return 0;
+        }
+        uint32_t offset = 0;
+        TreeNodeId node = 0;
+        for(uint32_t i = 0; i < best->count && found < max; i++)
+        {
+            node = NextEntry(best, &offset, node);
+            if(node <= TREE_ROOT || !TreeIsAttached(tree, node) || (seen[node >> 3] & (1 << (node & 7))))
+            {
+                continue;
+            }
+            seen[node >> 3] |= (uint8_t)(1 << (node & 7));
+            if(Matches(TreeName(tree, node), folded, length, prefix) ||
+               Matches(TreeDescription(tree, node), folded, length, prefix))
+            {
+                out[found++] = node;
+            }
+        }
+        free(seen);
+    }
+    else
+    {
+        TreeNodeId node = TreeNextPreorder(tree, TREE_ROOT, TREE_ROOT);
+        for(; node != TREE_NIL && found < max; node = TreeNextPreorder(tree, node, TREE_ROOT))
+        {
+            if(Matches(TreeName(tree, node), folded, length, prefix) ||
+               Matches(TreeDescription(tree, node), folded, length, prefix))
+            {
+                out[found++] = node;
+            }
+        }
+    }
+    free(folded);
+    return found;
+}
+
+/*=============================================================================
+*   TreeIndexMemory [size_t]
+*       Bytes the index holds, for reporting
+=============================================================================*/
+size_t TreeIndexMemory(const TreeIndex* index)
+{
+    size_t size = index->bytes + (size_t)index->nodeCapacity * sizeof(uint32_t);
+    if(index->lists)
+    {
+        size += ((size_t)index->listMask + 1) * sizeof(TreeIndexList);
+    }
+    return size;
+}
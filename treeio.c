@@ -0,0 +1,1446 @@
+/*=============================================================================
+*       treeio.c
+*       The tab-indented .dat text format: streaming parser and writer.
+*       Files are UTF-8 and start with a byte order mark. Files without one
+*       predate it and may hold ANSI text, which is converted on load.
+=============================================================================*/
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree.h"
+
+//Size of the blocks read from disk by the streaming loader
+#ifndef TREE_IO_BLOCK
+#define TREE_IO_BLOCK (1024 * 1024)
+#endif
+
+/*
+*   Output buffer for the writer. Text is formatted straight into
+*   `buffer`, which is written out with one fwrite whenever it fills up.
+*   Without a file the buffer just grows, so a caller can collect the
+*   output in memory.
+*/
+typedef struct _TreeWriter
+{
+    FILE* file;
+    char* buffer;
+    size_t length;
+    size_t capacity;
+    int failed;
+} TreeWriter;
+
+//A run of tabs that indents are copied from
+static const char tabRun[64] =
+    "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t"
+    "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
+
+/*=============================================================================
+*   WriterFlush [void]
+*       Hands the buffered text to the file, if there is one
+=============================================================================*/
+static void WriterFlush(TreeWriter* writer)
+{
+    if(writer->file && writer->length)
+    {
+        if(fwrite(writer->buffer, 1, writer->length, writer->file) != writer->length)
+        {
+            writer->failed = 1;
+        }
+        writer->length = 0;
+    }
+}
+
+/*=============================================================================
+*   WriterMakeRoom [int]
+*       Ensures `size` more bytes fit in the buffer, flushing to the file
+*       or growing the buffer as needed
+=============================================================================*/
+static int WriterMakeRoom(TreeWriter* writer, size_t size)
+{
+    if(writer->capacity - writer->length >= size)
+    {
+        return 1;
+    }
+    WriterFlush(writer);
+    if(writer->capacity - writer->length >= size)
+    {
+        return 1;
+    }
+
+    size_t capacity = writer->capacity ? writer->capacity : TREE_IO_BLOCK;
+    while(capacity - writer->length < size)
+    {
+        capacity *= 2;
+    }
+    char* buffer = (char*)realloc(writer->buffer, capacity);
+    if(!buffer)
+    {
+        writer->failed = 1;
+        return 0;
+    }
+    writer->buffer = buffer;
+    writer->capacity = capacity;
+    return 1;
+}
+
+/*=============================================================================
+*   WriterPut [void]
+*       Appends bytes; blocks larger than the buffer bypass it entirely
+=============================================================================*/
+static void WriterPut(TreeWriter* writer, const char* bytes, size_t size)
+{
+    if(writer->file && size >= TREE_IO_BLOCK)
+    {
+        WriterFlush(writer);
+        if(fwrite(bytes, 1, size, writer->file) != size)
+        {
+            writer->failed = 1;
+        }
+        return;
+    }
+    if(WriterMakeRoom(writer, size))
+    {
+        memcpy(writer->buffer + writer->length, bytes, size);
+        writer->length += size;
+    }
+}
+
+/*=============================================================================
+*   WriterIndent [void]
+*       Appends `level` tabs, copied from tabRun a run at a time
+=============================================================================*/
+static void WriterIndent(TreeWriter* writer, int level)
+{
+    while(level > 0)
+    {
+        int run = level < (int)sizeof(tabRun) ? level : (int)sizeof(tabRun);
+        WriterPut(writer, tabRun, run);
+        level -= run;
+    }
+}
+
+/*=============================================================================
+*   WriterEscaped [void]
+*       Appends a name or description escaped straight into the buffer
+=============================================================================*/
+static void WriterEscaped(TreeWriter* writer, TreeStr text)
+{
+    if(WriterMakeRoom(writer, (size_t)text.len * 2))
+    {
+        writer->length += TreeEscape(writer->buffer + writer->length, text.ptr, text.len);
+    }
+}
+
+/*=============================================================================
+*   WriterOpenNode [void]
+*       Appends a node's name, opening brace and description
+=============================================================================*/
+static void WriterOpenNode(TreeWriter* writer, const TreeNodeData* data, int level)
+{
+    WriterIndent(writer, level);
+    WriterEscaped(writer, data->name);
+    WriterPut(writer, "\n", 1);
+    WriterIndent(writer, level);
+    WriterPut(writer, "{\n", 2);
+    WriterIndent(writer, level + 1);
+    WriterEscaped(writer, data->description);
+    WriterPut(writer, "\n", 1);
+}
+
+/*=============================================================================
+*   WriterCloseNode [void]
+=============================================================================*/
+static void WriterCloseNode(TreeWriter* writer, int level)
+{
+    WriterIndent(writer, level);
+    WriterPut(writer, "}\n", 2);
+}
+
+/*=============================================================================
+*   WriteSubtree [void]
+*       Formats `top` and everything below it without recursion. Closing
+*       braces are emitted while climbing back up through the parent links,
+*       so no stack is needed however deep the tree is.
+*
+*       Parameters:
+*           TreeWriter* writer - Receives the text
+*           const TreeModel* tree - The model being saved
+*           TreeNodeId top - First node to write
+*           int level - Indent of `top`
+*
+=============================================================================*/
+static void WriteSubtree(TreeWriter* writer, const TreeModel* tree, TreeNodeId top, int level)
+{
+    TreeNodeId node = top;
+    for(;;)
+    {
+        WriterOpenNode(writer, &tree->data[node], level);
+        if(tree->firstChild[node] != TREE_NIL)
+        {
+            node = tree->firstChild[node];
+            level++;
+            continue;
+        }
+
+        //A leaf: close it and every ancestor whose last child we just finished
+        WriterCloseNode(writer, level);
+        while(node != top && tree->nextSibling[node] == TREE_NIL)
+        {
+            node = tree->parent[node];
+            level--;
+            WriterCloseNode(writer, level);
+        }
+        if(node == top)
+        {
+            return;
+        }
+        node = tree->nextSibling[node];
+    }
+}
+
+/*=============================================================================
+*   TreeSaveToStream [int]
+*       Writes every top level node and its children in the .dat format,
+*       UTF-8 behind a byte order mark. Output is batched into one large
+*       buffer and flushed in big writes.
+*
+*       Returns nonzero on success
+=============================================================================*/
+int TreeSaveToStream(const TreeModel* tree, FILE* file)
+{
+    TreeWriter writer = {0};
+    writer.file = file;
+    WriterPut(&writer, TREE_UTF8_BOM, TREE_UTF8_BOM_LENGTH);
+
+    for(TreeNodeId node = tree->firstChild[TREE_ROOT]; node != TREE_NIL; node = tree->nextSibling[node])
+    {
+        WriteSubtree(&writer, tree, node, 0);
+    }
+    WriterFlush(&writer);
+    free(writer.buffer);
+
+    return !writer.failed && !ferror(file);
+}
+
+/*
+*   The parallel writer splits the document into an ordered list of pieces.
+*   A run piece is a range of consecutive siblings that a worker formats
+*   into its own buffer; open and close pieces are the name/brace lines of
+*   the nodes that were split further, written by the calling thread.
+*/
+#define SAVE_PIECE_RUN   0
+#define SAVE_PIECE_OPEN  1
+#define SAVE_PIECE_CLOSE 2
+
+//Nodes below this depth are never split, their subtrees become one run
+#define SAVE_MAX_SPLIT_DEPTH 32
+
+//Pieces per thread, so uneven pieces still balance out
+#define SAVE_PIECES_PER_THREAD 8
+
+//Smaller documents are not worth starting threads for
+#define SAVE_PARALLEL_MIN_NODES 20000
+
+typedef struct _SavePiece
+{
+    int kind;
+    int level;
+    TreeNodeId first;       //run: first sibling, open/close: the node
+    TreeNodeId last;        //run: last sibling
+    TreeWriter out;
+} SavePiece;
+
+typedef struct _SaveJob
+{
+    const TreeModel* tree;
+    const int32_t* sizes;   //subtree node counts, indexed by node id
+    int32_t target;         //desired nodes per run
+
+    SavePiece* pieces;
+    int pieceCount;
+    int pieceCapacity;
+    int failed;
+
+    atomic_int next;        //next piece a worker should take
+} SaveJob;
+
+/*=============================================================================
+*   SubtreeSizes [int32_t*]
+*       Counts the nodes below every node in O(n) without recursion: nodes
+*       are listed in preorder, then each adds its count to its parent in
+*       reverse order.
+*
+*       Returns a malloc'ed array indexed by node id, or NULL
+=============================================================================*/
+static int32_t* SubtreeSizes(const TreeModel* tree)
+{
+    int32_t* sizes = (int32_t*)calloc(tree->used, sizeof(int32_t));
+    TreeNodeId* order = (TreeNodeId*)malloc((tree->count + 1) * sizeof(TreeNodeId));
+    if(!sizes || !order)
+    {
+        free(sizes);
+        free(order);
+        return NULL;
+    }
+
+    int32_t length = 0;
+    for(TreeNodeId node = TREE_ROOT; node != TREE_NIL; node = TreeNextPreorder(tree, node, TREE_ROOT))
+    {
+        order[length++] = node;
+    }
+    for(int32_t i = length - 1; i > 0; i--)
+    {
+        TreeNodeId node = order[i];
+        sizes[node] += 1;
+        sizes[tree->parent[node]] += sizes[node];
+    }
+
+    free(order);
+    return sizes;
+}
+
+/*=============================================================================
+*   AddPiece [void]
+=============================================================================*/
+static void AddPiece(SaveJob* job, int kind, int level, TreeNodeId first, TreeNodeId last)
+{
+    if(job->pieceCount == job->pieceCapacity)
+    {
+        int capacity = job->pieceCapacity ? job->pieceCapacity * 2 : 64;
+        SavePiece* pieces = (SavePiece*)realloc(job->pieces, capacity * sizeof(SavePiece));
+        if(!pieces)
+        {
+            job->failed = 1;
+            return;
+        }
+        job->pieces = pieces;
+        job->pieceCapacity = capacity;
+    }
+
+    SavePiece* piece = &job->pieces[job->pieceCount++];
+    memset(piece, 0, sizeof(*piece));
+    piece->kind = kind;
+    piece->level = level;
+    piece->first = first;
+    piece->last = last;
+}
+
+/*=============================================================================
+*   PlanChildren [void]
+*       Splits the children of `parent` into pieces. Consecutive small
+*       siblings are grouped into runs of about job->target nodes; a child
+*       that is large on its own is opened and its children planned in turn.
+=============================================================================*/
+static void PlanChildren(SaveJob* job, TreeNodeId parent, int level)
+{
+    const TreeModel* tree = job->tree;
+    TreeNodeId runFirst = TREE_NIL;
+    int32_t runSize = 0;
+
+    for(TreeNodeId child = tree->firstChild[parent]; child != TREE_NIL; child = tree->nextSibling[child])
+    {
+        int32_t size = job->sizes[child];
+        if(size > job->target && tree->firstChild[child] != TREE_NIL && level < SAVE_MAX_SPLIT_DEPTH)
+        {
+            //Finish the run so far, then split this child
+            if(runFirst != TREE_NIL)
+            {
+                AddPiece(job, SAVE_PIECE_RUN, level, runFirst, tree->prevSibling[child]);
+                runFirst = TREE_NIL;
+                runSize = 0;
+            }
+            AddPiece(job, SAVE_PIECE_OPEN, level, child, child);
+            PlanChildren(job, child, level + 1);
+            AddPiece(job, SAVE_PIECE_CLOSE, level, child, child);
+            continue;
+        }
+
+        if(runFirst == TREE_NIL)
+        {
+            runFirst = child;
+        }
+        runSize += size;
+        if(runSize >= job->target)
+        {
+            AddPiece(job, SAVE_PIECE_RUN, level, runFirst, child);
+            runFirst = TREE_NIL;
+            runSize = 0;
+        }
+    }
+    if(runFirst != TREE_NIL)
+    {
+        AddPiece(job, SAVE_PIECE_RUN, level, runFirst, tree->lastChild[parent]);
+    }
+}
+
+/*=============================================================================
+*   SaveWorker [void]
+*       Thread body: formats run pieces into their own buffers until none
+*       are left
+=============================================================================*/
+static void SaveWorker(void* arg)
+{
+    SaveJob* job = (SaveJob*)arg;
+    for(;;)
+    {
+        int index = atomic_fetch_add(&job->next, 1);
+        if(index >= job->pieceCount)
+        {
+            return;
+        }
+
+        SavePiece* piece = &job->pieces[index];
+        if(piece->kind != SAVE_PIECE_RUN)
+        {
+            continue;
+        }
+        for(TreeNodeId node = piece->first; ; node = job->tree->nextSibling[node])
+        {
+            WriteSubtree(&piece->out, job->tree, node, piece->level);
+            if(node == piece->last)
+            {
+                break;
+            }
+        }
+    }
+}
+
+/*=============================================================================
+*   TreeSaveToStreamParallel [int]
+*       Same output as TreeSaveToStream, byte for byte, but independent
+*       subtrees are formatted concurrently into their own buffers and
+*       then written out in document order.
+*
+*       Parameters:
+*           const TreeModel* tree - The model to save; must not change
+*                                   until the call returns
+*           FILE* file - Destination stream
+*           int threads - Worker count, 0 for one per processor
+*
+*       Returns nonzero on success
+=============================================================================*/
+int TreeSaveToStreamParallel(const TreeModel* tree, FILE* file, int threads)
+{
+    if(threads <= 0)
+    {
+        threads = TreeCpuCount();
+    }
+    if(threads == 1 || tree->count < SAVE_PARALLEL_MIN_NODES)
+    {
+        return TreeSaveToStream(tree, file);
+    }
+
+    SaveJob job;
+    memset(&job, 0, sizeof(job));
+    job.tree = tree;
+    job.sizes = SubtreeSizes(tree);
+    if(!job.sizes)
+    {
+        return TreeSaveToStream(tree, file);
+    }
+    job.target = tree->count / (threads * SAVE_PIECES_PER_THREAD) + 1;
+    atomic_init(&job.next, 0);
+    PlanChildren(&job, TREE_ROOT, 0);
+
+    TreeThread* workers = (TreeThread*)malloc(threads * sizeof(TreeThread));
+    int started = 0;
+    if(workers && !job.failed)
+    {
+        while(started < threads && TreeThreadStart(&workers[started], SaveWorker, &job))
+        {
+            started++;
+        }
+    }
+    //The calling thread helps too, and finishes alone if no thread started
+    SaveWorker(&job);
+    for(int i = 0; i < started; i++)
+    {
+        TreeThreadJoin(&workers[i]);
+    }
+    free(workers);
+
+    //Stitch the pieces together in document order
+    TreeWriter writer = {0};
+    writer.file = file;
+    writer.failed = job.failed;
+    WriterPut(&writer, TREE_UTF8_BOM, TREE_UTF8_BOM_LENGTH);
+    for(int i = 0; i < job.pieceCount; i++)
+    {
+        SavePiece* piece = &job.pieces[i];
+        switch(piece->kind)
+        {
+            case SAVE_PIECE_OPEN:
+                WriterOpenNode(&writer, &tree->data[piece->first], piece->level);
+                break;
+            case SAVE_PIECE_CLOSE:
+                WriterCloseNode(&writer, piece->level);
+                break;
+            default:
+                WriterPut(&writer, piece->out.buffer, piece->out.length);
+                writer.failed |= piece->out.failed;
+                break;
+        }
+        free(piece->out.buffer);
+    }
+    WriterFlush(&writer);
+    free(writer.buffer);
+
+    free(job.pieces);
+    free((void*)job.sizes);
+    return !writer.failed && !ferror(file);
+}
+
+/*=============================================================================
+*   TreeParserInit [void]
+*       Prepares a parser that reports every node of a .dat file in order
+*
+*       Parameters:
+*           TreeParser* parser - The parser to set up
+*           TreeNodeEvent onNode - Called once per node, after its description
+*           void* context - Passed through to onNode
+*
+=============================================================================*/
+void TreeParserInit(TreeParser* parser, TreeNodeEvent onNode, void* context)
+{
+    parser->onNode = onNode;
+    parser->context = context;
+    parser->depth = 0;
+    parser->untilClosed = 0;
+    parser->error = TREE_PARSE_OK;
+    parser->started = 0;
+    parser->utf8 = 0;
+}
+
+/*
+*   One line of input with the indent and the line break stripped
+*/
+typedef struct _ParsedLine
+{
+    const char* text;
+    size_t length;
+    const char* next;       //first byte of the following line
+    size_t indent;          //tabs stripped from the start
+} ParsedLine;
+
+/*=============================================================================
+*   NextLine [int]
+*       Finds the next line in [cursor, end)
+*
+*       Parameters:
+*           const char* cursor - Start of the line
+*           const char* end - End of the available text
+*           int final - Nonzero if no more text follows `end`
+*           ParsedLine* line - Receives the line
+*
+*       Returns 0 if the line is not complete yet
+=============================================================================*/
+static int NextLine(const char* cursor, const char* end, int final, ParsedLine* line)
+{
+    if(cursor >= end)
+    {
+        return 0;
+    }
+
+    const char* newline = (const char*)memchr(cursor, '\n', end - cursor);
+    const char* lineEnd;
+    if(newline)
+    {
+        lineEnd = newline;
+        line->next = newline + 1;
+    }
+    else if(final)
+    {
+        lineEnd = end;
+        line->next = end;
+    }
+    else
+    {
+        return 0;
+    }
+
+    if(lineEnd > cursor && lineEnd[-1] == '\r')
+    {
+        lineEnd--;
+    }
+    const char* start = cursor;
+    while(cursor < lineEnd && *cursor == '\t')
+    {
+        cursor++;
+    }
+    line->text = cursor;
+    line->length = lineEnd - cursor;
+    line->indent = cursor - start;
+    return 1;
+}
+
+/*=============================================================================
+*   TreeParseText [size_t]
+*       Parses as many complete records as `text` holds in one forward pass.
+*       A record is either a closing brace line or the three lines of a
+*       node (name, opening brace, description). Nesting is taken from the
+*       braces; indentation is only skipped over, except that a description
+*       in a file without a byte order mark keeps the tabs beyond its
+*       name's indent plus one. A byte order mark at the start of the input
+*       is skipped and sets parser->utf8.
+*
+*       Parameters:
+*           TreeParser* parser - Parser state carried between calls
+*           const char* text - The text to parse
+*           size_t length - Number of bytes in `text`
+*           int final - Nonzero if this is the end of the input
+*
+*       Returns the number of bytes consumed. Unconsumed bytes belong to an
+*       incomplete record and must be passed again with more text appended.
+*       parser->error is set if the text is malformed or a callback fails.
+=============================================================================*/
+size_t TreeParseText(TreeParser* parser, const char* text, size_t length, int final)
+{
+    const char* cursor = text;
+    const char* end = text + length;
+    ParsedLine line;
+
+    if(!parser->started)
+    {
+        //Wait for enough text to tell a byte order mark from a name
+        if(length < TREE_UTF8_BOM_LENGTH && !final && memcmp(text, TREE_UTF8_BOM, length) == 0)
+        {
+            return 0;
+        }
+        parser->started = 1;
+        if(length >= TREE_UTF8_BOM_LENGTH && memcmp(text, TREE_UTF8_BOM, TREE_UTF8_BOM_LENGTH) == 0)
+        {
+            parser->utf8 = 1;
+            cursor += TREE_UTF8_BOM_LENGTH;
+        }
+    }
+
+    while(parser->error == TREE_PARSE_OK && NextLine(cursor, end, final, &line))
+    {
+        //Closing brace of the innermost open node
+        if(line.length && line.text[0] == '}')
+        {
+            if(parser->depth == 0)
+            {
+                parser->error = TREE_PARSE_MALFORMED;
+                break;
+            }
+            parser->depth--;
+            cursor = line.next;
+            if(parser->untilClosed && parser->depth == 0)
+            {
+                break;
+            }
+            continue;
+        }
+
+        //A stray opening brace has no name to belong to
+        if(line.length && line.text[0] == '{')
+        {
+            parser->error = TREE_PARSE_MALFORMED;
+            break;
+        }
+
+        //Otherwise this is a name, which must be followed by an opening brace
+        ParsedLine brace;
+        if(!NextLine(line.next, end, final, &brace))
+        {
+            //Trailing blank lines at the end of the file are fine
+            if(final && line.length == 0 && line.next >= end)
+            {
+                cursor = line.next;
+                continue;
+            }
+            if(final)
+            {
+                parser->error = TREE_PARSE_MALFORMED;
+            }
+            break;
+        }
+        if(brace.length == 0 || brace.text[0] != '{')
+        {
+            //A blank line between records, not an empty name
+            if(line.length == 0)
+            {
+                cursor = line.next;
+                continue;
+            }
+            parser->error = TREE_PARSE_MALFORMED;
+            break;
+        }
+
+        ParsedLine description;
+        if(!NextLine(brace.next, end, final, &description))
+        {
+            if(final)
+            {
+                parser->error = TREE_PARSE_MALFORMED;
+            }
+            break;
+        }
+
+        //Files without a byte order mark did not escape tabs, so a
+        //description is only indented one tab deeper than its name and
+        //any tab after that is text
+        if(!parser->utf8 && description.indent > line.indent + 1)
+        {
+            size_t kept = description.indent - (line.indent + 1);
+            description.text -= kept;
+            description.length += kept;
+        }
+
+        TreeStr name;
+        name.ptr = line.text;
+        name.len = (uint32_t)line.length;
+        TreeStr desc;
+        desc.ptr = description.text;
+        desc.len = (uint32_t)description.length;
+        if(!parser->onNode(parser->context, parser->depth, name, desc))
+        {
+            parser->error = TREE_PARSE_ABORTED;
+            break;
+        }
+
+        parser->depth++;
+        cursor = description.next;
+    }
+
+    if(final && parser->error == TREE_PARSE_OK && parser->depth != 0)
+    {
+        //Unterminated node at the end of the file
+        parser->error = TREE_PARSE_MALFORMED;
+    }
+    return cursor - text;
+}
+
+/*=============================================================================
+*   TreeParseStream [int]
+*       Feeds a whole stream through TreeParseText in large blocks.
+*       A partial record at the end of a block is moved to the front of
+*       the buffer and completed by the next read.
+*
+*       Returns nonzero on success
+=============================================================================*/
+int TreeParseStream(TreeParser* parser, FILE* file)
+{
+    size_t capacity = TREE_IO_BLOCK;
+    char* buffer = (char*)malloc(capacity);
+    if(!buffer)
+    {
+        parser->error = TREE_PARSE_NO_MEMORY;
+        return 0;
+    }
+
+    size_t filled = 0;
+    int final = 0;
+    while(!final && parser->error == TREE_PARSE_OK)
+    {
+        //A single record larger than the buffer makes the buffer grow
+        if(filled == capacity)
+        {
+            char* grown = (char*)realloc(buffer, capacity * 2);
+            if(!grown)
+            {
+                parser->error = TREE_PARSE_NO_MEMORY;
+                break;
+            }
+            buffer = grown;
+            capacity *= 2;
+        }
+
+        size_t got = fread(buffer + filled, 1, capacity - filled, file);
+        filled += got;
+        final = got == 0;
+
+        size_t consumed = TreeParseText(parser, buffer, filled, final);
+        memmove(buffer, buffer + consumed, filled - consumed);
+        filled -= consumed;
+    }
+
+    free(buffer);
+    if(ferror(file) && parser->error == TREE_PARSE_OK)
+    {
+        parser->error = TREE_PARSE_IO;
+    }
+    return parser->error == TREE_PARSE_OK;
+}
+
+/*
+*   Loader state: the open node at every depth and scratch space for
+*   decoding names and descriptions. With `borrow` set the parsed text
+*   outlives the load (it is tree->mapping), so strings are referenced
+*   instead of copied. `parser` tells whether the file is marked as UTF-8.
+*/
+typedef struct _TreeBuilder
+{
+    TreeModel* tree;
+    TreeNodeId* stack;
+    int stackCapacity;
+    char* scratch;
+    size_t scratchCapacity;
+    int borrow;
+    const TreeParser* parser;
+} TreeBuilder;
+
+/*=============================================================================
+*   DecodeText [TreeStr]
+*       Turns a string as found in the file into model text in `out`:
+*       legacy bytes are transcoded first, which leaves the ASCII escapes
+*       alone, then escapes are resolved in place, by the old rules in a
+*       file without a byte order mark
+=============================================================================*/
+static TreeStr DecodeText(char* out, TreeStr text, int escaped, int legacy, int oldEscapes)
+{
+    size_t length = text.len;
+    const char* in = text.ptr;
+    if(legacy)
+    {
+        length = TreeLegacyToUtf8(out, in, length);
+        in = out;
+    }
+    if(escaped)
+    {
+        length = oldEscapes ? TreeUnescapeLegacy(out, in, length) : TreeUnescape(out, in, length);
+    }
+    TreeStr decoded = {out, (uint32_t)length};
+    return decoded;
+}
+
+/*=============================================================================
+*   BuildNode [int]
+*       TreeNodeEvent that appends each parsed node to the model
+=============================================================================*/
+static int BuildNode(void* context, int depth, TreeStr name, TreeStr description)
+{
+    TreeBuilder* builder = (TreeBuilder*)context;
+
+    //stack[depth] is the parent, stack[depth + 1] receives this node
+    if(depth + 2 > builder->stackCapacity)
+    {
+        int capacity = builder->stackCapacity * 2;
+        TreeNodeId* stack = (TreeNodeId*)realloc(builder->stack, capacity * sizeof(TreeNodeId));
+        if(!stack)
+        {
+            return 0;
+        }
+        builder->stack = stack;
+        builder->stackCapacity = capacity;
+    }
+
+    //Strings only need a copy if they contain escapes or, in a file
+    //without a byte order mark, text that is not UTF-8. Such a file has
+    //no escapes in names. The scratch space holds the name followed by
+    //the description.
+    int legacy = !builder->parser->utf8;
+    int nameEscaped = !legacy && memchr(name.ptr, '\\', name.len) != NULL;
+    int escaped = memchr(description.ptr, '\\', description.len) != NULL;
+    int nameLegacy = legacy && !TreeUtf8Valid(name.ptr, name.len);
+    int descriptionLegacy = legacy && !TreeUtf8Valid(description.ptr, description.len);
+    int nameCopied = nameEscaped || nameLegacy;
+    int copied = escaped || descriptionLegacy;
+    if(nameCopied || copied)
+    {
+        size_t needed = (size_t)name.len * (nameLegacy ? 3 : 1) + (size_t)description.len * (descriptionLegacy ? 3 : 1);
+        if(needed > builder->scratchCapacity)
+        {
+            char* scratch = (char*)realloc(builder->scratch, needed);
+            if(!scratch)
+            {
+                return 0;
+            }
+            builder->scratch = scratch;
+            builder->scratchCapacity = needed;
+        }
+        if(nameCopied)
+        {
+            name = DecodeText(builder->scratch, name, nameEscaped, nameLegacy, legacy);
+        }
+        if(copied)
+        {
+            description = DecodeText(builder->scratch + name.len, description, escaped, descriptionLegacy, legacy);
+        }
+    }
+
+    TreeModel* tree = builder->tree;
+    TreeNodeId node;
+    if(!builder->borrow)
+    {
+        node = TreeAddNode(tree, builder->stack[depth], name, description);
+    }
+    else
+    {
+        //Only decoded strings need storage of their own
+        if((nameCopied && !TreeStrPoolAdd(&tree->strings, name.ptr, name.len, &name)) ||
+           (copied && !TreeStrPoolAdd(&tree->strings, description.ptr, description.len, &description)))
+        {
+            return 0;
+        }
+        node = TreeAddNodeBorrowed(tree, builder->stack[depth], name, description);
+    }
+    if(node == TREE_NIL)
+    {
+        return 0;
+    }
+    builder->stack[depth + 1] = node;
+    return 1;
+}
+
+/*=============================================================================
+*   BuilderInit [int]
+=============================================================================*/
+static int BuilderInit(TreeBuilder* builder, TreeModel* tree, int borrow)
+{
+    memset(builder, 0, sizeof(*builder));
+    builder->tree = tree;
+    builder->borrow = borrow;
+    builder->stackCapacity = 64;
+    builder->stack = (TreeNodeId*)malloc(builder->stackCapacity * sizeof(TreeNodeId));
+    if(!builder->stack)
+    {
+        return 0;
+    }
+    builder->stack[0] = TREE_ROOT;
+    return 1;
+}
+
+/*=============================================================================
+*   BuilderFree [void]
+=============================================================================*/
+static void BuilderFree(TreeBuilder* builder)
+{
+    free(builder->stack);
+    free(builder->scratch);
+}
+
+/*=============================================================================
+*   TreeLoadFromStream [int]
+*       Clears the model and loads every top level node from a .dat stream
+*
+*       Returns nonzero on success. On failure the nodes read so far are kept.
+=============================================================================*/
+int TreeLoadFromStream(TreeModel* tree, FILE* file)
+{
+    TreeBuilder builder;
+    if(!BuilderInit(&builder, tree, 0))
+    {
+        return 0;
+    }
+
+    TreeClear(tree);
+    TreeParser parser;
+    TreeParserInit(&parser, BuildNode, &builder);
+    builder.parser = &parser;
+    int loaded = TreeParseStream(&parser, file);
+
+    BuilderFree(&builder);
+    return loaded;
+}
+
+/*=============================================================================
+*   ParseMapping [int]
+*       Builds the model from tree->mapping on the calling thread
+=============================================================================*/
+static int ParseMapping(TreeModel* tree)
+{
+    TreeBuilder builder;
+    if(!BuilderInit(&builder, tree, 1))
+    {
+        return 0;
+    }
+
+    TreeParser parser;
+    TreeParserInit(&parser, BuildNode, &builder);
+    builder.parser = &parser;
+    TreeParseText(&parser, tree->mapping.data, tree->mapping.size, 1);
+
+    BuilderFree(&builder);
+    return parser.error == TREE_PARSE_OK;
+}
+
+/*=============================================================================
+*   TreeLoadMapped [int]
+*       Clears the model and loads a .dat file by mapping it into memory
+*       and parsing it in place. Names and descriptions stay slices of the
+*       mapping; only strings containing escapes or legacy text are copied.
+*       Edits copy into the string pool as usual (see TreeSetName).
+*
+*       ***Call TreeReleaseMapping before overwriting the mapped file!***
+*
+*       Returns nonzero on success. On failure tree->mapping.data is NULL if
+*       the file could not be mapped at all (nothing was loaded, fall back
+*       to TreeLoadFromStream); otherwise the file is malformed and the
+*       nodes read so far are kept.
+=============================================================================*/
+int TreeLoadMapped(TreeModel* tree, FILE* file)
+{
+    TreeClear(tree);
+    if(!TreeMapStream(file, &tree->mapping))
+    {
+        return 0;
+    }
+    return ParseMapping(tree);
+}
+
+/*
+*   The parallel loader first scans for lines that start a node at a fixed
+*   depth D (D tabs, then a name, then D tabs and an opening brace on the
+*   next line). Each such node is the root of a block that can be parsed
+*   on its own. Workers parse runs of blocks into private models; the
+*   calling thread then parses the few lines above depth D and stitches the
+*   private models in under the right parents.
+*/
+
+//Deepest depth considered for splitting
+#define LOAD_SCAN_DEPTHS 8
+
+//Blocks per thread, so uneven blocks still balance out
+#define LOAD_PIECES_PER_THREAD 8
+
+//Smaller files are parsed on the calling thread
+#ifndef LOAD_PARALLEL_MIN_BYTES
+#define LOAD_PARALLEL_MIN_BYTES (4 * 1024 * 1024)
+#endif
+
+typedef struct _LoadScan
+{
+    const char* begin;      //lines starting in [begin, end) belong to this scan
+    const char* end;
+    const char* text;       //the whole file
+    const char* textEnd;
+    int depth;              //second pass: the depth whose blocks are collected
+
+    int64_t counts[LOAD_SCAN_DEPTHS];
+    const char** starts;
+    size_t startCount;
+    size_t startCapacity;
+    int failed;
+} LoadScan;
+
+typedef struct _LoadPiece
+{
+    size_t firstBlock;
+    size_t blockCount;
+    TreeModel model;        //private model, block k is its k-th top level node
+    TreeNodeId* roots;
+    int failed;
+} LoadPiece;
+
+typedef struct _LoadJob
+{
+    const char* textEnd;
+    int utf8;               //the file starts with a byte order mark
+    const char** starts;    //first byte of every block
+    const char** ends;      //one past the last byte of every block
+    LoadPiece* pieces;
+    int pieceCount;
+    atomic_int next;
+} LoadJob;
+
+/*=============================================================================
+*   BlockDepthAt [int]
+*       Checks whether the line at `line` starts a node whose opening brace
+*       follows on the next line with the same indent
+*
+*       Returns the node's depth, or -1 if the line starts no node
+=============================================================================*/
+static int BlockDepthAt(const char* line, const char* end)
+{
+    int depth = 0;
+    while(line + depth < end && line[depth] == '\t')
+    {
+        depth++;
+    }
+    if(line + depth >= end || line[depth] == '{' || line[depth] == '}' || depth >= LOAD_SCAN_DEPTHS)
+    {
+        return -1;
+    }
+
+    const char* next = (const char*)memchr(line + depth, '\n', end - (line + depth));
+    if(!next || end - (next + 1) < depth + 1)
+    {
+        return -1;
+    }
+    next++;
+    for(int i = 0; i < depth; i++)
+    {
+        if(next[i] != '\t')
+        {
+            return -1;
+        }
+    }
+    return next[depth] == '{' ? depth : -1;
+}
+
+/*=============================================================================
+*   ScanWorker [void]
+*       Thread body of both scan passes. The first pass counts block starts
+*       per depth; the second records the starts at scan->depth.
+=============================================================================*/
+static void ScanWorker(void* arg)
+{
+    LoadScan* scan = (LoadScan*)arg;
+    const char* line = scan->begin;
+
+    //A range that starts mid-line leaves that line to the previous range
+    if(line != scan->text && line[-1] != '\n')
+    {
+        const char* newline = (const char*)memchr(line, '\n', scan->textEnd - line);
+        line = newline ? newline + 1 : scan->textEnd;
+    }
+
+    while(line < scan->end)
+    {
+        int depth = BlockDepthAt(line, scan->textEnd);
+        if(depth >= 0 && scan->depth < 0)
+        {
+            scan->counts[depth]++;
+        }
+        else if(depth >= 0 && depth == scan->depth)
+        {
+            if(scan->startCount == scan->startCapacity)
+            {
+                size_t capacity = scan->startCapacity ? scan->startCapacity * 2 : 1024;
+                const char** starts = (const char**)realloc((void*)scan->starts, capacity * sizeof(const char*));
+                if(!starts)
+                {
+                    scan->failed = 1;
+                    return;
+                }
+                scan->starts = starts;
+                scan->startCapacity = capacity;
+            }
+            scan->starts[scan->startCount++] = line;
+        }
+
+        const char* newline = (const char*)memchr(line, '\n', scan->textEnd - line);
+        line = newline ? newline + 1 : scan->textEnd;
+    }
+}
+
+/*=============================================================================
+*   RunParallel [void]
+*       Calls proc on each of `count` items, one thread per item. The first
+*       item runs on the calling thread, as does any item whose thread
+*       cannot be started.
+*
+*       Parameters:
+*           TreeThreadProc proc - Work to do
+*           void* items - Array of items
+*           size_t stride - Size of one item in bytes
+*           int count - Number of items
+*
+=============================================================================*/
+static void RunParallel(TreeThreadProc proc, void* items, size_t stride, int count)
+{
+    TreeThread* workers = (TreeThread*)malloc(count * sizeof(TreeThread));
+    int started = 0;
+    for(int i = 1; i < count; i++)
+    {
+        void* item = (char*)items + i * stride;
+        if(workers && TreeThreadStart(&workers[started], proc, item))
+        {
+            started++;
+        }
+        else
+        {
+            proc(item);
+        }
+    }
+    proc(items);
+    for(int i = 0; i < started; i++)
+    {
+        TreeThreadJoin(&workers[i]);
+    }
+    free(workers);
+}
+
+/*=============================================================================
+*   LoadWorker [void]
+*       Thread body: parses pieces of blocks into their private models until
+*       none are left
+=============================================================================*/
+static void LoadWorker(void* arg)
+{
+    LoadJob* job = (LoadJob*)arg;
+    for(;;)
+    {
+        int index = atomic_fetch_add(&job->next, 1);
+        if(index >= job->pieceCount)
+        {
+            return;
+        }
+
+        LoadPiece* piece = &job->pieces[index];
+        TreeBuilder builder;
+        if(!TreeInit(&piece->model) || !BuilderInit(&builder, &piece->model, 1))
+        {
+            piece->failed = 1;
+            continue;
+        }
+
+        for(size_t k = 0; k < piece->blockCount && !piece->failed; k++)
+        {
+            size_t block = piece->firstBlock + k;
+            const char* start = job->starts[block];
+
+            //Parse exactly one node and everything below it
+            TreeParser parser;
+            TreeParserInit(&parser, BuildNode, &builder);
+            parser.untilClosed = 1;
+            parser.started = 1;
+            parser.utf8 = job->utf8;
+            builder.parser = &parser;
+            size_t consumed = TreeParseText(&parser, start, job->textEnd - start, 1);
+            if(parser.error != TREE_PARSE_OK || parser.depth != 0 || consumed == 0)
+            {
+                piece->failed = 1;
+                break;
+            }
+            job->ends[block] = start + consumed;
+            piece->roots[k] = piece->model.lastChild[TREE_ROOT];
+        }
+        BuilderFree(&builder);
+    }
+}
+
+/*=============================================================================
+*   ClearNodes [void]
+*       TreeClear that keeps the model's mapping
+=============================================================================*/
+static void ClearNodes(TreeModel* tree)
+{
+    TreeMapping mapping = tree->mapping;
+    tree->mapping.data = NULL;
+    TreeClear(tree);
+    tree->mapping = mapping;
+}
+
+/*=============================================================================
+*   StitchBlocks [int]
+*       Parses the lines above the split depth on the calling thread and
+*       attaches every block at its place. Blocks must already be adopted
+*       into `tree` with their ids in blockRoots.
+*
+*       Returns 0 if the scan did not match the real structure
+=============================================================================*/
+static int StitchBlocks(TreeModel* tree, LoadJob* job, size_t blockCount, int depth, const TreeNodeId* blockRoots)
+{
+    TreeBuilder builder;
+    if(!BuilderInit(&builder, tree, 1))
+    {
+        return 0;
+    }
+
+    TreeParser parser;
+    TreeParserInit(&parser, BuildNode, &builder);
+    builder.parser = &parser;
+    const char* cursor = tree->mapping.data;
+    int stitched = 1;
+    for(size_t block = 0; block < blockCount && stitched; block++)
+    {
+        //Everything between two blocks must be complete records above them
+        size_t length = job->starts[block] - cursor;
+        size_t consumed = TreeParseText(&parser, cursor, length, 0);
+        if(consumed != length || parser.error != TREE_PARSE_OK || parser.depth != depth)
+        {
+            stitched = 0;
+            break;
+        }
+        TreeAttachLast(tree, builder.stack[depth], blockRoots[block]);
+        cursor = job->ends[block];
+    }
+    if(stitched)
+    {
+        TreeParseText(&parser, cursor, job->textEnd - cursor, 1);
+        stitched = parser.error == TREE_PARSE_OK;
+    }
+
+    BuilderFree(&builder);
+    return stitched;
+}
+
+/*=============================================================================
+*   TreeLoadParallel [int]
+*       TreeLoadMapped, but the file is split at node boundaries found by a
+*       parallel pre-scan and the parts are parsed concurrently, each into
+*       a private model and arena that are merged afterwards. Falls back to
+*       a sequential parse for small files or if the scan turns out not to
+*       match the file's structure.
+*
+*       Parameters:
+*           TreeModel* tree - The model to load into
+*           FILE* file - The .dat file
+*           int threads - Worker count, 0 for one per processor
+*
+*       Returns the same as TreeLoadMapped
+=============================================================================*/
+int TreeLoadParallel(TreeModel* tree, FILE* file, int threads)
+{
+    if(threads <= 0)
+    {
+        threads = TreeCpuCount();
+    }
+
+    TreeClear(tree);
+    if(!TreeMapStream(file, &tree->mapping))
+    {
+        return 0;
+    }
+    const char* text = tree->mapping.data;
+    const char* textEnd = text + tree->mapping.size;
+    int utf8 = tree->mapping.size >= TREE_UTF8_BOM_LENGTH && memcmp(text, TREE_UTF8_BOM, TREE_UTF8_BOM_LENGTH) == 0;
+    if(utf8)
+    {
+        //Blocks are found after it; StitchBlocks parses it from the start
+        text += TREE_UTF8_BOM_LENGTH;
+    }
+    if(threads == 1 || tree->mapping.size < LOAD_PARALLEL_MIN_BYTES)
+    {
+        return ParseMapping(tree);
+    }
+
+    LoadScan* scans = (LoadScan*)calloc(threads, sizeof(LoadScan));
+    if(!scans)
+    {
+        return ParseMapping(tree);
+    }
+    size_t rangeSize = (textEnd - text) / threads;
+    for(int i = 0; i < threads; i++)
+    {
+        scans[i].text = text;
+        scans[i].textEnd = textEnd;
+        scans[i].begin = text + i * rangeSize;
+        scans[i].end = i == threads - 1 ? textEnd : text + (i + 1) * rangeSize;
+        scans[i].depth = -1;
+    }
+
+    //First pass: how many blocks start at each depth
+    RunParallel(ScanWorker, scans, sizeof(LoadScan), threads);
+    int64_t counts[LOAD_SCAN_DEPTHS] = {0};
+    for(int i = 0; i < threads; i++)
+    {
+        for(int depth = 0; depth < LOAD_SCAN_DEPTHS; depth++)
+        {
+            counts[depth] += scans[i].counts[depth];
+        }
+    }
+
+    //Split at the shallowest depth with enough blocks, else the busiest one
+    int depth = 0;
+    for(int d = 0; d < LOAD_SCAN_DEPTHS; d++)
+    {
+        if(counts[d] >= threads * LOAD_PIECES_PER_THREAD)
+        {
+            depth = d;
+            break;
+        }
+        if(counts[d] > counts[depth])
+        {
+            depth = d;
+        }
+    }
+
+    //Second pass: where those blocks start
+    for(int i = 0; i < threads; i++)
+    {
+        scans[i].depth = depth;
+    }
+    RunParallel(ScanWorker, scans, sizeof(LoadScan), threads);
+
+    size_t blockCount = 0;
+    int failed = 0;
+    for(int i = 0; i < threads; i++)
+    {
+        blockCount += scans[i].startCount;
+        failed |= scans[i].failed;
+    }
+
+    LoadJob job;
+    memset(&job, 0, sizeof(job));
+    job.textEnd = textEnd;
+    job.utf8 = utf8;
+    job.starts = (const char**)malloc((blockCount + 1) * sizeof(const char*));
+    job.ends = (const char**)malloc((blockCount + 1) * sizeof(const char*));
+    TreeNodeId* blockRoots = (TreeNodeId*)malloc((blockCount + 1) * sizeof(TreeNodeId));
+    job.pieces = (LoadPiece*)calloc((size_t)threads * LOAD_PIECES_PER_THREAD, sizeof(LoadPiece));
+    failed |= blockCount < 2 || !job.starts || !job.ends || !blockRoots || !job.pieces;
+
+    if(!failed)
+    {
+        blockCount = 0;
+        for(int i = 0; i < threads; i++)
+        {
+            //A range with no block start has no array to copy from
+            if(scans[i].startCount)
+            {
+                memcpy(job.starts + blockCount, scans[i].starts, scans[i].startCount * sizeof(const char*));
+                blockCount += scans[i].startCount;
+            }
+        }
+
+        //Group consecutive blocks into pieces of roughly equal size
+        size_t target = tree->mapping.size / (threads * LOAD_PIECES_PER_THREAD) + 1;
+        size_t first = 0;
+        for(size_t block = 0; block < blockCount; block++)
+        {
+            const char* next = block + 1 < blockCount ? job.starts[block + 1] : textEnd;
+            int lastPiece = job.pieceCount == threads * LOAD_PIECES_PER_THREAD - 1;
+            if(block + 1 == blockCount || (!lastPiece && (size_t)(next - job.starts[first]) >= target))
+            {
+                LoadPiece* piece = &job.pieces[job.pieceCount++];
+                piece->firstBlock = first;
+                piece->blockCount = block + 1 - first;
+                piece->roots = blockRoots + first;
+                first = block + 1;
+            }
+        }
+
+        atomic_init(&job.next, 0);
+        RunParallel(LoadWorker, &job, 0, threads);
+        for(int i = 0; i < job.pieceCount; i++)
+        {
+            failed |= job.pieces[i].failed;
+        }
+    }
+
+    //Merge the private models, then parse the levels above the blocks
+    for(int i = 0; !failed && i < job.pieceCount; i++)
+    {
+        LoadPiece* piece = &job.pieces[i];
+        TreeNodeId offset = TreeAdoptModel(tree, &piece->model);
+        if(offset == TREE_NIL)
+        {
+            failed = 1;
+            break;
+        }
+        for(size_t k = 0; k < piece->blockCount; k++)
+        {
+            piece->roots[k] += offset;
+        }
+    }
+    if(!failed)
+    {
+        failed = !StitchBlocks(tree, &job, blockCount, depth, blockRoots);
+    }
+
+    for(int i = 0; i < threads; i++)
+    {
+        free((void*)scans[i].starts);
+    }
+    free(scans);
+    for(int i = 0; job.pieces && i < job.pieceCount; i++)
+    {
+        TreeFree(&job.pieces[i].model);
+    }
+    free(job.pieces);
+    free((void*)job.starts);
+    free((void*)job.ends);
+    free(blockRoots);
+
+    if(failed)
+    {
+        ClearNodes(tree);
+        return ParseMapping(tree);
+    }
+    return 1;
+}
@@ -0,0 +1,644 @@
+/*=============================================================================
+*       treejournal.c
+*       Append-only edit journal. Saving an edited document appends the
+*       edits made since the last save to a sidecar file next to it instead
+*       of rewriting the whole tree; opening replays them on top of the
+*       base file. Once the journal grows past a share of the base file the
+*       caller rewrites the base and starts a new journal.
+=============================================================================*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree.h"
+
+/*
+*   Sidecar layout, little endian:
+*       JournalHeader
+*       JournalRecord, name bytes, description bytes    (repeated)
+*
+*   Records name nodes by serial number rather than id, since ids are not
+*   stable across loads. Serial 0 is TREE_ROOT, the base file's nodes are
+*   numbered 1.. in preorder and every inserted node takes the next free
+*   number. Serials are never reused, so a record can always be resolved
+*   against the state the earlier records produced. A deleted subtree is
+*   only detached until the end of the replay, so a later record can put
+*   it back when a deletion is undone.
+*/
+#define JOURNAL_MAGIC   "DTREEJNL"
+#define JOURNAL_VERSION 1
+
+#define JOURNAL_INSERT      1   //serial, parent, before, name, description
+#define JOURNAL_DELETE      2   //serial, with everything below it
+#define JOURNAL_NAME        3   //serial, name
+#define JOURNAL_DESCRIPTION 4   //serial, description
+#define JOURNAL_MOVE        5   //serial, parent, before
+#define JOURNAL_RESTORE     6   //serial of a deleted node, parent, before
+
+//No node: `before` of a node that is its parent's last child
+#define JOURNAL_NONE 0xFFFFFFFFu
+
+typedef struct _JournalHeader
+{
+    char magic[8];          //JOURNAL_MAGIC, no terminator
+    uint32_t version;
+    uint32_t baseCount;     //nodes in the base file, TREE_ROOT excluded
+    uint64_t baseSize;      //bytes in the base file
+} JournalHeader;
+
+typedef struct _JournalRecord
+{
+    uint32_t kind;          //JOURNAL_*
+    uint32_t serial;
+    uint32_t parent;
+    uint32_t before;
+    uint32_t nameLength;
+    uint32_t descriptionLength;
+    uint32_t check;         //JournalCheck of the record and its strings
+    uint32_t reserved;
+} JournalRecord;
+
+/*=============================================================================
+*   JournalCheck [uint32_t]
+*       FNV-1a over a record, with `check` taken as 0, and its strings.
+*       A record torn by a crash mid-append fails it.
+=============================================================================*/
+static uint32_t JournalCheck(const JournalRecord* record, const char* strings)
+{
+    JournalRecord copy = *record;
+    copy.check = 0;
+    uint32_t hash = 2166136261u;
+    const unsigned char* bytes = (const unsigned char*)&copy;
+    for(size_t i = 0; i < sizeof(copy); i++)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    size_t length = (size_t)record->nameLength + record->descriptionLength;
+    for(size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ (unsigned char)strings[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/*=============================================================================
+*   ReserveSerials [int]
+*       Grows the serial table to hold `serials` entries and the reverse
+*       table to cover every id the model has handed out
+=============================================================================*/
+static int ReserveSerials(TreeJournal* journal, const TreeModel* tree, uint32_t serials)
+{
+    if(serials > journal->serialCapacity)
+    {
+        uint32_t capacity = journal->serialCapacity ? journal->serialCapacity : 64;
+        while(capacity < serials)
+        {
+            capacity *= 2;
+        }
+        TreeNodeId* nodes = (TreeNodeId*)realloc(journal->nodes, capacity * sizeof(TreeNodeId));
+        if(!nodes)
+        {
+            return 0;
+        }
+        journal->nodes = nodes;
+        uint8_t* deleted = (uint8_t*)realloc(journal->deleted, capacity);
+        if(!deleted)
+        {
+            return 0;
+        }
+        memset(deleted + journal->serialCapacity, 0, capacity - journal->serialCapacity);
+        journal->deleted = deleted;
+        journal->serialCapacity = capacity;
+    }
+    if(tree->used > journal->idCapacity)
+    {
+        int32_t capacity = journal->idCapacity ? journal->idCapacity : 64;
+        while(capacity < tree->used)
+        {
+            capacity *= 2;
+        }
+        uint32_t* ids = (uint32_t*)realloc(journal->serials, capacity * sizeof(uint32_t));
+        if(!ids)
+        {
+            return 0;
+        }
+        journal->serials = ids;
+        journal->idCapacity = capacity;
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   SerialOf [uint32_t]
+*       The serial of a live node, JOURNAL_NONE for TREE_NIL
+=============================================================================*/
+static uint32_t SerialOf(const TreeJournal* journal, TreeNodeId node)
+{
+    return node == TREE_NIL ? JOURNAL_NONE : journal->serials[node];
+}
+
+/*=============================================================================
+*   Resolve [int]
+*       Finds the node a serial stands for. Fails for deleted nodes, also
+*       ones below a deleted node whose id has been handed out again.
+=============================================================================*/
+static int Resolve(const TreeJournal* journal, const TreeModel* tree, uint32_t serial, TreeNodeId* node)
+{
+    if(serial == JOURNAL_NONE)
+    {
+        *node = TREE_NIL;
+        return 1;
+    }
+    if(serial >= journal->serialCount)
+    {
+        return 0;
+    }
+    TreeNodeId found = journal->nodes[serial];
+    if(journal->deleted[serial] || !TreeIsLive(tree, found) || journal->serials[found] != serial)
+    {
+        return 0;
+    }
+    *node = found;
+    return 1;
+}
+
+/*=============================================================================
+*   ResolveDeleted [int]
+*       Finds the detached top node of a subtree deleted under a serial
+=============================================================================*/
+static int ResolveDeleted(const TreeJournal* journal, const TreeModel* tree, uint32_t serial, TreeNodeId* node)
+{
+    if(serial >= journal->serialCount || !journal->deleted[serial])
+    {
+        return 0;
+    }
+    TreeNodeId found = journal->nodes[serial];
+    if(!TreeIsLive(tree, found) || journal->serials[found] != serial || tree->parent[found] != TREE_NIL)
+    {
+        return 0;
+    }
+    *node = found;
+    return 1;
+}
+
+/*=============================================================================
+*   AddRecord [void]
+*       Queues a record for the next TreeJournalAppend. Running out of
+*       memory sets journal->failed, which asks for a full save instead.
+=============================================================================*/
+static void AddRecord(TreeJournal* journal, uint32_t kind, uint32_t serial, uint32_t parent, uint32_t before, TreeStr name, TreeStr description)
+{
+    JournalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.kind = kind;
+    record.serial = serial;
+    record.parent = parent;
+    record.before = before;
+    record.nameLength = name.len;
+    record.descriptionLength = description.len;
+
+    size_t size = sizeof(record) + name.len + description.len;
+    if(journal->pendingLength + size > journal->pendingCapacity)
+    {
+        size_t capacity = journal->pendingCapacity ? journal->pendingCapacity : 4096;
+        while(capacity < journal->pendingLength + size)
+        {
+            capacity *= 2;
+        }
+        char* grown = (char*)realloc(journal->pending, capacity);
+        if(!grown)
+        {
+            journal->failed = 1;
+            return;
+        }
+        journal->pending = grown;
+        journal->pendingCapacity = capacity;
+    }
+
+    char* out = journal->pending + journal->pendingLength;
+    char* strings = out + sizeof(record);
+    memcpy(strings, name.ptr, name.len);
+    memcpy(strings + name.len, description.ptr, description.len);
+    record.check = JournalCheck(&record, strings);
+    memcpy(out, &record, sizeof(record));
+    journal->pendingLength += size;
+}
+
+/*=============================================================================
+*   TreeJournalInit [void]
+*       Prepares a journal that is not attached to any file yet
+=============================================================================*/
+void TreeJournalInit(TreeJournal* journal)
+{
+    memset(journal, 0, sizeof(*journal));
+    journal->compactRatio = TREE_JOURNAL_COMPACT_RATIO;
+}
+
+/*=============================================================================
+*   TreeJournalFree [void]
+=============================================================================*/
+void TreeJournalFree(TreeJournal* journal)
+{
+    free(journal->nodes);
+    free(journal->deleted);
+    free(journal->serials);
+    free(journal->pending);
+    memset(journal, 0, sizeof(*journal));
+}
+
+/*=============================================================================
+*   TreeJournalClear [void]
+*       Detaches the journal from its file, e.g. for a new document. Edits
+*       are not recorded and the next save has to be a full one.
+=============================================================================*/
+void TreeJournalClear(TreeJournal* journal)
+{
+    journal->attached = 0;
+    journal->serialCount = 0;
+    journal->pendingLength = 0;
+    journal->logSize = 0;
+    journal->failed = 0;
+    journal->torn = 0;
+}
+
+/*=============================================================================
+*   TreeJournalReset [int]
+*       Attaches the journal to a base file that holds exactly the model,
+*       after it was loaded from it or written to it, and starts an empty
+*       journal. Nodes are numbered in preorder, the order of the file.
+*
+*       Parameters:
+*           TreeJournal* journal - The journal
+*           const TreeModel* tree - The model, as the base file has it
+*           uint64_t baseSize - Size of the base file in bytes
+*
+*       Returns nonzero on success; out of memory leaves it detached
+=============================================================================*/
+int TreeJournalReset(TreeJournal* journal, const TreeModel* tree, uint64_t baseSize)
+{
+    TreeJournalClear(journal);
+    if(!ReserveSerials(journal, tree, (uint32_t)tree->count + 1))
+    {
+        return 0;
+    }
+
+    //Detached nodes are not in the base file and get no serial
+    for(TreeNodeId node = 0; node < tree->used; node++)
+    {
+        journal->serials[node] = JOURNAL_NONE;
+    }
+    uint32_t serial = 0;
+    for(TreeNodeId node = TREE_ROOT; node != TREE_NIL; node = TreeNextPreorder(tree, node, TREE_ROOT))
+    {
+        journal->nodes[serial] = node;
+        journal->deleted[serial] = 0;
+        journal->serials[node] = serial;
+        serial++;
+    }
+    journal->serialCount = serial;
+    journal->baseCount = serial - 1;
+    journal->baseSize = baseSize;
+    journal->attached = 1;
+    return 1;
+}
+
+/*=============================================================================
+*   TreeJournalReplay [int]
+*       Applies a sidecar journal to the model just loaded from its base
+*       file and attached with TreeJournalReset. Later edits are numbered
+*       after the replayed ones, and appends continue the same file.
+*
+*       Parameters:
+*           TreeJournal* journal - The journal
+*           TreeModel* tree - The model loaded from the base file
+*           FILE* log - The sidecar, opened for binary reading
+*
+*       Returns nonzero if every record applied, also for an empty sidecar.
+*       Otherwise the journal
+*       belongs to another version of the base file (nothing is applied),
+*       or it ends in a torn or invalid record (the records before it are
+*       applied). Either way TreeJournalNeedsCompaction is then set, so
+*       the next save writes the whole file and drops the sidecar.
+=============================================================================*/
+int TreeJournalReplay(TreeJournal* journal, TreeModel* tree, FILE* log)
+{
+    JournalHeader header;
+    size_t got = journal->attached ? fread(&header, 1, sizeof(header), log) : 0;
+    if(journal->attached && got == 0 && !ferror(log))
+    {
+        //Left by a save that had nothing to append; the header comes with
+        //the first records
+        return 1;
+    }
+    if(got != sizeof(header) ||
+       memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 ||
+       header.version != JOURNAL_VERSION ||
+       header.baseCount != journal->baseCount ||
+       header.baseSize != journal->baseSize)
+    {
+        journal->torn = 1;
+        return 0;
+    }
+    journal->logSize = sizeof(header);
+
+    char* strings = NULL;
+    size_t stringCapacity = 0;
+    int applied = 1;
+    JournalRecord record;
+    while((got = fread(&record, 1, sizeof(record), log)) != 0)
+    {
+        applied = 0;
+        if(got != sizeof(record))
+        {
+            break;
+        }
+        size_t length = (size_t)record.nameLength + record.descriptionLength;
+        if(length > stringCapacity)
+        {
+            char* grown = (char*)realloc(strings, length);
+            if(!grown)
+            {
+                break;
+            }
+            strings = grown;
+            stringCapacity = length;
+        }
+        if((length && fread(strings, 1, length, log) != length) || JournalCheck(&record, strings) != record.check)
+        {
+            break;
+        }
+
+        TreeStr name = {strings, record.nameLength};
+        TreeStr description = {strings + record.nameLength, record.descriptionLength};
+        TreeNodeId node;
+        TreeNodeId parent;
+        TreeNodeId before;
+        switch(record.kind)
+        {
+            case JOURNAL_INSERT:
+                if(record.serial != journal->serialCount ||
+                   !Resolve(journal, tree, record.parent, &parent) || parent == TREE_NIL ||
+                   !Resolve(journal, tree, record.before, &before))
+                {
+                    break;
+                }
+                node = TreeAddNode(tree, parent, name, description);
+                if(node == TREE_NIL || !ReserveSerials(journal, tree, journal->serialCount + 1) ||
+                   (before != TREE_NIL && !TreeMoveNode(tree, node, parent, before)))
+                {
+                    break;
+                }
+                journal->nodes[record.serial] = node;
+                journal->deleted[record.serial] = 0;
+                journal->serials[node] = record.serial;
+                journal->serialCount++;
+                applied = 1;
+                break;
+
+            case JOURNAL_DELETE:
+                if(Resolve(journal, tree, record.serial, &node) && node != TREE_ROOT && node != TREE_NIL)
+                {
+                    TreeDetach(tree, node);
+                    journal->deleted[record.serial] = 1;
+                    applied = 1;
+                }
+                break;
+
+            case JOURNAL_RESTORE:
+                if(ResolveDeleted(journal, tree, record.serial, &node) &&
+                   Resolve(journal, tree, record.parent, &parent) && parent != TREE_NIL &&
+                   Resolve(journal, tree, record.before, &before) &&
+                   TreeMoveNode(tree, node, parent, before))
+                {
+                    journal->deleted[record.serial] = 0;
+                    applied = 1;
+                }
+                break;
+
+            case JOURNAL_NAME:
+                applied = Resolve(journal, tree, record.serial, &node) && node != TREE_NIL &&
+                          TreeSetName(tree, node, name);
+                break;
+
+            case JOURNAL_DESCRIPTION:
+                applied = Resolve(journal, tree, record.serial, &node) && node != TREE_NIL &&
+                          TreeSetDescription(tree, node, description);
+                break;
+
+            case JOURNAL_MOVE:
+                applied = Resolve(journal, tree, record.serial, &node) && node != TREE_NIL &&
+                          Resolve(journal, tree, record.parent, &parent) && parent != TREE_NIL &&
+                          Resolve(journal, tree, record.before, &before) &&
+                          TreeMoveNode(tree, node, parent, before);
+                break;
+        }
+        if(!applied)
+        {
+            break;
+        }
+        journal->logSize += sizeof(record) + length;
+    }
+    free(strings);
+
+    //What is still deleted now is gone for good
+    for(uint32_t serial = 0; serial < journal->serialCount; serial++)
+    {
+        TreeNodeId node;
+        if(ResolveDeleted(journal, tree, serial, &node))
+        {
+            TreeDeleteSubtree(tree, node);
+        }
+    }
+
+    //A partial or bad record, and anything after it, is left unapplied
+    if(!applied || ferror(log))
+    {
+        journal->torn = 1;
+        return 0;
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   Insert [void]
+*       Numbers a node and records it as inserted in front of `before`
+=============================================================================*/
+static void Insert(TreeJournal* journal, const TreeModel* tree, TreeNodeId node, TreeNodeId before)
+{
+    if(!ReserveSerials(journal, tree, journal->serialCount + 1))
+    {
+        journal->failed = 1;
+        return;
+    }
+    uint32_t serial = journal->serialCount++;
+    journal->nodes[serial] = node;
+    journal->deleted[serial] = 0;
+    journal->serials[node] = serial;
+    AddRecord(journal, JOURNAL_INSERT, serial, SerialOf(journal, tree->parent[node]),
+              SerialOf(journal, before), TreeName(tree, node), TreeDescription(tree, node));
+}
+
+/*=============================================================================
+*   TreeJournalInserted [void]
+*       Records a node just added to the model
+=============================================================================*/
+void TreeJournalInserted(TreeJournal* journal, const TreeModel* tree, TreeNodeId node)
+{
+    if(journal->attached)
+    {
+        Insert(journal, tree, node, tree->nextSibling[node]);
+    }
+}
+
+/*=============================================================================
+*   TreeJournalDeleted [void]
+*       Records a subtree about to be deleted from the model, or just
+*       detached
+*
+*       ***Call it before TreeDeleteSubtree, while the node is still live***
+=============================================================================*/
+void TreeJournalDeleted(TreeJournal* journal, const TreeModel* tree, TreeNodeId node)
+{
+    (void)tree;
+    if(journal->attached)
+    {
+        uint32_t serial = SerialOf(journal, node);
+        journal->deleted[serial] = 1;
+        AddRecord(journal, JOURNAL_DELETE, serial, JOURNAL_NONE, JOURNAL_NONE, TreeStrFromC(""), TreeStrFromC(""));
+    }
+}
+
+/*=============================================================================
+*   TreeJournalRestored [void]
+*       Records a detached subtree just put back. One record does if it was
+*       deleted since the base file was written; otherwise the base file
+*       never had it and every node of it is recorded as inserted.
+=============================================================================*/
+void TreeJournalRestored(TreeJournal* journal, const TreeModel* tree, TreeNodeId node)
+{
+    if(!journal->attached)
+    {
+        return;
+    }
+
+    uint32_t serial = journal->serials[node];
+    if(serial != JOURNAL_NONE && serial < journal->serialCount && journal->nodes[serial] == node && journal->deleted[serial])
+    {
+        journal->deleted[serial] = 0;
+        AddRecord(journal, JOURNAL_RESTORE, serial, SerialOf(journal, tree->parent[node]),
+                  SerialOf(journal, tree->nextSibling[node]), TreeStrFromC(""), TreeStrFromC(""));
+        return;
+    }
+
+    //In preorder every node below the top one is added after its siblings
+    for(TreeNodeId current = node; current != TREE_NIL && !journal->failed; current = TreeNextPreorder(tree, current, node))
+    {
+        Insert(journal, tree, current, current == node ? tree->nextSibling[node] : TREE_NIL);
+    }
+}
+
+/*=============================================================================
+*   TreeJournalNameChanged [void]
+*       Records the new name of a node
+=============================================================================*/
+void TreeJournalNameChanged(TreeJournal* journal, const TreeModel* tree, TreeNodeId node)
+{
+    if(journal->attached)
+    {
+        AddRecord(journal, JOURNAL_NAME, SerialOf(journal, node), JOURNAL_NONE, JOURNAL_NONE, TreeName(tree, node), TreeStrFromC(""));
+    }
+}
+
+/*=============================================================================
+*   TreeJournalDescriptionChanged [void]
+*       Records the new description of a node
+=============================================================================*/
+void TreeJournalDescriptionChanged(TreeJournal* journal, const TreeModel* tree, TreeNodeId node)
+{
+    if(journal->attached)
+    {
+        AddRecord(journal, JOURNAL_DESCRIPTION, SerialOf(journal, node), JOURNAL_NONE, JOURNAL_NONE, TreeStrFromC(""), TreeDescription(tree, node));
+    }
+}
+
+/*=============================================================================
+*   TreeJournalMoved [void]
+*       Records the new place of a node moved with TreeMoveNode
+=============================================================================*/
+void TreeJournalMoved(TreeJournal* journal, const TreeModel* tree, TreeNodeId node)
+{
+    if(journal->attached)
+    {
+        AddRecord(journal, JOURNAL_MOVE, SerialOf(journal, node), SerialOf(journal, tree->parent[node]),
+                  SerialOf(journal, tree->nextSibling[node]), TreeStrFromC(""), TreeStrFromC(""));
+    }
+}
+
+/*=============================================================================
+*   TreeJournalNeedsCompaction [int]
+*       Nonzero if the next save has to rewrite the base file: the journal
+*       is not attached or not trustworthy, or appending the pending edits
+*       would grow it past journal->compactRatio times the base file
+=============================================================================*/
+int TreeJournalNeedsCompaction(const TreeJournal* journal)
+{
+    if(!journal->attached || journal->failed || journal->torn)
+    {
+        return 1;
+    }
+    uint64_t size = journal->logSize ? journal->logSize : sizeof(JournalHeader);
+    size += journal->pendingLength;
+    return (double)size > journal->compactRatio * (double)journal->baseSize;
+}
+
+/*=============================================================================
+*   TreeJournalAppend [int]
+*       Writes the pending edits to the end of the sidecar, starting it
+*       with a header if it is new. Costs as much as the edits, not the
+*       document; with no edits nothing is written.
+*
+*       Parameters:
+*           TreeJournal* journal - An attached journal
+*           FILE* log - The sidecar, opened for binary appending
+*
+*       Returns nonzero on success. A failed append may leave part of a
+*       record behind, so the journal then asks for compaction.
+=============================================================================*/
+int TreeJournalAppend(TreeJournal* journal, FILE* log)
+{
+    if(!journal->attached || journal->failed || journal->torn)
+    {
+        return 0;
+    }
+    if(!journal->pendingLength)
+    {
+        return 1;
+    }
+
+    size_t written = 0;
+    int ok = 1;
+    if(journal->logSize == 0)
+    {
+        JournalHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+        header.version = JOURNAL_VERSION;
+        header.baseCount = journal->baseCount;
+        header.baseSize = journal->baseSize;
+        ok = fwrite(&header, sizeof(header), 1, log) == 1;
+        written += sizeof(header);
+    }
+    if(ok && journal->pendingLength)
+    {
+        ok = fwrite(journal->pending, 1, journal->pendingLength, log) == journal->pendingLength;
+        written += journal->pendingLength;
+    }
+    if(!ok || fflush(log) != 0)
+    {
+        journal->torn = 1;
+        return 0;
+    }
+
+    journal->logSize += written;
+    journal->pendingLength = 0;
+    return 1;
+}
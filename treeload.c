@@ -0,0 +1,483 @@
+/*=============================================================================
+*       treeload.c
+*       Opening a .dat file in the background. A worker thread parses the
+*       mapped file and hands the nodes over in batches through a lock-free
+*       queue; the thread that owns the model adds them a slice at a time,
+*       so the top of a huge file shows up long before the end is parsed.
+=============================================================================*/
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree.h"
+
+//Nodes in the first batch; later batches double up to LOAD_BATCH_MAX so
+//the first nodes arrive right away and the rest in few handoffs
+#define LOAD_BATCH_FIRST 64
+#define LOAD_BATCH_MAX   8192
+
+//Decoded text a batch holds before it is handed over
+#define LOAD_BATCH_TEXT (256 * 1024)
+
+//Batches waiting for the consumer; the parser waits when they are all full
+#define LOAD_QUEUE_LENGTH 64
+
+//Bytes parsed between progress updates
+#define LOAD_SLICE (256 * 1024)
+
+/*
+*   One parsed node. Strings point into the mapped file, or into the
+*   batch's text if they had to be decoded.
+*/
+typedef struct _LoadRecord
+{
+    int32_t depth;
+    TreeStr name;
+    TreeStr description;
+} LoadRecord;
+
+typedef struct _LoadBatch
+{
+    uint64_t end;           //bytes of the file parsed once this batch is applied
+    uint32_t count;
+    uint32_t capacity;
+    LoadRecord* records;
+    char* text;
+    size_t textLength;
+    size_t textCapacity;
+} LoadBatch;
+
+/*
+*   The fields before the queue belong to the worker while it runs, the
+*   ones after `finished` to the consumer. The queue is a ring with one
+*   producer and one consumer: the worker fills a place and then advances
+*   tail, the consumer empties one and then advances head, so neither
+*   needs a lock.
+*/
+struct _TreeLoader
+{
+    TreeThread thread;
+    const char* data;       //tree->mapping, which the loader does not own
+    size_t size;
+    TreeParser parser;
+    LoadBatch* batch;       //being filled
+    uint32_t batchLimit;
+    int error;              //TREE_PARSE_*, valid once finished is set
+
+    LoadBatch* queue[LOAD_QUEUE_LENGTH];
+    atomic_size_t head;     //next batch the consumer takes
+    atomic_size_t tail;     //next free place for the worker
+    atomic_int cancel;
+    atomic_int finished;
+
+    LoadBatch* current;     //being applied
+    uint32_t applied;       //records of current already in the model
+    uint64_t done;          //bytes whose nodes are all in the model
+    TreeNodeId* stack;      //stack[depth] is the parent of a node at depth
+    int stackCapacity;
+    int failed;             //TREE_PARSE_* of the consumer
+};
+
+/*=============================================================================
+*   FreeBatch [void]
+=============================================================================*/
+static void FreeBatch(LoadBatch* batch)
+{
+    if(batch)
+    {
+        free(batch->records);
+        free(batch->text);
+        free(batch);
+    }
+}
+
+/*=============================================================================
+*   NewBatch [LoadBatch*]
+*       A batch with room for `count` records and `text` bytes
+=============================================================================*/
+static LoadBatch* NewBatch(uint32_t count, size_t text)
+{
+    LoadBatch* batch = (LoadBatch*)calloc(1, sizeof(LoadBatch));
+    if(!batch)
+    {
+        return NULL;
+    }
+    batch->records = (LoadRecord*)malloc(count * sizeof(LoadRecord));
+    batch->text = (char*)malloc(text);
+    if(!batch->records || !batch->text)
+    {
+        FreeBatch(batch);
+        return NULL;
+    }
+    batch->capacity = count;
+    batch->textCapacity = text;
+    return batch;
+}
+
+/*=============================================================================
+*   Publish [int]
+*       Hands the batch being filled to the consumer, waiting while the
+*       queue is full
+*
+*       Returns 0 if the load was cancelled meanwhile
+=============================================================================*/
+static int Publish(TreeLoader* loader, uint64_t end)
+{
+    LoadBatch* batch = loader->batch;
+    if(!batch || batch->count == 0)
+    {
+        return 1;
+    }
+    batch->end = end;
+
+    size_t tail = atomic_load_explicit(&loader->tail, memory_order_relaxed);
+    while(tail - atomic_load_explicit(&loader->head, memory_order_acquire) == LOAD_QUEUE_LENGTH)
+    {
+        if(atomic_load_explicit(&loader->cancel, memory_order_relaxed))
+        {
+            return 0;
+        }
+        TreeSleep(1);
+    }
+    loader->queue[tail % LOAD_QUEUE_LENGTH] = batch;
+    atomic_store_explicit(&loader->tail, tail + 1, memory_order_release);
+
+    loader->batch = NULL;
+    if(loader->batchLimit < LOAD_BATCH_MAX)
+    {
+        loader->batchLimit *= 2;
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   DecodeInto [TreeStr]
+*       Copies a string that needs decoding into the batch's text: legacy
+*       bytes are transcoded first, then escapes are resolved in place, by
+*       the old rules in a file without a byte order mark
+=============================================================================*/
+static TreeStr DecodeInto(LoadBatch* batch, TreeStr text, int escaped, int legacy, int oldEscapes)
+{
+    char* out = batch->text + batch->textLength;
+    size_t length = text.len;
+    const char* in = text.ptr;
+    if(legacy)
+    {
+        length = TreeLegacyToUtf8(out, in, length);
+        in = out;
+    }
+    if(escaped)
+    {
+        length = oldEscapes ? TreeUnescapeLegacy(out, in, length) : TreeUnescape(out, in, length);
+    }
+    batch->textLength += length;
+    TreeStr decoded = {out, (uint32_t)length};
+    return decoded;
+}
+
+/*=============================================================================
+*   QueueNode [int]
+*       TreeNodeEvent of the worker; adds a node to the batch being filled
+=============================================================================*/
+static int QueueNode(void* context, int depth, TreeStr name, TreeStr description)
+{
+    TreeLoader* loader = (TreeLoader*)context;
+    if(atomic_load_explicit(&loader->cancel, memory_order_relaxed))
+    {
+        return 0;
+    }
+
+    //Strings that need no decoding stay slices of the mapping; names in a
+    //file without a byte order mark have no escapes
+    int legacy = !loader->parser.utf8;
+    int nameEscaped = !legacy && memchr(name.ptr, '\\', name.len) != NULL;
+    int escaped = memchr(description.ptr, '\\', description.len) != NULL;
+    int nameLegacy = legacy && !TreeUtf8Valid(name.ptr, name.len);
+    int descriptionLegacy = legacy && !TreeUtf8Valid(description.ptr, description.len);
+    size_t needed = 0;
+    if(nameEscaped || nameLegacy)
+    {
+        needed += (size_t)name.len * (nameLegacy ? 3 : 1);
+    }
+    if(escaped || descriptionLegacy)
+    {
+        needed += (size_t)description.len * (descriptionLegacy ? 3 : 1);
+    }
+
+    //The batch is handed over when it is full; its text never moves, so a
+    //string too long for an empty batch gets a batch of its own size
+    LoadBatch* batch = loader->batch;
+    if(batch && (batch->count == batch->capacity || batch->textLength + needed > batch->textCapacity))
+    {
+        if(!Publish(loader, (uint64_t)(name.ptr - loader->data)))
+        {
+            return 0;
+        }
+        batch = NULL;
+    }
+    if(!batch)
+    {
+        batch = NewBatch(loader->batchLimit, needed > LOAD_BATCH_TEXT ? needed : LOAD_BATCH_TEXT);
+        if(!batch)
+        {
+            loader->error = TREE_PARSE_NO_MEMORY;
+            return 0;
+        }
+        loader->batch = batch;
+    }
+
+    LoadRecord* record = &batch->records[batch->count++];
+    record->depth = depth;
+    record->name = nameEscaped || nameLegacy ? DecodeInto(batch, name, nameEscaped, nameLegacy, legacy) : name;
+    record->description = escaped || descriptionLegacy ? DecodeInto(batch, description, escaped, descriptionLegacy, legacy) : description;
+    return 1;
+}
+
+/*=============================================================================
+*   LoadWorker [void]
+*       Body of the worker thread. Parses the mapping a slice at a time and
+*       publishes what is left at the end.
+=============================================================================*/
+static void LoadWorker(void* arg)
+{
+    TreeLoader* loader = (TreeLoader*)arg;
+    TreeParser* parser = &loader->parser;
+
+    size_t position = 0;
+    size_t slice = LOAD_SLICE;
+    do
+    {
+        size_t length = loader->size - position < slice ? loader->size - position : slice;
+        int final = position + length == loader->size;
+        size_t consumed = TreeParseText(parser, loader->data + position, length, final);
+        position += consumed;
+
+        //A record longer than the slice is parsed again with a larger one
+        slice = consumed ? LOAD_SLICE : slice * 2;
+        if(final)
+        {
+            break;
+        }
+    }
+    while(parser->error == TREE_PARSE_OK);
+
+    //Nodes before a malformed record are kept, as TreeLoadMapped keeps them
+    if(!Publish(loader, position) && parser->error == TREE_PARSE_OK)
+    {
+        parser->error = TREE_PARSE_ABORTED;
+    }
+    if(loader->error == TREE_PARSE_OK)
+    {
+        loader->error = parser->error;
+    }
+    atomic_store_explicit(&loader->finished, 1, memory_order_release);
+}
+
+/*=============================================================================
+*   TreeLoaderStart [TreeLoader*]
+*       Clears the model, maps a .dat file into it and starts parsing it on
+*       a worker thread. As with TreeLoadMapped, names and descriptions
+*       stay slices of the mapping unless they had to be decoded.
+*
+*       ***Until TreeLoaderFinish the model may only be read and given
+*       nodes by TreeLoaderApply; it must not be edited, cleared or saved***
+*
+*       Parameters:
+*           TreeModel* tree - The model to load into
+*           FILE* file - The open file; it can be closed once this returns
+*
+*       Returns the loader, or NULL if the file could not be mapped or the
+*       thread not started (the model is then empty; load it some other way)
+=============================================================================*/
+TreeLoader* TreeLoaderStart(TreeModel* tree, FILE* file)
+{
+    TreeClear(tree);
+    TreeLoader* loader = (TreeLoader*)calloc(1, sizeof(TreeLoader));
+    if(!loader)
+    {
+        return NULL;
+    }
+    loader->stackCapacity = 64;
+    loader->stack = (TreeNodeId*)malloc(loader->stackCapacity * sizeof(TreeNodeId));
+    if(!loader->stack || !TreeMapStream(file, &tree->mapping))
+    {
+        free(loader->stack);
+        free(loader);
+        return NULL;
+    }
+    loader->stack[0] = TREE_ROOT;
+    loader->data = tree->mapping.data;
+    loader->size = tree->mapping.size;
+    loader->batchLimit = LOAD_BATCH_FIRST;
+    TreeParserInit(&loader->parser, QueueNode, loader);
+    atomic_init(&loader->head, 0);
+    atomic_init(&loader->tail, 0);
+    atomic_init(&loader->cancel, 0);
+    atomic_init(&loader->finished, 0);
+
+    if(!TreeThreadStart(&loader->thread, LoadWorker, loader))
+    {
+        TreeUnmap(&tree->mapping);
+        free(loader->stack);
+        free(loader);
+        return NULL;
+    }
+    return loader;
+}
+
+/*=============================================================================
+*   TreeLoaderApply [size_t]
+*       Adds nodes the worker has parsed so far to the model, in file order
+*       and each as the last child of its parent
+*
+*       Parameters:
+*           TreeLoader* loader - The loader
+*           TreeModel* tree - The model given to TreeLoaderStart
+*           size_t max - Most nodes to add in this call
+*           TreeLoadEvent onNode - Called for every node added, may be NULL
+*           void* context - Passed through to onNode
+*
+*       Returns the number of nodes added, 0 if none are ready yet. Running
+*       out of memory cancels the load.
+=============================================================================*/
+size_t TreeLoaderApply(TreeLoader* loader, TreeModel* tree, size_t max, TreeLoadEvent onNode, void* context)
+{
+    size_t added = 0;
+    while(added < max && !loader->failed)
+    {
+        if(!loader->current)
+        {
+            size_t head = atomic_load_explicit(&loader->head, memory_order_relaxed);
+            if(head == atomic_load_explicit(&loader->tail, memory_order_acquire))
+            {
+                break;
+            }
+            loader->current = loader->queue[head % LOAD_QUEUE_LENGTH];
+            loader->applied = 0;
+        }
+
+        LoadBatch* batch = loader->current;
+        while(loader->applied < batch->count && added < max)
+        {
+            LoadRecord* record = &batch->records[loader->applied];
+            int depth = record->depth;
+            if(depth + 2 > loader->stackCapacity)
+            {
+                int capacity = loader->stackCapacity * 2;
+                TreeNodeId* stack = (TreeNodeId*)realloc(loader->stack, capacity * sizeof(TreeNodeId));
+                if(!stack)
+                {
+                    loader->failed = TREE_PARSE_NO_MEMORY;
+                    break;
+                }
+                loader->stack = stack;
+                loader->stackCapacity = capacity;
+            }
+
+            //Decoded strings live in the batch, which is about to go
+            TreeStr name = record->name;
+            TreeStr description = record->description;
+            if((!TreeIsBorrowed(tree, name) && !TreeStrPoolAdd(&tree->strings, name.ptr, name.len, &name)) ||
+               (!TreeIsBorrowed(tree, description) && !TreeStrPoolAdd(&tree->strings, description.ptr, description.len, &description)))
+            {
+                loader->failed = TREE_PARSE_NO_MEMORY;
+                break;
+            }
+            TreeNodeId node = TreeAddNodeBorrowed(tree, loader->stack[depth], name, description);
+            if(node == TREE_NIL)
+            {
+                loader->failed = TREE_PARSE_NO_MEMORY;
+                break;
+            }
+            loader->stack[depth + 1] = node;
+            loader->applied++;
+            added++;
+            if(onNode)
+            {
+                onNode(context, node);
+            }
+        }
+
+        if(loader->applied == batch->count)
+        {
+            loader->done = batch->end;
+            FreeBatch(batch);
+            loader->current = NULL;
+            atomic_fetch_add_explicit(&loader->head, 1, memory_order_release);
+        }
+    }
+
+    if(loader->failed)
+    {
+        TreeLoaderCancel(loader);
+    }
+    return added;
+}
+
+/*=============================================================================
+*   TreeLoaderProgress [double]
+*       Share of the file whose nodes are in the model, from 0 to 1
+=============================================================================*/
+double TreeLoaderProgress(const TreeLoader* loader)
+{
+    return loader->size ? (double)loader->done / (double)loader->size : 1.0;
+}
+
+/*=============================================================================
+*   TreeLoaderDone [int]
+*       Nonzero once the worker has stopped and every node it parsed is in
+*       the model, or the load failed; TreeLoaderFinish will not wait then
+=============================================================================*/
+int TreeLoaderDone(const TreeLoader* loader)
+{
+    if(loader->failed)
+    {
+        return 1;
+    }
+    return atomic_load_explicit(&loader->finished, memory_order_acquire) && !loader->current &&
+           atomic_load_explicit(&loader->head, memory_order_relaxed) == atomic_load_explicit(&loader->tail, memory_order_acquire);
+}
+
+/*=============================================================================
+*   TreeLoaderCancel [void]
+*       Asks the worker to stop; it does within one node. May be called
+*       from any thread.
+=============================================================================*/
+void TreeLoaderCancel(TreeLoader* loader)
+{
+    atomic_store_explicit(&loader->cancel, 1, memory_order_relaxed);
+}
+
+/*=============================================================================
+*   TreeLoaderFinish [int]
+*       Waits for the worker and frees the loader. Nodes still queued are
+*       dropped, so call it once TreeLoaderDone says so, or after
+*       TreeLoaderCancel. The model keeps the mapping and what was added.
+*
+*       Returns TREE_PARSE_OK if the whole file is in the model, otherwise
+*       why not: TREE_PARSE_ABORTED after a cancel, TREE_PARSE_MALFORMED or
+*       TREE_PARSE_NO_MEMORY
+=============================================================================*/
+int TreeLoaderFinish(TreeLoader* loader)
+{
+    int complete = TreeLoaderDone(loader);
+    TreeLoaderCancel(loader);
+    TreeThreadJoin(&loader->thread);
+
+    int error = loader->failed ? loader->failed : loader->error;
+    if(error == TREE_PARSE_OK && !complete)
+    {
+        error = TREE_PARSE_ABORTED;
+    }
+
+    FreeBatch(loader->current);
+    size_t tail = atomic_load_explicit(&loader->tail, memory_order_relaxed);
+    for(size_t head = atomic_load_explicit(&loader->head, memory_order_relaxed); head != tail; head++)
+    {
+        FreeBatch(loader->queue[head % LOAD_QUEUE_LENGTH]);
+    }
+    FreeBatch(loader->batch);
+    free(loader->stack);
+    free(loader);
+    return error;
+}
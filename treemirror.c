@@ -0,0 +1,331 @@
+/*=============================================================================
+*       treemirror.c
+*       Lazy mirroring of the model into a view. Only nodes whose parent
+*       has been expanded exist in the view; everything below a collapsed
+*       node lives in the model alone.
+=============================================================================*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree.h"
+
+/*=============================================================================
+*   CountingInsert [void*]
+*       Insert callback of TreeCountingViewOps. The mirror does the
+*       counting; any non-NULL handle will do.
+=============================================================================*/
+static void* CountingInsert(void* context, void* parent, void* after, TreeNodeId node)
+{
+    (void)context;
+    (void)parent;
+    (void)after;
+    return (void*)(intptr_t)(node + 1);
+}
+
+//A view without a window, for headless tools that measure materialization
+const TreeViewOps TreeCountingViewOps = {CountingInsert};
+
+/*=============================================================================
+*   MirrorReserve [int]
+*       Grows the per-node arrays to cover every id the model has handed out
+=============================================================================*/
+static int MirrorReserve(TreeMirror* mirror)
+{
+    int32_t needed = mirror->tree->used;
+    if(needed <= mirror->capacity)
+    {
+        return 1;
+    }
+
+    int32_t capacity = mirror->capacity ? mirror->capacity : 64;
+    while(capacity < needed)
+    {
+        capacity *= 2;
+    }
+
+    void** handles = (void**)realloc(mirror->handles, capacity * sizeof(void*));
+    if(!handles)
+    {
+        return 0;
+    }
+    mirror->handles = handles;
+
+    uint8_t* populated = (uint8_t*)realloc(mirror->populated, capacity);
+    if(!populated)
+    {
+        return 0;
+    }
+    mirror->populated = populated;
+
+    memset(mirror->handles + mirror->capacity, 0, (capacity - mirror->capacity) * sizeof(void*));
+    memset(mirror->populated + mirror->capacity, 0, capacity - mirror->capacity);
+    mirror->capacity = capacity;
+    return 1;
+}
+
+/*=============================================================================
+*   Insert [int]
+*       Inserts a node into the view after its previous sibling, below a
+*       parent whose children are in the view
+=============================================================================*/
+static int Insert(TreeMirror* mirror, TreeNodeId node)
+{
+    TreeNodeId parent = mirror->tree->parent[node];
+    TreeNodeId prev = mirror->tree->prevSibling[node];
+    void* handle = mirror->ops->insert(mirror->context, mirror->handles[parent], prev != TREE_NIL ? mirror->handles[prev] : NULL, node);
+    if(!handle)
+    {
+        return 0;
+    }
+    mirror->handles[node] = handle;
+    mirror->materialized++;
+    return 1;
+}
+
+/*=============================================================================
+*   TreeMirrorInit [void]
+*       Connects a model to a view. Nothing is inserted until
+*       TreeMirrorReset.
+*
+*       Parameters:
+*           TreeMirror* mirror - The mirror to set up
+*           TreeModel* tree - The model being shown
+*           const TreeViewOps* ops - The view's callbacks
+*           void* context - Passed to every callback
+*
+=============================================================================*/
+void TreeMirrorInit(TreeMirror* mirror, TreeModel* tree, const TreeViewOps* ops, void* context)
+{
+    memset(mirror, 0, sizeof(*mirror));
+    mirror->tree = tree;
+    mirror->ops = ops;
+    mirror->context = context;
+}
+
+/*=============================================================================
+*   TreeMirrorFree [void]
+=============================================================================*/
+void TreeMirrorFree(TreeMirror* mirror)
+{
+    free(mirror->handles);
+    free(mirror->populated);
+    memset(mirror, 0, sizeof(*mirror));
+}
+
+/*=============================================================================
+*   TreeMirrorClear [void]
+*       Forgets every handle, for a view that is about to be emptied. Only
+*       the materialized nodes are visited, so this costs as much as the
+*       view holds, not the document.
+*
+*       ***Call it before the model is cleared or replaced, while its links
+*       still describe what the view shows***
+=============================================================================*/
+void TreeMirrorClear(TreeMirror* mirror)
+{
+    const TreeModel* tree = mirror->tree;
+    if(mirror->capacity && mirror->populated[TREE_ROOT])
+    {
+        for(TreeNodeId node = tree->firstChild[TREE_ROOT]; node != TREE_NIL; node = tree->nextSibling[node])
+        {
+            TreeMirrorRemoved(mirror, node);
+        }
+        mirror->populated[TREE_ROOT] = 0;
+    }
+    mirror->materialized = 0;
+}
+
+/*=============================================================================
+*   TreeMirrorReset [int]
+*       Inserts the top level nodes of a model into a view emptied with
+*       TreeMirrorClear
+*
+*       Returns nonzero on success
+=============================================================================*/
+int TreeMirrorReset(TreeMirror* mirror)
+{
+    return TreeMirrorExpand(mirror, TREE_ROOT);
+}
+
+/*=============================================================================
+*   TreeMirrorExpand [int]
+*       Inserts the children of a node into the view the first time the
+*       node is expanded; later calls do nothing
+*
+*       Parameters:
+*           TreeMirror* mirror - The mirror
+*           TreeNodeId node - A node that is in the view, or TREE_ROOT
+*
+*       Returns nonzero on success
+=============================================================================*/
+int TreeMirrorExpand(TreeMirror* mirror, TreeNodeId node)
+{
+    const TreeModel* tree = mirror->tree;
+    if(!TreeIsLive(tree, node) || !MirrorReserve(mirror))
+    {
+        return 0;
+    }
+    if(mirror->populated[node])
+    {
+        return 1;
+    }
+    if(node != TREE_ROOT && !mirror->handles[node])
+    {
+        return 0;
+    }
+
+    void* parent = mirror->handles[node];
+    void* after = NULL;
+    for(TreeNodeId child = tree->firstChild[node]; child != TREE_NIL; child = tree->nextSibling[child])
+    {
+        void* handle = mirror->ops->insert(mirror->context, parent, after, child);
+        if(!handle)
+        {
+            return 0;
+        }
+        mirror->handles[child] = handle;
+        mirror->materialized++;
+        after = handle;
+    }
+    mirror->populated[node] = 1;
+    return 1;
+}
+
+/*=============================================================================
+*   TreeMirrorAdded [int]
+*       Shows a node just added to the model, or a detached subtree just
+*       put back, in its place among its siblings. If its parent's children
+*       were never inserted they all are now, the new node included.
+*
+*       Returns nonzero on success
+=============================================================================*/
+int TreeMirrorAdded(TreeMirror* mirror, TreeNodeId node)
+{
+    if(!MirrorReserve(mirror))
+    {
+        return 0;
+    }
+
+    //Nothing to show below a parent that is not in the view either
+    TreeNodeId parent = mirror->tree->parent[node];
+    if(parent != TREE_ROOT && !mirror->handles[parent])
+    {
+        return 1;
+    }
+    if(!mirror->populated[parent])
+    {
+        return TreeMirrorExpand(mirror, parent);
+    }
+
+    return Insert(mirror, node);
+}
+
+/*=============================================================================
+*   TreeMirrorAppended [int]
+*       Shows a node just appended to the model while a file is loading,
+*       but only below a parent whose children are in the view already;
+*       under any other parent it turns up when that parent is expanded
+*
+*       Returns nonzero on success
+=============================================================================*/
+int TreeMirrorAppended(TreeMirror* mirror, TreeNodeId node)
+{
+    if(!MirrorReserve(mirror))
+    {
+        return 0;
+    }
+    return mirror->populated[mirror->tree->parent[node]] ? Insert(mirror, node) : 1;
+}
+
+/*=============================================================================
+*   TreeMirrorRemoved [void]
+*       Forgets the handles of a subtree about to be deleted from the model,
+*       or just detached. The view deletes its items itself. Only the
+*       materialized part of the subtree is walked.
+=============================================================================*/
+void TreeMirrorRemoved(TreeMirror* mirror, TreeNodeId node)
+{
+    const TreeModel* tree = mirror->tree;
+    if(node >= mirror->capacity || !mirror->handles[node])
+    {
+        return;
+    }
+
+    TreeNodeId current = node;
+    while(current != TREE_NIL)
+    {
+        mirror->handles[current] = NULL;
+        mirror->materialized--;
+
+        //Descend only where children were inserted
+        TreeNodeId next = TREE_NIL;
+        if(mirror->populated[current] && tree->firstChild[current] != TREE_NIL)
+        {
+            next = tree->firstChild[current];
+        }
+        mirror->populated[current] = 0;
+        for(TreeNodeId up = current; next == TREE_NIL && up != node; up = tree->parent[up])
+        {
+            next = tree->nextSibling[up];
+        }
+        current = next;
+    }
+}
+
+/*=============================================================================
+*   TreeMirrorHandle [void*]
+*       The view's handle for a node, NULL if it is not materialized
+=============================================================================*/
+void* TreeMirrorHandle(const TreeMirror* mirror, TreeNodeId node)
+{
+    return node >= 0 && node < mirror->capacity ? mirror->handles[node] : NULL;
+}
+
+/*=============================================================================
+*   TreeMirrorReveal [void*]
+*       Inserts the items missing on the way down to a node, e.g. one found
+*       by a search, so that it can be selected
+*
+*       Returns the node's handle, NULL on failure
+=============================================================================*/
+void* TreeMirrorReveal(TreeMirror* mirror, TreeNodeId node)
+{
+    const TreeModel* tree = mirror->tree;
+    if(node == TREE_ROOT || !TreeIsAttached(tree, node) || !MirrorReserve(mirror))
+    {
+        return NULL;
+    }
+    if(mirror->handles[node])
+    {
+        return mirror->handles[node];
+    }
+
+    //The ancestors up to the closest one already in the view
+    int32_t depth = 1;
+    TreeNodeId top = tree->parent[node];
+    while(top != TREE_ROOT && !mirror->handles[top])
+    {
+        top = tree->parent[top];
+        depth++;
+    }
+    TreeNodeId* path = (TreeNodeId*)malloc(depth * sizeof(TreeNodeId));
+    if(!path)
+    {
+        return NULL;
+    }
+    TreeNodeId current = tree->parent[node];
+    for(int32_t i = 0; i < depth; i++)
+    {
+        path[i] = current;
+        current = tree->parent[current];
+    }
+
+    //Expand from the top down, each step inserts the next one
+    int ok = 1;
+    for(int32_t i = depth - 1; i >= 0 && ok; i--)
+    {
+        ok = TreeMirrorExpand(mirror, path[i]);
+    }
+    free(path);
+    return ok ? mirror->handles[node] : NULL;
+}
@@ -0,0 +1,597 @@
+/*=============================================================================
+*       treepath.c
+*       Lookup of nodes by path, e.g. "Root/Servers/eu-west/db01". Every
+*       child is filed under its parent and a hash of its name, so each
+*       step of a path is one probe of a hash table instead of a walk over
+*       the siblings, however many there are.
+=============================================================================*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree.h"
+
+/*
+*   The children of `parent` whose names hash to `hash`, chained through
+*   the index's next and prev arrays in the order they were added. Names
+*   that differ but share a hash share a slot; the chain is checked.
+*/
+struct _TreePathSlot
+{
+    TreeNodeId parent;      //TREE_NIL for a free slot
+    uint32_t hash;
+    TreeNodeId first;
+    TreeNodeId last;
+};
+
+/*=============================================================================
+*   HashName [uint32_t]
+*       FNV-1a of a name's bytes
+=============================================================================*/
+static uint32_t HashName(const char* text, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*=============================================================================
+*   HomeSlot [uint32_t]
+*       Where the probe for a parent and name hash starts
+=============================================================================*/
+static inline uint32_t HomeSlot(const TreePathIndex* index, TreeNodeId parent, uint32_t hash)
+{
+    uint32_t key = hash ^ ((uint32_t)parent * 0x9E3779B1u);
+    key ^= key >> 15;
+    key *= 0x2C1B3C6Du;
+    key ^= key >> 12;
+    return key & index->slotMask;
+}
+
+/*=============================================================================
+*   FindSlot [TreePathSlot*]
+*       The slot of a parent and name hash, NULL if there is none
+=============================================================================*/
+static TreePathSlot* FindSlot(const TreePathIndex* index, TreeNodeId parent, uint32_t hash)
+{
+    if(!index->slots)
+    {
+        return NULL;
+    }
+    for(uint32_t slot = HomeSlot(index, parent, hash); ; slot = (slot + 1) & index->slotMask)
+    {
+        TreePathSlot* entry = &index->slots[slot];
+        if(entry->parent == parent && entry->hash == hash)
+        {
+            return entry;
+        }
+        if(entry->parent == TREE_NIL)
+        {
+            return NULL;
+        }
+    }
+}
+
+/*=============================================================================
+*   GrowSlots [int]
+*       Doubles the slot table and rehashes the slots already in it
+=============================================================================*/
+static int GrowSlots(TreePathIndex* index)
+{
+    uint32_t oldCount = index->slots ? index->slotMask + 1 : 0;
+    uint32_t newCount = oldCount ? oldCount * 2 : 1024;
+    TreePathSlot* old = index->slots;
+    TreePathSlot* slots = (TreePathSlot*)malloc(newCount * sizeof(TreePathSlot));
+    if(!slots)
+    {
+        return 0;
+    }
+    for(uint32_t i = 0; i < newCount; i++)
+    {
+        slots[i].parent = TREE_NIL;
+    }
+
+    index->slots = slots;
+    index->slotMask = newCount - 1;
+    for(uint32_t i = 0; i < oldCount; i++)
+    {
+        if(old[i].parent == TREE_NIL)
+        {
+            continue;
+        }
+        uint32_t slot = HomeSlot(index, old[i].parent, old[i].hash);
+        while(slots[slot].parent != TREE_NIL)
+        {
+            slot = (slot + 1) & index->slotMask;
+        }
+        slots[slot] = old[i];
+    }
+    free(old);
+    return 1;
+}
+
+/*=============================================================================
+*   RemoveSlot [void]
+*       Empties a slot, moving later slots of the same probe run back so
+*       that no probe stops short of them
+=============================================================================*/
+static void RemoveSlot(TreePathIndex* index, TreePathSlot* entry)
+{
+    uint32_t hole = (uint32_t)(entry - index->slots);
+    for(uint32_t slot = (hole + 1) & index->slotMask; index->slots[slot].parent != TREE_NIL; slot = (slot + 1) & index->slotMask)
+    {
+        //Move it unless its home lies cyclically between the hole and it
+        uint32_t home = HomeSlot(index, index->slots[slot].parent, index->slots[slot].hash);
+        if(((slot - home) & index->slotMask) >= ((slot - hole) & index->slotMask))
+        {
+            index->slots[hole] = index->slots[slot];
+            hole = slot;
+        }
+    }
+    index->slots[hole].parent = TREE_NIL;
+    index->slotUsed--;
+}
+
+/*=============================================================================
+*   ReserveNodes [int]
+*       Makes room in the per node arrays for every id the model handed out
+=============================================================================*/
+static int ReserveNodes(TreePathIndex* index, const TreeModel* tree)
+{
+    if(tree->used <= index->nodeCapacity)
+    {
+        return 1;
+    }
+    int32_t capacity = index->nodeCapacity ? index->nodeCapacity : 64;
+    while(capacity < tree->used)
+    {
+        capacity *= 2;
+    }
+
+    uint32_t* hashes = (uint32_t*)realloc(index->hashes, capacity * sizeof(uint32_t));
+    if(hashes)
+    {
+        index->hashes = hashes;
+    }
+    TreeNodeId* next = (TreeNodeId*)realloc(index->next, capacity * sizeof(TreeNodeId));
+    if(next)
+    {
+        index->next = next;
+    }
+    TreeNodeId* prev = (TreeNodeId*)realloc(index->prev, capacity * sizeof(TreeNodeId));
+    if(prev)
+    {
+        index->prev = prev;
+    }
+    TreeNodeId* parents = (TreeNodeId*)realloc(index->parents, capacity * sizeof(TreeNodeId));
+    if(parents)
+    {
+        index->parents = parents;
+    }
+    if(!hashes || !next || !prev || !parents)
+    {
+        return 0;
+    }
+
+    //TREE_FREE in prev marks a node that is not filed
+    for(int32_t i = index->nodeCapacity; i < capacity; i++)
+    {
+        index->prev[i] = TREE_FREE;
+    }
+    index->nodeCapacity = capacity;
+    return 1;
+}
+
+/*=============================================================================
+*   AddNode [int]
+*       Files a node under its parent and name. A slot's chain keeps the
+*       sibling order, so of several siblings with the same name a path
+*       always finds the first, as a walk over the siblings would.
+*
+*       Parameters:
+*           TreeNodeId node - A live node, not filed
+*           int last - No sibling after it is filed yet, e.g. while
+*                      building or for a node just added at the end
+*
+*       Returns 0 if out of memory
+=============================================================================*/
+static int AddNode(TreePathIndex* index, const TreeModel* tree, TreeNodeId node, int last)
+{
+    //Keep the table at most half full
+    if(!index->slots || (index->slotUsed + 1) * 2 > index->slotMask + 1)
+    {
+        if(!GrowSlots(index))
+        {
+            return 0;
+        }
+    }
+
+    TreeNodeId parent = tree->parent[node];
+    TreeStr name = TreeName(tree, node);
+    uint32_t hash = HashName(name.ptr, name.len);
+    uint32_t slot = HomeSlot(index, parent, hash);
+    while(index->slots[slot].parent != TREE_NIL &&
+          (index->slots[slot].parent != parent || index->slots[slot].hash != hash))
+    {
+        slot = (slot + 1) & index->slotMask;
+    }
+
+    TreePathSlot* entry = &index->slots[slot];
+    index->hashes[node] = hash;
+    index->parents[node] = parent;
+    if(entry->parent == TREE_NIL)
+    {
+        entry->parent = parent;
+        entry->hash = hash;
+        entry->first = node;
+        entry->last = node;
+        index->prev[node] = TREE_NIL;
+        index->next[node] = TREE_NIL;
+        index->slotUsed++;
+        return 1;
+    }
+
+    //The first later sibling in the same chain, if any, follows it
+    TreeNodeId next = TREE_NIL;
+    for(TreeNodeId sibling = last ? TREE_NIL : tree->nextSibling[node]; sibling != TREE_NIL; sibling = tree->nextSibling[sibling])
+    {
+        if(sibling < index->nodeCapacity && index->prev[sibling] != TREE_FREE && index->hashes[sibling] == hash)
+        {
+            next = sibling;
+            break;
+        }
+    }
+
+    TreeNodeId prev = next != TREE_NIL ? index->prev[next] : entry->last;
+    index->prev[node] = prev;
+    index->next[node] = next;
+    if(prev != TREE_NIL)
+    {
+        index->next[prev] = node;
+    }
+    else
+    {
+        entry->first = node;
+    }
+    if(next != TREE_NIL)
+    {
+        index->prev[next] = node;
+    }
+    else
+    {
+        entry->last = node;
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   RemoveNode [void]
+*       Takes a node out of its slot's chain. It is found by the parent and
+*       name it was filed with, so it may have been detached or renamed
+*       since.
+=============================================================================*/
+static void RemoveNode(TreePathIndex* index, TreeNodeId node)
+{
+    if(node >= index->nodeCapacity || index->prev[node] == TREE_FREE)
+    {
+        return;
+    }
+    TreePathSlot* entry = FindSlot(index, index->parents[node], index->hashes[node]);
+    TreeNodeId prev = index->prev[node];
+    TreeNodeId next = index->next[node];
+    index->prev[node] = TREE_FREE;
+    if(!entry)
+    {
+        return;
+    }
+
+    if(prev != TREE_NIL)
+    {
+        index->next[prev] = next;
+    }
+    else
+    {
+        entry->first = next;
+    }
+    if(next != TREE_NIL)
+    {
+        index->prev[next] = prev;
+    }
+    else
+    {
+        entry->last = prev;
+    }
+    if(entry->first == TREE_NIL)
+    {
+        RemoveSlot(index, entry);
+    }
+}
+
+/*=============================================================================
+*   ScanChildren [TreeNodeId]
+*       The first child of `parent` with the given name, found by walking
+*       the siblings; used before the index is built
+=============================================================================*/
+static TreeNodeId ScanChildren(const TreeModel* tree, TreeNodeId parent, TreeStr name)
+{
+    for(TreeNodeId child = tree->firstChild[parent]; child != TREE_NIL; child = tree->nextSibling[child])
+    {
+        if(TreeStrEqual(TreeName(tree, child), name))
+        {
+            return child;
+        }
+    }
+    return TREE_NIL;
+}
+
+/*=============================================================================
+*   TreePathInit [void]
+*       Prepares an index that is not built yet
+=============================================================================*/
+void TreePathInit(TreePathIndex* index)
+{
+    memset(index, 0, sizeof(*index));
+}
+
+/*=============================================================================
+*   TreePathClear [void]
+*       Drops everything, e.g. for a new document. Edits are not filed
+*       and lookups walk the siblings until it is built again.
+=============================================================================*/
+void TreePathClear(TreePathIndex* index)
+{
+    free(index->slots);
+    free(index->hashes);
+    free(index->next);
+    free(index->prev);
+    free(index->parents);
+    memset(index, 0, sizeof(*index));
+}
+
+/*=============================================================================
+*   TreePathFree [void]
+=============================================================================*/
+void TreePathFree(TreePathIndex* index)
+{
+    TreePathClear(index);
+}
+
+/*=============================================================================
+*   TreePathBuild [int]
+*       Files every node in the document, visiting the children of each
+*       parent in sibling order. Parents are reached by a preorder walk, so
+*       detached and freed ids cost nothing.
+*
+*       Returns nonzero on success; out of memory leaves it not built
+=============================================================================*/
+int TreePathBuild(TreePathIndex* index, const TreeModel* tree)
+{
+    TreePathClear(index);
+    if(!ReserveNodes(index, tree))
+    {
+        TreePathClear(index);
+        return 0;
+    }
+    for(TreeNodeId parent = TREE_ROOT; parent != TREE_NIL; parent = TreeNextPreorder(tree, parent, TREE_ROOT))
+    {
+        for(TreeNodeId child = tree->firstChild[parent]; child != TREE_NIL; child = tree->nextSibling[child])
+        {
+            if(!AddNode(index, tree, child, 1))
+            {
+                TreePathClear(index);
+                return 0;
+            }
+        }
+    }
+    index->built = 1;
+    return 1;
+}
+
+/*=============================================================================
+*   File [void]
+*       Files a node, dropping the index if out of memory; it is then
+*       rebuilt on demand
+=============================================================================*/
+static void File(TreePathIndex* index, const TreeModel* tree, TreeNodeId node, int last)
+{
+    if(!ReserveNodes(index, tree) || !AddNode(index, tree, node, last))
+    {
+        TreePathClear(index);
+    }
+}
+
+/*=============================================================================
+*   TreePathInserted [void]
+*       Files a node just added to the model, or a detached subtree just
+*       put back, with everything below it. Only the top node can have
+*       siblings of its name after it; the rest are filed in order.
+=============================================================================*/
+void TreePathInserted(TreePathIndex* index, const TreeModel* tree, TreeNodeId node)
+{
+    for(TreeNodeId current = node; current != TREE_NIL && index->built; current = TreeNextPreorder(tree, current, node))
+    {
+        File(index, tree, current, current != node);
+    }
+}
+
+/*=============================================================================
+*   TreePathRenamed [void]
+*       Files a node again under the name it was just given. Finding its
+*       place among siblings of the same name may walk the siblings after
+*       it, once per rename.
+=============================================================================*/
+void TreePathRenamed(TreePathIndex* index, const TreeModel* tree, TreeNodeId node)
+{
+    if(index->built)
+    {
+        RemoveNode(index, node);
+        File(index, tree, node, 0);
+    }
+}
+
+/*=============================================================================
+*   TreePathMoved [void]
+*       Files a node again under the parent it was just moved to. The nodes
+*       below it are filed under their own parents, which came along, so
+*       they stay where they are.
+=============================================================================*/
+void TreePathMoved(TreePathIndex* index, const TreeModel* tree, TreeNodeId node)
+{
+    TreePathRenamed(index, tree, node);
+}
+
+/*=============================================================================
+*   TreePathDeleted [void]
+*       Takes a subtree about to be deleted, or just detached, out of the
+*       index
+*
+*       ***Call it before TreeDeleteSubtree, while the nodes are still live***
+=============================================================================*/
+void TreePathDeleted(TreePathIndex* index, const TreeModel* tree, TreeNodeId node)
+{
+    if(!index->built)
+    {
+        return;
+    }
+    for(TreeNodeId current = node; current != TREE_NIL; current = TreeNextPreorder(tree, current, node))
+    {
+        RemoveNode(index, current);
+    }
+}
+
+/*=============================================================================
+*   TreePathFind [TreeNodeId]
+*       Resolves a path of names separated by '/', the first of them a top
+*       level node's. A '/' or '\' inside a name is written with a '\'
+*       before it, as TreePathFormat does. Each step costs one probe once
+*       the index is built, a walk over the siblings before that; of
+*       several siblings with the same name the first is found either way.
+*
+*       Parameters:
+*           const TreePathIndex* index - The index of `tree`
+*           const TreeModel* tree - The model
+*           const char* path - UTF-8 path, not NUL terminated
+*           size_t length - Number of bytes in `path`
+*
+*       Returns the node, or TREE_NIL if no node has the path
+=============================================================================*/
+TreeNodeId TreePathFind(const TreePathIndex* index, const TreeModel* tree, const char* path, size_t length)
+{
+    char* name = (char*)malloc(length ? length : 1);
+    if(!name)
+    {
+        return TREE_NIL;
+    }
+
+    TreeNodeId node = TREE_ROOT;
+    size_t i = 0;
+    while(node != TREE_NIL)
+    {
+        //Unescape one name
+        size_t nameLength = 0;
+        while(i < length && path[i] != '/')
+        {
+            if(path[i] == '\\' && i + 1 < length)
+            {
+                i++;
+            }
+            name[nameLength++] = path[i++];
+        }
+
+        TreeStr text = { name, (uint32_t)nameLength };
+        if(!index->built)
+        {
+            node = ScanChildren(tree, node, text);
+        }
+        else
+        {
+            TreePathSlot* entry = FindSlot(index, node, HashName(name, nameLength));
+            node = TREE_NIL;
+            for(TreeNodeId child = entry ? entry->first : TREE_NIL; child != TREE_NIL; child = index->next[child])
+            {
+                if(TreeStrEqual(TreeName(tree, child), text))
+                {
+                    node = child;
+                    break;
+                }
+            }
+        }
+
+        if(i == length)
+        {
+            break;
+        }
+        i++;
+    }
+    free(name);
+    return node;
+}
+
+/*=============================================================================
+*   TreePathFormat [size_t]
+*       Writes the path of a node as TreePathFind reads it, NUL
+*       terminated. Nothing is written unless the
+*       whole path and its terminator fit.
+*
+*       Parameters:
+*           const TreeModel* tree - The model
+*           TreeNodeId node - A live node
+*           char* out - Receives the path, may be NULL if `size` is 0
+*           size_t size - Bytes available at `out`
+*
+*       Returns the length of the path, not counting the terminator
+=============================================================================*/
+size_t TreePathFormat(const TreeModel* tree, TreeNodeId node, char* out, size_t size)
+{
+    //Measure first, then fill from the end back to the top level
+    size_t length = 0;
+    for(TreeNodeId current = node; current != TREE_ROOT && current != TREE_NIL; current = tree->parent[current])
+    {
+        TreeStr name = TreeName(tree, current);
+        length += name.len + (current != node);
+        for(uint32_t i = 0; i < name.len; i++)
+        {
+            length += name.ptr[i] == '/' || name.ptr[i] == '\\';
+        }
+    }
+
+    if(size > length)
+    {
+        size_t end = length;
+        out[end] = '\0';
+        for(TreeNodeId current = node; current != TREE_ROOT && current != TREE_NIL; current = tree->parent[current])
+        {
+            if(current != node)
+            {
+                out[--end] = '/';
+            }
+            TreeStr name = TreeName(tree, current);
+            for(uint32_t i = name.len; i-- > 0; )
+            {
+                out[--end] = name.ptr[i];
+                if(name.ptr[i] == '/' || name.ptr[i] == '\\')
+                {
+                    out[--end] = '\\';
+                }
+            }
+        }
+    }
+    return length;
+}
+
+/*=============================================================================
+*   TreePathMemory [size_t]
+*       Bytes the index holds, for reporting
+=============================================================================*/
+size_t TreePathMemory(const TreePathIndex* index)
+{
+    size_t size = (size_t)index->nodeCapacity * (sizeof(uint32_t) + 3 * sizeof(TreeNodeId));
+    if(index->slots)
+    {
+        size += ((size_t)index->slotMask + 1) * sizeof(TreePathSlot);
+    }
+    return size;
+}
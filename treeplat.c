@@ -0,0 +1,319 @@
+/*=============================================================================
+*       treeplat.c
+*       The few operating system services the portable model needs,
+*       implemented for Win32 and POSIX
+=============================================================================*/
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <psapi.h>
+#else
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "tree.h"
+
+/*=============================================================================
+*   TreeMapStream [int]
+*       Maps the whole file behind an open stream read-only. The stream can
+*       be closed afterwards; the mapping stays valid until TreeUnmap.
+*
+*       Parameters:
+*           FILE* file - An open stream, read from the start
+*           TreeMapping* mapping - Receives the view
+*
+*       Returns nonzero on success. An empty file maps to a NULL view.
+*       Anything but a regular file fails, so callers fall back to reading
+*       the stream; a pipe would otherwise map as empty.
+=============================================================================*/
+int TreeMapStream(FILE* file, TreeMapping* mapping)
+{
+    mapping->data = NULL;
+    mapping->size = 0;
+
+#ifdef _WIN32
+    HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(file));
+    LARGE_INTEGER size;
+    if(hFile == INVALID_HANDLE_VALUE || GetFileType(hFile) != FILE_TYPE_DISK || !GetFileSizeEx(hFile, &size))
+    {
+        return 0;
+    }
+    if(size.QuadPart == 0)
+    {
+        return 1;
+    }
+
+    HANDLE hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(!hMapping)
+    {
+        return 0;
+    }
+    //The view keeps the mapping object alive on its own
+    const char* data = (const char*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(hMapping);
+    if(!data)
+    {
+        return 0;
+    }
+    mapping->data = data;
+    mapping->size = (size_t)size.QuadPart;
+#else
+    struct stat info;
+    int fd = fileno(file);
+    if(fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        return 0;
+    }
+    if(info.st_size == 0)
+    {
+        return 1;
+    }
+
+    void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(data == MAP_FAILED)
+    {
+        return 0;
+    }
+    //The file is parsed front to back exactly once
+    madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+    mapping->data = (const char*)data;
+    mapping->size = (size_t)info.st_size;
+#endif
+    return 1;
+}
+
+/*=============================================================================
+*   TreeUnmap [void]
+*       Releases a view made by TreeMapStream; safe on an empty mapping
+=============================================================================*/
+void TreeUnmap(TreeMapping* mapping)
+{
+    if(mapping->data)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(mapping->data);
+#else
+        munmap((void*)mapping->data, mapping->size);
+#endif
+    }
+    mapping->data = NULL;
+    mapping->size = 0;
+}
+
+/*=============================================================================
+*   TreeStreamSize [uint64_t]
+*       Size of the file behind an open stream, including data still in
+*       its buffer once that is flushed
+=============================================================================*/
+uint64_t TreeStreamSize(FILE* file)
+{
+    fflush(file);
+#ifdef _WIN32
+    __int64 size = _filelengthi64(_fileno(file));
+    return size < 0 ? 0 : (uint64_t)size;
+#else
+    struct stat info;
+    return fstat(fileno(file), &info) == 0 ? (uint64_t)info.st_size : 0;
+#endif
+}
+
+/*=============================================================================
+*   TreeStreamIsFile [int]
+*       Nonzero if an open stream is a regular file on disk, which can seek
+*       and be mapped, rather than a pipe, terminal or device
+=============================================================================*/
+int TreeStreamIsFile(FILE* file)
+{
+#ifdef _WIN32
+    HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(file));
+    return hFile != INVALID_HANDLE_VALUE && GetFileType(hFile) == FILE_TYPE_DISK;
+#else
+    struct stat info;
+    return fstat(fileno(file), &info) == 0 && S_ISREG(info.st_mode);
+#endif
+}
+
+/*=============================================================================
+*   TreeStreamSeek [int]
+*       Moves a stream to a byte offset, which may be past 2 GB where long
+*       is 32 bits
+*
+*       Returns nonzero on success
+=============================================================================*/
+int TreeStreamSeek(FILE* file, uint64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(file, (__int64)offset, SEEK_SET) == 0;
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+/*=============================================================================
+*   TreeStreamSync [int]
+*       Flushes a stream written to and asks the system to put it on disk,
+*       so a file renamed into place afterwards is never found empty
+*
+*       Returns nonzero on success
+=============================================================================*/
+int TreeStreamSync(FILE* file)
+{
+    if(fflush(file) != 0)
+    {
+        return 0;
+    }
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+/*=============================================================================
+*   ThreadEntry
+*       Adapts the platform's thread entry signature to TreeThreadProc
+=============================================================================*/
+#ifdef _WIN32
+static DWORD WINAPI ThreadEntry(LPVOID arg)
+{
+    TreeThread* thread = (TreeThread*)arg;
+    thread->proc(thread->arg);
+    return 0;
+}
+#else
+static void* ThreadEntry(void* arg)
+{
+    TreeThread* thread = (TreeThread*)arg;
+    thread->proc(thread->arg);
+    return NULL;
+}
+#endif
+
+/*=============================================================================
+*   TreeThreadStart [int]
+*       Runs proc(arg) on a new thread
+*
+*       Parameters:
+*           TreeThread* thread - Receives the thread; must stay in place
+*                                until TreeThreadJoin returns
+*           TreeThreadProc proc - Thread body
+*           void* arg - Passed to proc
+*
+*       Returns nonzero on success
+=============================================================================*/
+int TreeThreadStart(TreeThread* thread, TreeThreadProc proc, void* arg)
+{
+    thread->proc = proc;
+    thread->arg = arg;
+#ifdef _WIN32
+    thread->handle = CreateThread(NULL, 0, ThreadEntry, thread, 0, NULL);
+    return thread->handle != NULL;
+#else
+    pthread_t handle;
+    if(pthread_create(&handle, NULL, ThreadEntry, thread) != 0)
+    {
+        return 0;
+    }
+    thread->handle = (void*)(uintptr_t)handle;
+    return 1;
+#endif
+}
+
+/*=============================================================================
+*   TreeThreadJoin [void]
+*       Waits for a thread started with TreeThreadStart to finish
+=============================================================================*/
+void TreeThreadJoin(TreeThread* thread)
+{
+#ifdef _WIN32
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+#else
+    pthread_join((pthread_t)(uintptr_t)thread->handle, NULL);
+#endif
+}
+
+/*=============================================================================
+*   TreeSleep [void]
+*       Gives up the processor for about `milliseconds`
+=============================================================================*/
+void TreeSleep(unsigned milliseconds)
+{
+#ifdef _WIN32
+    Sleep(milliseconds);
+#else
+    struct timespec delay;
+    delay.tv_sec = milliseconds / 1000;
+    delay.tv_nsec = (long)(milliseconds % 1000) * 1000000L;
+    nanosleep(&delay, NULL);
+#endif
+}
+
+/*=============================================================================
+*   TreeCpuCount [int]
+*       Number of processors available to this process, at least 1
+=============================================================================*/
+int TreeCpuCount(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+/*=============================================================================
+*   TreeSeconds [double]
+*       A monotonic clock for measuring intervals, in seconds
+=============================================================================*/
+double TreeSeconds(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+#endif
+}
+
+/*=============================================================================
+*   TreePeakMemory [size_t]
+*       Largest resident set (working set on Windows) this process has had,
+*       in bytes, or 0 if unknown
+=============================================================================*/
+size_t TreePeakMemory(void)
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return 0;
+    }
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0;
+    }
+#ifdef __APPLE__
+    return (size_t)usage.ru_maxrss;
+#else
+    //Linux reports kilobytes
+    return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
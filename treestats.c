@@ -0,0 +1,156 @@
+/*=============================================================================
+*       treestats.c
+*       Counters for where a session's time and memory go: how often each
+*       phase of opening, saving and showing a document ran and how long it
+*       took, how much the model holds, and how many calls went to the
+*       view. Phases are coarse, one timer read at each end, so keeping the
+*       counters costs next to nothing; built with TREE_STATS 0 they are
+*       not kept at all.
+=============================================================================*/
+#include <string.h>
+
+#include "tree.h"
+
+//Names of the TREE_PHASE_* in a dump
+static const char* const phaseNames[TREE_PHASE_COUNT] =
+{
+    "load", "replay", "view", "edit_fields", "snapshot", "serialize", "journal", "teardown"
+};
+
+/*=============================================================================
+*   TreeStatsInit [void]
+*       Zeroes every counter
+=============================================================================*/
+void TreeStatsInit(TreeStats* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+/*=============================================================================
+*   TreeStatsStart [double]
+*       The time a phase starts at, for TreeStatsStop
+*
+*       Returns 0 if counters are not kept
+=============================================================================*/
+double TreeStatsStart(void)
+{
+#if TREE_STATS
+    return TreeSeconds();
+#else
+    return 0;
+#endif
+}
+
+/*=============================================================================
+*   TreeStatsStop [void]
+*       Counts a run of a phase that began at `start`
+*
+*       Parameters:
+*           TreeStats* stats - The counters
+*           int phase - TREE_PHASE_*
+*           double start - What TreeStatsStart returned
+*
+=============================================================================*/
+void TreeStatsStop(TreeStats* stats, int phase, double start)
+{
+#if TREE_STATS
+    TreeStatsAdd(stats, phase, TreeSeconds() - start);
+#else
+    (void)stats;
+    (void)phase;
+    (void)start;
+#endif
+}
+
+/*=============================================================================
+*   TreeStatsAdd [void]
+*       Counts a run of a phase timed elsewhere, e.g. on another thread
+=============================================================================*/
+void TreeStatsAdd(TreeStats* stats, int phase, double seconds)
+{
+#if TREE_STATS
+    TreePhaseStats* entry = &stats->phases[phase];
+    entry->runs++;
+    entry->seconds += seconds;
+    entry->last = seconds;
+    if(seconds > entry->longest)
+    {
+        entry->longest = seconds;
+    }
+#else
+    (void)stats;
+    (void)phase;
+    (void)seconds;
+#endif
+}
+
+/*=============================================================================
+*   TreeStatsPhaseName [const char*]
+*       The name of a TREE_PHASE_* as it appears in a dump
+=============================================================================*/
+const char* TreeStatsPhaseName(int phase)
+{
+    return phase >= 0 && phase < TREE_PHASE_COUNT ? phaseNames[phase] : "";
+}
+
+/*=============================================================================
+*   TreeModelMemory [size_t]
+*       Bytes a model allocated for its nodes: the link arrays and the
+*       string handles, for every id it has room for
+*
+*       Parameters:
+*           const TreeModel* tree - The model
+*           size_t* strings - Receives the bytes allocated for strings,
+*                             the intern table included; a mapped file the
+*                             strings point into is not counted
+*
+*       Returns the bytes for the nodes
+=============================================================================*/
+size_t TreeModelMemory(const TreeModel* tree, size_t* strings)
+{
+    *strings = tree->strings.arena.allocated;
+    if(tree->strings.slots)
+    {
+        *strings += ((size_t)tree->strings.slotMask + 1) * sizeof(TreeStr);
+    }
+    return (size_t)tree->capacity * (5 * sizeof(TreeNodeId) + sizeof(TreeNodeData));
+}
+
+/*=============================================================================
+*   TreeStatsWrite [int]
+*       Writes the counters as one JSON object on one line, with the
+*       model's size and the process's peak memory as of now
+*
+*       Parameters:
+*           const TreeStats* stats - The counters
+*           const TreeModel* tree - The model they are about, may be NULL
+*           FILE* file - Where to write
+*
+*       Returns 0 on a write error
+=============================================================================*/
+int TreeStatsWrite(const TreeStats* stats, const TreeModel* tree, FILE* file)
+{
+    fprintf(file, "{");
+    if(tree)
+    {
+        size_t strings;
+        size_t nodes = TreeModelMemory(tree, &strings);
+        fprintf(file, "\"nodes\":%ld,\"node_bytes\":%llu,\"string_bytes\":%llu,\"mapped_bytes\":%llu,",
+                (long)tree->count, (unsigned long long)nodes, (unsigned long long)strings,
+                (unsigned long long)tree->mapping.size);
+    }
+    fprintf(file, "\"index_bytes\":%llu,\"peak_rss_bytes\":%llu,\"bytes_read\":%llu,\"bytes_written\":%llu,"
+            "\"view_calls\":%llu,\"phases\":{",
+            (unsigned long long)stats->indexBytes, (unsigned long long)TreePeakMemory(),
+            (unsigned long long)stats->bytesRead, (unsigned long long)stats->bytesWritten,
+            (unsigned long long)stats->viewCalls);
+    for(int phase = 0; phase < TREE_PHASE_COUNT; phase++)
+    {
+        const TreePhaseStats* entry = &stats->phases[phase];
+        fprintf(file, "%s\"%s\":{\"runs\":%llu,\"seconds\":%.6f,\"last\":%.6f,\"longest\":%.6f}",
+                phase ? "," : "", phaseNames[phase], (unsigned long long)entry->runs,
+                entry->seconds, entry->last, entry->longest);
+    }
+    fprintf(file, "}}\n");
+    return !ferror(file);
+}
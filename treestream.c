@@ -0,0 +1,710 @@
+/*=============================================================================
+*       treestream.c
+*       Reading and writing files of any format one node at a time, without
+*       building a model, so that memory stays bounded however large the
+*       file is. Text is parsed as it is read; binary and compressed files
+*       are mapped and walked along their links, which lets a reader skip a
+*       whole subtree without touching it.
+=============================================================================*/
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree.h"
+
+//Records TreeStreamWriter keeps before writing them out; links to older
+//records are patched in the file
+#define STREAM_WINDOW 65536
+
+//Bytes moved at a time when copying between files
+#define STREAM_COPY (1024 * 1024)
+
+//A run of tabs that indents are copied from
+static const char tabRun[64] =
+    "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t"
+    "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
+
+/*=============================================================================
+*   Scratch [char*]
+*       Grows a scratch buffer to hold at least `size` bytes
+*
+*       Returns the buffer, NULL if out of memory
+=============================================================================*/
+static char* Scratch(char** buffer, size_t* capacity, size_t size)
+{
+    if(size > *capacity)
+    {
+        size_t grown = *capacity ? *capacity : 4096;
+        while(grown < size)
+        {
+            grown *= 2;
+        }
+        char* bigger = (char*)realloc(*buffer, grown);
+        if(!bigger)
+        {
+            return NULL;
+        }
+        *buffer = bigger;
+        *capacity = grown;
+    }
+    return *buffer;
+}
+
+/*=============================================================================
+*   TreeStreamFormat [int]
+*       Tells the formats apart by their magic numbers and rewinds the
+*       stream; only call it on a stream that can seek, see TreeStreamIsFile
+*
+*       Returns a TREE_FORMAT_*; anything else is taken for text.
+*       TREE_FORMAT_ERROR if the stream could not be rewound.
+=============================================================================*/
+int TreeStreamFormat(FILE* file)
+{
+    int compressed = TreeIsCompressedStream(file);
+    if(compressed)
+    {
+        return compressed < 0 ? TREE_FORMAT_ERROR : TREE_FORMAT_COMPRESSED;
+    }
+    int binary = TreeIsBinaryStream(file);
+    return binary < 0 ? TREE_FORMAT_ERROR : binary ? TREE_FORMAT_BINARY : TREE_FORMAT_TEXT;
+}
+
+/*=============================================================================
+*   Scanning text
+=============================================================================*/
+
+typedef struct _TextScan
+{
+    TreeScanEvent onNode;
+    void* context;
+    const TreeParser* parser;
+    int skipBelow;          //nodes deeper than this are not reported, -1 for none
+    int stopped;
+    char* scratch;
+    size_t scratchCapacity;
+} TextScan;
+
+/*=============================================================================
+*   DecodeString [TreeStr]
+*       Turns a string as found in a .dat file into UTF-8 text at `out`,
+*       which holds three bytes for every byte of it. A file without a
+*       byte order mark has no escapes in names and only "\n" in
+*       descriptions.
+=============================================================================*/
+static TreeStr DecodeString(char* out, TreeStr text, int legacy, int isName)
+{
+    if(legacy && !TreeUtf8Valid(text.ptr, text.len))
+    {
+        text.len = (uint32_t)TreeLegacyToUtf8(out, text.ptr, text.len);
+        text.ptr = out;
+    }
+    if((!legacy || !isName) && memchr(text.ptr, '\\', text.len))
+    {
+        text.len = (uint32_t)(legacy ? TreeUnescapeLegacy(out, text.ptr, text.len) : TreeUnescape(out, text.ptr, text.len));
+        text.ptr = out;
+    }
+    return text;
+}
+
+/*=============================================================================
+*   ScanTextNode [int]
+*       TreeNodeEvent that decodes a node and reports it, unless it is
+*       inside a subtree being skipped
+=============================================================================*/
+static int ScanTextNode(void* context, int depth, TreeStr name, TreeStr description)
+{
+    TextScan* scan = (TextScan*)context;
+    if(scan->skipBelow >= 0)
+    {
+        if(depth > scan->skipBelow)
+        {
+            return 1;
+        }
+        scan->skipBelow = -1;
+    }
+
+    size_t nameRoom = (size_t)name.len * 3;
+    char* scratch = Scratch(&scan->scratch, &scan->scratchCapacity, nameRoom + (size_t)description.len * 3 + 1);
+    if(!scratch)
+    {
+        return 0;
+    }
+    int legacy = !scan->parser->utf8;
+    name = DecodeString(scratch, name, legacy, 1);
+    description = DecodeString(scratch + nameRoom, description, legacy, 0);
+
+    int next = scan->onNode(scan->context, depth, name, description);
+    if(next == TREE_SCAN_STOP)
+    {
+        scan->stopped = 1;
+        return 0;
+    }
+    if(next == TREE_SCAN_SKIP)
+    {
+        scan->skipBelow = depth;
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   ScanText [int]
+*       Parses a .dat stream a block at a time
+=============================================================================*/
+static int ScanText(FILE* file, TreeScanEvent onNode, void* context)
+{
+    TreeParser parser;
+    TextScan scan = {onNode, context, &parser, -1, 0, NULL, 0};
+    TreeParserInit(&parser, ScanTextNode, &scan);
+    TreeParseStream(&parser, file);
+    free(scan.scratch);
+    if(scan.stopped)
+    {
+        return TREE_PARSE_OK;
+    }
+    return parser.error == TREE_PARSE_ABORTED ? TREE_PARSE_NO_MEMORY : parser.error;
+}
+
+/*=============================================================================
+*   Scanning binary and compressed files
+=============================================================================*/
+
+/*
+*   Records and strings of a .dtb image, read in place or out of a .dtz
+*   file a block at a time
+*/
+typedef struct _RecordSource
+{
+    const TreeBinView* binary;
+    TreeZipView* compressed;
+    const TreeBinHeader* header;
+    int legacy;
+    char* scratch;
+    size_t scratchCapacity;
+} RecordSource;
+
+/*=============================================================================
+*   SourceRecord [int]
+*       Reads a record and checks it
+=============================================================================*/
+static int SourceRecord(RecordSource* source, TreeNodeId node, TreeBinNode* record)
+{
+    return source->binary ? TreeBinNodeAt(source->binary, node, record) : TreeZipNodeAt(source->compressed, node, record);
+}
+
+/*=============================================================================
+*   SourceStrings [int]
+*       Finds the name and description of a record. Compressed strings are
+*       decoded into scratch space, and so are the legacy strings of a
+*       version 1 image that are not UTF-8.
+=============================================================================*/
+static int SourceStrings(RecordSource* source, const TreeBinNode* record, TreeStr* name, TreeStr* description)
+{
+    size_t raw = (size_t)record->nameLength + record->descriptionLength;
+    char* scratch = Scratch(&source->scratch, &source->scratchCapacity, raw * 4 + 1);
+    if(!scratch)
+    {
+        return 0;
+    }
+
+    if(source->binary)
+    {
+        const char* heap = source->binary->data + source->header->heapOffset;
+        name->ptr = heap + record->nameOffset;
+        description->ptr = heap + record->descriptionOffset;
+    }
+    else
+    {
+        uint64_t heap = source->header->heapOffset;
+        if(!TreeZipRead(source->compressed, heap + record->nameOffset, scratch, record->nameLength) ||
+           !TreeZipRead(source->compressed, heap + record->descriptionOffset, scratch + record->nameLength, record->descriptionLength))
+        {
+            return 0;
+        }
+        name->ptr = scratch;
+        description->ptr = scratch + record->nameLength;
+    }
+    name->len = record->nameLength;
+    description->len = record->descriptionLength;
+
+    //Converted text goes after the raw strings
+    if(source->legacy)
+    {
+        char* out = scratch + raw;
+        if(!TreeUtf8Valid(name->ptr, name->len))
+        {
+            name->len = (uint32_t)TreeLegacyToUtf8(out, name->ptr, name->len);
+            name->ptr = out;
+            out += name->len;
+        }
+        if(!TreeUtf8Valid(description->ptr, description->len))
+        {
+            description->len = (uint32_t)TreeLegacyToUtf8(out, description->ptr, description->len);
+            description->ptr = out;
+        }
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   ScanRecords [int]
+*       Walks the records in preorder along their links. The stack holds
+*       the next sibling of every open node, so climbing back up needs no
+*       parent links. Records must be in preorder, as TreeSaveBinary writes
+*       them: every node reported comes after the one before, which also
+*       keeps a damaged file from sending the walk round in circles.
+=============================================================================*/
+static int ScanRecords(RecordSource* source, TreeScanEvent onNode, void* context)
+{
+    TreeBinNode record;
+    if(!SourceRecord(source, TREE_ROOT, &record))
+    {
+        return TREE_PARSE_MALFORMED;
+    }
+
+    TreeNodeId* stack = NULL;
+    int depth = 0;
+    int capacity = 0;
+    int error = TREE_PARSE_OK;
+    TreeNodeId previous = TREE_ROOT;
+    TreeNodeId node = record.firstChild;
+    while(node != TREE_NIL)
+    {
+        TreeStr name, description;
+        if(node <= previous || !SourceRecord(source, node, &record))
+        {
+            error = TREE_PARSE_MALFORMED;
+            break;
+        }
+        if(!SourceStrings(source, &record, &name, &description))
+        {
+            error = source->binary ? TREE_PARSE_NO_MEMORY : TREE_PARSE_MALFORMED;
+            break;
+        }
+        previous = node;
+
+        int next = onNode(context, depth, name, description);
+        if(next == TREE_SCAN_STOP)
+        {
+            break;
+        }
+        if(next == TREE_SCAN_NEXT && record.firstChild != TREE_NIL)
+        {
+            if(depth == capacity)
+            {
+                capacity = capacity ? capacity * 2 : 64;
+                TreeNodeId* grown = (TreeNodeId*)realloc(stack, capacity * sizeof(TreeNodeId));
+                if(!grown)
+                {
+                    error = TREE_PARSE_NO_MEMORY;
+                    break;
+                }
+                stack = grown;
+            }
+            stack[depth++] = record.nextSibling;
+            node = record.firstChild;
+            continue;
+        }
+
+        node = record.nextSibling;
+        while(node == TREE_NIL && depth > 0)
+        {
+            node = stack[--depth];
+        }
+    }
+    free(stack);
+    free(source->scratch);
+    return error;
+}
+
+/*=============================================================================
+*   TreeScanStream [int]
+*       Reports every node of a file in preorder without loading it. Text
+*       is read a block at a time. Binary and compressed files are mapped
+*       and followed along their links, so a skipped subtree costs nothing,
+*       and a compressed file only decodes the blocks it reaches.
+*
+*       Parameters:
+*           FILE* file - Stream opened for binary reading; only text may
+*                        come from a pipe
+*           int format - TREE_FORMAT_* of the stream, see TreeStreamFormat
+*           TreeScanEvent onNode - Called for every node not skipped
+*           void* context - Passed to onNode
+*
+*       Returns TREE_PARSE_OK if the scan reached the end or onNode stopped
+*       it, otherwise why the file could not be read
+=============================================================================*/
+int TreeScanStream(FILE* file, int format, TreeScanEvent onNode, void* context)
+{
+    if(format == TREE_FORMAT_TEXT)
+    {
+        return ScanText(file, onNode, context);
+    }
+
+    TreeMapping mapping;
+    if(!TreeMapStream(file, &mapping))
+    {
+        return TREE_PARSE_IO;
+    }
+
+    int error = TREE_PARSE_MALFORMED;
+    RecordSource source;
+    memset(&source, 0, sizeof(source));
+    TreeBinView binary;
+    TreeZipView compressed;
+    if(format == TREE_FORMAT_BINARY && TreeBinOpen(&binary, mapping.data, mapping.size))
+    {
+        source.binary = &binary;
+        source.header = &binary.header;
+        source.legacy = binary.header.version == TREE_BIN_VERSION_LEGACY;
+        error = ScanRecords(&source, onNode, context);
+    }
+    else if(format == TREE_FORMAT_COMPRESSED && TreeZipOpen(&compressed, mapping.data, mapping.size))
+    {
+        source.compressed = &compressed;
+        source.header = &compressed.image;
+        source.legacy = compressed.image.version == TREE_BIN_VERSION_LEGACY;
+        error = ScanRecords(&source, onNode, context);
+        TreeZipClose(&compressed);
+    }
+    TreeUnmap(&mapping);
+    return error;
+}
+
+/*=============================================================================
+*   Writing
+=============================================================================*/
+
+/*=============================================================================
+*   Put [void]
+*       Writes bytes to the writer's file, remembering a failure
+=============================================================================*/
+static void Put(TreeStreamWriter* writer, FILE* file, const void* bytes, size_t size)
+{
+    if(size && fwrite(bytes, 1, size, file) != size)
+    {
+        writer->failed = 1;
+    }
+}
+
+/*=============================================================================
+*   PutIndent [void]
+=============================================================================*/
+static void PutIndent(TreeStreamWriter* writer, int level)
+{
+    while(level > 0)
+    {
+        int run = level < (int)sizeof(tabRun) ? level : (int)sizeof(tabRun);
+        Put(writer, writer->file, tabRun, run);
+        level -= run;
+    }
+}
+
+/*=============================================================================
+*   PutEscaped [void]
+=============================================================================*/
+static void PutEscaped(TreeStreamWriter* writer, TreeStr text)
+{
+    char* escaped = Scratch(&writer->text, &writer->textCapacity, (size_t)text.len * 2 + 1);
+    if(!escaped)
+    {
+        writer->failed = 1;
+        return;
+    }
+    Put(writer, writer->file, escaped, TreeEscape(escaped, text.ptr, text.len));
+}
+
+/*=============================================================================
+*   CopyFile [void]
+*       Appends the rest of `from` to `to`
+=============================================================================*/
+static void CopyFile(TreeStreamWriter* writer, FILE* from, FILE* to)
+{
+    char* buffer = (char*)malloc(STREAM_COPY);
+    if(!buffer)
+    {
+        writer->failed = 1;
+        return;
+    }
+    size_t read;
+    while((read = fread(buffer, 1, STREAM_COPY, from)) > 0)
+    {
+        Put(writer, to, buffer, read);
+    }
+    if(ferror(from))
+    {
+        writer->failed = 1;
+    }
+    free(buffer);
+}
+
+/*=============================================================================
+*   FlushWindow [void]
+*       Writes out the records kept in memory
+=============================================================================*/
+static void FlushWindow(TreeStreamWriter* writer)
+{
+    Put(writer, writer->file, writer->window, (size_t)writer->windowCount * sizeof(TreeBinNode));
+    writer->windowStart += writer->windowCount;
+    writer->windowCount = 0;
+}
+
+/*=============================================================================
+*   PatchLink [void]
+*       Sets a link of a record written before, in memory if it is still
+*       in the window and in the file otherwise
+*
+*       Parameters:
+*           TreeStreamWriter* writer - The writer
+*           TreeNodeId node - The record to change
+*           size_t field - offsetof the link in TreeBinNode
+*           TreeNodeId value - What it links to
+*
+=============================================================================*/
+static void PatchLink(TreeStreamWriter* writer, TreeNodeId node, size_t field, TreeNodeId value)
+{
+    if(node >= writer->windowStart)
+    {
+        memcpy((char*)&writer->window[node - writer->windowStart] + field, &value, sizeof(value));
+        return;
+    }
+    //Records before the window are all in the file, which ends with them
+    uint64_t end = sizeof(TreeBinHeader) + (uint64_t)writer->windowStart * sizeof(TreeBinNode);
+    if(!TreeStreamSeek(writer->file, sizeof(TreeBinHeader) + (uint64_t)node * sizeof(TreeBinNode) + field) ||
+       fwrite(&value, sizeof(value), 1, writer->file) != 1 ||
+       !TreeStreamSeek(writer->file, end))
+    {
+        writer->failed = 1;
+    }
+}
+
+/*=============================================================================
+*   AddRecord [void]
+*       Appends the record of a node at `level`, TREE_ROOT's being level 0,
+*       and links it to its parent or previous sibling
+=============================================================================*/
+static void AddRecord(TreeStreamWriter* writer, int level, TreeStr name, TreeStr description)
+{
+    TreeNodeId node = writer->count++;
+    if(writer->windowCount == STREAM_WINDOW)
+    {
+        FlushWindow(writer);
+    }
+
+    TreeBinNode* record = &writer->window[writer->windowCount++];
+    memset(record, 0, sizeof(*record));
+    record->parent = level ? writer->last[level - 1] : TREE_NIL;
+    record->firstChild = TREE_NIL;
+    record->nextSibling = TREE_NIL;
+    record->nameOffset = writer->heapSize;
+    record->nameLength = name.len;
+    record->descriptionOffset = writer->heapSize + name.len;
+    record->descriptionLength = description.len;
+    writer->heapSize += (uint64_t)name.len + description.len;
+    Put(writer, writer->heap, name.ptr, name.len);
+    Put(writer, writer->heap, description.ptr, description.len);
+
+    //A level below the open ones holds no node yet under this parent
+    if(level)
+    {
+        if(level < writer->levels)
+        {
+            PatchLink(writer, writer->last[level], offsetof(TreeBinNode, nextSibling), node);
+        }
+        else
+        {
+            PatchLink(writer, record->parent, offsetof(TreeBinNode, firstChild), node);
+        }
+    }
+    writer->last[level] = node;
+    writer->levels = level + 1;
+}
+
+/*=============================================================================
+*   TreeStreamWriterOpen [int]
+*       Starts writing a file of any format
+*
+*       Parameters:
+*           TreeStreamWriter* writer - The writer to set up
+*           FILE* out - Stream opened for binary writing, at its start
+*           int format - TREE_FORMAT_* to write
+*           int threads - Blocks compressed at once, 0 for one per processor
+*
+*       Returns nonzero on success
+=============================================================================*/
+int TreeStreamWriterOpen(TreeStreamWriter* writer, FILE* out, int format, int threads)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->format = format;
+    writer->threads = threads;
+    writer->out = out;
+    writer->file = out;
+    writer->levels = 1;
+    if(format == TREE_FORMAT_TEXT)
+    {
+        Put(writer, out, TREE_UTF8_BOM, TREE_UTF8_BOM_LENGTH);
+        return !writer->failed;
+    }
+
+    //Compressed output is the binary image compressed at the end; binary
+    //output is patched in place if the stream allows it
+    if(format == TREE_FORMAT_COMPRESSED || fseek(out, 0, SEEK_CUR) != 0)
+    {
+        writer->file = tmpfile();
+    }
+    writer->heap = tmpfile();
+    writer->window = (TreeBinNode*)malloc(STREAM_WINDOW * sizeof(TreeBinNode));
+    writer->levelCapacity = 64;
+    writer->last = (TreeNodeId*)malloc(writer->levelCapacity * sizeof(TreeNodeId));
+    if(!writer->file || !writer->heap || !writer->window || !writer->last)
+    {
+        writer->failed = 1;
+        TreeStreamWriterClose(writer);
+        return 0;
+    }
+
+    //The header is written again once the counts are known
+    TreeBinHeader header;
+    memset(&header, 0, sizeof(header));
+    Put(writer, writer->file, &header, sizeof(header));
+    TreeStr empty = {"", 0};
+    AddRecord(writer, 0, empty, empty);
+    return !writer->failed;
+}
+
+/*=============================================================================
+*   TreeStreamWriterNode [int]
+*       Writes the next node in preorder
+*
+*       Parameters:
+*           TreeStreamWriter* writer - An open writer
+*           int depth - 0 for a top level node, at most one more than the
+*                       node before
+*           TreeStr name - UTF-8 text
+*           TreeStr description - UTF-8 text
+*
+*       Returns nonzero on success
+=============================================================================*/
+int TreeStreamWriterNode(TreeStreamWriter* writer, int depth, TreeStr name, TreeStr description)
+{
+    int level = depth + 1;
+    if(writer->failed || depth < 0 || level > writer->levels)
+    {
+        writer->failed = 1;
+        return 0;
+    }
+
+    if(writer->format == TREE_FORMAT_TEXT)
+    {
+        //Close the nodes this one is not inside of
+        while(writer->levels > level)
+        {
+            writer->levels--;
+            PutIndent(writer, writer->levels - 1);
+            Put(writer, writer->file, "}\n", 2);
+        }
+        PutIndent(writer, depth);
+        PutEscaped(writer, name);
+        Put(writer, writer->file, "\n", 1);
+        PutIndent(writer, depth);
+        Put(writer, writer->file, "{\n", 2);
+        PutIndent(writer, depth + 1);
+        PutEscaped(writer, description);
+        Put(writer, writer->file, "\n", 1);
+        writer->levels = level + 1;
+        return !writer->failed;
+    }
+
+    if(writer->count == INT32_MAX)
+    {
+        writer->failed = 1;
+        return 0;
+    }
+    if(level >= writer->levelCapacity)
+    {
+        int capacity = writer->levelCapacity * 2;
+        TreeNodeId* last = (TreeNodeId*)realloc(writer->last, capacity * sizeof(TreeNodeId));
+        if(!last)
+        {
+            writer->failed = 1;
+            return 0;
+        }
+        writer->last = last;
+        writer->levelCapacity = capacity;
+    }
+    AddRecord(writer, level, name, description);
+    return !writer->failed;
+}
+
+/*=============================================================================
+*   TreeStreamWriterClose [int]
+*       Finishes the file and frees the writer. Binary output gets its
+*       strings appended and its header filled in; compressed output is
+*       compressed from the binary image.
+*
+*       Returns nonzero if the whole file was written
+=============================================================================*/
+int TreeStreamWriterClose(TreeStreamWriter* writer)
+{
+    if(writer->format == TREE_FORMAT_TEXT)
+    {
+        while(writer->levels > 1)
+        {
+            writer->levels--;
+            PutIndent(writer, writer->levels - 1);
+            Put(writer, writer->file, "}\n", 2);
+        }
+    }
+    else if(!writer->failed)
+    {
+        FlushWindow(writer);
+        rewind(writer->heap);
+        CopyFile(writer, writer->heap, writer->file);
+
+        TreeBinHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TREE_BIN_MAGIC, sizeof(header.magic));
+        header.version = TREE_BIN_VERSION;
+        header.recordSize = sizeof(TreeBinNode);
+        header.nodeCount = (uint32_t)writer->count;
+        header.recordOffset = sizeof(TreeBinHeader);
+        header.heapOffset = header.recordOffset + (uint64_t)writer->count * sizeof(TreeBinNode);
+        header.heapSize = writer->heapSize;
+        if(!TreeStreamSeek(writer->file, 0))
+        {
+            writer->failed = 1;
+        }
+        Put(writer, writer->file, &header, sizeof(header));
+
+        if(writer->file != writer->out && !writer->failed)
+        {
+            rewind(writer->file);
+            if(writer->format == TREE_FORMAT_COMPRESSED)
+            {
+                writer->failed = !TreeCompressStream(writer->file, writer->out, writer->threads);
+            }
+            else
+            {
+                CopyFile(writer, writer->file, writer->out);
+            }
+        }
+    }
+
+    if(fflush(writer->out) != 0)
+    {
+        writer->failed = 1;
+    }
+    if(writer->file && writer->file != writer->out)
+    {
+        fclose(writer->file);
+    }
+    if(writer->heap)
+    {
+        fclose(writer->heap);
+    }
+    free(writer->window);
+    free(writer->last);
+    free(writer->text);
+    int written = !writer->failed;
+    memset(writer, 0, sizeof(*writer));
+    return written;
+}
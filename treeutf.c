@@ -0,0 +1,316 @@
+/*=============================================================================
+*       treeutf.c
+*       UTF-8 validation and UTF-8 <-> UTF-16 transcoding. The model keeps
+*       UTF-8; the Win32 controls speak UTF-16. Runs of ASCII, which is most
+*       of a typical tree, are converted a vector at a time.
+=============================================================================*/
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include <stdlib.h>
+
+#include "tree.h"
+
+#if !defined(TREE_NO_SIMD) && defined(__SSE2__)
+#define UTF_SSE2 1
+#include <emmintrin.h>
+#endif
+
+//Written for anything that is not valid UTF-8 or UTF-16
+#define UTF_REPLACEMENT 0xFFFD
+
+//What the bytes 0x80-0x9F mean in Windows-1252; the rest is Latin-1
+static const uint16_t cp1252High[32] =
+{
+    0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+    0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+    0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+    0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178
+};
+
+/*=============================================================================
+*   DecodeUtf8 [size_t]
+*       Decodes the sequence starting at `in`, rejecting overlong forms,
+*       surrogates and code points above U+10FFFF
+*
+*       Returns the sequence length, or 0 if it is invalid
+=============================================================================*/
+static size_t DecodeUtf8(const unsigned char* in, size_t length, uint32_t* code)
+{
+    unsigned char lead = in[0];
+    size_t size;
+    uint32_t value;
+    uint32_t least;
+    if(lead < 0x80)
+    {
+        *code = lead;
+        return 1;
+    }
+    else if(lead >= 0xC2 && lead <= 0xDF)
+    {
+        size = 2;
+        value = lead & 0x1F;
+        least = 0x80;
+    }
+    else if((lead & 0xF0) == 0xE0)
+    {
+        size = 3;
+        value = lead & 0x0F;
+        least = 0x800;
+    }
+    else if(lead >= 0xF0 && lead <= 0xF4)
+    {
+        size = 4;
+        value = lead & 0x07;
+        least = 0x10000;
+    }
+    else
+    {
+        return 0;
+    }
+
+    if(size > length)
+    {
+        return 0;
+    }
+    for(size_t i = 1; i < size; i++)
+    {
+        if((in[i] & 0xC0) != 0x80)
+        {
+            return 0;
+        }
+        value = (value << 6) | (in[i] & 0x3F);
+    }
+    if(value < least || value > 0x10FFFF || (value >= 0xD800 && value <= 0xDFFF))
+    {
+        return 0;
+    }
+    *code = value;
+    return size;
+}
+
+/*=============================================================================
+*   EncodeUtf8 [size_t]
+*       Writes one code point, returns the number of bytes
+=============================================================================*/
+static size_t EncodeUtf8(char* out, uint32_t code)
+{
+    if(code < 0x80)
+    {
+        out[0] = (char)code;
+        return 1;
+    }
+    if(code < 0x800)
+    {
+        out[0] = (char)(0xC0 | (code >> 6));
+        out[1] = (char)(0x80 | (code & 0x3F));
+        return 2;
+    }
+    if(code < 0x10000)
+    {
+        out[0] = (char)(0xE0 | (code >> 12));
+        out[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (code & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (code >> 18));
+    out[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (code & 0x3F));
+    return 4;
+}
+
+/*=============================================================================
+*   TreeUtf8Valid [int]
+*       Checks that `length` bytes are well-formed UTF-8
+=============================================================================*/
+int TreeUtf8Valid(const char* in, size_t length)
+{
+    const unsigned char* text = (const unsigned char*)in;
+    size_t i = 0;
+    while(i < length)
+    {
+#ifdef UTF_SSE2
+        //Skip ASCII a block at a time
+        while(i + 16 <= length)
+        {
+            unsigned mask = (unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(text + i)));
+            if(mask)
+            {
+                i += (unsigned)__builtin_ctz(mask);
+                break;
+            }
+            i += 16;
+        }
+        if(i >= length)
+        {
+            break;
+        }
+#endif
+        uint32_t code;
+        size_t size = DecodeUtf8(text + i, length - i, &code);
+        if(!size)
+        {
+            return 0;
+        }
+        i += size;
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   TreeUtf8ToUtf16 [size_t]
+*       Transcodes UTF-8 to UTF-16. Invalid bytes become U+FFFD each.
+*
+*       Parameters:
+*           uint16_t* out - Destination, at least `length` units
+*           const char* in - UTF-8 text
+*           size_t length - Number of bytes in `in`
+*
+*       Returns the number of units written
+=============================================================================*/
+size_t TreeUtf8ToUtf16(uint16_t* out, const char* in, size_t length)
+{
+    const unsigned char* text = (const unsigned char*)in;
+    size_t i = 0;
+    size_t j = 0;
+    while(i < length)
+    {
+#ifdef UTF_SSE2
+        //Widen ASCII 16 bytes at a time. A block with other bytes is
+        //still stored whole (j <= i, so it fits) and kept up to them.
+        const __m128i zero = _mm_setzero_si128();
+        while(i + 16 <= length)
+        {
+            __m128i block = _mm_loadu_si128((const __m128i*)(text + i));
+            _mm_storeu_si128((__m128i*)(out + j), _mm_unpacklo_epi8(block, zero));
+            _mm_storeu_si128((__m128i*)(out + j + 8), _mm_unpackhi_epi8(block, zero));
+            unsigned mask = (unsigned)_mm_movemask_epi8(block);
+            if(mask)
+            {
+                unsigned ascii = (unsigned)__builtin_ctz(mask);
+                i += ascii;
+                j += ascii;
+                break;
+            }
+            i += 16;
+            j += 16;
+        }
+        if(i >= length)
+        {
+            break;
+        }
+#endif
+        uint32_t code;
+        size_t size = DecodeUtf8(text + i, length - i, &code);
+        if(!size)
+        {
+            code = UTF_REPLACEMENT;
+            size = 1;
+        }
+        if(code >= 0x10000)
+        {
+            //Four bytes in, two units out
+            code -= 0x10000;
+            out[j++] = (uint16_t)(0xD800 | (code >> 10));
+            out[j++] = (uint16_t)(0xDC00 | (code & 0x3FF));
+        }
+        else
+        {
+            out[j++] = (uint16_t)code;
+        }
+        i += size;
+    }
+    return j;
+}
+
+/*=============================================================================
+*   TreeUtf16ToUtf8 [size_t]
+*       Transcodes UTF-16 to UTF-8. Unpaired surrogates become U+FFFD.
+*
+*       Parameters:
+*           char* out - Destination, at least 3 * `length` bytes
+*           const uint16_t* in - UTF-16 text
+*           size_t length - Number of units in `in`
+*
+*       Returns the number of bytes written
+=============================================================================*/
+size_t TreeUtf16ToUtf8(char* out, const uint16_t* in, size_t length)
+{
+    size_t i = 0;
+    size_t j = 0;
+    while(i < length)
+    {
+#ifdef UTF_SSE2
+        //Narrow ASCII 8 units at a time, the same way as above
+        const __m128i high = _mm_set1_epi16((short)0xFF80);
+        const __m128i zero = _mm_setzero_si128();
+        while(i + 8 <= length)
+        {
+            __m128i block = _mm_loadu_si128((const __m128i*)(in + i));
+            _mm_storel_epi64((__m128i*)(out + j), _mm_packus_epi16(block, block));
+            unsigned ascii = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(block, high), zero));
+            if(ascii != 0xFFFF)
+            {
+                unsigned count = (unsigned)__builtin_ctz(~ascii) / 2;
+                i += count;
+                j += count;
+                break;
+            }
+            i += 8;
+            j += 8;
+        }
+        if(i >= length)
+        {
+            break;
+        }
+#endif
+        uint32_t code = in[i++];
+        if(code >= 0xD800 && code <= 0xDBFF && i < length && in[i] >= 0xDC00 && in[i] <= 0xDFFF)
+        {
+            code = 0x10000 + ((code - 0xD800) << 10) + (in[i++] - 0xDC00);
+        }
+        else if(code >= 0xD800 && code <= 0xDFFF)
+        {
+            code = UTF_REPLACEMENT;
+        }
+        j += EncodeUtf8(out + j, code);
+    }
+    return j;
+}
+
+/*=============================================================================
+*   TreeLegacyToUtf8 [size_t]
+*       Converts text from a file saved before the format was UTF-8. Such
+*       files hold the ANSI code page of the machine that wrote them; on
+*       Windows that is taken to be this machine's, elsewhere Windows-1252.
+*
+*       Parameters:
+*           char* out - Destination, at least 3 * `length` bytes
+*           const char* in - Legacy text
+*           size_t length - Number of bytes in `in`
+*
+*       Returns the number of bytes written
+=============================================================================*/
+size_t TreeLegacyToUtf8(char* out, const char* in, size_t length)
+{
+#ifdef _WIN32
+    //Every byte decodes to at most one unit, and a unit to at most 3 bytes
+    uint16_t* wide = length && length <= INT32_MAX ? (uint16_t*)malloc(length * sizeof(uint16_t)) : NULL;
+    int units = wide ? MultiByteToWideChar(CP_ACP, 0, in, (int)length, (wchar_t*)wide, (int)length) : 0;
+    if(units > 0)
+    {
+        size_t written = TreeUtf16ToUtf8(out, wide, (size_t)units);
+        free(wide);
+        return written;
+    }
+    free(wide);
+#endif
+    size_t j = 0;
+    for(size_t i = 0; i < length; i++)
+    {
+        unsigned char byte = (unsigned char)in[i];
+        j += EncodeUtf8(out + j, byte >= 0x80 && byte < 0xA0 ? cp1252High[byte - 0x80] : byte);
+    }
+    return j;
+}
@@ -0,0 +1,1055 @@
+/*=============================================================================
+*       treezip.c
+*       The compressed .dtz format: a .dtb image cut into fixed-size blocks
+*       that are compressed independently. A block index at the end of the
+*       file lets a reader decode only the blocks it needs, and lets a full
+*       load decode them all on several threads at once.
+=============================================================================*/
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree.h"
+
+/*
+*   Layout, little endian:
+*       TreeZipHeader
+*       compressed blocks, in image order
+*       TreeZipBlock[blockCount]    at trailer.indexOffset
+*       TreeZipTrailer              the last bytes of the file
+*
+*   Blocks are compressed with a small LZ77 codec, a run of sequences
+*   that each hold:
+*       token               literal count in the high nibble, match
+*                           length minus ZIP_MIN_MATCH in the low one
+*       extra bytes         if a nibble is 15, further bytes are added to
+*                           it until one is below 255
+*       literals
+*       offset              2 bytes, how far back the match starts
+*       extra bytes         for the match length
+*   The last sequence ends after its literals and has no match.
+*/
+
+#define ZIP_MIN_MATCH    4
+#define ZIP_LAST_LITERAL 5      //a block always ends in this many literals
+#define ZIP_MATCH_LIMIT  12     //no match starts this close to the end
+#define ZIP_MAX_OFFSET   65535
+#define ZIP_HASH_BITS    14
+
+//Blocks compressed together while saving, on as many threads as allowed
+#define ZIP_BATCH_BLOCKS 64
+
+//Records read at a time by TreeZipLoadSubtree
+#define ZIP_RECORD_CHUNK 1024
+
+/*=============================================================================
+*   Codec
+=============================================================================*/
+
+static inline uint32_t Read32(const uint8_t* bytes)
+{
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static inline uint32_t Hash(uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - ZIP_HASH_BITS);
+}
+
+/*=============================================================================
+*   MatchLength [size_t]
+*       How many bytes at `a` and `b` agree, comparing no further than `end`
+=============================================================================*/
+static size_t MatchLength(const uint8_t* a, const uint8_t* b, const uint8_t* end)
+{
+    const uint8_t* start = b;
+#if defined(__GNUC__)
+    while(end - b >= 8)
+    {
+        uint64_t x, y;
+        memcpy(&x, a, sizeof(x));
+        memcpy(&y, b, sizeof(y));
+        if(x != y)
+        {
+            //The format is little endian, and so is every target
+            return (size_t)(b - start) + ((unsigned)__builtin_ctzll(x ^ y) >> 3);
+        }
+        a += 8;
+        b += 8;
+    }
+#endif
+    while(b < end && *a == *b)
+    {
+        a++;
+        b++;
+    }
+    return (size_t)(b - start);
+}
+
+/*=============================================================================
+*   PutLength [uint8_t*]
+*       Writes the extra bytes of a length whose nibble was 15
+=============================================================================*/
+static uint8_t* PutLength(uint8_t* out, size_t length)
+{
+    while(length >= 255)
+    {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = (uint8_t)length;
+    return out;
+}
+
+/*=============================================================================
+*   PutSequence [uint8_t*]
+*       Writes literals followed by a match, or by nothing if `length` is 0
+*
+*       Returns the end of the sequence, NULL if it would not fit before `limit`
+=============================================================================*/
+static uint8_t* PutSequence(uint8_t* out, uint8_t* limit, const uint8_t* literals, size_t count, size_t offset, size_t length)
+{
+    //Token, both lengths' extra bytes, offset
+    size_t worst = 1 + count + count / 255 + 1 + 2 + length / 255 + 1;
+    if((size_t)(limit - out) < worst)
+    {
+        return NULL;
+    }
+
+    size_t matchNibble = length ? length - ZIP_MIN_MATCH : 0;
+    uint8_t* token = out++;
+    *token = (uint8_t)(((count < 15 ? count : 15) << 4) | (matchNibble < 15 ? matchNibble : 15));
+    if(count >= 15)
+    {
+        out = PutLength(out, count - 15);
+    }
+    memcpy(out, literals, count);
+    out += count;
+
+    if(length)
+    {
+        *out++ = (uint8_t)offset;
+        *out++ = (uint8_t)(offset >> 8);
+        if(matchNibble >= 15)
+        {
+            out = PutLength(out, matchNibble - 15);
+        }
+    }
+    return out;
+}
+
+/*=============================================================================
+*   Compress [size_t]
+*       Compresses one block. Matches are found through a hash of the next
+*       four bytes, and the search skips ahead faster the longer it goes
+*       without one, so incompressible data passes quickly.
+*
+*       Parameters:
+*           uint8_t* out - Receives the compressed block
+*           size_t capacity - Bytes available at out
+*           const uint8_t* in - The block
+*           size_t length - Its size, at most TREE_ZIP_BLOCK
+*
+*       Returns the compressed size, 0 if it would not be smaller than
+*       capacity
+=============================================================================*/
+static size_t Compress(uint8_t* out, size_t capacity, const uint8_t* in, size_t length)
+{
+    //Positions plus one, 0 for none
+    uint32_t table[1 << ZIP_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    uint8_t* cursor = out;
+    uint8_t* limit = out + capacity;
+    const uint8_t* end = in + length;
+    size_t anchor = 0;
+    size_t position = 0;
+    size_t searchEnd = length > ZIP_MATCH_LIMIT ? length - ZIP_MATCH_LIMIT : 0;
+
+    while(position < searchEnd)
+    {
+        uint32_t sequence = Read32(in + position);
+        uint32_t* slot = &table[Hash(sequence)];
+        size_t candidate = *slot;
+        *slot = (uint32_t)position + 1;
+
+        if(candidate && position - (candidate - 1) <= ZIP_MAX_OFFSET && Read32(in + candidate - 1) == sequence)
+        {
+            candidate--;
+            size_t match = ZIP_MIN_MATCH + MatchLength(in + candidate + ZIP_MIN_MATCH, in + position + ZIP_MIN_MATCH,
+                                                       end - ZIP_LAST_LITERAL);
+            cursor = PutSequence(cursor, limit, in + anchor, position - anchor, position - candidate, match);
+            if(!cursor)
+            {
+                return 0;
+            }
+            position += match;
+            anchor = position;
+        }
+        else
+        {
+            position += 1 + ((position - anchor) >> 6);
+        }
+    }
+
+    cursor = PutSequence(cursor, limit, in + anchor, length - anchor, 0, 0);
+    return cursor && cursor < limit ? (size_t)(cursor - out) : 0;
+}
+
+/*=============================================================================
+*   GetLength [int]
+*       Adds the extra bytes of a length whose nibble was 15
+=============================================================================*/
+static int GetLength(const uint8_t** cursor, const uint8_t* end, size_t* length, size_t most)
+{
+    uint8_t byte;
+    do
+    {
+        if(*cursor == end || *length > most)
+        {
+            return 0;
+        }
+        byte = *(*cursor)++;
+        *length += byte;
+    }
+    while(byte == 255);
+    return 1;
+}
+
+/*=============================================================================
+*   Decompress [int]
+*       Decodes one block, checking every length and offset against the
+*       input and the output, so a damaged file cannot write out of bounds
+*
+*       Returns nonzero if the input decodes to exactly `length` bytes
+=============================================================================*/
+static int Decompress(uint8_t* out, size_t length, const uint8_t* in, size_t size)
+{
+    const uint8_t* cursor = in;
+    const uint8_t* end = in + size;
+    uint8_t* target = out;
+    uint8_t* targetEnd = out + length;
+
+    while(cursor < end)
+    {
+        uint8_t token = *cursor++;
+
+        size_t count = token >> 4;
+        if(count == 15 && !GetLength(&cursor, end, &count, length))
+        {
+            return 0;
+        }
+        if(count > (size_t)(end - cursor) || count > (size_t)(targetEnd - target))
+        {
+            return 0;
+        }
+        memcpy(target, cursor, count);
+        target += count;
+        cursor += count;
+        if(cursor == end)
+        {
+            break;
+        }
+
+        if(end - cursor < 2)
+        {
+            return 0;
+        }
+        size_t offset = cursor[0] | ((size_t)cursor[1] << 8);
+        cursor += 2;
+        size_t match = token & 15;
+        if(match == 15 && !GetLength(&cursor, end, &match, length))
+        {
+            return 0;
+        }
+        match += ZIP_MIN_MATCH;
+        if(offset == 0 || offset > (size_t)(target - out) || match > (size_t)(targetEnd - target))
+        {
+            return 0;
+        }
+
+        const uint8_t* source = target - offset;
+        if(offset >= match)
+        {
+            memcpy(target, source, match);
+            target += match;
+        }
+        else
+        {
+            //Overlapping, a run repeating the last `offset` bytes
+            for(size_t i = 0; i < match; i++)
+            {
+                *target++ = *source++;
+            }
+        }
+    }
+    return target == targetEnd;
+}
+
+/*=============================================================================
+*   RunWorkers [void]
+*       Runs `proc` on up to `threads` threads at once, all with the same
+*       job, one of them the calling thread. Workers take their share of
+*       the job themselves.
+=============================================================================*/
+static void RunWorkers(TreeThreadProc proc, void* job, int threads)
+{
+    TreeThread workers[64];
+    int started = 0;
+    while(started < threads - 1 && started < 64 && TreeThreadStart(&workers[started], proc, job))
+    {
+        started++;
+    }
+    proc(job);
+    for(int i = 0; i < started; i++)
+    {
+        TreeThreadJoin(&workers[i]);
+    }
+}
+
+/*=============================================================================
+*   Saving
+=============================================================================*/
+
+/*
+*   A save in progress. The image arrives through ZipSink and is gathered
+*   into a batch of blocks, which are compressed together and written out
+*   in order once the batch is full.
+*/
+typedef struct _ZipWriter
+{
+    FILE* file;
+    int threads;
+    uint8_t* raw;               //ZIP_BATCH_BLOCKS blocks of image
+    size_t rawLength;
+    uint8_t* packed;            //the same blocks compressed, TREE_ZIP_BLOCK apart
+    size_t packedSize[ZIP_BATCH_BLOCKS];
+    size_t batchBlocks;
+    atomic_size_t next;         //block workers take next
+    TreeZipBlock* index;
+    uint32_t blockCount;
+    uint32_t indexCapacity;
+    uint64_t offset;            //file offset of the next block
+    uint64_t rawSize;
+    int failed;
+} ZipWriter;
+
+/*=============================================================================
+*   CompressWorker [void]
+*       Compresses blocks of the batch until there are none left
+=============================================================================*/
+static void CompressWorker(void* arg)
+{
+    ZipWriter* writer = (ZipWriter*)arg;
+    for(;;)
+    {
+        size_t block = atomic_fetch_add_explicit(&writer->next, 1, memory_order_relaxed);
+        if(block >= writer->batchBlocks)
+        {
+            return;
+        }
+        size_t start = block * TREE_ZIP_BLOCK;
+        size_t length = writer->rawLength - start < TREE_ZIP_BLOCK ? writer->rawLength - start : TREE_ZIP_BLOCK;
+        writer->packedSize[block] = Compress(writer->packed + start, length, writer->raw + start, length);
+    }
+}
+
+/*=============================================================================
+*   WriteBatch [void]
+*       Compresses the gathered blocks and appends them to the file. A
+*       block that does not get smaller is stored as it is.
+=============================================================================*/
+static void WriteBatch(ZipWriter* writer)
+{
+    if(!writer->rawLength)
+    {
+        return;
+    }
+    writer->batchBlocks = (writer->rawLength + TREE_ZIP_BLOCK - 1) / TREE_ZIP_BLOCK;
+    atomic_store_explicit(&writer->next, 0, memory_order_relaxed);
+    RunWorkers(CompressWorker, writer, writer->threads < (int)writer->batchBlocks ? writer->threads : (int)writer->batchBlocks);
+
+    if(writer->blockCount + writer->batchBlocks > writer->indexCapacity)
+    {
+        uint32_t capacity = writer->indexCapacity ? writer->indexCapacity * 2 : 256;
+        TreeZipBlock* index = (TreeZipBlock*)realloc(writer->index, capacity * sizeof(TreeZipBlock));
+        if(!index)
+        {
+            writer->failed = 1;
+            return;
+        }
+        writer->index = index;
+        writer->indexCapacity = capacity;
+    }
+
+    for(size_t block = 0; block < writer->batchBlocks; block++)
+    {
+        size_t start = block * TREE_ZIP_BLOCK;
+        TreeZipBlock* entry = &writer->index[writer->blockCount++];
+        entry->offset = writer->offset;
+        entry->rawSize = (uint32_t)(writer->rawLength - start < TREE_ZIP_BLOCK ? writer->rawLength - start : TREE_ZIP_BLOCK);
+        entry->size = writer->packedSize[block] ? (uint32_t)writer->packedSize[block] : entry->rawSize;
+
+        const uint8_t* bytes = writer->packedSize[block] ? writer->packed + start : writer->raw + start;
+        if(fwrite(bytes, 1, entry->size, writer->file) != entry->size)
+        {
+            writer->failed = 1;
+        }
+        writer->offset += entry->size;
+    }
+    writer->rawSize += writer->rawLength;
+    writer->rawLength = 0;
+}
+
+/*=============================================================================
+*   ZipSink [int]
+*       TreeBinSink that gathers the image into batches of blocks
+=============================================================================*/
+static int ZipSink(void* context, const void* bytes, size_t size)
+{
+    ZipWriter* writer = (ZipWriter*)context;
+    const uint8_t* from = (const uint8_t*)bytes;
+    while(size && !writer->failed)
+    {
+        size_t room = (size_t)ZIP_BATCH_BLOCKS * TREE_ZIP_BLOCK - writer->rawLength;
+        size_t part = size < room ? size : room;
+        memcpy(writer->raw + writer->rawLength, from, part);
+        writer->rawLength += part;
+        from += part;
+        size -= part;
+        if(writer->rawLength == (size_t)ZIP_BATCH_BLOCKS * TREE_ZIP_BLOCK)
+        {
+            WriteBatch(writer);
+        }
+    }
+    return !writer->failed;
+}
+
+/*=============================================================================
+*   ZipBegin [ZipWriter*]
+*       Starts a .dtz file on `file` by writing its header
+*
+*       Returns NULL if out of memory
+=============================================================================*/
+static ZipWriter* ZipBegin(FILE* file, int threads)
+{
+    ZipWriter* writer = (ZipWriter*)calloc(1, sizeof(ZipWriter));
+    if(!writer)
+    {
+        return NULL;
+    }
+    writer->file = file;
+    writer->threads = threads > 0 ? threads : TreeCpuCount();
+    writer->raw = (uint8_t*)malloc((size_t)ZIP_BATCH_BLOCKS * TREE_ZIP_BLOCK);
+    writer->packed = (uint8_t*)malloc((size_t)ZIP_BATCH_BLOCKS * TREE_ZIP_BLOCK);
+    if(!writer->raw || !writer->packed)
+    {
+        free(writer->raw);
+        free(writer->packed);
+        free(writer);
+        return NULL;
+    }
+
+    TreeZipHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TREE_ZIP_MAGIC, sizeof(header.magic));
+    header.version = TREE_ZIP_VERSION;
+    header.blockSize = TREE_ZIP_BLOCK;
+    writer->failed = fwrite(&header, 1, sizeof(header), file) != sizeof(header);
+    writer->offset = sizeof(header);
+    return writer;
+}
+
+/*=============================================================================
+*   ZipEnd [int]
+*       Writes the last blocks, the block index and the trailer, and frees
+*       the writer
+*
+*       Returns nonzero if everything was written
+=============================================================================*/
+static int ZipEnd(ZipWriter* writer)
+{
+    WriteBatch(writer);
+
+    TreeZipTrailer trailer;
+    memset(&trailer, 0, sizeof(trailer));
+    trailer.indexOffset = writer->offset;
+    trailer.rawSize = writer->rawSize;
+    trailer.blockCount = writer->blockCount;
+    memcpy(trailer.magic, TREE_ZIP_MAGIC, sizeof(trailer.magic));
+    if(!writer->failed &&
+       (fwrite(writer->index, sizeof(TreeZipBlock), writer->blockCount, writer->file) != writer->blockCount ||
+        fwrite(&trailer, 1, sizeof(trailer), writer->file) != sizeof(trailer)))
+    {
+        writer->failed = 1;
+    }
+
+    int written = !writer->failed;
+    free(writer->raw);
+    free(writer->packed);
+    free(writer->index);
+    free(writer);
+    return written;
+}
+
+/*=============================================================================
+*   TreeSaveCompressed [int]
+*       Writes the model as a .dtz file: the .dtb image TreeSaveBinary
+*       would write, compressed a block at a time
+*
+*       Parameters:
+*           const TreeModel* tree - The model to write
+*           FILE* file - Stream opened for binary writing, need not seek
+*           int threads - Blocks compressed at once, 0 for one per processor
+*
+*       Returns nonzero on success
+=============================================================================*/
+int TreeSaveCompressed(const TreeModel* tree, FILE* file, int threads)
+{
+    ZipWriter* writer = ZipBegin(file, threads);
+    if(!writer)
+    {
+        return 0;
+    }
+    int saved = TreeSaveBinaryTo(tree, ZipSink, writer);
+    return ZipEnd(writer) && saved;
+}
+
+/*=============================================================================
+*   TreeCompressStream [int]
+*       Compresses a .dtb image read from `in` into a .dtz file, holding
+*       one batch of blocks at a time whatever the size of the image
+*
+*       Parameters:
+*           FILE* in - The .dtb image, read to its end
+*           FILE* out - Stream opened for binary writing, need not seek
+*           int threads - Blocks compressed at once, 0 for one per processor
+*
+*       Returns nonzero on success
+=============================================================================*/
+int TreeCompressStream(FILE* in, FILE* out, int threads)
+{
+    ZipWriter* writer = ZipBegin(out, threads);
+    if(!writer)
+    {
+        return 0;
+    }
+
+    //Read straight into the batch, writing it out whenever it fills up
+    for(;;)
+    {
+        size_t room = (size_t)ZIP_BATCH_BLOCKS * TREE_ZIP_BLOCK - writer->rawLength;
+        size_t read = fread(writer->raw + writer->rawLength, 1, room, in);
+        writer->rawLength += read;
+        if(writer->rawLength == (size_t)ZIP_BATCH_BLOCKS * TREE_ZIP_BLOCK)
+        {
+            WriteBatch(writer);
+        }
+        if(read < room || writer->failed)
+        {
+            break;
+        }
+    }
+    int read = !ferror(in);
+    return ZipEnd(writer) && read;
+}
+
+/*=============================================================================
+*   Reading
+=============================================================================*/
+
+/*=============================================================================
+*   BlockAt [TreeZipBlock]
+*       The index entry of a block, which TreeZipOpen has checked
+=============================================================================*/
+static TreeZipBlock BlockAt(const TreeZipView* view, uint32_t block)
+{
+    TreeZipBlock entry;
+    memcpy(&entry, view->data + view->trailer.indexOffset + (uint64_t)block * sizeof(TreeZipBlock), sizeof(entry));
+    return entry;
+}
+
+/*=============================================================================
+*   DecodeBlock [int]
+*       Decodes one block into `out`, which holds its rawSize bytes
+=============================================================================*/
+static int DecodeBlock(const TreeZipView* view, uint32_t block, char* out)
+{
+    TreeZipBlock entry = BlockAt(view, block);
+    const char* in = view->data + entry.offset;
+    if(entry.size == entry.rawSize)
+    {
+        memcpy(out, in, entry.size);
+        return 1;
+    }
+    return Decompress((uint8_t*)out, entry.rawSize, (const uint8_t*)in, entry.size);
+}
+
+/*=============================================================================
+*   TreeIsCompressedStream [int]
+*       Peeks at the start of a stream for the .dtz magic number and
+*       rewinds it
+*
+*       Returns -1 if the stream could not be rewound (a pipe), after which
+*       the bytes peeked at are lost
+=============================================================================*/
+int TreeIsCompressedStream(FILE* file)
+{
+    char magic[8];
+    size_t read = fread(magic, 1, sizeof(magic), file);
+    if(fseek(file, 0, SEEK_SET) != 0)
+    {
+        return -1;
+    }
+    return read == sizeof(magic) && memcmp(magic, TREE_ZIP_MAGIC, sizeof(magic)) == 0;
+}
+
+/*=============================================================================
+*   TreeZipOpen [int]
+*       Checks a .dtz file held in memory, its block index, and the header
+*       of the image inside, which costs decoding the first block
+*
+*       Parameters:
+*           TreeZipView* view - Receives the file; free with TreeZipClose
+*           const char* data - The whole file, kept until TreeZipClose
+*           size_t size - Its length in bytes
+*
+*       Returns nonzero if the file is valid as far as the index goes;
+*       blocks are only checked as they are decoded
+=============================================================================*/
+int TreeZipOpen(TreeZipView* view, const char* data, size_t size)
+{
+    memset(view, 0, sizeof(*view));
+    view->data = data;
+    view->size = size;
+    view->cached[0] = view->cached[1] = -1;
+    if(size < sizeof(TreeZipHeader) + sizeof(TreeZipTrailer))
+    {
+        return 0;
+    }
+
+    memcpy(&view->header, data, sizeof(TreeZipHeader));
+    memcpy(&view->trailer, data + size - sizeof(TreeZipTrailer), sizeof(TreeZipTrailer));
+    TreeZipHeader* header = &view->header;
+    TreeZipTrailer* trailer = &view->trailer;
+    uint64_t indexEnd = size - sizeof(TreeZipTrailer);
+    if(memcmp(header->magic, TREE_ZIP_MAGIC, sizeof(header->magic)) != 0 ||
+       memcmp(trailer->magic, TREE_ZIP_MAGIC, sizeof(trailer->magic)) != 0 ||
+       header->version != TREE_ZIP_VERSION ||
+       header->blockSize == 0 || header->blockSize > TREE_ZIP_BLOCK ||
+       trailer->rawSize > SIZE_MAX ||
+       trailer->blockCount != (trailer->rawSize + header->blockSize - 1) / header->blockSize ||
+       trailer->indexOffset < sizeof(TreeZipHeader) || trailer->indexOffset > indexEnd ||
+       (uint64_t)trailer->blockCount * sizeof(TreeZipBlock) != indexEnd - trailer->indexOffset)
+    {
+        return 0;
+    }
+
+    //Every block but the last holds blockSize bytes of image
+    for(uint32_t block = 0; block < trailer->blockCount; block++)
+    {
+        TreeZipBlock entry = BlockAt(view, block);
+        uint64_t rawSize = block == trailer->blockCount - 1 ? trailer->rawSize - (uint64_t)block * header->blockSize : header->blockSize;
+        if(entry.rawSize != rawSize || entry.size > entry.rawSize ||
+           entry.offset < sizeof(TreeZipHeader) || entry.offset > trailer->indexOffset ||
+           entry.size > trailer->indexOffset - entry.offset)
+        {
+            return 0;
+        }
+    }
+
+    //The image header is checked as TreeBinOpen checks it, only the header is read
+    view->cache[0] = (char*)malloc(header->blockSize);
+    view->cache[1] = (char*)malloc(header->blockSize);
+    TreeBinView image;
+    if(!view->cache[0] || !view->cache[1] || !TreeZipRead(view, 0, &view->image, sizeof(TreeBinHeader)) ||
+       !TreeBinOpen(&image, (const char*)&view->image, (size_t)trailer->rawSize))
+    {
+        TreeZipClose(view);
+        return 0;
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   TreeZipClose [void]
+*       Frees what TreeZipOpen allocated; the file itself is the caller's
+=============================================================================*/
+void TreeZipClose(TreeZipView* view)
+{
+    for(int i = 0; i < 2; i++)
+    {
+        free(view->cache[i]);
+        view->cache[i] = NULL;
+        view->cached[i] = -1;
+    }
+}
+
+/*=============================================================================
+*   TreeZipRead [int]
+*       Copies bytes of the image out, decoding only the blocks they lie in
+*
+*       Parameters:
+*           TreeZipView* view - A file opened with TreeZipOpen
+*           uint64_t offset - Where in the image to start
+*           void* out - Receives the bytes
+*           size_t length - How many
+*
+*       Returns nonzero on success; 0 if the range is outside the image or
+*       a block is damaged
+=============================================================================*/
+int TreeZipRead(TreeZipView* view, uint64_t offset, void* out, size_t length)
+{
+    if(offset > view->trailer.rawSize || length > view->trailer.rawSize - offset)
+    {
+        return 0;
+    }
+
+    char* to = (char*)out;
+    uint32_t blockSize = view->header.blockSize;
+    while(length)
+    {
+        uint32_t block = (uint32_t)(offset / blockSize);
+        size_t within = (size_t)(offset % blockSize);
+        size_t part = BlockAt(view, block).rawSize - within;
+        if(part > length)
+        {
+            part = length;
+        }
+
+        //Reuse either cache, or replace the one used longer ago
+        int slot = view->cached[0] == block ? 0 : view->cached[1] == block ? 1 : !view->recent;
+        if(view->cached[slot] != block)
+        {
+            view->cached[slot] = -1;
+            if(!DecodeBlock(view, block, view->cache[slot]))
+            {
+                return 0;
+            }
+            view->cached[slot] = block;
+        }
+        view->recent = slot;
+        memcpy(to, view->cache[slot] + within, part);
+        to += part;
+        offset += part;
+        length -= part;
+    }
+    return 1;
+}
+
+/*=============================================================================
+*   TreeZipNodeAt [int]
+*       Reads one record, as TreeBinNodeAt does from a .dtb image
+*
+*       Returns nonzero if the record exists and its links and strings
+*       are in range
+=============================================================================*/
+int TreeZipNodeAt(TreeZipView* view, TreeNodeId node, TreeBinNode* record)
+{
+    if(node < 0 || node >= (int32_t)view->image.nodeCount)
+    {
+        return 0;
+    }
+    return TreeZipRead(view, view->image.recordOffset + (uint64_t)node * sizeof(TreeBinNode), record, sizeof(TreeBinNode)) &&
+           TreeBinNodeValid(&view->image, record);
+}
+
+/*=============================================================================
+*   SubtreeEnd [TreeNodeId]
+*       The record after the last one of a subtree. Records are in
+*       preorder, so that is the next sibling of the node or of its nearest
+*       ancestor that has one.
+*
+*       Returns TREE_NIL if a record on the way is damaged
+=============================================================================*/
+static TreeNodeId SubtreeEnd(TreeZipView* view, TreeNodeId node)
+{
+    for(;;)
+    {
+        TreeBinNode record;
+        if(!TreeZipNodeAt(view, node, &record))
+        {
+            return TREE_NIL;
+        }
+        if(record.nextSibling != TREE_NIL)
+        {
+            return record.nextSibling > node ? record.nextSibling : TREE_NIL;
+        }
+        if(record.parent == TREE_NIL)
+        {
+            return (TreeNodeId)view->image.nodeCount;
+        }
+        if(record.parent >= node)
+        {
+            return TREE_NIL;
+        }
+        node = record.parent;
+    }
+}
+
+/*=============================================================================
+*   TreeZipLoadSubtree [TreeNodeId]
+*       Adds one node of the file and everything below it to a model,
+*       decoding only the blocks that hold them: a subtree's records are
+*       one run in preorder, and so are its strings in the heap. The
+*       strings are decoded into the model's string arena and used there.
+*
+*       Parameters:
+*           TreeModel* tree - The model to add to
+*           TreeZipView* view - A file opened with TreeZipOpen
+*           TreeNodeId node - Record index of the node in the file; for
+*                             TREE_ROOT its children are added instead
+*           TreeNodeId parent - The node in `tree` to add them under, last
+*
+*       Returns the node added, `parent` for TREE_ROOT, or TREE_NIL on
+*       failure, when nothing is added
+=============================================================================*/
+TreeNodeId TreeZipLoadSubtree(TreeModel* tree, TreeZipView* view, TreeNodeId node, TreeNodeId parent)
+{
+    TreeNodeId end = SubtreeEnd(view, node);
+    TreeBinNode first, last;
+    if(end == TREE_NIL || !TreeIsLive(tree, parent) ||
+       !TreeZipNodeAt(view, node, &first) || !TreeZipNodeAt(view, end - 1, &last))
+    {
+        return TREE_NIL;
+    }
+
+    //The strings of the subtree, from the node's name to the last description
+    uint64_t heapStart = first.nameOffset;
+    uint64_t heapEnd = last.descriptionOffset + last.descriptionLength;
+    TreeNodeId* ids = (TreeNodeId*)malloc((size_t)(end - node) * sizeof(TreeNodeId));
+    TreeBinNode* records = (TreeBinNode*)malloc(ZIP_RECORD_CHUNK * sizeof(TreeBinNode));
+    char* heap = heapEnd >= heapStart && heapEnd - heapStart <= SIZE_MAX ?
+                 (char*)TreeArenaAlloc(&tree->strings.arena, (size_t)(heapEnd - heapStart) + 1, 1) : NULL;
+    int valid = ids && records && heap &&
+                TreeZipRead(view, view->image.heapOffset + heapStart, heap, (size_t)(heapEnd - heapStart));
+
+    TreeNodeId previousLast = tree->lastChild[parent];
+    if(valid)
+    {
+        ids[0] = parent;
+    }
+    for(TreeNodeId chunk = node; chunk < end && valid; chunk += ZIP_RECORD_CHUNK)
+    {
+        size_t count = end - chunk < ZIP_RECORD_CHUNK ? (size_t)(end - chunk) : ZIP_RECORD_CHUNK;
+        valid = TreeZipRead(view, view->image.recordOffset + (uint64_t)chunk * sizeof(TreeBinNode), records,
+                            count * sizeof(TreeBinNode));
+        for(size_t i = 0; i < count && valid; i++)
+        {
+            TreeNodeId at = chunk + (TreeNodeId)i;
+            TreeBinNode* record = &records[i];
+            if(at == TREE_ROOT)
+            {
+                continue;
+            }
+
+            //Parents come before their children, inside the subtree
+            TreeNodeId above = at == node ? parent : TREE_NIL;
+            if(at != node && record->parent >= node && record->parent < at)
+            {
+                above = ids[record->parent - node];
+            }
+            if(above == TREE_NIL || !TreeBinNodeValid(&view->image, record) ||
+               record->nameOffset < heapStart || record->nameOffset + record->nameLength > heapEnd ||
+               record->descriptionOffset < heapStart || record->descriptionOffset + record->descriptionLength > heapEnd)
+            {
+                valid = 0;
+                break;
+            }
+
+            TreeStr name = {heap + (record->nameOffset - heapStart), record->nameLength};
+            TreeStr description = {heap + (record->descriptionOffset - heapStart), record->descriptionLength};
+            ids[at - node] = TreeAddNodeBorrowed(tree, above, name, description);
+            valid = ids[at - node] != TREE_NIL;
+        }
+    }
+
+    TreeNodeId added = valid ? ids[0] : TREE_NIL;
+    if(!valid && ids)
+    {
+        while(tree->lastChild[parent] != previousLast)
+        {
+            TreeDeleteSubtree(tree, tree->lastChild[parent]);
+        }
+    }
+    free(ids);
+    free(records);
+    return added;
+}
+
+/*
+*   A full load. Blocks before the heap are decoded into `front`, those in
+*   the heap straight into the model's string arena, where the strings
+*   then stay; the one block that holds both goes to front and its heap
+*   part is copied over afterwards.
+*/
+typedef struct _ZipLoad
+{
+    const TreeZipView* view;
+    char* front;
+    size_t frontSize;
+    char* heap;
+    uint64_t heapOffset;
+    atomic_uint next;
+    atomic_int failed;
+} ZipLoad;
+
+/*=============================================================================
+*   DecodeWorker [void]
+*       Decodes blocks of the file until there are none left
+=============================================================================*/
+static void DecodeWorker(void* arg)
+{
+    ZipLoad* load = (ZipLoad*)arg;
+    uint32_t blockSize = load->view->header.blockSize;
+    for(;;)
+    {
+        unsigned block = atomic_fetch_add_explicit(&load->next, 1, memory_order_relaxed);
+        if(block >= load->view->trailer.blockCount || atomic_load_explicit(&load->failed, memory_order_relaxed))
+        {
+            return;
+        }
+        uint64_t start = (uint64_t)block * blockSize;
+        char* out = start < load->frontSize ? load->front + start : load->heap + (start - load->heapOffset);
+        if(!DecodeBlock(load->view, block, out))
+        {
+            atomic_store_explicit(&load->failed, 1, memory_order_relaxed);
+        }
+    }
+}
+
+/*=============================================================================
+*   ReadAll [char*]
+*       Reads a stream that cannot be mapped into memory
+=============================================================================*/
+static char* ReadAll(FILE* file, size_t* size)
+{
+    size_t capacity = 0;
+    char* data = NULL;
+    *size = 0;
+    for(;;)
+    {
+        if(*size == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 1024 * 1024;
+            char* grown = (char*)realloc(data, capacity);
+            if(!grown)
+            {
+                free(data);
+                return NULL;
+            }
+            data = grown;
+        }
+        size_t read = fread(data + *size, 1, capacity - *size, file);
+        *size += read;
+        if(read == 0)
+        {
+            break;
+        }
+    }
+    if(ferror(file))
+    {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+/*=============================================================================
+*   ReleaseFile [void]
+*       Lets go of a file ReadAll read or TreeMapStream mapped
+=============================================================================*/
+static void ReleaseFile(TreeMapping* mapping, char* owned)
+{
+    if(owned)
+    {
+        free(owned);
+    }
+    else
+    {
+        TreeUnmap(mapping);
+    }
+}
+
+/*=============================================================================
+*   TreeLoadCompressed [int]
+*       Loads a .dtz file, decoding its blocks on several threads. The
+*       strings are decoded into the model's string arena and used there,
+*       so the file is not kept open.
+*
+*       Parameters:
+*           TreeModel* tree - The model to load into
+*           FILE* file - Stream opened for binary reading
+*           int threads - Blocks decoded at once, 0 for one per processor
+*
+*       Returns nonzero on success; otherwise the model is left empty
+=============================================================================*/
+int TreeLoadCompressed(TreeModel* tree, FILE* file, int threads)
+{
+    TreeClear(tree);
+
+    TreeMapping mapping;
+    char* owned = NULL;
+    if(!TreeMapStream(file, &mapping) || !mapping.data)
+    {
+        rewind(file);
+        owned = ReadAll(file, &mapping.size);
+        mapping.data = owned;
+        if(!owned)
+        {
+            return 0;
+        }
+    }
+
+    TreeZipView view;
+    if(!TreeZipOpen(&view, mapping.data, mapping.size))
+    {
+        ReleaseFile(&mapping, owned);
+        return 0;
+    }
+
+    //The heap must close the image and the records come before it, as
+    //TreeSaveBinary writes them
+    TreeBinHeader* image = &view.image;
+    uint64_t blockSize = view.header.blockSize;
+    uint64_t frontSize = (image->heapOffset + blockSize - 1) / blockSize * blockSize;
+    ZipLoad load;
+    memset(&load, 0, sizeof(load));
+    load.view = &view;
+    load.frontSize = (size_t)(frontSize < view.trailer.rawSize ? frontSize : view.trailer.rawSize);
+    load.heapOffset = image->heapOffset;
+    int loaded = image->heapOffset + image->heapSize == view.trailer.rawSize &&
+                 image->recordOffset + (uint64_t)image->nodeCount * sizeof(TreeBinNode) <= image->heapOffset;
+    if(loaded)
+    {
+        load.front = (char*)malloc(load.frontSize);
+        load.heap = (char*)TreeArenaAlloc(&tree->strings.arena, (size_t)image->heapSize + 1, 1);
+        loaded = load.front && load.heap;
+    }
+    if(loaded)
+    {
+        int workers = threads > 0 ? threads : TreeCpuCount();
+        RunWorkers(DecodeWorker, &load, workers < (int)view.trailer.blockCount ? workers : (int)view.trailer.blockCount);
+        loaded = !atomic_load(&load.failed);
+    }
+    if(loaded)
+    {
+        memcpy(load.heap, load.front + image->heapOffset, load.frontSize - (size_t)image->heapOffset);
+
+        //Only the records are at front, which is all TreeBinLoadView reads there
+        TreeBinView binary;
+        loaded = TreeBinOpen(&binary, load.front, (size_t)view.trailer.rawSize) &&
+                 TreeBinLoadView(tree, &binary, load.heap, 1);
+    }
+
+    free(load.front);
+    TreeZipClose(&view);
+    ReleaseFile(&mapping, owned);
+    if(!loaded)
+    {
+        TreeClear(tree);
+    }
+    return loaded;
+}